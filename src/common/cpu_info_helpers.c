@@ -32,8 +32,14 @@
 #include <limits.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <fcntl.h>
 #include "cpu_info_helpers.h"
 
+/* Snapshot of the online cpus, see online_cpus_update() */
+static cpu_set_t *online_set;
+static int online_set_cpus;
+static int online_set_valid;
+
 int get_attribute(char *path, const char *fmt, int *value)
 {
 	FILE *fp;
@@ -83,11 +89,154 @@ int __sysattr_is_writeable(char *attribute, int threads_in_system)
 	return test_sysattr(attribute, W_OK, threads_in_system);
 }
 
+/**
+ * parse_cpu_list
+ * @brief Decode a cpu list such as "0-3,8-11" into a cpu set
+ *
+ * @param buf nul terminated cpu list
+ * @param set cpu set to fill in, NULL to only find the highest cpu
+ * @param size size of set in bytes
+ * @returns highest cpu in the list, -1 if the list is empty or malformed
+ */
+int parse_cpu_list(const char *buf, cpu_set_t *set, size_t size)
+{
+	const char *p = buf;
+	char *end;
+	long first, last, cpu;
+	int max = -1;
+
+	while (*p && *p != '\n') {
+		first = strtol(p, &end, 10);
+		if (end == p || first < 0)
+			return -1;
+
+		last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+				return -1;
+		}
+
+		if (last > max)
+			max = last;
+
+		if (set) {
+			for (cpu = first; cpu <= last; cpu++)
+				CPU_SET_S(cpu, size, set);
+		}
+
+		p = end;
+		if (*p == ',')
+			p++;
+		else if (*p && *p != '\n')
+			return -1;
+	}
+
+	return max;
+}
+
+/**
+ * online_cpus_update
+ * @brief Take a snapshot of the online cpus
+ *
+ * The online cpus are read from the single SYSFS_ONLINE_CPUS range list
+ * rather than from the online file of each cpu.  cpu_online() and
+ * __get_one_smt_state() answer from the snapshot until it is taken
+ * again or invalidated.
+ *
+ * @returns 0 on success, -1 if the snapshot could not be taken
+ */
+int online_cpus_update(void)
+{
+	char *list = NULL, *tmp;
+	size_t list_sz = 0, len = 0;
+	cpu_set_t *set;
+	size_t size;
+	ssize_t rc;
+	int fd, max = -1;
+
+	online_set_valid = 0;
+
+	fd = open(SYSFS_ONLINE_CPUS, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	/* The list is short unless cpus are sparsely numbered, grow the
+	 * buffer as needed. */
+	do {
+		if (len + 1 >= list_sz) {
+			list_sz = list_sz ? list_sz * 2 : 1024;
+			tmp = realloc(list, list_sz);
+			if (!tmp) {
+				rc = -1;
+				break;
+			}
+			list = tmp;
+		}
+
+		rc = read(fd, list + len, list_sz - len - 1);
+		if (rc > 0)
+			len += rc;
+	} while (rc > 0 || (rc < 0 && errno == EINTR));
+
+	close(fd);
+
+	if (!rc) {
+		list[len] = '\0';
+		max = parse_cpu_list(list, NULL, 0);
+	}
+
+	if (max < 0) {
+		free(list);
+		return -1;
+	}
+
+	set = CPU_ALLOC(max + 1);
+	if (!set) {
+		free(list);
+		return -1;
+	}
+
+	size = CPU_ALLOC_SIZE(max + 1);
+	CPU_ZERO_S(size, set);
+	parse_cpu_list(list, set, size);
+	free(list);
+
+	if (online_set)
+		CPU_FREE(online_set);
+
+	online_set = set;
+	online_set_cpus = max + 1;
+	online_set_valid = 1;
+	return 0;
+}
+
+/**
+ * online_cpus_invalidate
+ * @brief Discard the snapshot of the online cpus
+ *
+ * To be called after cpus are on/offlined, the next query takes
+ * a new snapshot.
+ */
+void online_cpus_invalidate(void)
+{
+	online_set_valid = 0;
+}
+
 int cpu_online(int thread)
 {
 	char path[SYSFS_PATH_MAX];
 	int rc, online;
 
+	if (online_set_valid || !online_cpus_update()) {
+		if (thread >= online_set_cpus)
+			return 0;
+
+		return CPU_ISSET_S(thread, CPU_ALLOC_SIZE(online_set_cpus),
+				   online_set) ? 1 : 0;
+	}
+
 	sprintf(path, SYSFS_CPUDIR"/online", thread);
 	rc = get_attribute(path, "%d", &online);
 
@@ -177,7 +326,8 @@ int __get_one_smt_state(int core, int threads_per_cpu)
 	int smt_state = 0;
 	int i;
 
-	if (!__sysattr_is_readable("online", threads_per_cpu)) {
+	if (!online_set_valid && online_cpus_update() &&
+	    !__sysattr_is_readable("online", threads_per_cpu)) {
 		perror("Cannot retrieve smt state");
 		return -2;
 	}
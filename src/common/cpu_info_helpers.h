@@ -24,14 +24,20 @@
 #ifndef _CPU_INFO_HELPERS_H
 #define _CPU_INFO_HELPERS_H
 
+#include <sched.h>
+
 #define SYSFS_CPUDIR    "/sys/devices/system/cpu/cpu%d"
 #define SYSFS_SUBCORES  "/sys/devices/system/cpu/subcores_per_core"
+#define SYSFS_ONLINE_CPUS "/sys/devices/system/cpu/online"
 #define INTSERV_PATH    "/proc/device-tree/cpus/%s/ibm,ppc-interrupt-server#s"
 
 #define SYSFS_PATH_MAX	128
 
 extern int __sysattr_is_readable(char *attribute, int threads_in_system);
 extern int __sysattr_is_writeable(char *attribute, int threads_in_system);
+extern int parse_cpu_list(const char *buf, cpu_set_t *set, size_t size);
+extern int online_cpus_update(void);
+extern void online_cpus_invalidate(void);
 extern int cpu_online(int thread);
 extern int is_subcore_capable(void);
 extern int num_subcores(void);
@@ -0,0 +1,960 @@
+/**
+ * @file nvram_lib.c
+ * @brief Common routines to access NVRAM partitions
+ *
+ * NVRAM is read and parsed once by nvram_open().  Config variables
+ * are looked up and updated in the copy in memory, nvram_flush() then
+ * writes each partition that changed back once.
+ *
+ * Copyright (c) 2003, 2004, 2005, 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#if defined(__FreeBSD__)
+#include <sys/endian.h>
+#else
+#include <endian.h>
+#endif
+#include "nvram_lib.h"
+
+#define ERR_MSG		0
+#define WARN_MSG	1
+#define MAXLINE		512
+
+static void nvram_drop_config(struct nvram *nvram, int i);
+
+/**
+ * nvram_msg
+ * @brief print a message to stderr, prefixed with the command name
+ *
+ * @param msg_type either ERR_MSG or WARN_MSG
+ * @param fmt formatted string a la printf()
+ */
+static void nvram_msg(int msg_type, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+static void nvram_msg(int msg_type, const char *fmt, ...)
+{
+	va_list ap;
+	char buf[MAXLINE];
+	int n;
+
+	n = snprintf(buf, sizeof(buf), "%s: %s", program_invocation_name,
+		     (msg_type == WARN_MSG ? "WARNING: " : "ERROR: "));
+
+	va_start(ap, fmt);
+	vsnprintf(buf + n, sizeof(buf) - n, fmt, ap);
+	va_end(ap);
+
+	fflush(stderr);
+	fputs(buf, stderr);
+	fflush(NULL);
+}
+
+/**
+ * part_name_valid
+ * @brief check the length of a partition name
+ *
+ * @param name partition name
+ * @return true if the name fits a partition header
+ */
+bool part_name_valid(const char *name)
+{
+	if (strlen(name) > MAX_PART_NAME) {
+		nvram_msg(ERR_MSG, "partition name maximum length is %d\n",
+			  MAX_PART_NAME);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * nvram_dt_size
+ * @brief get the size of NVRAM from the device tree
+ *
+ * @return size in bytes, 0 if it is not known
+ */
+static int nvram_dt_size(void)
+{
+	uint32_t size;
+	int fd, len;
+
+	fd = open(NVRAM_DT_SIZE, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	len = read(fd, &size, sizeof(size));
+	close(fd);
+
+	return len == sizeof(size) ? be32toh(size) : 0;
+}
+
+/**
+ * nvram_open
+ * @brief open, read and parse NVRAM
+ *
+ * The filename and size in nvram are used when they are set, the
+ * default NVRAM devices and their size otherwise.  The size is that
+ * of the file, or the one in the device tree if the device does not
+ * report it.  nvram_close() must be called even if this fails.
+ *
+ * @param nvram nvram struct to fill in
+ * @return 0 on success, !0 on failure
+ */
+int nvram_open(struct nvram *nvram)
+{
+	int flags = nvram->read_only ? O_RDONLY : O_RDWR;
+	struct stat sbuf;
+	off_t size;
+
+	if (nvram->filename) {
+		nvram->fd = open(nvram->filename, flags);
+		if (nvram->fd == -1) {
+			nvram_msg(ERR_MSG, "cannot open \"%s\": %s\n",
+				  nvram->filename, strerror(errno));
+			return -1;
+		}
+	} else {
+		nvram->filename = NVRAM_FILENAME1;
+		nvram->fd = open(nvram->filename, flags);
+		if (nvram->fd == -1) {
+			int errno1 = errno;
+
+			nvram->filename = NVRAM_FILENAME2;
+			nvram->fd = open(nvram->filename, flags);
+			if (nvram->fd == -1) {
+				nvram_msg(ERR_MSG, "cannot open \"%s\": %s\n",
+					  NVRAM_FILENAME1, strerror(errno1));
+				nvram_msg(ERR_MSG, "cannot open \"%s\": %s\n",
+					  NVRAM_FILENAME2, strerror(errno));
+				return -1;
+			}
+		}
+	}
+
+	if (fstat(nvram->fd, &sbuf) < 0) {
+		nvram_msg(ERR_MSG, "cannot stat %s: %s\n", nvram->filename,
+			  strerror(errno));
+		return -1;
+	}
+
+	if (!nvram->nbytes) {
+		size = lseek(nvram->fd, 0, SEEK_END);
+		if (size < 0 && errno == ESPIPE) {
+			/* a pipe is read until it ends */
+			nvram->nbytes = DEFAULT_NVRAM_SZ;
+		} else if (size < 0) {
+			nvram_msg(ERR_MSG, "cannot seek(END) %s: %s\n",
+				  nvram->filename, strerror(errno));
+			return -1;
+		} else {
+			nvram->nbytes = size;
+			if (!nvram->nbytes && !S_ISREG(sbuf.st_mode))
+				nvram->nbytes = nvram_dt_size();
+
+			/* nvram_read() trims this to what it could read */
+			if (!nvram->nbytes)
+				nvram->nbytes = DEFAULT_NVRAM_SZ;
+
+			if (lseek(nvram->fd, 0, SEEK_SET) < 0) {
+				nvram_msg(ERR_MSG, "cannot seek(SET) %s: "
+					  "%s\n", nvram->filename,
+					  strerror(errno));
+				return -1;
+			}
+		}
+	}
+
+	nvram->data = malloc(nvram->nbytes);
+	if (nvram->data == NULL) {
+		nvram_msg(ERR_MSG, "cannot allocate space for nvram of %d "
+			  "bytes\n", nvram->nbytes);
+		return -1;
+	}
+
+	if (nvram_read(nvram) != 0)
+		return -1;
+
+	return nvram_parse_partitions(nvram);
+}
+
+/**
+ * nvram_close
+ * @brief free the copy of NVRAM and close the device
+ *
+ * Changes that were not written back by nvram_flush() are lost.
+ *
+ * @param nvram nvram struct to release
+ */
+void nvram_close(struct nvram *nvram)
+{
+	int i;
+
+	for (i = 0; i < nvram->nparts; i++) {
+		nvram_drop_config(nvram, i);
+		free(nvram->clean[i]);
+		nvram->clean[i] = NULL;
+	}
+
+	if (nvram->data)
+		free(nvram->data);
+	nvram->data = NULL;
+
+	if (nvram->fd != -1)
+		close(nvram->fd);
+	nvram->fd = -1;
+}
+
+/**
+ * nvram_read
+ * @brief read in the contents of nvram
+ *
+ * Everything that is left is asked for with each read, the kernel
+ * returns at most a page of NVRAM at a time.
+ *
+ * @param nvram nvram struct to read data into
+ * @return 0 on success, !0 on failure
+ */
+int nvram_read(struct nvram *nvram)
+{
+	int len = 0, remaining, nreads = 0;
+	char *p;
+
+	p = nvram->data;
+	remaining = nvram->nbytes;
+
+	while (remaining > 0) {
+		len = read(nvram->fd, p, remaining);
+		if (len == -1 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+
+		p += len;
+		remaining -= len;
+		nreads++;
+	}
+
+	if (len == -1) {
+		nvram_msg(ERR_MSG, "cannot read \"%s\": %s\n",
+			  nvram->filename, strerror(errno));
+		return -1;
+	}
+
+	/* If we are using the DEFAULT_NVRAM_SZ value we to do a small bit
+	 * of fixup here.  All of the remaining code assumes that nbytes
+	 * contains the actual size of nvram, not a guess-timated amount
+	 * and bad things ensue if it is not correct.
+	 */
+	if (nvram->nbytes == DEFAULT_NVRAM_SZ) {
+		nvram->nbytes = nvram->nbytes - remaining;
+		remaining = DEFAULT_NVRAM_SZ - (remaining + nvram->nbytes);
+	}
+
+	if (remaining) {
+		nvram_msg(WARN_MSG, "expected %d bytes, but only read %d!\n",
+			  nvram->nbytes, nvram->nbytes - remaining);
+		/* preserve the given nbytes, but zero the rest in case
+		 * someone cares
+		 */
+		memset(p, 0, remaining);
+	}
+
+	if (nvram->verbose)
+		printf("NVRAM size %d bytes\n", nvram->nbytes);
+	if (nvram->verbose > 1)
+		printf("read NVRAM in %d reads\n", nreads);
+
+	return 0;
+}
+
+/**
+ * checksum
+ * @brief calculate the checksum for a partition header
+ *
+ * @param p pointer to partition header, length in big endian
+ * @return calculated checksum
+ */
+static unsigned char checksum(struct partition_header *p)
+{
+	unsigned int c_sum, c_sum2;
+	unsigned short *sp = (unsigned short *)p->name; /* assume 6 shorts */
+
+	c_sum = p->signature + p->length + sp[0] + sp[1] + sp[2] + sp[3]
+		+ sp[4] + sp[5];
+
+	/* The sum probably may have spilled into the 3rd byte.  Fold it
+	 * back.
+	 */
+	c_sum = ((c_sum & 0xffff) + (c_sum >> 16)) & 0xffff;
+
+	/* The sum cannot exceed 2 bytes.  Fold it into a checksum */
+	c_sum2 = (c_sum >> 8) + (c_sum << 8);
+	c_sum = ((c_sum + c_sum2) >> 8) & 0xff;
+
+	return c_sum;
+}
+
+/**
+ * nvram_parse_partitions
+ * @brief fill in the nvram structure with data from nvram
+ *
+ * Fill in the partition parts of the struct nvram.
+ * This makes handling partitions easier for the rest of the code.
+ *
+ * The spec says that partitions are made up of 16 byte blocks and
+ * the partition header must be 16 bytes.  We verify that here.
+ *
+ * @param nvram pointer to nvram struct to fill out
+ * @return 0 on success, !0 otherwise
+ */
+int nvram_parse_partitions(struct nvram *nvram)
+{
+	char *nvram_end = nvram->data + nvram->nbytes;
+	char *p_start = nvram->data;
+	struct partition_header *phead;
+	unsigned char c_sum;
+
+	if (sizeof(struct partition_header) != 16) {
+		nvram_msg(ERR_MSG, "partition_header struct is not 16 bytes\n");
+		return -1;
+	}
+
+	while (p_start < nvram_end) {
+		phead = (struct partition_header *)p_start;
+		nvram->parts[nvram->nparts++] = phead;
+		c_sum = checksum(phead);
+		if (c_sum != phead->checksum)
+			nvram_msg(WARN_MSG, "this partition checksum should "
+				  "be %02x!\n", c_sum);
+		phead->length = be16toh(phead->length);
+		p_start += phead->length * NVRAM_BLOCK_SIZE;
+	}
+
+	if (nvram->verbose)
+		printf("NVRAM contains %d partitions\n", nvram->nparts);
+
+	return 0;
+}
+
+/**
+ * nvram_find_partition
+ * @brief Find a partition given a signature and name.
+ *
+ * If signature is zero (invalid) it is not used for matching.
+ * If name is NULL it is ignored.
+ * start is the partition in which to resume a search (NULL starts at
+ * the first partition).
+ *
+ * @param nvram nvram struct to search
+ * @param signature partition signature to find
+ * @param name partition name to find
+ * @param start partition header to start search at
+ * @return pointer to partition header on success, NULL otherwise
+ */
+struct partition_header *
+nvram_find_partition(struct nvram *nvram, unsigned char signature,
+		     const char *name, struct partition_header *start)
+{
+	struct partition_header *phead;
+	int i;
+
+	/* Get starting partition.  This is not terribly efficient... */
+	if (start == NULL) {
+		i = 0;
+		if (nvram->verbose > 1)
+			printf("find partition starts with zero\n");
+	} else {
+		for (i = 0; i < nvram->nparts; i++)
+			if (nvram->parts[i] == start)
+				break;
+		i++;	/* start at next partition */
+		if (nvram->verbose > 1)
+			printf("find partition starts with %d\n", i);
+	}
+
+	/* Search starting with partition i... */
+	while (i < nvram->nparts) {
+		phead = nvram->parts[i];
+		if (signature == '\0' || signature == phead->signature) {
+			if (name == NULL ||
+			    strncmp(name, phead->name, sizeof(phead->name)) == 0)
+				return phead;
+		}
+		i++;
+	}
+
+	return NULL;
+}
+
+/**
+ * nvram_part_index
+ * @brief find the index of a partition in nvram->parts
+ *
+ * @param nvram nvram struct containing phead
+ * @param phead partition header
+ * @return index of the partition, -1 if it is not in nvram
+ */
+static int nvram_part_index(struct nvram *nvram, struct partition_header *phead)
+{
+	int i;
+
+	for (i = 0; i < nvram->nparts; i++) {
+		if (nvram->parts[i] == phead)
+			return i;
+	}
+
+	return -1;
+}
+
+static int config_entry_cmp(const void *a, const void *b)
+{
+	const struct nvram_config_entry *ea = a, *eb = b;
+	int len = ea->namelen < eb->namelen ? ea->namelen : eb->namelen;
+	int rc;
+
+	rc = memcmp(ea->name, eb->name, len);
+	if (rc == 0)
+		rc = ea->namelen - eb->namelen;
+
+	/* Pairs with the same name stay in partition order */
+	if (rc == 0)
+		rc = ea->name < eb->name ? -1 : ea->name > eb->name;
+
+	return rc;
+}
+
+/**
+ * nvram_index_config
+ * @brief tokenize the name=value pairs of a partition
+ *
+ * The pairs are sorted by name, so each lookup is a binary search
+ * instead of a walk over the whole partition.
+ *
+ * @param nvram nvram struct containing the partition
+ * @param i index of the partition
+ * @return 0 on success, !0 otherwise
+ */
+static int nvram_index_config(struct nvram *nvram, int i)
+{
+	struct partition_header *phead = nvram->parts[i];
+	struct nvram_config_entry *entries;
+	char *data, *end, *eq;
+	int n = 0, size = 0;
+	size_t len;
+
+	data = (char *)phead + sizeof(*phead);
+	end = (char *)phead + phead->length * NVRAM_BLOCK_SIZE;
+
+	size = 16;
+	entries = malloc(size * sizeof(*entries));
+	if (entries == NULL)
+		goto nomem;
+
+	while (data < end && *data != '\0') {
+		len = strnlen(data, end - data);
+
+		eq = memchr(data, '=', len);
+		if (eq != NULL && data + len < end) {
+			if (n == size) {
+				struct nvram_config_entry *tmp;
+
+				size *= 2;
+				tmp = realloc(entries, size * sizeof(*entries));
+				if (tmp == NULL)
+					goto nomem;
+				entries = tmp;
+			}
+
+			entries[n].name = data;
+			entries[n].namelen = eq - data;
+			entries[n].value = eq + 1;
+			n++;
+		}
+
+		data += len + 1;
+	}
+
+	qsort(entries, n, sizeof(*entries), config_entry_cmp);
+
+	nvram->config[i] = entries;
+	nvram->nconfig[i] = n;
+
+	if (nvram->verbose > 1)
+		printf("indexed %d config variables in \"%.12s\"\n", n,
+		       phead->name);
+
+	return 0;
+
+nomem:
+	free(entries);
+	nvram_msg(ERR_MSG, "cannot allocate space to index \"%.12s\" "
+		  "partition\n", phead->name);
+	return -1;
+}
+
+/**
+ * nvram_drop_config
+ * @brief forget the name=value pairs of a partition after it changed
+ *
+ * @param nvram nvram struct containing the partition
+ * @param i index of the partition
+ */
+static void nvram_drop_config(struct nvram *nvram, int i)
+{
+	free(nvram->config[i]);
+	nvram->config[i] = NULL;
+	nvram->nconfig[i] = 0;
+}
+
+/**
+ * nvram_find_config_var
+ * @brief Look up all of the name=value pairs of a config variable
+ *
+ * @param nvram nvram struct containing phead
+ * @param phead partition containing name
+ * @param name config variable to look up
+ * @param entries set to the first matching pair, the others follow it
+ *	  in the order they appear in the partition
+ * @return number of matching pairs, -1 on error
+ */
+int nvram_find_config_var(struct nvram *nvram, struct partition_header *phead,
+			  const char *name, struct nvram_config_entry **entries)
+{
+	struct nvram_config_entry *config;
+	int i, lo, hi, mid, n, namelen = strlen(name);
+	int rc;
+
+	i = nvram_part_index(nvram, phead);
+	if (i < 0)
+		return -1;
+
+	if (nvram->config[i] == NULL && nvram_index_config(nvram, i))
+		return -1;
+
+	config = nvram->config[i];
+	n = nvram->nconfig[i];
+
+	/* find the first pair with this name */
+	lo = 0;
+	hi = n;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		rc = memcmp(config[mid].name, name,
+			    config[mid].namelen < namelen ?
+			    config[mid].namelen : namelen);
+		if (rc == 0)
+			rc = config[mid].namelen - namelen;
+
+		if (rc < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*entries = &config[lo];
+	for (n = 0; lo + n < nvram->nconfig[i]; n++) {
+		if (config[lo + n].namelen != namelen ||
+		    memcmp(config[lo + n].name, name, namelen))
+			break;
+	}
+
+	return n;
+}
+
+/**
+ * nvram_get_config_var
+ * @brief Look up an Open Firmware config variable
+ *
+ * @param nvram nvram struct containing pname
+ * @param pname partition containing name
+ * @param name config variable to look up
+ * @return value of the first name=value pair for name, NULL if there
+ *	   is none
+ */
+char *nvram_get_config_var(struct nvram *nvram, const char *pname,
+			   const char *name)
+{
+	struct partition_header *phead;
+	struct nvram_config_entry *entries;
+
+	phead = nvram_find_partition(nvram, 0, pname, NULL);
+	if (phead == NULL)
+		return NULL;
+
+	if (nvram_find_config_var(nvram, phead, name, &entries) <= 0)
+		return NULL;
+
+	return (char *)entries[0].value;
+}
+
+/**
+ * nvram_set_config_var
+ * @brief Update an Open Firmware config variable in memory
+ *
+ * This will attempt to update the value half of a name/value
+ * pair in the nvram config partition.  If the name/value pair
+ * is not found in the partition then the specified name/value pair
+ * is added to the end of the data in the partition.  An empty value
+ * removes the pair.
+ *
+ * Only the copy of the partition in memory is changed, nvram_flush()
+ * writes it back.
+ *
+ * @param nvram nvram struct containing pname
+ * @param pname partition containing config_var
+ * @param config_var OF config variable to update, as name=value
+ * @return 0 on success, !0 otherwise
+ */
+int nvram_set_config_var(struct nvram *nvram, const char *pname,
+			 const char *config_var)
+{
+	struct partition_header *phead, hdr;
+	const char *new_config_value;
+	char *data_offset;
+	char *new_part;
+	char *new_part_offset, *new_part_end;
+	char *tmp_offset;
+	int config_name_len;
+	int part_size, i;
+
+	new_config_value = strchr(config_var, '=');
+	if (!new_config_value) {
+		nvram_msg(ERR_MSG, "config variables must be in the format "
+			  "\"name=value\"");
+		return -1;
+	}
+	new_config_value++;
+
+	phead = nvram_find_partition(nvram, 0, pname, NULL);
+	if (phead == NULL) {
+		nvram_msg(ERR_MSG, "there is no \"%s\" partition!\n", pname);
+		return -1;
+	}
+
+	part_size = phead->length * NVRAM_BLOCK_SIZE;
+	data_offset = (char *)phead + sizeof(*phead);
+
+	new_part = calloc(1, part_size);
+	if (new_part == NULL) {
+		nvram_msg(ERR_MSG, "cannot allocate space to update \"%s\" "
+			  "partition\n", pname);
+		return -1;
+	}
+
+	/* get the length of the name of the config variable we are
+	 * updating, including the '='
+	 */
+	config_name_len = new_config_value - config_var;
+
+	/* now find this config variable in the partition */
+	while (*data_offset != '\0') {
+		if (strncmp(data_offset, config_var, config_name_len) == 0)
+			break;
+		data_offset += strlen(data_offset) + 1;
+	}
+
+	/* Copy everything up to the config name we are modifying
+	 * to the new partition
+	 */
+	memcpy(new_part, phead, data_offset - (char *)phead);
+
+	/* make sure the new config var will fit into the partition and
+	 * add it
+	 */
+	new_part_offset = new_part + (data_offset - (char *)phead);
+	new_part_end = new_part + part_size;
+
+	if ((new_part_offset + strlen(config_var) + 1) >= new_part_end) {
+		nvram_msg(ERR_MSG, "cannot update config var to\"%s\".\n"
+			  "\tThere is not enough room in the \"%s\" "
+			  "partition\n", config_var, pname);
+		free(new_part);
+		return -1;
+	}
+
+	if (strlen(new_config_value)) {
+		memcpy(new_part_offset, config_var, strlen(config_var));
+		new_part_offset += strlen(config_var);
+		*new_part_offset++ = '\0';
+	}
+
+	/* Find the end of the name/value pairs in the partition so we
+	 * can copy them over to the new partition.
+	 */
+	data_offset += strlen(data_offset) + 1;
+	tmp_offset = data_offset;
+	while (*data_offset != '\0')
+		data_offset += strlen(data_offset) + 1;
+
+	/* we should now be pointing to a double NULL, verify this */
+	if ((data_offset[-1] != '\0') && (data_offset[0] != '\0')) {
+		nvram_msg(ERR_MSG, "the \"%s\" partition appears to be "
+			  "corrupt\n", pname);
+		free(new_part);
+		return -1;
+	}
+
+	/* go past double NULL */
+	data_offset++;
+
+	/* verify that this will fit into the new partition */
+	if ((new_part_offset + (data_offset - tmp_offset)) > new_part_end) {
+		nvram_msg(ERR_MSG, "cannot update open firmware config var "
+			  "to \"%s\".\n\tThere is not enough room in the "
+			  "\"%s\" partition\n", config_var, pname);
+		free(new_part);
+		return -1;
+	}
+
+	memcpy(new_part_offset, tmp_offset, data_offset - tmp_offset);
+
+	/* recalculate the checksum over the header as it is stored */
+	memcpy(&hdr, new_part, sizeof(hdr));
+	hdr.length = htobe16(hdr.length);
+	((struct partition_header *)new_part)->checksum = checksum(&hdr);
+
+	i = nvram_part_index(nvram, phead);
+	if (!nvram->dirty[i]) {
+		/* without it the whole partition is written back */
+		nvram->clean[i] = malloc(part_size);
+		if (nvram->clean[i])
+			memcpy(nvram->clean[i], phead, part_size);
+		nvram->dirty[i] = true;
+	}
+
+	memcpy(phead, new_part, part_size);
+	free(new_part);
+
+	nvram_drop_config(nvram, i);
+
+	return 0;
+}
+
+/**
+ * nvram_set_config_vars
+ * @brief Update several config variables of a partition in memory
+ *
+ * The name=value pairs are applied in order as by
+ * nvram_set_config_var().  Either all of them are applied or, if one
+ * is malformed or does not fit, the partition is left as it was.
+ *
+ * @param nvram nvram struct containing pname
+ * @param pname partition containing the config variables
+ * @param config_vars config variables to update, as name=value
+ * @param nvars number of entries in config_vars
+ * @return 0 on success, !0 otherwise
+ */
+int nvram_set_config_vars(struct nvram *nvram, const char *pname,
+			  char * const *config_vars, int nvars)
+{
+	struct partition_header *phead;
+	char *saved;
+	bool was_dirty;
+	int part_size, i, j;
+
+	for (j = 0; j < nvars; j++) {
+		if (strchr(config_vars[j], '=') == NULL ||
+		    config_vars[j][0] == '=') {
+			nvram_msg(ERR_MSG, "config variables must be in the "
+				  "format \"name=value\"\n");
+			return -1;
+		}
+	}
+
+	phead = nvram_find_partition(nvram, 0, pname, NULL);
+	if (phead == NULL) {
+		nvram_msg(ERR_MSG, "there is no \"%s\" partition!\n", pname);
+		return -1;
+	}
+
+	part_size = phead->length * NVRAM_BLOCK_SIZE;
+	saved = malloc(part_size);
+	if (saved == NULL) {
+		nvram_msg(ERR_MSG, "cannot allocate space to update \"%s\" "
+			  "partition\n", pname);
+		return -1;
+	}
+	memcpy(saved, phead, part_size);
+
+	i = nvram_part_index(nvram, phead);
+	was_dirty = nvram->dirty[i];
+
+	for (j = 0; j < nvars; j++) {
+		if (nvram_set_config_var(nvram, pname, config_vars[j]) != 0)
+			break;
+	}
+
+	if (j < nvars) {
+		memcpy(phead, saved, part_size);
+		nvram_drop_config(nvram, i);
+		if (!was_dirty) {
+			free(nvram->clean[i]);
+			nvram->clean[i] = NULL;
+			nvram->dirty[i] = false;
+		}
+	}
+
+	free(saved);
+	return j < nvars ? -1 : 0;
+}
+
+/**
+ * nvram_write_blocks
+ * @brief write part of a partition back to NVRAM
+ *
+ * @param nvram nvram struct to write to
+ * @param buf data to write
+ * @param offset offset of buf in NVRAM
+ * @param len number of bytes to write
+ * @return 0 on success, !0 otherwise
+ */
+static int nvram_write_blocks(struct nvram *nvram, const char *buf,
+			      off_t offset, int len)
+{
+	int rc, done;
+
+	if (lseek(nvram->fd, offset, SEEK_SET) == -1) {
+		nvram_msg(ERR_MSG, "could not seek to offset %ld of %s\n",
+			  (long)offset, nvram->filename);
+		return -1;
+	}
+
+	for (rc = 0, done = 0; done < len; done += rc) {
+		rc = write(nvram->fd, buf + done, len - done);
+		if (rc < 0 && errno == EINTR) {
+			rc = 0;
+			continue;
+		}
+		if (rc <= 0)
+			break;
+	}
+
+	if (done != len) {
+		nvram_msg(ERR_MSG, "only wrote %d bytes back to %s at offset "
+			  "%ld, expected to write %d bytes\n", done,
+			  nvram->filename, (long)offset, len);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * nvram_write_partition
+ * @brief write a partition from memory back to NVRAM
+ *
+ * When the partition as it was last written is known, only the runs
+ * of blocks that differ from it are written.
+ *
+ * @param nvram nvram struct containing the partition
+ * @param i index of the partition
+ * @return 0 on success, !0 otherwise
+ */
+static int nvram_write_partition(struct nvram *nvram, int i)
+{
+	struct partition_header *phead = nvram->parts[i];
+	struct partition_header *hdr;
+	const char *clean = nvram->clean[i];
+	off_t offset = (char *)phead - nvram->data;
+	int part_size = phead->length * NVRAM_BLOCK_SIZE;
+	int start, end, nblocks = 0;
+	char *part;
+	int rc = 0;
+
+	part = malloc(part_size);
+	if (part == NULL) {
+		nvram_msg(ERR_MSG, "cannot allocate space to write \"%.12s\" "
+			  "partition\n", phead->name);
+		return -1;
+	}
+
+	memcpy(part, phead, part_size);
+	hdr = (struct partition_header *)part;
+	hdr->length = htobe16(hdr->length);
+
+	for (start = 0; start < part_size; start = end) {
+		end = start + NVRAM_BLOCK_SIZE;
+		if (clean && !memcmp((char *)phead + start, clean + start,
+				     NVRAM_BLOCK_SIZE))
+			continue;
+
+		while (end < part_size &&
+		       (!clean || memcmp((char *)phead + end, clean + end,
+					 NVRAM_BLOCK_SIZE)))
+			end += NVRAM_BLOCK_SIZE;
+
+		rc = nvram_write_blocks(nvram, part + start, offset + start,
+					end - start);
+		if (rc)
+			break;
+		nblocks += (end - start) / NVRAM_BLOCK_SIZE;
+	}
+
+	free(part);
+
+	if (!rc && nvram->verbose > 1)
+		printf("Wrote %d of %d blocks of the \"%.12s\" partition\n",
+		       nblocks, part_size / NVRAM_BLOCK_SIZE, phead->name);
+
+	return rc;
+}
+
+/**
+ * nvram_flush
+ * @brief write the partitions that changed back to NVRAM
+ *
+ * @param nvram nvram struct to write back
+ * @return 0 on success, !0 otherwise
+ */
+int nvram_flush(struct nvram *nvram)
+{
+	int i, rc = 0;
+
+	for (i = 0; i < nvram->nparts; i++) {
+		if (!nvram->dirty[i])
+			continue;
+
+		if (nvram->read_only) {
+			nvram_msg(ERR_MSG, "%s was opened read only\n",
+				  nvram->filename);
+			return -1;
+		}
+
+		if (nvram->verbose)
+			printf("Writing the \"%.12s\" partition\n",
+			       nvram->parts[i]->name);
+
+		if (nvram_write_partition(nvram, i)) {
+			rc = -1;
+		} else {
+			nvram->dirty[i] = false;
+			free(nvram->clean[i]);
+			nvram->clean[i] = NULL;
+		}
+	}
+
+	return rc;
+}
@@ -0,0 +1,128 @@
+/**
+ * @file nvram_lib.h
+ * @brief Header of common routines to access NVRAM partitions
+ *
+ * Copyright (c) 2003, 2004, 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef _NVRAM_LIB_H
+#define _NVRAM_LIB_H
+
+#include <stdbool.h>
+
+#define NVRAM_SIG_SP	0x02	/**< support processor signature */
+#define NVRAM_SIG_OF	0x50	/**< open firmware config signature */
+#define NVRAM_SIG_FW	0x51	/**< general firmware signature */
+#define NVRAM_SIG_HW	0x52	/**< hardware (VPD) signature */
+#define NVRAM_SIG_SYS	0x70	/**< system env vars signature */
+#define NVRAM_SIG_CFG	0x71	/**< config data signature */
+#define NVRAM_SIG_ELOG	0x72	/**< error log signature */
+#define NVRAM_SIG_VEND	0x7e	/**< vendor defined signature */
+#define NVRAM_SIG_FREE	0x7f	/**< Free space signature */
+#define NVRAM_SIG_OS	0xa0	/**< OS defined signature */
+
+#define NVRAM_BLOCK_SIZE	16
+#define NVRAM_FILENAME1		"/dev/nvram"
+#define NVRAM_FILENAME2		"/dev/misc/nvram"
+#define NVRAM_DT_SIZE		"/proc/device-tree/nvram/#bytes"
+
+#define DEFAULT_NVRAM_SZ	(1024 * 1024)
+
+/**
+ * @def MAX_PART_NAME
+ * @brief maximum number of bytes in partition name
+ */
+#define MAX_PART_NAME 12
+
+/**
+ * @struct partition_header
+ * @brief nvram partition header data
+ *
+ * The length is kept in host byte order once the partitions are parsed,
+ * the checksum is that of the header with the length in big endian as
+ * it is stored in NVRAM.
+ */
+struct partition_header {
+	unsigned char	signature;		/**< partition signature */
+	unsigned char	checksum;		/**< partition checksum */
+	unsigned short	length;			/**< partition length */
+	char		name[MAX_PART_NAME];	/**< partition name */
+};
+
+/**
+ * @struct nvram_config_entry
+ * @brief name=value pair of a config partition
+ */
+struct nvram_config_entry {
+	const char	*name;		/**< pair in the partition data */
+	int		namelen;	/**< length of the name */
+	const char	*value;		/**< value, NUL terminated */
+};
+
+/* Internal representation of NVRAM. */
+#define MAX_PARTITIONS 50
+/**
+ * @struct nvram
+ * @brief internal representation of nvram data
+ */
+struct nvram {
+	char	*filename;		/**< original filename */
+	int	fd;			/**< file descriptor */
+	int	verbose;		/**< print what is being done */
+	bool	read_only;		/**< open the device read only */
+	int	nparts;			/**< number of partitions */
+	int	nbytes;			/**< size of data in bytes.  This
+					 *   cannot be changed
+					 *   (i.e. hardware size)
+					 */
+	struct partition_header *parts[MAX_PARTITIONS];
+					/**< partition header pointers
+					 *   into data
+					 */
+	bool	dirty[MAX_PARTITIONS];	/**< partition changed in data */
+	char	*clean[MAX_PARTITIONS];	/**< partition as last written,
+					 *   kept while it is dirty
+					 */
+	struct nvram_config_entry *config[MAX_PARTITIONS];
+					/**< name=value pairs of each
+					 *   partition sorted by name, built
+					 *   on first lookup
+					 */
+	int	nconfig[MAX_PARTITIONS];/**< number of pairs in config */
+	char	*data;			/**< nvram contents */
+};
+
+extern bool part_name_valid(const char *name);
+extern int nvram_open(struct nvram *nvram);
+extern void nvram_close(struct nvram *nvram);
+extern int nvram_read(struct nvram *nvram);
+extern int nvram_parse_partitions(struct nvram *nvram);
+extern struct partition_header *nvram_find_partition(struct nvram *nvram,
+		unsigned char signature, const char *name,
+		struct partition_header *start);
+extern int nvram_find_config_var(struct nvram *nvram,
+				 struct partition_header *phead,
+				 const char *name,
+				 struct nvram_config_entry **entries);
+extern char *nvram_get_config_var(struct nvram *nvram, const char *pname,
+				  const char *name);
+extern int nvram_set_config_var(struct nvram *nvram, const char *pname,
+				const char *config_var);
+extern int nvram_set_config_vars(struct nvram *nvram, const char *pname,
+				 char * const *config_vars, int nvars);
+extern int nvram_flush(struct nvram *nvram);
+
+#endif /* _NVRAM_LIB_H */
@@ -0,0 +1,264 @@
+/**
+ * @file record_output.c
+ * @brief Common routines to stream machine readable records
+ *
+ * Each record is one line of CSV or JSON.  Records are built in a
+ * buffer that is reused from one sample to the next, and all of the
+ * records of a sample are written with a single write() so that a
+ * consumer reading from a pipe never sees a partial sample.
+ *
+ * Copyright (c) 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "record_output.h"
+
+/**
+ * record_parse_format
+ * @brief Translate a format name from the command line
+ *
+ * @param name "csv" or "json"
+ * @param format format to fill in
+ * @returns 0 on success, -1 if the format is unknown
+ */
+int record_parse_format(const char *name, enum record_format *format)
+{
+	if (!strcmp(name, "csv"))
+		*format = RECORD_CSV;
+	else if (!strcmp(name, "json"))
+		*format = RECORD_JSON;
+	else
+		return -1;
+
+	return 0;
+}
+
+static void buf_printf(char **buf, size_t *len, size_t *sz,
+		       const char *fmt, ...)
+{
+	va_list ap;
+	char *tmp;
+	int n;
+
+	while (1) {
+		if (*buf) {
+			va_start(ap, fmt);
+			n = vsnprintf(*buf + *len, *sz - *len, fmt, ap);
+			va_end(ap);
+
+			if (n < 0)
+				return;
+
+			if (*len + n < *sz) {
+				*len += n;
+				return;
+			}
+		}
+
+		tmp = realloc(*buf, *sz ? *sz * 2 : 1024);
+		if (!tmp)
+			return;
+
+		*buf = tmp;
+		*sz = *sz ? *sz * 2 : 1024;
+	}
+}
+
+#define rec_printf(rec, fmt, ...) \
+	buf_printf(&(rec)->buf, &(rec)->len, &(rec)->sz, fmt, ##__VA_ARGS__)
+
+/**
+ * record_field
+ * @brief Start a new field, emitting the separator and the field name
+ */
+static void record_field(struct record *rec, const char *name)
+{
+	if (rec->format == RECORD_JSON) {
+		rec_printf(rec, "%s\"%s\":", rec->nfields ? "," : "", name);
+	} else {
+		if (rec->nfields)
+			rec_printf(rec, ",");
+
+		if (!rec->header_done)
+			buf_printf(&rec->header, &rec->header_len,
+				   &rec->header_sz, "%s%s",
+				   rec->nfields ? "," : "", name);
+	}
+
+	rec->nfields++;
+}
+
+/**
+ * record_begin
+ * @brief Start a new record, stamped with the current time
+ *
+ * @param rec record to start
+ */
+void record_begin(struct record *rec)
+{
+	struct timeval tv;
+
+	rec->nfields = 0;
+	if (!rec->header_done)
+		rec->header_len = 0;
+
+	if (rec->format == RECORD_JSON)
+		rec_printf(rec, "{");
+
+	gettimeofday(&tv, NULL);
+	record_field(rec, "timestamp");
+	rec_printf(rec, "%lld.%06ld", (long long)tv.tv_sec, (long)tv.tv_usec);
+}
+
+void record_add_str(struct record *rec, const char *name, const char *value)
+{
+	const char *p;
+
+	record_field(rec, name);
+
+	if (rec->format == RECORD_JSON) {
+		rec_printf(rec, "\"");
+		for (p = value; *p; p++) {
+			if (*p == '"' || *p == '\\')
+				rec_printf(rec, "\\%c", *p);
+			else if ((unsigned char)*p < 0x20)
+				rec_printf(rec, "\\u%04x", *p);
+			else
+				rec_printf(rec, "%c", *p);
+		}
+		rec_printf(rec, "\"");
+	} else if (strpbrk(value, ",\"\n")) {
+		rec_printf(rec, "\"");
+		for (p = value; *p; p++) {
+			if (*p == '"')
+				rec_printf(rec, "\"\"");
+			else
+				rec_printf(rec, "%c", *p);
+		}
+		rec_printf(rec, "\"");
+	} else {
+		rec_printf(rec, "%s", value);
+	}
+}
+
+void record_add_null(struct record *rec, const char *name)
+{
+	record_field(rec, name);
+	if (rec->format == RECORD_JSON)
+		rec_printf(rec, "null");
+}
+
+void record_add_int(struct record *rec, const char *name, long long value)
+{
+	record_field(rec, name);
+	rec_printf(rec, "%lld", value);
+}
+
+void record_add_uint(struct record *rec, const char *name,
+		     unsigned long long value)
+{
+	record_field(rec, name);
+	rec_printf(rec, "%llu", value);
+}
+
+void record_add_double(struct record *rec, const char *name, double value)
+{
+	record_field(rec, name);
+
+	/* JSON has no representation for nan or inf */
+	if (value != value || value - value != 0) {
+		if (rec->format == RECORD_JSON)
+			rec_printf(rec, "null");
+	} else
+		rec_printf(rec, "%.2f", value);
+}
+
+static int write_all(const char *buf, size_t len)
+{
+	ssize_t rc;
+
+	while (len) {
+		rc = write(STDOUT_FILENO, buf, len);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		buf += rc;
+		len -= rc;
+	}
+
+	return 0;
+}
+
+/**
+ * record_end
+ * @brief Finish the record being built
+ *
+ * @param rec record to finish
+ */
+void record_end(struct record *rec)
+{
+	if (rec->format == RECORD_JSON)
+		rec_printf(rec, "}");
+	rec_printf(rec, "\n");
+
+	if (rec->format == RECORD_CSV && !rec->header_done) {
+		buf_printf(&rec->header, &rec->header_len, &rec->header_sz,
+			   "\n");
+		rec->header_done = 1;
+	}
+}
+
+/**
+ * record_flush
+ * @brief Write the finished records to stdout
+ *
+ * For CSV output the header line is written ahead of the first record.
+ *
+ * @param rec records to write
+ * @returns 0 on success, -1 on failure
+ */
+int record_flush(struct record *rec)
+{
+	int rc = 0;
+
+	if (rec->header_done && rec->header_len) {
+		if (write_all(rec->header, rec->header_len))
+			rc = -1;
+		rec->header_len = 0;
+	}
+
+	if (rec->len && write_all(rec->buf, rec->len))
+		rc = -1;
+
+	rec->len = 0;
+	return rc;
+}
+
+void record_free(struct record *rec)
+{
+	free(rec->buf);
+	free(rec->header);
+	memset(rec, 0, sizeof(*rec));
+}
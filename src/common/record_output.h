@@ -0,0 +1,59 @@
+/**
+ * @file record_output.h
+ * @brief Header of common routines to stream machine readable records
+ *
+ * Copyright (c) 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef _RECORD_OUTPUT_H
+#define _RECORD_OUTPUT_H
+
+#include <stddef.h>
+
+enum record_format {
+	RECORD_NONE,
+	RECORD_CSV,
+	RECORD_JSON,
+};
+
+struct record {
+	enum record_format format;
+	char	*buf;		/* record being built */
+	size_t	len;
+	size_t	sz;
+	char	*header;	/* CSV header, built with the first record */
+	size_t	header_len;
+	size_t	header_sz;
+	int	header_done;	/* CSV header is complete */
+	int	nfields;	/* fields in the record being built */
+};
+
+extern int record_parse_format(const char *name, enum record_format *format);
+extern void record_begin(struct record *rec);
+extern void record_add_str(struct record *rec, const char *name,
+			   const char *value);
+extern void record_add_null(struct record *rec, const char *name);
+extern void record_add_int(struct record *rec, const char *name,
+			   long long value);
+extern void record_add_uint(struct record *rec, const char *name,
+			    unsigned long long value);
+extern void record_add_double(struct record *rec, const char *name,
+			      double value);
+extern void record_end(struct record *rec);
+extern int record_flush(struct record *rec);
+extern void record_free(struct record *rec);
+
+#endif /* _RECORD_OUTPUT_H */
@@ -0,0 +1,275 @@
+/**
+ * @file rtas_tokens.c
+ * @brief Common routines to look up RTAS tokens
+ *
+ * The tokens of the RTAS calls are the properties of the rtas node of
+ * the device tree.  rtas_tokens_load() reads them all once into a table
+ * that is looked up by name or by value through hash tables, a tool
+ * that needs a single token can read it with rtas_token_read().
+ *
+ * Copyright (c) 2015, 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <endian.h>
+#include "rtas_tokens.h"
+
+/**
+ * read_token_at
+ * @brief read the token property name of the rtas node open on dfd
+ *
+ * @param dfd directory fd of the rtas node
+ * @param name name of the property
+ * @param token set to the token in host byte order
+ * @return 0 on success, !0 otherwise
+ */
+static int read_token_at(int dfd, const char *name, uint32_t *token)
+{
+	uint32_t betoken;
+	int fd, rc;
+
+	fd = openat(dfd, name, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	rc = read(fd, &betoken, sizeof(betoken));
+	close(fd);
+	if (rc != sizeof(betoken))
+		return -1;
+
+	*token = be32toh(betoken);
+	return 0;
+}
+
+/**
+ * rtas_token_read
+ * @brief read the token of a single RTAS call
+ *
+ * @param name name of the RTAS call
+ * @param token set to the token, may be NULL to check that the call
+ *	  exists
+ * @return 0 on success, !0 if the call is not available
+ */
+int rtas_token_read(const char *name, uint32_t *token)
+{
+	char path[sizeof(OFDT_RTAS_PATH) + MAX_RTAS_NAME_LEN + 1];
+	uint32_t tmp;
+
+	snprintf(path, sizeof(path), "%s/%s", OFDT_RTAS_PATH, name);
+	return read_token_at(AT_FDCWD, path, token ? token : &tmp);
+}
+
+/**
+ * hash_name
+ * @brief FNV-1a hash of an RTAS call name
+ */
+static unsigned int hash_name(const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	for (; *name; name++)
+		h = (h ^ (unsigned char)*name) * 16777619u;
+
+	return h;
+}
+
+/**
+ * hash_value
+ * @brief hash of an RTAS token
+ */
+static unsigned int hash_value(uint32_t value)
+{
+	return value * 2654435761u;
+}
+
+/**
+ * token_cmp
+ * @brief qsort() comparison of two tokens by name
+ */
+static int token_cmp(const void *a, const void *b)
+{
+	const struct rtas_token *ta = a, *tb = b;
+
+	return strncmp(ta->name, tb->name, MAX_RTAS_NAME_LEN);
+}
+
+/**
+ * rtas_tokens_free
+ * @brief free a table returned by rtas_tokens_load()
+ *
+ * @param tokens table to free, may be NULL
+ */
+void rtas_tokens_free(struct rtas_tokens *tokens)
+{
+	int i;
+
+	if (tokens == NULL)
+		return;
+
+	for (i = 0; i < tokens->ntokens; i++)
+		free(tokens->tokens[i].name);
+	free(tokens->tokens);
+	free(tokens->by_name);
+	free(tokens->by_value);
+	free(tokens);
+}
+
+/**
+ * rtas_tokens_load
+ * @brief read the tokens of all of the RTAS calls
+ *
+ * The rtas node is read once, each property that holds at least four
+ * bytes is taken as the token of the call of the same name.
+ *
+ * @return table of the tokens, NULL on failure
+ */
+struct rtas_tokens *rtas_tokens_load(void)
+{
+	struct rtas_tokens *tokens;
+	struct rtas_token *tok, *ntoks;
+	struct dirent *dp;
+	unsigned int h;
+	int nalloc = 0;
+	DIR *dir;
+	int i;
+
+	dir = opendir(OFDT_RTAS_PATH);
+	if (dir == NULL) {
+		fprintf(stderr, "Could not open %s:\n%s\n", OFDT_RTAS_PATH,
+			strerror(errno));
+		return NULL;
+	}
+
+	tokens = calloc(1, sizeof(*tokens));
+	if (tokens == NULL)
+		goto err;
+
+	while ((dp = readdir(dir)) != NULL) {
+		if (dp->d_name[0] == '.')
+			continue;
+
+		if (tokens->ntokens == nalloc) {
+			nalloc = nalloc ? nalloc * 2 : 64;
+			ntoks = realloc(tokens->tokens,
+					nalloc * sizeof(*tokens->tokens));
+			if (ntoks == NULL)
+				goto err;
+			tokens->tokens = ntoks;
+		}
+
+		tok = &tokens->tokens[tokens->ntokens];
+		if (read_token_at(dirfd(dir), dp->d_name, &tok->token)) {
+			fprintf(stderr, "Could not get rtas token for %s\n",
+				dp->d_name);
+			continue;
+		}
+
+		tok->name = strdup(dp->d_name);
+		if (tok->name == NULL)
+			goto err;
+		tokens->ntokens++;
+	}
+
+	closedir(dir);
+	dir = NULL;
+
+	qsort(tokens->tokens, tokens->ntokens, sizeof(*tokens->tokens),
+	      token_cmp);
+
+	/* a power of two at least twice the number of tokens */
+	for (tokens->nbuckets = 64; tokens->nbuckets < 2 * tokens->ntokens;)
+		tokens->nbuckets *= 2;
+
+	tokens->by_name = malloc(tokens->nbuckets * sizeof(int));
+	tokens->by_value = malloc(tokens->nbuckets * sizeof(int));
+	if (tokens->by_name == NULL || tokens->by_value == NULL)
+		goto err;
+	memset(tokens->by_name, -1, tokens->nbuckets * sizeof(int));
+	memset(tokens->by_value, -1, tokens->nbuckets * sizeof(int));
+
+	/* hashed in reverse so that the chains keep the sorted order */
+	for (i = tokens->ntokens - 1; i >= 0; i--) {
+		tok = &tokens->tokens[i];
+
+		h = hash_name(tok->name) & (tokens->nbuckets - 1);
+		tok->name_next = tokens->by_name[h];
+		tokens->by_name[h] = i;
+
+		h = hash_value(tok->token) & (tokens->nbuckets - 1);
+		tok->value_next = tokens->by_value[h];
+		tokens->by_value[h] = i;
+	}
+
+	return tokens;
+
+err:
+	fprintf(stderr, "Could not allocate token list\n");
+	if (dir)
+		closedir(dir);
+	rtas_tokens_free(tokens);
+	return NULL;
+}
+
+/**
+ * rtas_token_by_name
+ * @brief look up an RTAS call by name
+ *
+ * @param tokens table returned by rtas_tokens_load()
+ * @param name name of the call
+ * @return the token, NULL if there is no such call
+ */
+struct rtas_token *rtas_token_by_name(struct rtas_tokens *tokens,
+				      const char *name)
+{
+	int i;
+
+	i = tokens->by_name[hash_name(name) & (tokens->nbuckets - 1)];
+	for (; i >= 0; i = tokens->tokens[i].name_next) {
+		if (!strncmp(name, tokens->tokens[i].name, MAX_RTAS_NAME_LEN))
+			return &tokens->tokens[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * rtas_token_by_value
+ * @brief look up an RTAS call by token
+ *
+ * @param tokens table returned by rtas_tokens_load()
+ * @param value token of the call
+ * @return the first call, by name, with that token, NULL if there is
+ *	   none
+ */
+struct rtas_token *rtas_token_by_value(struct rtas_tokens *tokens,
+				       uint32_t value)
+{
+	int i;
+
+	i = tokens->by_value[hash_value(value) & (tokens->nbuckets - 1)];
+	for (; i >= 0; i = tokens->tokens[i].value_next) {
+		if (tokens->tokens[i].token == value)
+			return &tokens->tokens[i];
+	}
+
+	return NULL;
+}
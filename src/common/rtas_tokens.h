@@ -0,0 +1,63 @@
+/**
+ * @file rtas_tokens.h
+ * @brief Header of common routines to look up RTAS tokens
+ *
+ * Copyright (c) 2015, 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef _RTAS_TOKENS_H
+#define _RTAS_TOKENS_H
+
+#include <stdint.h>
+
+#define OFDT_RTAS_PATH		"/proc/device-tree/rtas"
+#define MAX_RTAS_NAME_LEN	80
+
+/**
+ * @struct rtas_token
+ * @brief RTAS call name and token from the rtas device tree node
+ */
+struct rtas_token {
+	uint32_t	token;		/**< token of the call */
+	char		*name;		/**< name of the call */
+	int		name_next;	/**< next token in the name hash chain */
+	int		value_next;	/**< next token in the value hash chain */
+};
+
+/**
+ * @struct rtas_tokens
+ * @brief table of the RTAS tokens, sorted by name and hashed by name
+ *	  and by value
+ */
+struct rtas_tokens {
+	int			ntokens;	/**< number of tokens */
+	struct rtas_token	*tokens;	/**< tokens sorted by name */
+	int			nbuckets;	/**< size of the hash tables */
+	int			*by_name;	/**< first token of each name
+						 *   chain, -1 if none */
+	int			*by_value;	/**< first token of each value
+						 *   chain, -1 if none */
+};
+
+extern int rtas_token_read(const char *name, uint32_t *token);
+extern struct rtas_tokens *rtas_tokens_load(void);
+extern void rtas_tokens_free(struct rtas_tokens *tokens);
+extern struct rtas_token *rtas_token_by_name(struct rtas_tokens *tokens,
+					     const char *name);
+extern struct rtas_token *rtas_token_by_value(struct rtas_tokens *tokens,
+					      uint32_t value);
+
+#endif /* _RTAS_TOKENS_H */
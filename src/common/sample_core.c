@@ -0,0 +1,661 @@
+/**
+ * @file sample_core.c
+ * @brief Common routines to sample files and per-cpu counters
+ *
+ * The files and counters sampled by lparstat, vcpustat and ppc64_cpu are
+ * read through descriptors and buffers that are kept across samples, so
+ * a sample costs one pread() per file or counter.
+ *
+ * Copyright (c) 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#endif
+#include "sample_core.h"
+#include "sample_timer.h"
+#include "cpu_info_helpers.h"
+
+#ifndef __NR_perf_event_open
+#define __NR_perf_event_open	319
+#endif
+
+/**
+ * sample_file_read
+ * @brief Read a file through a descriptor kept open across samples
+ *
+ * The file is read with pread() starting at the given offset into a
+ * buffer that is reused by subsequent reads.
+ *
+ * @param sf file to read
+ * @param offset offset in the file to start reading at
+ * @param one_line stop reading at the end of the first line
+ * @returns number of bytes read, -1 on error
+ */
+ssize_t sample_file_read(struct sample_file *sf, off_t offset, bool one_line)
+{
+	ssize_t len = 0, rc;
+
+	if (sf->fd < 0) {
+		sf->fd = open(sf->path, O_RDONLY);
+		if (sf->fd < 0) {
+			fprintf(stderr, "Could not open %s\n", sf->path);
+			return -1;
+		}
+	}
+
+	while (1) {
+		if (sf->buf_sz - len < 2) {
+			size_t sz = sf->buf_sz ? sf->buf_sz * 2 : 4096;
+			char *buf;
+
+			buf = realloc(sf->buf, sz);
+			if (!buf) {
+				fprintf(stderr, "Could not allocate memory to read %s\n",
+					sf->path);
+				return -1;
+			}
+
+			sf->buf = buf;
+			sf->buf_sz = sz;
+		}
+
+		rc = pread(sf->fd, sf->buf + len, sf->buf_sz - len - 1,
+			   offset + len);
+		if (rc < 0) {
+			fprintf(stderr, "Could not read %s\n", sf->path);
+			return -1;
+		}
+
+		if (rc == 0)
+			break;
+
+		if (one_line && memchr(sf->buf + len, '\n', rc)) {
+			len += rc;
+			break;
+		}
+
+		len += rc;
+	}
+
+	sf->buf[len] = '\0';
+	if (one_line) {
+		char *nl = strchr(sf->buf, '\n');
+
+		if (nl)
+			*nl = '\0';
+	}
+
+	return len;
+}
+
+void sample_file_close(struct sample_file *sf)
+{
+	if (sf->fd >= 0)
+		close(sf->fd);
+	sf->fd = -1;
+
+	free(sf->buf);
+	sf->buf = NULL;
+	sf->buf_sz = 0;
+}
+
+static struct sample_file present_file = SAMPLE_FILE_INIT(SYSFS_PRESENT_CPUS);
+
+/**
+ * present_cpus
+ * @brief Find the number of cpu slots needed for the present cpus
+ *
+ * @returns highest present cpu plus one
+ */
+static int present_cpus(void)
+{
+	char path[SYSFS_PATH_MAX];
+	int max = -1;
+
+	if (sample_file_read(&present_file, 0, true) > 0)
+		max = parse_cpu_list(present_file.buf, NULL, 0);
+
+	if (max < 0) {
+		/* count the cpu directories instead */
+		do {
+			snprintf(path, SYSFS_PATH_MAX, SYSFS_CPUDIR, ++max);
+		} while (!access(path, F_OK));
+		max--;
+	}
+
+	return max + 1;
+}
+
+/**
+ * raise_nofile_limit
+ * @brief Raise the limit of open files so nr descriptors can be opened
+ *
+ * @param nr descriptors needed, the standard ones aside
+ */
+void raise_nofile_limit(int nr)
+{
+	struct rlimit old_rlim, new_rlim;
+	rlim_t new = nr + 8;
+
+	getrlimit(RLIMIT_NOFILE, &old_rlim);
+
+	if (old_rlim.rlim_cur > new)
+		return;
+
+	new_rlim.rlim_cur = new;
+	new_rlim.rlim_max = old_rlim.rlim_max;
+	if (new_rlim.rlim_max != RLIM_INFINITY && new_rlim.rlim_max < new)
+		new_rlim.rlim_cur = new_rlim.rlim_max;
+
+	setrlimit(RLIMIT_NOFILE, &new_rlim);
+}
+
+/**
+ * cpu_sampler_init
+ * @brief Set up a sampler of per-cpu counters
+ *
+ * No cpu is sampled until cpu_sampler_update() is called.
+ *
+ * @param s sampler to set up
+ * @param counters counters to sample on each cpu, kept by the sampler
+ * @param nr_counters number of counters, up to CPU_SAMPLER_MAX
+ * @param cpuset only sample the cpus this process may run on
+ * @returns 0 on success, -1 on failure
+ */
+int cpu_sampler_init(struct cpu_sampler *s, const struct cpu_counter *counters,
+		     int nr_counters, bool cpuset)
+{
+	int nr;
+
+	memset(s, 0, sizeof(*s));
+	if (nr_counters > CPU_SAMPLER_MAX)
+		return -1;
+
+	s->counters = counters;
+	s->nr_counters = nr_counters;
+	s->cpuset = cpuset;
+
+	if (!cpuset)
+		return 0;
+
+	for (nr = CPU_SETSIZE; ; nr *= 2) {
+		s->allowed = CPU_ALLOC(nr);
+		if (!s->allowed)
+			break;
+
+		if (!sched_getaffinity(0, CPU_ALLOC_SIZE(nr), s->allowed)) {
+			s->nr_allowed = nr;
+			return 0;
+		}
+
+		CPU_FREE(s->allowed);
+		s->allowed = NULL;
+		if (errno != EINVAL)
+			break;
+	}
+
+	fprintf(stderr, "Could not determine the cpuset of this process\n");
+	return -1;
+}
+
+static int cpu_allowed(struct cpu_sampler *s, int cpu)
+{
+	if (!s->cpuset)
+		return 1;
+
+	if (cpu >= s->nr_allowed)
+		return 0;
+
+	return CPU_ISSET_S(cpu, CPU_ALLOC_SIZE(s->nr_allowed), s->allowed);
+}
+
+/**
+ * cpu_sampler_resize
+ * @brief Grow the per-cpu descriptor and value arrays
+ *
+ * Values already sampled are preserved.
+ *
+ * @param s sampler
+ * @param nr number of cpu slots needed
+ * @returns 0 on success, -1 on failure
+ */
+static int cpu_sampler_resize(struct cpu_sampler *s, int nr)
+{
+	int nc = s->nr_counters, old_nr = s->nr;
+	unsigned long long *vals;
+	unsigned char *flags;
+	cpu_set_t *cpus;
+	int *fds;
+	int i;
+
+	if (nr <= old_nr)
+		return 0;
+
+	fds = realloc(s->fds, nr * nc * sizeof(*fds));
+	if (!fds)
+		goto err;
+	s->fds = fds;
+
+	for (i = old_nr * nc; i < nr * nc; i++)
+		fds[i] = -1;
+
+	cpus = CPU_ALLOC(nr);
+	if (!cpus)
+		goto err;
+
+	CPU_ZERO_S(CPU_ALLOC_SIZE(nr), cpus);
+	for (i = 0; i < old_nr; i++) {
+		if (CPU_ISSET_S(i, CPU_ALLOC_SIZE(old_nr), s->cpus))
+			CPU_SET_S(i, CPU_ALLOC_SIZE(nr), cpus);
+	}
+
+	if (s->cpus)
+		CPU_FREE(s->cpus);
+	s->cpus = cpus;
+
+	vals = calloc(1, 3 * nc * nr * sizeof(*vals) + 2 * nr);
+	if (!vals)
+		goto err;
+	flags = (unsigned char *)(vals + 3 * nc * nr);
+
+	for (i = 0; i < nc; i++) {
+		if (old_nr) {
+			memcpy(vals + (i * nr), s->val[i],
+			       old_nr * sizeof(*vals));
+			memcpy(vals + ((nc + i) * nr), s->old[i],
+			       old_nr * sizeof(*vals));
+			memcpy(vals + ((2 * nc + i) * nr), s->delta[i],
+			       old_nr * sizeof(*vals));
+		}
+
+		s->val[i] = vals + (i * nr);
+		s->old[i] = vals + ((nc + i) * nr);
+		s->delta[i] = vals + ((2 * nc + i) * nr);
+	}
+
+	if (old_nr) {
+		memcpy(flags, s->sampled, old_nr);
+		memcpy(flags + nr, s->old_sampled, old_nr);
+	}
+
+	free(s->buf);
+	s->buf = vals;
+	s->sampled = flags;
+	s->old_sampled = flags + nr;
+	s->nr = nr;
+
+	raise_nofile_limit(nr * nc);
+	return 0;
+
+err:
+	fprintf(stderr, "Failed to allocate memory for per-cpu samples\n");
+	return -1;
+}
+
+static void cpu_sampler_close_cpu(struct cpu_sampler *s, int cpu)
+{
+	int *fds = &s->fds[cpu * s->nr_counters];
+	int i;
+
+	for (i = 0; i < s->nr_counters; i++) {
+		if (fds[i] >= 0)
+			close(fds[i]);
+		fds[i] = -1;
+	}
+
+	CPU_CLR_S(cpu, CPU_ALLOC_SIZE(s->nr), s->cpus);
+}
+
+/**
+ * cpu_sampler_open_cpu
+ * @brief Open the counters of a cpu
+ *
+ * @param s sampler
+ * @param cpu cpu number
+ * @returns 0 on success, -1 if a counter that is not optional failed
+ */
+static int cpu_sampler_open_cpu(struct cpu_sampler *s, int cpu)
+{
+	const struct cpu_counter *ctr;
+	int *fds = &s->fds[cpu * s->nr_counters];
+	char path[SYSFS_PATH_MAX];
+	int i, len;
+
+	for (i = 0; i < s->nr_counters; i++) {
+		ctr = &s->counters[i];
+
+		if (ctr->perf) {
+			fds[i] = perf_counter_open(cpu, ctr->perf_type,
+						   ctr->perf_config, false);
+		} else {
+			len = snprintf(path, SYSFS_PATH_MAX, SYSFS_CPUDIR, cpu);
+			snprintf(path + len, SYSFS_PATH_MAX - len, "/%s",
+				 ctr->name);
+			fds[i] = open(path, O_RDONLY);
+		}
+
+		if (fds[i] >= 0 || ctr->optional)
+			continue;
+
+		if (ctr->perf)
+			fprintf(stderr, "Failed to open the %s counter of cpu %d\n",
+				ctr->name, cpu);
+		else
+			fprintf(stderr, "Failed to open %s\n", path);
+
+		cpu_sampler_close_cpu(s, cpu);
+		return -1;
+	}
+
+	CPU_SET_S(cpu, CPU_ALLOC_SIZE(s->nr), s->cpus);
+	return 0;
+}
+
+/**
+ * cpu_sampler_update
+ * @brief Track cpus coming online or going offline
+ *
+ * The present cpus are read once per call and the online cpus are taken
+ * from a new online_cpus_update() snapshot.  Only the counters of the
+ * cpus that changed are opened or closed.  Once the first sample has
+ * been read, a cpu whose counters can not be opened yet is picked up by
+ * a later update.
+ *
+ * @param s sampler
+ * @returns number of cpus that changed, -1 on failure
+ */
+int cpu_sampler_update(struct cpu_sampler *s)
+{
+	int i, want, changed = 0;
+	size_t size;
+
+	if (cpu_sampler_resize(s, present_cpus()))
+		return -1;
+
+	online_cpus_update();
+
+	size = CPU_ALLOC_SIZE(s->nr);
+	for (i = 0; i < s->nr; i++) {
+		want = cpu_online(i) && cpu_allowed(s, i);
+		if (want == !!CPU_ISSET_S(i, size, s->cpus))
+			continue;
+
+		changed++;
+		if (!want)
+			cpu_sampler_close_cpu(s, i);
+		else if (cpu_sampler_open_cpu(s, i) && !s->time_us)
+			return -1;
+	}
+
+	return changed;
+}
+
+/**
+ * cpu_sampler_save
+ * @brief Keep the current sample as the previous one
+ *
+ * @param s sampler
+ */
+void cpu_sampler_save(struct cpu_sampler *s)
+{
+	unsigned long long *tmp;
+	unsigned char *flags;
+	int i;
+
+	if (!s->nr)
+		return;
+
+	for (i = 0; i < s->nr_counters; i++) {
+		tmp = s->old[i];
+		s->old[i] = s->val[i];
+		s->val[i] = tmp;
+	}
+
+	flags = s->old_sampled;
+	s->old_sampled = s->sampled;
+	s->sampled = flags;
+	memset(s->sampled, 0, s->nr);
+
+	s->old_time_us = s->time_us;
+	s->old_tb = s->tb;
+	s->old_valid = 1;
+}
+
+static int read_counter(struct cpu_sampler *s, int counter, int fd,
+			unsigned long long *value)
+{
+	struct perf_count count;
+	char buf[64];
+	ssize_t rc;
+
+	if (s->counters[counter].perf) {
+		if (perf_counter_read(fd, &count))
+			return -1;
+
+		/* scale to the time the counter was enabled if it was
+		 * multiplexed with other counters */
+		*value = count.value;
+		if (count.time_running &&
+		    count.time_running < count.time_enabled)
+			*value = (double)count.value * count.time_enabled /
+				 count.time_running;
+		return 0;
+	}
+
+	rc = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (rc < 0)
+		return -1;
+
+	buf[rc] = '\0';
+	*value = strtoull(buf, NULL, s->counters[counter].base);
+	return 0;
+}
+
+/**
+ * cpu_sampler_read
+ * @brief Read the counters of every cpu into the current sample
+ *
+ * The timebase and monotonic time of the sample are read first.  The
+ * change of each counter is computed for the cpus that are in both the
+ * current and the previous sample.  A cpu that went offline since the
+ * last update is left out of the sample.
+ *
+ * @param s sampler
+ * @returns number of cpus left out, -1 on failure
+ */
+int cpu_sampler_read(struct cpu_sampler *s)
+{
+	size_t size = CPU_ALLOC_SIZE(s->nr);
+	int i, j, fd, dropped = 0;
+
+	s->time_us = monotonic_usecs();
+	s->tb = read_timebase();
+
+	for (i = 0; i < s->nr; i++) {
+		if (!CPU_ISSET_S(i, size, s->cpus))
+			continue;
+
+		for (j = 0; j < s->nr_counters; j++) {
+			fd = s->fds[i * s->nr_counters + j];
+			if (fd < 0) {
+				s->val[j][i] = 0;
+				continue;
+			}
+
+			if (read_counter(s, j, fd, &s->val[j][i]))
+				break;
+		}
+
+		if (j < s->nr_counters) {
+			online_cpus_update();
+			if (cpu_online(i)) {
+				fprintf(stderr, "Failed to read the %s counter of cpu %d\n",
+					s->counters[j].name, i);
+				return -1;
+			}
+
+			cpu_sampler_close_cpu(s, i);
+			dropped++;
+			continue;
+		}
+
+		s->sampled[i] = 1;
+
+		for (j = 0; j < s->nr_counters; j++)
+			s->delta[j][i] = (s->old_valid && s->old_sampled[i]) ?
+					 s->val[j][i] - s->old[j][i] : 0;
+	}
+
+	return dropped;
+}
+
+void cpu_sampler_close(struct cpu_sampler *s)
+{
+	int i;
+
+	for (i = 0; i < s->nr; i++)
+		cpu_sampler_close_cpu(s, i);
+
+	free(s->fds);
+	free(s->buf);
+	if (s->cpus)
+		CPU_FREE(s->cpus);
+	if (s->allowed)
+		CPU_FREE(s->allowed);
+	memset(s, 0, sizeof(*s));
+
+	sample_file_close(&present_file);
+}
+
+/**
+ * perf_counter_open
+ * @brief Open a counting perf event on a cpu
+ *
+ * The event reports how long it was enabled and running, to detect
+ * multiplexing with other counters.
+ *
+ * @param cpu cpu number
+ * @param type perf event type
+ * @param config perf event config
+ * @param disabled leave the event disabled until PERF_EVENT_IOC_ENABLE
+ * @returns file descriptor of the event, -1 on failure
+ */
+int perf_counter_open(int cpu, uint32_t type, uint64_t config, bool disabled)
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = disabled;
+	attr.size = sizeof(attr);
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+			   PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return syscall(__NR_perf_event_open, &attr, -1, cpu, -1, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/**
+ * perf_counter_read
+ * @brief Read a perf event opened by perf_counter_open()
+ *
+ * @param fd file descriptor of the event
+ * @param count value and times of the event
+ * @returns 0 on success, -1 on failure
+ */
+int perf_counter_read(int fd, struct perf_count *count)
+{
+	if (read(fd, count, sizeof(*count)) != sizeof(*count))
+		return -1;
+
+	return 0;
+}
+
+/**
+ * timebase_freq
+ * @brief Find the frequency of the timebase, from /proc/cpuinfo
+ *
+ * The value is read once and cached.
+ *
+ * @returns ticks per second, 0 if not known
+ */
+unsigned long long timebase_freq(void)
+{
+	static unsigned long long freq;
+	static int done;
+	char buf[80];
+	char *tb;
+	FILE *f;
+
+	if (done)
+		return freq;
+	done = 1;
+
+	f = fopen("/proc/cpuinfo", "r");
+	if (!f)
+		return 0;
+
+	while ((fgets(buf, sizeof(buf), f)) != NULL) {
+		if (!strncmp(buf, "timebase", 8)) {
+			tb = strchr(buf, ':');
+			if (tb)
+				freq = strtoull(tb + 1, NULL, 10);
+			break;
+		}
+	}
+	fclose(f);
+
+	return freq;
+}
+
+/**
+ * read_timebase
+ * @brief Read the timebase
+ *
+ * Other architectures have no timebase, the monotonic clock is scaled
+ * to the timebase frequency instead, or to nanoseconds if it is not
+ * known.
+ *
+ * @returns timebase ticks
+ */
+unsigned long long read_timebase(void)
+{
+#if defined(__powerpc__) || defined(__powerpc64__)
+	return __builtin_ppc_get_timebase();
+#else
+	unsigned long long us = monotonic_usecs();
+	unsigned long long freq = timebase_freq();
+
+	if (!freq)
+		freq = 1000000000ULL;
+
+	return (us / 1000000) * freq + (us % 1000000) * freq / 1000000;
+#endif
+}
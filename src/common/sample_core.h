@@ -0,0 +1,132 @@
+/**
+ * @file sample_core.h
+ * @brief Header of common routines to sample files and per-cpu counters
+ *
+ * Copyright (c) 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef _SAMPLE_CORE_H
+#define _SAMPLE_CORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sched.h>
+#include <sys/types.h>
+
+#define SYSFS_PRESENT_CPUS	"/sys/devices/system/cpu/present"
+
+/* A file read through a descriptor kept open across samples */
+struct sample_file {
+	const char *path;
+	int	fd;		/* kept open between samples, -1 if closed */
+	char	*buf;		/* contents from the last read */
+	size_t	buf_sz;		/* allocated size of buf */
+	off_t	offset;		/* offset of the data of interest in the file */
+};
+
+#define SAMPLE_FILE_INIT(p)	{ .path = (p), .fd = -1 }
+
+extern ssize_t sample_file_read(struct sample_file *sf, off_t offset,
+				bool one_line);
+extern void sample_file_close(struct sample_file *sf);
+
+/* A counter sampled on every cpu, from sysfs or perf */
+struct cpu_counter {
+	const char *name;	/* file in the sysfs cpu directory, or name
+				 * of the perf event for messages */
+	int	base;		/* base of the value in the sysfs file */
+	bool	perf;		/* a perf event rather than a sysfs file */
+	uint32_t perf_type;	/* perf event type and config */
+	uint64_t perf_config;
+	bool	optional;	/* cpus are sampled without the counter when
+				 * it can not be opened */
+};
+
+#define CPU_SAMPLER_MAX	8	/* counters per sampler */
+
+/*
+ * Per-cpu counters with their descriptors kept open across samples.
+ * Each value array is indexed by cpu number, and all of them are carved
+ * out of a single allocation so a pass over one counter for every cpu
+ * touches contiguous memory.
+ */
+struct cpu_sampler {
+	const struct cpu_counter *counters;
+	int	nr_counters;
+	bool	cpuset;			/* only the cpus we may run on */
+	int	nr;			/* number of cpu slots */
+	int	*fds;			/* nr_counters per cpu, -1 if closed */
+	cpu_set_t *cpus;		/* cpus with their counters open */
+	cpu_set_t *allowed;		/* our cpuset, when cpuset is set */
+	int	nr_allowed;		/* cpus the allowed set can hold */
+	void	*buf;			/* allocation backing the arrays */
+	unsigned long long *val[CPU_SAMPLER_MAX];	/* current sample */
+	unsigned long long *old[CPU_SAMPLER_MAX];	/* previous sample */
+	unsigned long long *delta[CPU_SAMPLER_MAX];	/* val - old, for the
+							 * cpus in both */
+	unsigned char *sampled;		/* cpu is in the current sample */
+	unsigned char *old_sampled;	/* cpu is in the previous sample */
+	int	old_valid;		/* old[] holds a previous sample */
+	long long time_us;		/* monotonic time of the sample */
+	long long old_time_us;
+	unsigned long long tb;		/* timebase of the sample */
+	unsigned long long old_tb;
+};
+
+extern int cpu_sampler_init(struct cpu_sampler *s,
+			    const struct cpu_counter *counters,
+			    int nr_counters, bool cpuset);
+extern int cpu_sampler_update(struct cpu_sampler *s);
+extern void cpu_sampler_save(struct cpu_sampler *s);
+extern int cpu_sampler_read(struct cpu_sampler *s);
+extern void cpu_sampler_close(struct cpu_sampler *s);
+
+/* cpu was sampled at both ends of the interval */
+static inline int cpu_sampler_both(struct cpu_sampler *s, int cpu)
+{
+	return s->sampled[cpu] && s->old_sampled[cpu];
+}
+
+/* counter is open on the cpu, optional counters may not be */
+static inline int cpu_counter_valid(struct cpu_sampler *s, int counter,
+				    int cpu)
+{
+	return s->fds[cpu * s->nr_counters + counter] >= 0;
+}
+
+/* Iterate over the cpus sampled at both ends of the interval */
+#define for_each_sampled_cpu(s, cpu)				\
+	for ((cpu) = 0; (cpu) < (s)->nr; (cpu)++)		\
+		if (!cpu_sampler_both((s), (cpu)))		\
+			continue;				\
+		else
+
+/* Perf counter value with PERF_FORMAT_TOTAL_TIME_{ENABLED,RUNNING} */
+struct perf_count {
+	uint64_t value;
+	uint64_t time_enabled;
+	uint64_t time_running;
+};
+
+extern int perf_counter_open(int cpu, uint32_t type, uint64_t config,
+			     bool disabled);
+extern int perf_counter_read(int fd, struct perf_count *count);
+
+extern unsigned long long timebase_freq(void);
+extern unsigned long long read_timebase(void);
+extern void raise_nofile_limit(int nr);
+
+#endif /* _SAMPLE_CORE_H */
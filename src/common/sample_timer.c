@@ -0,0 +1,122 @@
+/**
+ * @file sample_timer.c
+ * @brief Common routines to schedule periodic samples
+ *
+ * Samples are taken at absolute deadlines that are a whole number of
+ * periods after the first one, so the time spent collecting a sample
+ * does not push the following samples back.
+ *
+ * Copyright (c) 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include "sample_timer.h"
+
+#define NSEC_PER_SEC	1000000000LL
+
+/* Shortest interval accepted, anything shorter mostly measures ourselves */
+#define MIN_INTERVAL_NS	10000000LL
+
+/**
+ * parse_interval
+ * @brief Parse an interval in seconds, fractions of a second allowed
+ *
+ * @param arg interval from the command line
+ * @param interval parsed interval
+ * @returns 0 on success, -1 if the interval is not valid
+ */
+int parse_interval(const char *arg, double *interval)
+{
+	char *end;
+	double val;
+
+	errno = 0;
+	val = strtod(arg, &end);
+	if (errno || end == arg || *end != '\0' || !isfinite(val) ||
+	    val < 0 || (val > 0 && val * NSEC_PER_SEC < MIN_INTERVAL_NS))
+		return -1;
+
+	*interval = val;
+	return 0;
+}
+
+static long long timespec_ns(struct timespec *ts)
+{
+	return ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+/**
+ * sample_timer_start
+ * @brief Start a timer, the first deadline is one interval from now
+ *
+ * @param timer timer to start
+ * @param interval seconds between samples
+ */
+void sample_timer_start(struct sample_timer *timer, double interval)
+{
+	timer->period_ns = interval * NSEC_PER_SEC;
+	clock_gettime(CLOCK_MONOTONIC, &timer->next);
+}
+
+/**
+ * sample_timer_wait
+ * @brief Sleep until the next deadline of a timer
+ *
+ * If collecting the previous sample took longer than a period, the
+ * deadlines that have already passed are skipped rather than taken
+ * back to back, so samples stay on the original schedule.
+ *
+ * @param timer timer to wait for
+ * @returns 0 at the deadline, -1 if interrupted by a signal
+ */
+int sample_timer_wait(struct sample_timer *timer)
+{
+	struct timespec now;
+	long long next, missed;
+	int rc;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	next = timespec_ns(&timer->next) + timer->period_ns;
+	if (next <= timespec_ns(&now)) {
+		missed = (timespec_ns(&now) - next) / timer->period_ns + 1;
+		next += missed * timer->period_ns;
+	}
+
+	timer->next.tv_sec = next / NSEC_PER_SEC;
+	timer->next.tv_nsec = next % NSEC_PER_SEC;
+
+	rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &timer->next,
+			     NULL);
+	return rc ? -1 : 0;
+}
+
+/**
+ * monotonic_usecs
+ * @brief Read the monotonic clock, for measuring the length of intervals
+ *
+ * @returns microseconds since an arbitrary point in the past
+ */
+long long monotonic_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
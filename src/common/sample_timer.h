@@ -0,0 +1,36 @@
+/**
+ * @file sample_timer.h
+ * @brief Header of common routines to schedule periodic samples
+ *
+ * Copyright (c) 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef _SAMPLE_TIMER_H
+#define _SAMPLE_TIMER_H
+
+#include <time.h>
+
+struct sample_timer {
+	struct timespec next;		/* deadline of the next sample */
+	long long	period_ns;
+};
+
+extern int parse_interval(const char *arg, double *interval);
+extern void sample_timer_start(struct sample_timer *timer, double interval);
+extern int sample_timer_wait(struct sample_timer *timer);
+extern long long monotonic_usecs(void);
+
+#endif /* _SAMPLE_TIMER_H */
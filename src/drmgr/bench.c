@@ -0,0 +1,324 @@
+/**
+ * @file bench.c
+ * @brief Benchmark drmgr device discovery on a synthetic partition
+ *
+ * Copyright (c) 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "dr.h"
+#include "ofdt.h"
+#include "drcpu.h"
+#include "drmem.h"
+#include "drpci.h"
+#include "bench.h"
+
+#include "options.c"
+
+int output_level = 1;
+int log_fd = 0;
+
+int is_lsslot_cmd = 0;
+
+/*
+ * drmgr-bench is built with DR_ROOT pointing at a scratch directory.
+ * For each size, from the largest size halved steps - 1 times up to the
+ * largest size, a synthetic partition is created there and the
+ * discovery routines are timed against it.  Each size doubles the
+ * previous one, so a routine that scales linearly takes about twice as
+ * long at every step; larger ratios are flagged.
+ */
+#define DRC_CACHE_DIR		DR_STATE_DIR "/drc_cache"
+#define BENCH_SUPERLINEAR	3.0
+
+static struct bench_tree bench_tree;
+static int bench_warm_cache;
+
+static int bench_get_lmbs(void)
+{
+	struct lmb_list_head *lmb_list;
+
+	lmb_list = get_lmbs(LMB_NORMAL_SORT, LMB_SCNS_LAZY);
+	if (lmb_list == NULL)
+		return -1;
+
+	free_lmbs(lmb_list);
+	return 0;
+}
+
+static int bench_get_lmbs_eager(void)
+{
+	struct lmb_list_head *lmb_list;
+
+	lmb_list = get_lmbs(LMB_NORMAL_SORT, LMB_SCNS_EAGER);
+	if (lmb_list == NULL)
+		return -1;
+
+	free_lmbs(lmb_list);
+	return 0;
+}
+
+static int bench_get_drc_info(void)
+{
+	char path[DR_PATH_MAX];
+	int nr_phbs, i;
+
+	if (get_drc_info(OFDT_BASE) == NULL ||
+	    get_drc_info(CPU_OFDT_BASE) == NULL)
+		return -1;
+
+	nr_phbs = (bench_tree.nr_slots + bench_tree.slots_per_phb - 1) /
+		  bench_tree.slots_per_phb;
+
+	for (i = 0; i < nr_phbs; i++) {
+		snprintf(path, DR_PATH_MAX, "%s/pci@%llx", OFDT_BASE,
+			 BENCH_PHB_BUID + i);
+		if (get_drc_info(path) == NULL)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int bench_init_cpu_info(void)
+{
+	struct dr_info dr_info;
+
+	if (init_cpu_drc_info(&dr_info))
+		return -1;
+
+	free_cpu_drc_info(&dr_info);
+	return 0;
+}
+
+static int bench_get_dlpar_nodes(void)
+{
+	struct dr_node *node_list;
+
+	node_list = get_dlpar_nodes(PCI_NODES | VIO_NODES | HEA_NODES);
+	if (node_list == NULL)
+		return -1;
+
+	free_node(node_list);
+	return 0;
+}
+
+struct bench_fn {
+	const char	*name;
+	int		(*fn)(void);
+	double		prev_ms;	/* best time at the previous size */
+};
+
+static struct bench_fn bench_fns[] = {
+	{"get_lmbs", bench_get_lmbs},
+	{"get_lmbs (eager)", bench_get_lmbs_eager},
+	{"get_drc_info", bench_get_drc_info},
+	{"init_cpu_drc_info", bench_init_cpu_info},
+	{"get_dlpar_nodes", bench_get_dlpar_nodes},
+	{NULL, NULL}
+};
+
+static double bench_ms(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000.0 +
+	       (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/**
+ * bench_run
+ * @brief Time a discovery routine
+ *
+ * The connector lists cached in memory are dropped before every run, as
+ * is the persistent DRC cache unless -w was given.
+ *
+ * @param fn routine to time
+ * @param repeat number of runs
+ * @param best fastest run in ms
+ * @param avg average run in ms
+ * @returns 0 on success, !0 otherwise
+ */
+static int bench_run(struct bench_fn *fn, int repeat, double *best,
+		     double *avg)
+{
+	struct timespec start, end;
+	double ms, total = 0;
+	int i, rc;
+
+	*best = 0;
+	for (i = 0; i < repeat; i++) {
+		free_drc_info();
+		if (!bench_warm_cache && bench_remove_dir(DRC_CACHE_DIR))
+			return -1;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		rc = fn->fn();
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		if (rc) {
+			say(ERROR, "%s failed\n", fn->name);
+			return rc;
+		}
+
+		ms = bench_ms(&start, &end);
+		if (i == 0 || ms < *best)
+			*best = ms;
+		total += ms;
+	}
+
+	free_drc_info();
+	*avg = total / repeat;
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: drmgr-bench [-l lmbs] [-c cpus] [-s slots] "
+		"[-t threads] [-p slots_per_phb]\n"
+		"\t\t   [-n steps] [-r repeat] [-w] [-g] [-k] [-d level]\n"
+		"\t-l, -c, -s  largest number of LMBs, CPUs and PCI slots\n"
+		"\t-t          threads per CPU\n"
+		"\t-p          PCI slots per PHB\n"
+		"\t-n          number of sizes, each half the next one\n"
+		"\t-r          runs of each routine per size\n"
+		"\t-w          keep the persistent DRC cache between runs\n"
+		"\t-g          only generate the largest tree and exit\n"
+		"\t-k          keep the tree when done\n"
+		"\t-d          drmgr log level\n"
+		"The synthetic tree is created in %s\n", DR_ROOT);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_tree max = {65536, 2048, 500, 8, 16};
+	struct bench_fn *fn;
+	int steps = 4, repeat = 5;
+	int generate_only = 0, keep = 0;
+	double best, avg, scale;
+	int c, step, rc = 0;
+
+	if (strlen(DR_ROOT) < 2) {
+		fprintf(stderr, "drmgr-bench must be built with DR_ROOT set "
+			"to a scratch directory\n");
+		return 1;
+	}
+
+	while ((c = getopt(argc, argv, "l:c:s:t:p:n:r:wgkd:h")) != -1) {
+		switch (c) {
+		case 'l':
+			max.nr_lmbs = strtol(optarg, NULL, 0);
+			break;
+		case 'c':
+			max.nr_cpus = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			max.nr_slots = strtol(optarg, NULL, 0);
+			break;
+		case 't':
+			max.smt = strtol(optarg, NULL, 0);
+			break;
+		case 'p':
+			max.slots_per_phb = strtol(optarg, NULL, 0);
+			break;
+		case 'n':
+			steps = strtol(optarg, NULL, 0);
+			break;
+		case 'r':
+			repeat = strtol(optarg, NULL, 0);
+			break;
+		case 'w':
+			bench_warm_cache = 1;
+			break;
+		case 'g':
+			generate_only = 1;
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		case 'd':
+			output_level = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (generate_only)
+		steps = 1;
+
+	/* The smallest size still needs an owned and an unowned resource */
+	if (max.smt < 1 || max.slots_per_phb < 1 || steps < 1 || repeat < 1 ||
+	    (max.nr_lmbs >> (steps - 1)) < 2 ||
+	    (max.nr_cpus >> (steps - 1)) < 2 ||
+	    (max.nr_slots >> (steps - 1)) < 1) {
+		usage();
+		return 1;
+	}
+
+	if (generate_only) {
+		bench_tree = max;
+		if (bench_tree_remove() || bench_tree_create(&bench_tree))
+			return 1;
+
+		printf("Created %d LMBs, %d CPUs and %d slots in %s\n",
+		       max.nr_lmbs, max.nr_cpus, max.nr_slots, DR_ROOT);
+		return 0;
+	}
+
+	printf("%8s %6s %6s  %-20s %10s %10s %6s\n", "lmbs", "cpus", "slots",
+	       "routine", "best ms", "avg ms", "scale");
+
+	for (step = steps - 1; step >= 0 && !rc; step--) {
+		bench_tree = max;
+		bench_tree.nr_lmbs >>= step;
+		bench_tree.nr_cpus >>= step;
+		bench_tree.nr_slots >>= step;
+
+		rc = bench_tree_remove();
+		if (!rc)
+			rc = bench_tree_create(&bench_tree);
+
+		for (fn = bench_fns; fn->name && !rc; fn++) {
+			rc = bench_run(fn, repeat, &best, &avg);
+			if (rc)
+				break;
+
+			printf("%8d %6d %6d  %-20s %10.3f %10.3f",
+			       bench_tree.nr_lmbs, bench_tree.nr_cpus,
+			       bench_tree.nr_slots, fn->name, best, avg);
+
+			if (fn->prev_ms > 0) {
+				scale = best / fn->prev_ms;
+				printf(" %6.2f%s", scale,
+				       scale > BENCH_SUPERLINEAR ?
+				       "  superlinear" : "");
+			}
+			printf("\n");
+
+			fn->prev_ms = best;
+		}
+	}
+
+	if (!keep)
+		bench_tree_remove();
+
+	return rc ? 1 : 0;
+}
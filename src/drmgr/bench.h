@@ -0,0 +1,46 @@
+/**
+ * @file bench.h
+ * @brief Synthetic device tree for benchmarking drmgr
+ *
+ * Copyright (c) 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+/* Size of a synthetic partition, half of each resource is owned */
+struct bench_tree {
+	int	nr_lmbs;
+	int	nr_cpus;
+	int	nr_slots;
+	int	smt;		/* threads per cpu */
+	int	slots_per_phb;
+};
+
+#define BENCH_LMB_SIZE		0x10000000ULL	/* 256 MB */
+#define BENCH_PHB_BUID		0x800000020000000ULL	/* of PHB 0 */
+
+#define BENCH_PHB_DRC_BASE	0x20000000
+#define BENCH_SLOT_DRC_BASE	0x21000000
+#define BENCH_CPU_DRC_BASE	0x10000000
+#define BENCH_LMB_DRC_BASE	0x80000000
+
+int bench_tree_create(struct bench_tree *);
+int bench_tree_remove(void);
+int bench_remove_dir(const char *);
+
+#endif /* _BENCH_H_ */
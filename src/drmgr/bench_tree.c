@@ -0,0 +1,467 @@
+/**
+ * @file bench_tree.c
+ * @brief Generate a synthetic device tree and sysfs for benchmarking drmgr
+ *
+ * Copyright (c) 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <endian.h>
+#include <sys/stat.h>
+#include "dr.h"
+#include "ofdt.h"
+#include "drmem.h"
+#include "bench.h"
+
+/*
+ * The tree is created under DR_ROOT and laid out the way the discovery
+ * code expects to find it on a PowerVM partition:
+ *
+ *   /proc/device-tree			PHB connectors
+ *	ibm,dynamic-reconfiguration-memory	LMBs in ibm,dynamic-memory
+ *	cpus				CPU connectors
+ *	    PowerPC,POWER9@<reg>	owned CPUs
+ *	pci@<buid>			PHBs with the connectors of their slots
+ *	    ethernet@<n>		adapters in owned slots
+ *   /sys/devices/system/memory		memory blocks of the owned LMBs
+ *   /sys/devices/system/cpu		threads of the owned CPUs
+ *   /sys/devices/pci<n>:00		PCI devices of the owned slots
+ */
+#define BENCH_LOC_PREFIX	"U78D2.001.WZS0001-P1-C"
+
+/* Device tree property value, in big endian like the real thing */
+struct prop_buf {
+	char	*data;
+	size_t	len;
+	size_t	sz;
+};
+
+static int buf_add(struct prop_buf *buf, const void *data, size_t len)
+{
+	if (buf->len + len > buf->sz) {
+		size_t sz = buf->sz ? buf->sz : 4096;
+		char *new_data;
+
+		while (sz < buf->len + len)
+			sz *= 2;
+
+		new_data = realloc(buf->data, sz);
+		if (new_data == NULL)
+			return -1;
+
+		buf->data = new_data;
+		buf->sz = sz;
+	}
+
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	return 0;
+}
+
+static int buf_u32(struct prop_buf *buf, uint32_t val)
+{
+	val = htobe32(val);
+	return buf_add(buf, &val, sizeof(val));
+}
+
+static int buf_u64(struct prop_buf *buf, uint64_t val)
+{
+	val = htobe64(val);
+	return buf_add(buf, &val, sizeof(val));
+}
+
+static int buf_str(struct prop_buf *buf, const char *str)
+{
+	return buf_add(buf, str, strlen(str) + 1);
+}
+
+/**
+ * make_dir
+ * @brief Create a directory and its missing parents
+ *
+ * @param path directory to create
+ * @returns 0 on success, !0 otherwise
+ */
+static int make_dir(const char *path)
+{
+	char tmp[DR_PATH_MAX];
+	char *p;
+
+	snprintf(tmp, DR_PATH_MAX, "%s", path);
+	for (p = tmp + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+
+		*p = '\0';
+		if (mkdir(tmp, 0755) && errno != EEXIST)
+			goto err;
+		*p = '/';
+	}
+
+	if (mkdir(tmp, 0755) && errno != EEXIST)
+		goto err;
+
+	return 0;
+
+err:
+	say(ERROR, "Could not create %s: %s\n", tmp, strerror(errno));
+	return -1;
+}
+
+static int write_file(const char *dir, const char *name, const void *data,
+		      size_t len)
+{
+	char path[DR_PATH_MAX];
+	int fd, rc;
+
+	snprintf(path, DR_PATH_MAX, "%s/%s", dir, name);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		say(ERROR, "Could not create %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	rc = write(fd, data, len);
+	close(fd);
+
+	if (rc != len) {
+		say(ERROR, "Could not write %s\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Write a property and release its buffer */
+static int write_prop(const char *dir, const char *name, struct prop_buf *buf)
+{
+	int rc;
+
+	rc = write_file(dir, name, buf->data, buf->len);
+	free(buf->data);
+	memset(buf, 0, sizeof(*buf));
+	return rc;
+}
+
+static int write_u32_prop(const char *dir, const char *name, uint32_t val)
+{
+	val = htobe32(val);
+	return write_file(dir, name, &val, sizeof(val));
+}
+
+static int write_str_prop(const char *dir, const char *name, const char *str)
+{
+	return write_file(dir, name, str, strlen(str) + 1);
+}
+
+/* Write a sysfs attribute, which unlike a property is plain text */
+static int write_attr(const char *dir, const char *name, const char *fmt, ...)
+{
+	char buf[DR_BUF_SZ];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, DR_BUF_SZ, fmt, ap);
+	va_end(ap);
+
+	return write_file(dir, name, buf, len);
+}
+
+/**
+ * write_drc_props
+ * @brief Write the ibm,drc-* properties of a range of connectors
+ *
+ * @param dir device tree node to write the properties to
+ * @param first number of the first connector
+ * @param nr number of connectors
+ * @param name_fmt printf format of the connector names, given the number
+ * @param type connector type
+ * @param index_base drc index of connector number 0
+ * @returns 0 on success, !0 otherwise
+ */
+static int write_drc_props(const char *dir, int first, int nr,
+			   const char *name_fmt, const char *type,
+			   uint32_t index_base)
+{
+	struct prop_buf names = {0}, types = {0};
+	struct prop_buf indexes = {0}, domains = {0};
+	char name[DRC_STR_MAX];
+	int i, rc = 0;
+
+	rc |= buf_u32(&names, nr);
+	rc |= buf_u32(&types, nr);
+	rc |= buf_u32(&indexes, nr);
+	rc |= buf_u32(&domains, nr);
+
+	for (i = first; i < first + nr; i++) {
+		snprintf(name, DRC_STR_MAX, name_fmt, i);
+		rc |= buf_str(&names, name);
+		rc |= buf_str(&types, type);
+		rc |= buf_u32(&indexes, index_base + i);
+		rc |= buf_u32(&domains, 0xffffffff);
+	}
+
+	if (rc) {
+		free(names.data);
+		free(types.data);
+		free(indexes.data);
+		free(domains.data);
+		return -1;
+	}
+
+	rc |= write_prop(dir, "ibm,drc-names", &names);
+	rc |= write_prop(dir, "ibm,drc-types", &types);
+	rc |= write_prop(dir, "ibm,drc-indexes", &indexes);
+	rc |= write_prop(dir, "ibm,drc-power-domains", &domains);
+	return rc;
+}
+
+static int bench_tree_memory(struct bench_tree *tree)
+{
+	struct prop_buf drmem = {0};
+	char path[DR_PATH_MAX];
+	int i, rc = 0;
+
+	if (make_dir(DYNAMIC_RECONFIG_MEM) ||
+	    make_dir(DR_ROOT "/sys/devices/system/memory"))
+		return -1;
+
+	rc |= buf_u32(&drmem, tree->nr_lmbs);
+	for (i = 0; i < tree->nr_lmbs; i++) {
+		int owned = i < tree->nr_lmbs / 2;
+
+		rc |= buf_u64(&drmem, i * BENCH_LMB_SIZE);
+		rc |= buf_u32(&drmem, BENCH_LMB_DRC_BASE + i);
+		rc |= buf_u32(&drmem, 0);
+		rc |= buf_u32(&drmem, 0);
+		rc |= buf_u32(&drmem, owned ? DRMEM_ASSIGNED : 0);
+		if (rc || !owned)
+			continue;
+
+		/* One memory block per lmb */
+		snprintf(path, DR_PATH_MAX,
+			 DR_ROOT "/sys/devices/system/memory/memory%d", i);
+		rc |= make_dir(path);
+		rc |= write_attr(path, "removable", "1\n");
+		rc |= write_attr(path, "state", "online\n");
+	}
+
+	if (rc) {
+		free(drmem.data);
+		return -1;
+	}
+
+	rc |= write_prop(DYNAMIC_RECONFIG_MEM, "ibm,dynamic-memory", &drmem);
+
+	rc |= buf_u64(&drmem, BENCH_LMB_SIZE);
+	rc |= write_prop(DYNAMIC_RECONFIG_MEM, "ibm,lmb-size", &drmem);
+
+	/* Every lmb uses the one associativity list, node 0 */
+	rc |= buf_u32(&drmem, 1);
+	rc |= buf_u32(&drmem, 4);
+	for (i = 0; i < 4; i++)
+		rc |= buf_u32(&drmem, 0);
+	rc |= write_prop(DYNAMIC_RECONFIG_MEM,
+			 "ibm,associativity-lookup-arrays", &drmem);
+
+	rc |= write_attr(DR_ROOT "/sys/devices/system/memory",
+			 "block_size_bytes", "%llx\n", BENCH_LMB_SIZE);
+	return rc;
+}
+
+static int bench_tree_cpus(struct bench_tree *tree)
+{
+	struct prop_buf intserv = {0};
+	char path[DR_PATH_MAX];
+	int i, t, rc = 0;
+
+	if (make_dir(CPU_OFDT_BASE))
+		return -1;
+
+	rc = write_drc_props(CPU_OFDT_BASE, 0, tree->nr_cpus, "CPU %d", "CPU",
+			     BENCH_CPU_DRC_BASE);
+
+	for (i = 0; i < tree->nr_cpus / 2 && !rc; i++) {
+		int reg = i * tree->smt;
+
+		snprintf(path, DR_PATH_MAX, "%s/PowerPC,POWER9@%x",
+			 CPU_OFDT_BASE, reg);
+		if (make_dir(path))
+			return -1;
+
+		rc |= write_str_prop(path, "name", "PowerPC,POWER9");
+		rc |= write_str_prop(path, "device_type", "cpu");
+		rc |= write_u32_prop(path, "ibm,my-drc-index",
+				     BENCH_CPU_DRC_BASE + i);
+		rc |= write_u32_prop(path, "reg", reg);
+
+		for (t = 0; t < tree->smt; t++)
+			rc |= buf_u32(&intserv, reg + t);
+		rc |= write_prop(path, "ibm,ppc-interrupt-server#s", &intserv);
+
+		/* The logical ids of the threads match their physical ids */
+		for (t = 0; t < tree->smt && !rc; t++) {
+			snprintf(path, DR_PATH_MAX,
+				 DR_ROOT "/sys/devices/system/cpu/cpu%d",
+				 reg + t);
+			rc |= make_dir(path);
+			rc |= write_attr(path, "physical_id", "%d\n", reg + t);
+			rc |= write_attr(path, "online", "1\n");
+		}
+	}
+
+	return rc;
+}
+
+static int bench_tree_slots(struct bench_tree *tree)
+{
+	char phb_path[DR_PATH_MAX / 2];
+	char path[DR_PATH_MAX];
+	char buf[DR_BUF_SZ];
+	int nr_phbs, phb, slot, nr, rc;
+
+	nr_phbs = (tree->nr_slots + tree->slots_per_phb - 1) /
+		  tree->slots_per_phb;
+
+	rc = write_drc_props(OFDT_BASE, 0, nr_phbs, "PHB %d", "PHB",
+			     BENCH_PHB_DRC_BASE);
+
+	for (phb = 0; phb < nr_phbs && !rc; phb++) {
+		int first = phb * tree->slots_per_phb;
+
+		nr = tree->nr_slots - first;
+		if (nr > tree->slots_per_phb)
+			nr = tree->slots_per_phb;
+
+		snprintf(phb_path, sizeof(phb_path), "%s/pci@%llx", OFDT_BASE,
+			 BENCH_PHB_BUID + phb);
+		if (make_dir(phb_path))
+			return -1;
+
+		rc |= write_str_prop(phb_path, "name", "pci");
+		rc |= write_str_prop(phb_path, "device_type", "pci");
+		rc |= write_u32_prop(phb_path, "ibm,my-drc-index",
+				     BENCH_PHB_DRC_BASE + phb);
+		rc |= write_drc_props(phb_path, first, nr,
+				      BENCH_LOC_PREFIX "%d", "SLOT",
+				      BENCH_SLOT_DRC_BASE);
+
+		/* Every other slot holds an adapter */
+		for (slot = first; slot < first + nr && !rc; slot += 2) {
+			snprintf(path, DR_PATH_MAX, "%s/ethernet@%x",
+				 phb_path, slot);
+			if (make_dir(path))
+				return -1;
+
+			snprintf(buf, DR_BUF_SZ, BENCH_LOC_PREFIX "%d-T1",
+				 slot);
+			rc |= write_str_prop(path, "name", "ethernet");
+			rc |= write_str_prop(path, "ibm,loc-code", buf);
+			rc |= write_u32_prop(path, "ibm,my-drc-index",
+					     BENCH_SLOT_DRC_BASE + slot);
+			rc |= write_u32_prop(path, "vendor-id", 0x14e4);
+			rc |= write_u32_prop(path, "device-id", 0x168e);
+
+			snprintf(path, DR_PATH_MAX,
+				 DR_ROOT "/sys/devices/pci%04x:00/%04x:00:%02x.0",
+				 phb, phb, slot - first);
+			rc |= make_dir(path);
+			rc |= write_attr(path, "devspec",
+					 "/pci@%llx/ethernet@%x\n",
+					 BENCH_PHB_BUID + phb, slot);
+		}
+	}
+
+	return rc;
+}
+
+/**
+ * bench_tree_create
+ * @brief Create a synthetic partition under DR_ROOT
+ *
+ * @param tree size of the partition
+ * @returns 0 on success, !0 otherwise
+ */
+int bench_tree_create(struct bench_tree *tree)
+{
+	if (make_dir(OFDT_BASE) || make_dir(DR_ROOT "/proc/ppc64") ||
+	    make_dir(DR_STATE_DIR) || make_dir(DR_ROOT "/var/log") ||
+	    make_dir(DR_ROOT "/var/lock"))
+		return -1;
+
+	if (write_str_prop(OFDT_BASE, "device_type", "chrp") ||
+	    write_file(OFDT_BASE, "ibm,lpar-capable", NULL, 0))
+		return -1;
+
+	if (bench_tree_memory(tree) || bench_tree_cpus(tree) ||
+	    bench_tree_slots(tree)) {
+		say(ERROR, "Could not create the synthetic tree\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int bench_tree_unlink(const char *path, const struct stat *sb,
+			     int type, struct FTW *ftw)
+{
+	if (remove(path)) {
+		say(ERROR, "Could not remove %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * bench_remove_dir
+ * @brief Remove a directory of the synthetic partition and its contents
+ *
+ * @param path directory to remove
+ * @returns 0 on success, !0 otherwise
+ */
+int bench_remove_dir(const char *path)
+{
+	struct stat sb;
+
+	/* Never touch anything outside of the synthetic partition */
+	if (strlen(DR_ROOT) < 2 || strncmp(path, DR_ROOT, strlen(DR_ROOT)))
+		return -1;
+
+	if (lstat(path, &sb))
+		return 0;
+
+	return nftw(path, bench_tree_unlink, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+/**
+ * bench_tree_remove
+ * @brief Remove the synthetic partition under DR_ROOT
+ *
+ * @returns 0 on success, !0 otherwise
+ */
+int bench_tree_remove(void)
+{
+	return bench_remove_dir(DR_ROOT);
+}
@@ -34,22 +34,57 @@
 #include <ctype.h>
 #include <sys/wait.h>
 #include <endian.h>
+#include <pthread.h>
 #include "dr.h"
 #include "ofdt.h"
 
 char *add_slot_fname = ADD_SLOT_FNAME;
 char *remove_slot_fname = REMOVE_SLOT_FNAME;
 
-#define DR_LOG_PATH	"/var/log/drmgr"
-#define DR_LOG_PATH0	"/var/log/drmgr.0"
+#define DR_LOG_PATH	DR_ROOT "/var/log/drmgr"
+#define DR_LOG_PATH0	DR_ROOT "/var/log/drmgr.0"
 
-#define LPARCFG_PATH	"/proc/ppc64/lparcfg"
+#define LPARCFG_PATH	DR_ROOT "/proc/ppc64/lparcfg"
 
-#define SYSFS_DLPAR_FILE	"/sys/kernel/dlpar"
+#define SYSFS_DLPAR_FILE	DR_ROOT "/sys/kernel/dlpar"
 
 static int dr_lock_fd = 0;
 static long dr_timeout;
 
+/* The ofdt file and command buffer are kept for a whole DLPAR operation */
+static int ofdt_fd = -1;
+static char *ofdt_buf;
+static size_t ofdt_buf_sz;
+
+/* Device tree updates made while a transaction is open are queued in
+ * the journal and only written to the kernel when the outermost
+ * transaction is committed.
+ */
+#define OFDT_OP_ADD_NODE	1
+#define OFDT_OP_REMOVE_NODE	2
+#define OFDT_OP_PROPERTY	3
+
+#define OFDT_TXN_MAX_DEPTH	8
+
+struct ofdt_op {
+	int	type;
+	char	*cmd;
+	size_t	len;
+	char	*undo;		/* command reverting cmd, NULL if none */
+	size_t	undo_len;
+};
+
+static struct ofdt_op *ofdt_ops;
+static int nr_ofdt_ops;
+static int ofdt_ops_sz;
+
+/* number of queued ops when each open transaction was started */
+static int ofdt_txn_marks[OFDT_TXN_MAX_DEPTH];
+static int ofdt_txn_depth;
+
+/* Held by the thread with open transactions, once per nesting level */
+static pthread_mutex_t ofdt_txn_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
 /**
  * set_output level
  * @brief Common routine to set the output level
@@ -109,20 +144,93 @@ void * __zalloc(size_t size, const char *func, int line)
 	return data;
 }
 
-static int check_kmods(void)
+#define DR_ARENA_MIN_CHUNK	(64 * 1024)
+/* alignment of arena allocations, matches struct dr_arena_chunk data */
+#define DR_ARENA_ALIGN		16
+
+/**
+ * dr_arena_init
+ * @brief Initialize an arena
+ *
+ * @param arena arena to initialize
+ * @param size_hint expected total size of allocations from the arena,
+ *        used to size the first chunk
+ */
+void dr_arena_init(struct dr_arena *arena, size_t size_hint)
+{
+	arena->chunks = NULL;
+	arena->chunk_sz = MAX(size_hint, DR_ARENA_MIN_CHUNK);
+}
+
+void *__dr_arena_zalloc(struct dr_arena *arena, size_t size,
+			const char *func, int line)
+{
+	struct dr_arena_chunk *chunk = arena->chunks;
+	void *data;
+
+	size = (size + DR_ARENA_ALIGN - 1) & ~(DR_ARENA_ALIGN - 1);
+
+	if (chunk == NULL || (chunk->size - chunk->used) < size) {
+		size_t chunk_sz;
+
+		if (arena->chunk_sz == 0)
+			arena->chunk_sz = DR_ARENA_MIN_CHUNK;
+
+		chunk_sz = MAX(arena->chunk_sz, size);
+		chunk = __zalloc(sizeof(*chunk) + chunk_sz, func, line);
+		if (chunk == NULL)
+			return NULL;
+
+		chunk->size = chunk_sz;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+
+		/* The first chunk is sized to hold everything we expect
+		 * to allocate, additional chunks only need to cover the
+		 * overflow.
+		 */
+		arena->chunk_sz = DR_ARENA_MIN_CHUNK;
+	}
+
+	data = chunk->data + chunk->used;
+	chunk->used += size;
+	return data;
+}
+
+/**
+ * dr_arena_free
+ * @brief Free all memory allocated from an arena
+ *
+ * @param arena arena to free
+ */
+void dr_arena_free(struct dr_arena *arena)
+{
+	struct dr_arena_chunk *chunk;
+
+	while (arena->chunks) {
+		chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+}
+
+static int kmods_loaded = 0;
+
+/**
+ * load_dlpar_kmods
+ * @brief Make sure the rpadlpar_io module used for slot DLPAR is loaded
+ *
+ * A successful check is remembered, so that a drmgr daemon only does
+ * it once for all of its requests.
+ *
+ * @returns 0 on success, !0 otherwise
+ */
+int load_dlpar_kmods(void)
 {
 	struct stat sbuf;
 	int rc;
 
-	/* We only need to do this for PHB/SLOT/PCI operations */
-	if (usr_drc_type != DRC_TYPE_PCI && usr_drc_type != DRC_TYPE_PHB &&
-	    usr_drc_type != DRC_TYPE_SLOT && !display_capabilities)
-		return 0;
-
-	/* We don't use rpadlar_io/rpaphp for PCI operations run with the
-	 * -v / virtio flag, which relies on generic PCI rescan instead
-	 */
-	if (usr_drc_type == DRC_TYPE_PCI && pci_virtio && !display_capabilities)
+	if (kmods_loaded)
 		return 0;
 
 	/* Before checking for dlpar capability, we need to ensure that
@@ -151,10 +259,29 @@ static int check_kmods(void)
 		remove_slot_fname = REMOVE_SLOT_FNAME2;
 		rc = stat(add_slot_fname, &sbuf);
 	}
-	
+
+	if (!rc)
+		kmods_loaded = 1;
+
 	return rc;
 }
 
+static int check_kmods(void)
+{
+	/* We only need to do this for PHB/SLOT/PCI operations */
+	if (usr_drc_type != DRC_TYPE_PCI && usr_drc_type != DRC_TYPE_PHB &&
+	    usr_drc_type != DRC_TYPE_SLOT && !display_capabilities)
+		return 0;
+
+	/* We don't use rpadlar_io/rpaphp for PCI operations run with the
+	 * -v / virtio flag, which relies on generic PCI rescan instead
+	 */
+	if (usr_drc_type == DRC_TYPE_PCI && pci_virtio && !display_capabilities)
+		return 0;
+
+	return load_dlpar_kmods();
+}
+
 /**
  * dr_init
  * @brief Initialization routine for drmgr and lsslot
@@ -222,6 +349,8 @@ dr_fini(void)
 	char tbuf[128];
 
 	free_drc_info();
+	ofdt_close();
+	trace_fini();
 
 	if (! log_fd)
 		return;
@@ -251,122 +380,841 @@ dr_fini(void)
 			return;
 		}
 
-		rc = rename(DR_LOG_PATH, DR_LOG_PATH0);
-		if (rc) {
-			fprintf(stderr, "Could not rename %s to %s\n\t%s\n",
-				DR_LOG_PATH, DR_LOG_PATH0, strerror(errno));
-			return;
-		}
+		/* Another drmgr may have rotated the log already */
+		rc = rename(DR_LOG_PATH, DR_LOG_PATH0);
+		if (rc && (errno != ENOENT)) {
+			fprintf(stderr, "Could not rename %s to %s\n\t%s\n",
+				DR_LOG_PATH, DR_LOG_PATH0, strerror(errno));
+			return;
+		}
+	}
+
+	dr_unlock();
+}
+
+/**
+ * set_timeout
+ *
+ */
+void set_timeout(int timeout)
+{
+	if (!timeout) {
+		dr_timeout = -1;
+		return;
+	}
+
+	dr_timeout = time((time_t *)0);
+	if (dr_timeout == -1)
+		return;
+
+	dr_timeout += timeout;
+}
+
+/**
+ *
+ */
+int drmgr_timed_out(void)
+{
+	if (dr_timeout == -1)
+		return 0;	/* No timeout specified */
+
+	if (dr_timeout > time((time_t *)0))
+		return 0;
+
+	say(WARN, "Drmgr has exceeded its specified wait time and will not "
+	    "continue\n");
+	return 1;
+}
+
+/**
+ * elapsed_ms
+ * @brief Milliseconds elapsed since a CLOCK_MONOTONIC time stamp
+ *
+ * @param start time stamp
+ * @returns elapsed time in milliseconds
+ */
+long elapsed_ms(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 +
+	       (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/**
+ * prrn_progress
+ * @brief Report the progress of a PRRN update after a batch of resources
+ *
+ * @param type resource type, "LMB" or "CPU"
+ * @param drc_indexes drc indexes of the batch
+ * @param nr_batch number of resources in the batch
+ * @param nr_done number of resources processed so far
+ * @param nr number of resources of this type in the event
+ * @param start time the batch was started at
+ */
+void prrn_progress(const char *type, uint32_t *drc_indexes, int nr_batch,
+		   int nr_done, int nr, struct timespec *start)
+{
+	long ms = elapsed_ms(start);
+	int i;
+
+	for (i = 0; i < nr_batch; i++)
+		say(DEBUG, "%s %x: %ld ms, batch of %d\n", type,
+		    drc_indexes[i], ms, nr_batch);
+
+	say(INFO, "PRRN: processed %d of %d %ss\n", nr_done, nr, type);
+}
+
+/*
+ * The DR lock is a set of byte range locks on DR_LOCK_FILE.  Byte
+ * DR_LOCK_PARTITION guards the partition as a whole, every resource
+ * class has a byte of its own after it:
+ *
+ *   memory	the LMB list and ibm,dynamic-memory
+ *   cpu	the cpu nodes and threads
+ *   I/O	PHBs, PCI and virtual slots and HEA ports, which share the
+ *		PHB nodes and the rpadlpar_io interface
+ *
+ * An operation on one class holds the partition byte shared and its
+ * class byte exclusive, so memory, cpu and I/O operations run at the
+ * same time while two operations on the same class are serialized.
+ * Operations that span classes (migration, hibernation, PRRN events)
+ * hold the partition byte exclusive, lsslot and drmgr -C hold their
+ * bytes shared.
+ *
+ * Locks are always taken partition byte first, then class bytes in
+ * increasing order, and are all released together by dr_unlock().
+ * Older drmgr and lsslot binaries lock the whole file, which conflicts
+ * with every byte, so they still exclude all other operations.
+ */
+enum dr_lock_class {
+	DR_LOCK_PARTITION,
+	DR_LOCK_MEM,
+	DR_LOCK_CPU,
+	DR_LOCK_IO,
+	DR_LOCK_NONE,
+};
+
+static const char *dr_lock_names[] = {
+	"partition", "memory", "cpu", "I/O"
+};
+
+/**
+ * dr_lock_class
+ * @brief Find the resource class a drmgr or lsslot invocation acts on
+ *
+ * @returns DR_LOCK_PARTITION, a resource class or DR_LOCK_NONE if only
+ *	    the partition byte is needed
+ */
+static enum dr_lock_class dr_lock_class(void)
+{
+	if (display_capabilities)
+		return DR_LOCK_NONE;
+
+	if (prrn_filename || usr_action == MIGRATE)
+		return DR_LOCK_PARTITION;
+
+	if (usr_drc_name && !strncmp(usr_drc_name, "HEA", 3))
+		return DR_LOCK_IO;
+
+	switch (usr_drc_type) {
+	case DRC_TYPE_MEM:
+		return DR_LOCK_MEM;
+	case DRC_TYPE_CPU:
+		return DR_LOCK_CPU;
+	case DRC_TYPE_PCI:
+	case DRC_TYPE_SLOT:
+	case DRC_TYPE_PHB:
+	case DRC_TYPE_PORT:
+		return DR_LOCK_IO;
+	default:
+		return DR_LOCK_PARTITION;
+	}
+}
+
+/**
+ * dr_lock_byte
+ * @brief Lock one byte of the DR lock file
+ *
+ * This waits for the drmgr timeout if the byte cannot be locked.
+ *
+ * @param byte byte to lock
+ * @param type F_RDLCK or F_WRLCK
+ * @returns 0 on success, -1 otherwise
+ */
+static int dr_lock_byte(enum dr_lock_class byte, short type)
+{
+	struct flock    dr_lock_info;
+	int             rc;
+
+	dr_lock_info.l_type = type;
+	dr_lock_info.l_whence = SEEK_SET;
+	dr_lock_info.l_start = byte;
+	dr_lock_info.l_len = 1;
+
+	do {
+		rc = fcntl(dr_lock_fd, F_SETLK, &dr_lock_info);
+		if (rc == 0) {
+			say(DEBUG, "Obtained %s %s lock\n",
+			    type == F_RDLCK ? "shared" : "exclusive",
+			    dr_lock_names[byte]);
+			return 0;
+		}
+
+		/* lock may be held by another process */
+		if (errno != EACCES && errno != EAGAIN)
+			break;
+
+		if (drmgr_timed_out())
+			break;
+
+		sleep(1);
+	} while (1);
+
+	perror(DR_LOCK_FILE);
+	return -1;
+}
+
+/**
+ * dr_lock
+ * @brief Lock the resources of this drmgr or lsslot invocation
+ *
+ * This will attempt to lock a token (either file or directory) and wait
+ * a specified amount of time if the lock cannot be granted.
+ *
+ * @returns 0 if successful, -1 otherwise
+ */
+int dr_lock(void)
+{
+	enum dr_lock_class class = dr_lock_class();
+	short type = is_lsslot_cmd ? F_RDLCK : F_WRLCK;
+	mode_t          old_mode;
+	int		rc;
+
+	old_mode = umask(0);
+	dr_lock_fd = open(DR_LOCK_FILE, O_RDWR | O_CREAT,
+			  S_IRUSR | S_IRGRP | S_IROTH);
+	umask(old_mode);
+	if (dr_lock_fd < 0)
+		return -1;
+
+	if (class == DR_LOCK_PARTITION) {
+		rc = dr_lock_byte(DR_LOCK_PARTITION, type);
+	} else {
+		rc = dr_lock_byte(DR_LOCK_PARTITION, F_RDLCK);
+		if (!rc && class != DR_LOCK_NONE)
+			rc = dr_lock_byte(class, type);
+	}
+
+	/* Closing the file drops any byte locked so far */
+	if (rc) {
+		close(dr_lock_fd);
+		dr_lock_fd = 0;
+	}
+
+	return rc;
+}
+
+/**
+ * dr_unlock
+ * @brief unlock a lock granted via dr_lock()
+ *
+ * @returns 0 on success, -1 otherwise
+ */
+int
+dr_unlock(void)
+{
+	struct flock	dr_lock_info;
+
+	dr_lock_info.l_whence = SEEK_SET;
+	dr_lock_info.l_start = 0;
+	dr_lock_info.l_len = 0;
+	dr_lock_info.l_type = F_UNLCK;
+	if (fcntl(dr_lock_fd, F_SETLK, &dr_lock_info) < 0)
+		return -1;
+
+	close(dr_lock_fd);
+	dr_lock_fd = 0;
+	return 0;
+
+}
+
+/**
+ * ofdt_apply
+ * @brief Write a command to the kernel's Open Firmware tree interface
+ *
+ * The kernel handles each write as one command, so a command must be
+ * written with a single write() call.  The file is opened on first use
+ * and kept open until ofdt_close().
+ *
+ * @param buf command to write
+ * @param len length of the command
+ * @returns 0 on success, !0 otherwise
+ */
+static int
+ofdt_apply(const char *buf, size_t len)
+{
+	struct trace_span span;
+	ssize_t rc;
+
+	if (ofdt_fd < 0) {
+		ofdt_fd = open(OFDTPATH, O_WRONLY);
+		if (ofdt_fd < 0) {
+			say(ERROR, "Failed to open %s: %s\n", OFDTPATH,
+			    strerror(errno));
+			return -1;
+		}
+	}
+
+	trace_begin(&span, TRACE_OFDT, "ofdt_write");
+	rc = write(ofdt_fd, buf, len);
+	trace_end(&span);
+	if (rc < 0 || (size_t)rc != len) {
+		say(ERROR, "Write to %s failed: %s\n", OFDTPATH,
+		    strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * ofdt_buf_reserve
+ * @brief Make room in the ofdt command buffer
+ *
+ * @param len length of the command so far
+ * @param need number of bytes to append
+ * @returns 0 on success, !0 otherwise
+ */
+static int
+ofdt_buf_reserve(size_t len, size_t need)
+{
+	size_t sz = ofdt_buf_sz ? ofdt_buf_sz : 4096;
+	char *buf;
+
+	/* one more byte for the terminating nul */
+	while (sz < len + need + 1)
+		sz *= 2;
+
+	if (sz == ofdt_buf_sz)
+		return 0;
+
+	buf = realloc(ofdt_buf, sz);
+	if (buf == NULL) {
+		say(ERROR, "Failed to allocate buffer to write to kernel\n");
+		return -1;
+	}
+
+	ofdt_buf = buf;
+	ofdt_buf_sz = sz;
+	return 0;
+}
+
+/**
+ * ofdt_buf_add_prop
+ * @brief Append a property to the add_node command in the ofdt buffer
+ *
+ * @param len length of the command so far, updated on return
+ * @param name property name
+ * @param value property value
+ * @param length length of the property value
+ * @returns 0 on success, !0 otherwise
+ */
+static int
+ofdt_buf_add_prop(size_t *len, const char *name, const char *value,
+		  int length)
+{
+	size_t name_len = strlen(name);
+
+	/* two spaces, name, space, length up to 10 digits, value */
+	if (ofdt_buf_reserve(*len, name_len + length + 13))
+		return -1;
+
+	ofdt_buf[(*len)++] = ' ';
+	memcpy(ofdt_buf + *len, name, name_len);
+	*len += name_len;
+	*len += sprintf(ofdt_buf + *len, " %d ", length);
+	if (length)
+		memcpy(ofdt_buf + *len, value, length);
+	*len += length;
+	ofdt_buf[*len] = '\0';
+
+	return 0;
+}
+
+/**
+ * ofdt_op_type
+ * @brief Classify an ofdt command
+ *
+ * @param cmd ofdt command
+ * @returns OFDT_OP_* type of the command
+ */
+static int
+ofdt_op_type(const char *cmd)
+{
+	if (!strncmp(cmd, "add_node ", 9))
+		return OFDT_OP_ADD_NODE;
+
+	if (!strncmp(cmd, "remove_node ", 12))
+		return OFDT_OP_REMOVE_NODE;
+
+	/* update_property and remove_property */
+	return OFDT_OP_PROPERTY;
+}
+
+/**
+ * ofdt_op_key
+ * @brief Find what a queued op applies to
+ *
+ * This is the node path for node ops and "phandle name" for
+ * property ops.
+ *
+ * @param op queued op
+ * @param key_len length of the key on return
+ * @returns pointer to the key in the op's command
+ */
+static const char *
+ofdt_op_key(const struct ofdt_op *op, size_t *key_len)
+{
+	const char *end = op->cmd + op->len;
+	const char *key, *p;
+	int tokens = (op->type == OFDT_OP_PROPERTY) ? 2 : 1;
+
+	key = memchr(op->cmd, ' ', op->len);
+	if (key == NULL) {
+		*key_len = 0;
+		return end;
+	}
+
+	for (p = ++key; p < end; p++) {
+		if ((*p == ' ' || *p == '\0') && --tokens == 0)
+			break;
+	}
+
+	*key_len = p - key;
+	return key;
+}
+
+static int
+ofdt_op_key_cmp(const struct ofdt_op *op, const char *key, size_t key_len)
+{
+	const char *op_key;
+	size_t op_key_len;
+
+	op_key = ofdt_op_key(op, &op_key_len);
+	if (op_key_len != key_len)
+		return 1;
+
+	return memcmp(op_key, key, key_len);
+}
+
+/**
+ * ofdt_txn_last
+ * @brief Find the last queued op on a device tree node
+ *
+ * @param path full path of the node
+ * @returns OFDT_OP_* type of the op, 0 if none is queued
+ */
+static int
+ofdt_txn_last(const char *path)
+{
+	const char *key = path + strlen(OFDT_BASE);
+	size_t key_len = strlen(key);
+	int i;
+
+	for (i = nr_ofdt_ops - 1; i >= 0; i--) {
+		if (ofdt_ops[i].type == OFDT_OP_PROPERTY)
+			continue;
+
+		if (!ofdt_op_key_cmp(&ofdt_ops[i], key, key_len))
+			return ofdt_ops[i].type;
+	}
+
+	return 0;
+}
+
+static void
+ofdt_txn_truncate(int nr)
+{
+	while (nr_ofdt_ops > nr) {
+		nr_ofdt_ops--;
+		free(ofdt_ops[nr_ofdt_ops].cmd);
+		free(ofdt_ops[nr_ofdt_ops].undo);
+	}
+
+	if (nr_ofdt_ops == 0) {
+		free(ofdt_ops);
+		ofdt_ops = NULL;
+		ofdt_ops_sz = 0;
+	}
+}
+
+/**
+ * ofdt_txn_queue
+ * @brief Add a command to the journal of the open transaction
+ *
+ * A property update replaces any update of the same property queued
+ * since the last node op of the current transaction, only the final
+ * value has to reach the kernel.
+ *
+ * @param buf command to queue
+ * @param len length of the command
+ * @returns 0 on success, !0 otherwise
+ */
+static int
+ofdt_txn_queue(const char *buf, size_t len)
+{
+	struct ofdt_op *op;
+	int mark = ofdt_txn_marks[ofdt_txn_depth - 1];
+	int type = ofdt_op_type(buf);
+	int i;
+
+	if (nr_ofdt_ops == ofdt_ops_sz) {
+		struct ofdt_op *ops;
+		int sz = ofdt_ops_sz ? ofdt_ops_sz * 2 : 64;
+
+		ops = realloc(ofdt_ops, sz * sizeof(*ops));
+		if (ops == NULL) {
+			say(ERROR, "Could not allocate device tree journal\n");
+			return -1;
+		}
+
+		ofdt_ops = ops;
+		ofdt_ops_sz = sz;
+	}
+
+	op = &ofdt_ops[nr_ofdt_ops];
+	op->cmd = zalloc(len);
+	if (op->cmd == NULL)
+		return -1;
+
+	memcpy(op->cmd, buf, len);
+	op->len = len;
+	op->type = type;
+	op->undo = NULL;
+	op->undo_len = 0;
+
+	if (type == OFDT_OP_PROPERTY) {
+		const char *key;
+		size_t key_len;
+
+		key = ofdt_op_key(op, &key_len);
+
+		for (i = nr_ofdt_ops - 1; i >= mark; i--) {
+			if (ofdt_ops[i].type != OFDT_OP_PROPERTY)
+				break;
+
+			if (ofdt_op_key_cmp(&ofdt_ops[i], key, key_len))
+				continue;
+
+			say(DEBUG, "Merging update of property %.*s\n",
+			    (int)key_len, key);
+			free(ofdt_ops[i].cmd);
+			memmove(&ofdt_ops[i], &ofdt_ops[i + 1],
+				(nr_ofdt_ops - i) * sizeof(*op));
+			nr_ofdt_ops--;
+			break;
+		}
+	}
+
+	nr_ofdt_ops++;
+	return 0;
+}
+
+/**
+ * ofdt_write
+ * @brief Queue or write a command to the kernel's Open Firmware tree
+ *
+ * @param buf command to write
+ * @param len length of the command
+ * @returns 0 on success, !0 otherwise
+ */
+static int
+ofdt_write(const char *buf, size_t len)
+{
+	int rc;
+
+	pthread_mutex_lock(&ofdt_txn_lock);
+	if (ofdt_txn_depth)
+		rc = ofdt_txn_queue(buf, len);
+	else
+		rc = ofdt_apply(buf, len);
+	pthread_mutex_unlock(&ofdt_txn_lock);
+
+	return rc;
+}
+
+/**
+ * ofdt_node_snapshot
+ * @brief Build the add_node command re-creating a device tree node
+ *
+ * Only the node itself is saved, its children are removed by earlier
+ * ops in the journal which carry their own snapshots.
+ *
+ * @param op queued remove_node op to save the undo command for
+ * @returns 0 on success, !0 otherwise
+ */
+static int
+ofdt_node_snapshot(struct ofdt_op *op)
+{
+	char path[DR_PATH_MAX];
+	const char *key;
+	size_t key_len, len;
+	struct dirent *de;
+	struct stat sb;
+	char *value;
+	int length;
+	DIR *d;
+	int rc = 0;
+
+	key = ofdt_op_key(op, &key_len);
+	snprintf(path, DR_PATH_MAX, "%s%.*s", OFDT_BASE, (int)key_len, key);
+
+	d = opendir(path);
+	if (d == NULL)
+		return -1;
+
+	if (ofdt_buf_reserve(0, strlen("add_node ") + key_len)) {
+		closedir(d);
+		return -1;
+	}
+
+	len = sprintf(ofdt_buf, "add_node %.*s", (int)key_len, key);
+
+	while ((de = readdir(d)) != NULL && !rc) {
+		char prop_path[DR_PATH_MAX];
+
+		if (snprintf(prop_path, DR_PATH_MAX, "%s/%s", path,
+			     de->d_name) >= DR_PATH_MAX) {
+			say(ERROR, "Property path %s/%s is too long\n", path,
+			    de->d_name);
+			rc = -1;
+			break;
+		}
+
+		if (lstat(prop_path, &sb) || !S_ISREG(sb.st_mode))
+			continue;
+
+		value = NULL;
+		length = 0;
+		if (sb.st_size) {
+			length = get_property_alloc(prop_path, NULL, &value);
+			if (length < 0) {
+				rc = -1;
+				break;
+			}
+		}
+
+		rc = ofdt_buf_add_prop(&len, de->d_name, value, length);
+		free(value);
 	}
 
-	dr_unlock();
+	closedir(d);
+	if (rc)
+		return rc;
+
+	op->undo = zalloc(len + 1);
+	if (op->undo == NULL)
+		return -1;
+
+	memcpy(op->undo, ofdt_buf, len + 1);
+	op->undo_len = len + 1;
+	return 0;
 }
 
 /**
- * set_timeout
+ * ofdt_txn_begin
+ * @brief Start a device tree transaction
+ *
+ * Device tree updates are queued until the transaction is committed.
+ * Transactions nest, a nested transaction that is aborted drops only
+ * its own updates and one that is committed is written along with the
+ * outermost transaction.  Updates queued in a transaction are not
+ * visible in the device tree until then.
+ *
+ * Other threads starting a transaction wait until the outermost
+ * transaction of this thread is committed or aborted.
  *
+ * @returns 0 on success, !0 otherwise
  */
-void set_timeout(int timeout)
+int
+ofdt_txn_begin(void)
 {
-	if (!timeout) {
-		dr_timeout = -1;
-		return;
+	pthread_mutex_lock(&ofdt_txn_lock);
+
+	if (ofdt_txn_depth == OFDT_TXN_MAX_DEPTH) {
+		say(ERROR, "Too many nested device tree transactions\n");
+		pthread_mutex_unlock(&ofdt_txn_lock);
+		return -1;
 	}
 
-	dr_timeout = time((time_t *)0);
-	if (dr_timeout == -1)
+	ofdt_txn_marks[ofdt_txn_depth++] = nr_ofdt_ops;
+	return 0;
+}
+
+/**
+ * ofdt_txn_abort
+ * @brief Drop the updates queued in the current transaction
+ */
+void
+ofdt_txn_abort(void)
+{
+	if (ofdt_txn_depth == 0)
 		return;
 
-	dr_timeout += timeout;
+	ofdt_txn_truncate(ofdt_txn_marks[--ofdt_txn_depth]);
+	pthread_mutex_unlock(&ofdt_txn_lock);
 }
 
 /**
+ * ofdt_txn_write
+ * @brief Write the journal of the outermost transaction to the kernel
  *
+ * @param revert revert the node ops written so far if one fails,
+ *		 otherwise carry on with the next update
+ * @returns 0 on success, !0 if an update failed
  */
-int drmgr_timed_out(void)
+static int
+ofdt_txn_write(int revert)
 {
-	if (dr_timeout == -1)
-		return 0;	/* No timeout specified */
+	struct ofdt_op *op;
+	int i, rc = 0, failed = 0;
 
-	if (dr_timeout > time((time_t *)0))
-		return 0;
+	if (nr_ofdt_ops)
+		say(DEBUG, "Committing %d device tree updates\n", nr_ofdt_ops);
 
-	say(WARN, "Drmgr has exceeded its specified wait time and will not "
-	    "continue\n");
-	return 1;
+	for (i = 0; i < nr_ofdt_ops; i++) {
+		op = &ofdt_ops[i];
+
+		if (!revert) {
+			if (ofdt_apply(op->cmd, op->len)) {
+				say(DEBUG, "Skipping failed device tree update "
+				    "%.*s\n", (int)op->len, op->cmd);
+				failed++;
+			}
+			continue;
+		}
+
+		if (op->type == OFDT_OP_ADD_NODE) {
+			const char *key;
+			size_t key_len;
+
+			key = ofdt_op_key(op, &key_len);
+			op->undo = zalloc(key_len + 13);
+			if (op->undo)
+				op->undo_len = sprintf(op->undo,
+						       "remove_node %.*s",
+						       (int)key_len, key);
+		} else if (op->type == OFDT_OP_REMOVE_NODE) {
+			if (ofdt_node_snapshot(op))
+				say(DEBUG, "Could not save %.*s for rollback\n",
+				    (int)op->len, op->cmd);
+		}
+
+		rc = ofdt_apply(op->cmd, op->len);
+		if (rc)
+			break;
+	}
+
+	if (failed) {
+		say(ERROR, "%d of %d device tree updates failed\n", failed,
+		    nr_ofdt_ops);
+		rc = -1;
+	} else if (rc) {
+		say(ERROR, "Device tree update failed, reverting %d updates\n",
+		    i);
+
+		while (--i >= 0) {
+			op = &ofdt_ops[i];
+			if (op->undo)
+				ofdt_apply(op->undo, op->undo_len);
+		}
+	}
+
+	ofdt_txn_truncate(0);
+	return rc;
 }
 
 /**
- * dr_lock
- * @brief Attempt to lock a token
+ * ofdt_txn_commit
+ * @brief Commit the current device tree transaction
  *
- * This will attempt to lock a token (either file or directory) and wait
- * a specified amount of time if the lock cannot be granted.
+ * For the outermost transaction the queued updates are written to the
+ * kernel in order.  If one fails, the node adds and removes already
+ * written are reverted in reverse order.  Property updates can not be
+ * reverted, they carry values that firmware has already applied.
  *
- * @returns lock id if successful, -1 otherwise
+ * @returns 0 on success, !0 otherwise
  */
-int dr_lock(void)
+int
+ofdt_txn_commit(void)
 {
-	struct flock    dr_lock_info;
-	int             rc;
-	mode_t          old_mode;
+	int rc;
 
-	old_mode = umask(0);
-	dr_lock_fd = open(DR_LOCK_FILE, O_RDWR | O_CREAT,
-			  S_IRUSR | S_IRGRP | S_IROTH);
-	if (dr_lock_fd < 0)
-		return -1;
+	if (ofdt_txn_depth == 0)
+		return 0;
 
-	umask(old_mode);
-	dr_lock_info.l_type = F_WRLCK;
-	dr_lock_info.l_whence = SEEK_SET;
-	dr_lock_info.l_start = 0;
-	dr_lock_info.l_len = 0;
+	if (--ofdt_txn_depth) {
+		pthread_mutex_unlock(&ofdt_txn_lock);
+		return 0;
+	}
 
-	do {
-		rc = fcntl(dr_lock_fd, F_SETLK, &dr_lock_info);
-		if (rc == 0)
-			return 0;
+	rc = ofdt_txn_write(1);
+	pthread_mutex_unlock(&ofdt_txn_lock);
+	return rc;
+}
 
-		/* lock may be held by another process */
-		if (errno != EACCES && errno != EAGAIN)
-			break;
+/**
+ * ofdt_txn_commit_all
+ * @brief Commit the current device tree transaction without rollback
+ *
+ * As ofdt_txn_commit(), but for updates that firmware has already
+ * made to the platform.  A failed update is logged and the remaining
+ * ones are still written, nothing is reverted.
+ *
+ * @returns 0 on success, !0 if an update failed
+ */
+int
+ofdt_txn_commit_all(void)
+{
+	int rc;
 
-		if (drmgr_timed_out())
-			break;
+	if (ofdt_txn_depth == 0)
+		return 0;
 
-		sleep(1);
-	} while (1);
+	if (--ofdt_txn_depth) {
+		pthread_mutex_unlock(&ofdt_txn_lock);
+		return 0;
+	}
 
-	close(dr_lock_fd);
-	dr_lock_fd = 0;
-	perror(DR_LOCK_FILE);
-	return -1;
+	rc = ofdt_txn_write(0);
+	pthread_mutex_unlock(&ofdt_txn_lock);
+	return rc;
 }
 
 /**
- * dr_unlock
- * @brief unlock a lock granted via dr_lock()
+ * ofdt_close
+ * @brief Close the kernel's Open Firmware tree interface
  *
- * @param lock_id
- * @returns 0 on success, -1 otherwise
+ * For the end of a DLPAR operation, this also frees the command buffer.
  */
-int
-dr_unlock(void)
+void
+ofdt_close(void)
 {
-	struct flock	dr_lock_info;
+	/* updates of transactions left open are dropped */
+	while (ofdt_txn_depth)
+		ofdt_txn_abort();
+	ofdt_txn_truncate(0);
 
-	dr_lock_info.l_whence = SEEK_SET;
-	dr_lock_info.l_start = 0;
-	dr_lock_info.l_len = 0;
-	dr_lock_info.l_type = F_UNLCK;
-	if (fcntl(dr_lock_fd, F_SETLK, &dr_lock_info) < 0)
-		return -1;
+	if (ofdt_fd >= 0)
+		close(ofdt_fd);
 
-	close(dr_lock_fd);
-	dr_lock_fd = 0;
-	return 0;
+	ofdt_fd = -1;
 
+	free(ofdt_buf);
+	ofdt_buf = NULL;
+	ofdt_buf_sz = 0;
 }
 
 /**
@@ -383,21 +1231,20 @@ dr_unlock(void)
 static int
 add_node(char *path, struct of_node *new_nodes)
 {
-	int rc = 0;
-	int nprops = 0;
-	int fd;
 	struct of_property *prop;
-	char *buf, *pos;
 	char *add_path;
-	size_t bufsize = 0;
+	size_t len;
 	struct stat sbuf;
+	int last = ofdt_txn_last(path);
 
 	/* If the device node already exists, no work to be done.  This is
 	 * usually the case for adding a dedicated cpu that shares a
 	 * l2-cache with another apu and that cache already exists in the
-	 * device tree.
+	 * device tree.  Within a transaction the node may also be queued
+	 * for addition or removal already.
 	 */
-	if (!stat(path, &sbuf)) {
+	if (last == OFDT_OP_ADD_NODE ||
+	    (!stat(path, &sbuf) && last != OFDT_OP_REMOVE_NODE)) {
 		say(DEBUG, "Device-tree node %s already exists, skipping\n",
 		    path);
 		return 0;
@@ -405,83 +1252,35 @@ add_node(char *path, struct of_node *new_nodes)
 
 	say(DEBUG, "Adding device-tree node %s\n", path);
 
+	if (new_nodes->properties == NULL) {
+		say(ERROR, "new_nodes have no properties\n");
+		return -1;
+	}
+
 	/* The path passed in is a full ofdt path, remove the preceeding
 	 * /proc/device-tree for the write to the kernel.
 	 */
 	add_path = path + strlen(OFDT_BASE);
 
-	/* determine the total size of the buffer we need to allocate */
-	bufsize += strlen("add_node ");
-	bufsize += strlen(add_path) + 1;
-	for (prop = new_nodes->properties; prop; prop = prop->next) {
-		char tmp[16] = { '\0' }; /* for length */
-
-		nprops++;
-		bufsize += strlen(prop->name) + 1; /* name + space */
-		sprintf(tmp, "%d", prop->length);
-
-		bufsize += strlen(tmp) + 1;	/* length + space*/
-		bufsize += prop->length + 1;	/* value + space */
-	}
-
-	if (! nprops) {
-		say(ERROR, "new_nodes have no properties\n");
+	if (ofdt_buf_reserve(0, strlen("add_node ") + strlen(add_path)))
 		return -1;
-	}
 
-	buf = zalloc(bufsize);
-	if (buf == NULL) {
-		say(ERROR, "Failed to allocate buffer to write to kernel\n");
-		return errno;
-	}
-
-	strcpy(buf, "add_node ");
-	strcat(buf, add_path);
-	pos = buf + strlen(buf);
+	len = sprintf(ofdt_buf, "add_node %s", add_path);
 
-	/* this is less than optimal, iterating over the entire buffer
-	 * for every strcat...
+	/* The command is built in a single pass, as
+	 * "add_node path name length value name length value..."
 	 */
 	for (prop = new_nodes->properties; prop; prop = prop->next) {
-		char tmp[16] = { '\0' }; /* for length */
-
-		*pos++ = ' ';
-
-		memcpy(pos, prop->name, strlen(prop->name));
-		pos += strlen(prop->name);
-		*pos++ = ' ';
-
-		sprintf(tmp, "%d", prop->length);
-		memcpy(pos, tmp, strlen(tmp));
-		pos += strlen(tmp);
-		*pos++ = ' ';
-
-		memcpy(pos, prop->value, prop->length);
-		pos += prop->length;
+		if (ofdt_buf_add_prop(&len, prop->name, prop->value,
+				      prop->length))
+			return -1;
 	}
-	*pos = '\0';
 
 	/* dump the buffer for debugging */
-	say(DEBUG, "ofdt update: %s\n", buf);
-
-	fd = open(OFDTPATH, O_WRONLY);
-	if (fd == -1) {
-		say(ERROR, "Failed to open %s: %s\n", OFDTPATH,
-		    strerror(errno));
-		free(buf);
-		return -1;
-	}
-
-	rc = write(fd, buf, bufsize);
-	if (rc <= 0)
-		say(ERROR, "Write to %s failed: %s\n", OFDTPATH,
-		    strerror(errno));
-	else
-		rc = 0;
+	say(DEBUG, "ofdt update: %s\n", ofdt_buf);
 
-	free(buf);
-	close(fd);
-	return rc;
+	/* The terminating nul has always been part of the command */
+	return ofdt_write(ofdt_buf, len + 1);
 }
 
 /**
@@ -497,11 +1296,15 @@ add_node(char *path, struct of_node *new_nodes)
 static int
 remove_node(const char *path)
 {
-	int rc = 0;
-	int fd;
 	int cmdlen;
 	char buf[DR_PATH_MAX];
 
+	if (ofdt_txn_last(path) == OFDT_OP_REMOVE_NODE) {
+		say(DEBUG, "Device-tree node %s already removed, skipping\n",
+		    path);
+		return 0;
+	}
+
 	say(DEBUG, "Removing device-tree node %s\n", path);
 
 	memset(buf, 0, DR_PATH_MAX);
@@ -513,22 +1316,7 @@ remove_node(const char *path)
 
 	cmdlen = strlen(buf);
 
-	fd = open(OFDTPATH, O_WRONLY);
-	if (fd == -1) {
-		say(ERROR, "Failed to open %s: %s\n", OFDTPATH,
-		    strerror(errno));
-		return -1;
-	}
-
-	rc = write(fd, buf, cmdlen);
-	if (rc != cmdlen)
-		say(ERROR, "Write to %s failed: %s\n", OFDTPATH,
-		    strerror(errno));
-	else
-		rc = 0;
-
-	close(fd);
-	return rc;
+	return ofdt_write(buf, cmdlen);
 }
 
 /**
@@ -570,22 +1358,22 @@ _add_device_tree_nodes(char *path, struct of_node *new_nodes)
 int
 add_device_tree_nodes(char *path, struct of_node *new_nodes)
 {
-	struct of_node *node;
-	char rm_path[DR_PATH_MAX];
 	int rc;
 
+	/* The nodes are added in one transaction, so that they are all
+	 * removed again if one of them can not be added.
+	 */
+	rc = ofdt_txn_begin();
+	if (rc)
+		return rc;
+
 	rc = _add_device_tree_nodes(path, new_nodes);
 	if (rc) {
-		for (node = new_nodes; node; node = node->sibling) {
-			if (!node->added)
-				continue;
-			
-			sprintf(rm_path, "%s/%s", path, node->name);
-			remove_node(rm_path);
-		}
+		ofdt_txn_abort();
+		return rc;
 	}
 
-	return rc;
+	return ofdt_txn_commit();
 }
 
 /**
@@ -597,13 +1385,12 @@ add_device_tree_nodes(char *path, struct of_node *new_nodes)
  * @param root_path
  * @returns 0 on success, !0 otherwise
  */
-int
-remove_device_tree_nodes(const char *path)
+static int
+_remove_device_tree_nodes(const char *path)
 {
         DIR *d;
         struct dirent *de;
         struct stat sb;
-	int found = 1;
 	int rc;
 
 	rc = lstat(path, &sb);
@@ -616,30 +1403,20 @@ remove_device_tree_nodes(const char *path)
 		return -1;
 	}
 
-	while (found) {
+	/* Remove any subdirectories.  The removals are queued in the
+	 * journal, so the directory does not change while it is read.
+	 */
+	while ((de = readdir(d)) != NULL) {
 		char subdir_name[DR_PATH_MAX];
 
-		found = 0;
-
-		/* Remove any subdirectories */
-		while ((de = readdir(d)) != NULL) {
-			if (is_dot_dir(de->d_name))
-				continue;
-
-			sprintf(subdir_name, "%s/%s", path, de->d_name);
-			rc = lstat(subdir_name, &sb);
-			if (!rc && (S_ISDIR(sb.st_mode))
-			    && (!S_ISLNK(sb.st_mode))) {
-				found = 1;
-				break;
-			}
-		}
+		if (is_dot_dir(de->d_name))
+			continue;
 
-		if (found) {
-			rc = remove_device_tree_nodes(subdir_name);
-			rewinddir(d);
-		}
+		sprintf(subdir_name, "%s/%s", path, de->d_name);
+		if (lstat(subdir_name, &sb) || !S_ISDIR(sb.st_mode))
+			continue;
 
+		rc = _remove_device_tree_nodes(subdir_name);
 		if (rc)
 			break;
 	}
@@ -652,6 +1429,24 @@ remove_device_tree_nodes(const char *path)
         return rc;
 }
 
+int
+remove_device_tree_nodes(const char *path)
+{
+	int rc;
+
+	rc = ofdt_txn_begin();
+	if (rc)
+		return rc;
+
+	rc = _remove_device_tree_nodes(path);
+	if (rc) {
+		ofdt_txn_abort();
+		return rc;
+	}
+
+	return ofdt_txn_commit();
+}
+
 /**
  * update_property
  *
@@ -660,26 +1455,9 @@ remove_device_tree_nodes(const char *path)
 int
 update_property(const char *buf, size_t len)
 {
-	int fd, rc;
-
 	say(DEBUG, "Updating OF property\n");
 
-	fd = open(OFDTPATH, O_WRONLY);
-	if (fd == -1) {
-		say(ERROR, "Failed to open %s: %s\n", OFDTPATH,
-		    strerror(errno));
-		return -1;
-	}
-
-	rc = write(fd, buf, len);
-	if ((size_t)rc != len)
-		say(ERROR, "Write to %s failed: %s\n", OFDTPATH,
-		    strerror(errno));
-	else
-		rc = 0;
-
-	close(fd);
-	return rc;
+	return ofdt_write(buf, len);
 }
 
 /**
@@ -718,7 +1496,7 @@ get_att_prop(const char *path, const char *name, char *buf, size_t buf_sz,
 	/* Yes, this is sort of a hack but we only read properties from
 	 * either /proc or sysfs so it works and is cheaper than a strcmp()
 	 */
-	switch (dir[1]) {
+	switch (dir[strlen(DR_ROOT) + 1]) {
 	    case 'p':	/* /proc */
 		rc = stat(dir, &sbuf);
 		if (rc)
@@ -843,6 +1621,71 @@ get_property_size(const char *path, const char *property)
 	return sb.st_size;
 }
 
+/**
+ * get_property_alloc
+ * @brief retrieve a property into a newly allocated buffer
+ *
+ * The property file is opened once and read into a buffer sized from
+ * fstat(), instead of separately stat'ing, opening and reading it.  The
+ * caller is responsible for freeing the buffer.
+ *
+ * @param path path to the property to retrieve
+ * @param name name of the property to retrieve
+ * @param buf pointer to the allocated buffer on success
+ * @returns size of the property on success, -1 otherwise
+ */
+int
+get_property_alloc(const char *path, const char *property, char **buf)
+{
+	char dir[DR_PATH_MAX];
+	struct stat sb;
+	ssize_t len, sz = 0;
+	char *data;
+	int fd;
+
+	if (property != NULL)
+		snprintf(dir, DR_PATH_MAX, "%s/%s", path, property);
+	else
+		snprintf(dir, DR_PATH_MAX, "%s", path);
+
+	fd = open(dir, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &sb) || sb.st_size <= 0) {
+		close(fd);
+		return -1;
+	}
+
+	data = zalloc(sb.st_size);
+	if (data == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	while (sz < sb.st_size) {
+		len = read(fd, data + sz, sb.st_size - sz);
+		if (len < 0 && errno == EINTR)
+			continue;
+
+		if (len <= 0)
+			break;
+
+		sz += len;
+	}
+
+	close(fd);
+
+	if (sz != sb.st_size) {
+		say(DEBUG, "Could not read %s: %s\n", dir, strerror(errno));
+		free(data);
+		return -1;
+	}
+
+	*buf = data;
+	return sz;
+}
+
 /**
  * sighandler
  * @brief Simple signal handler to print signal/stack info, cleanup and exit.
@@ -1237,7 +2080,7 @@ cpu_dlpar_capable(void)
         struct dirent *de;
         struct stat sbuf;
 	char fname[DR_PATH_MAX];
-	char *cpu_dir = "/sys/devices/system/cpu";
+	char *cpu_dir = DR_ROOT "/sys/devices/system/cpu";
 	int capable = 1;
 
 	say(ERROR, "Validating CPU DLPAR capability...");
@@ -1298,7 +2141,7 @@ int
 mem_dlpar_capable(void)
 {
 	return dlpar_capable("Memory DLPAR",
-			     "/sys/devices/system/memory/block_size_bytes");
+			     DR_ROOT "/sys/devices/system/memory/block_size_bytes");
 }
 
 int
@@ -1317,13 +2160,14 @@ int
 pmig_capable(void)
 {
 	return dlpar_capable("partition migration",
-			     "/proc/device-tree/ibm,migratable-partition");
+			     DR_ROOT "/proc/device-tree/ibm,migratable-partition");
 }
 
 int
 phib_capable(void)
 {
-	return dlpar_capable("partition hibernation", "/sys/devices/system/power/hibernate");
+	return dlpar_capable("partition hibernation",
+			     DR_ROOT "/sys/devices/system/power/hibernate");
 }
 
 int
@@ -1410,8 +2254,8 @@ print_dlpar_capabilities(void)
 int ams_balloon_active(void)
 {
 	/* CMM's loaned_kb file only appears when AMS is enabled */
-	char *ams_enabled = "/sys/devices/system/cmm/cmm0/loaned_kb";
-	char *cmm_param_path = "/sys/module/cmm/parameters";
+	char *ams_enabled = DR_ROOT "/sys/devices/system/cmm/cmm0/loaned_kb";
+	char *cmm_param_path = DR_ROOT "/sys/module/cmm/parameters";
 	struct stat sbuf;
 	static int is_inactive = 1;
 	static int ams_checked = 0;
@@ -1477,6 +2321,7 @@ int kernel_dlpar_exists(void)
  */
 int do_kernel_dlpar(const char *cmd, int cmdlen)
 {
+	struct trace_span span;
 	int fd, rc;
 	int my_errno;
 
@@ -1490,9 +2335,11 @@ int do_kernel_dlpar(const char *cmd, int cmdlen)
 		return -1;
 	}
 
+	trace_begin(&span, TRACE_SYSFS, "kernel-dlpar");
 	rc = write(fd, cmd, cmdlen);
 	my_errno = errno;
 	close(fd);
+	trace_end(&span);
 	if (rc <= 0) {
 		/* write does not set errno for rc == 0 */
 		say(ERROR, "Failed to write to %s: %s\n", SYSFS_DLPAR_FILE,
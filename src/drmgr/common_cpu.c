@@ -33,66 +33,138 @@
 #include "ofdt.h"
 
 /* format strings for easy access */
-#define DR_THREAD_DIR_PATH "/sys/devices/system/cpu/cpu%d"
-#define DR_THREAD_ONLINE_PATH "/sys/devices/system/cpu/cpu%d/online"
-#define DR_THREAD_PHYSID_PATH "/sys/devices/system/cpu/cpu%d/physical_id"
+#define DR_THREAD_DIR_PATH DR_ROOT "/sys/devices/system/cpu/cpu%d"
+#define DR_THREAD_ONLINE_PATH DR_ROOT "/sys/devices/system/cpu/cpu%d/online"
+#define DR_THREAD_PHYSID_PATH DR_ROOT "/sys/devices/system/cpu/cpu%d/physical_id"
 
 #define DR_CPU_INTSERVERS_PATH \
-        "/proc/device-tree/cpus/%s/ibm,ppc-interrupt-server#s"
+        DR_ROOT "/proc/device-tree/cpus/%s/ibm,ppc-interrupt-server#s"
+
+static int cpu_index_cmp(const void *a, const void *b)
+{
+	const struct cpu_index *ia = a;
+	const struct cpu_index *ib = b;
+
+	if (ia->key != ib->key)
+		return ia->key < ib->key ? -1 : 1;
+
+	/* threads sharing a physical id stay in logical id order */
+	if (ia->thread && ib->thread)
+		return ia->thread->id - ib->thread->id;
+
+	return 0;
+}
 
 /**
- * free_thread_info
- * @brief free the thread list and any associated allocated memory
+ * cpu_index_find
+ * @brief Find the first entry of a sorted lookup table with a key
  *
- * @param thread_list list of threads to free
+ * @param table lookup table to search
+ * @param nr number of entries in the table
+ * @param key key to find
+ * @returns index of the first entry with the key, nr if there is none
  */
-static inline void
-free_thread_info(struct thread *thread_list)
+static int cpu_index_find(struct cpu_index *table, int nr, uint32_t key)
 {
-	struct thread *thread;
+	int lo = 0, hi = nr;
 
-	while (thread_list) {
-		thread = thread_list;
-		thread_list = thread->next;
-		free(thread);
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (table[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+
+	if (lo < nr && table[lo].key == key)
+		return lo;
+
+	return nr;
+}
+
+/**
+ * cpu_by_drc_index
+ * @brief Find the cpu with the specified drc index
+ *
+ * @param dr_info cpu drc information
+ * @param drc_index drc index to find
+ * @returns pointer to cpu, NULL if not found
+ */
+struct dr_node *
+cpu_by_drc_index(struct dr_info *dr_info, uint32_t drc_index)
+{
+	int i;
+
+	i = cpu_index_find(dr_info->drc_indexes, dr_info->nr_drc_indexes,
+			   drc_index);
+	if (i == dr_info->nr_drc_indexes)
+		return NULL;
+
+	return dr_info->drc_indexes[i].cpu;
+}
+
+/**
+ * thread_by_id
+ * @brief Find the thread with the specified logical id
+ *
+ * @param dr_info cpu drc information
+ * @param id linux logical cpu id
+ * @returns pointer to thread, NULL if not found
+ */
+struct thread *
+thread_by_id(struct dr_info *dr_info, int id)
+{
+	if (id < 0 || id >= dr_info->nr_threads)
+		return NULL;
+
+	return dr_info->threads[id];
 }
 
 /**
  * get_cpu_threads
- * Associate a thread to the cpu it belongs to.
+ * Associate the threads of a cpu to the cpu.
  *
- * @param all_cpus list of all cpus
- * @param thread thread to associate.
+ * The threads are looked up by the physical ids in the cpu's
+ * ibm,ppc-interrupt-server#s property.
+ *
+ * @param cpu cpu to find the threads of
+ * @param dr_info cpu drc information
  */
 static void
-get_cpu_threads(struct dr_node *cpu, struct thread *all_threads)
+get_cpu_threads(struct dr_node *cpu, struct dr_info *dr_info)
 {
-	struct thread *thread;
-	struct thread *last = NULL;
-	int i;
+	struct cpu_index *phys_ids = dr_info->phys_ids;
+	int nr = dr_info->nr_phys_ids;
+	struct thread *thread, **pos;
+	int i, j;
 
-	for (thread = all_threads; thread; thread = thread->next) {
-		for (i = 0; i < cpu->cpu_nthreads; i++) {
-			if (cpu->cpu_intserv_nums[i] != thread->phys_id)
-				continue;
+	cpu->cpu_threads = NULL;
+
+	for (i = 0; i < cpu->cpu_nthreads; i++) {
+		j = cpu_index_find(phys_ids, nr, cpu->cpu_intserv_nums[i]);
+		for (; j < nr && phys_ids[j].key == cpu->cpu_intserv_nums[i];
+		     j++) {
+			thread = phys_ids[j].thread;
 
 			/* Special case for older kernels where the default
 			 * physical id of a thread was 0, which is also a
 			 * valid physical id.
 			 */
-			if (thread->phys_id == 0) {
-				char *cpuid = strrchr(thread->path, 'c');
-				if (cpuid[3] != '0')
-					continue;
-			}
+			if (thread->phys_id == 0 && thread->id != 0)
+				continue;
+
+			/* Keep the siblings in logical id order */
+			for (pos = &cpu->cpu_threads;
+			     *pos && (*pos)->id < thread->id;
+			     pos = &(*pos)->sibling)
+				;
 
-			if (last)
-				last->sibling = thread;
-			else
-				cpu->cpu_threads = thread;
+			if (*pos == thread)
+				continue;
 
-			last = thread;
+			thread->sibling = *pos;
+			*pos = thread;
 			thread->cpu = cpu;
 		}
 	}
@@ -102,36 +174,64 @@ get_cpu_threads(struct dr_node *cpu, struct thread *all_threads)
  * init_thread_info
  * @brief Initialize thread data
  *
- * Initialize global thread or "logical cpu" data. The physical cpu data
- * initialization must have been completed before this is called.
+ * Initialize global thread or "logical cpu" data, along with the
+ * tables to look threads up by logical and physical id.
  *
- * @returns pointer to thread_info on success, NULL otherwise
+ * @returns 0 on success, !0 otherwise
  */
 static int
 init_thread_info(struct dr_info *dr_info)
 {
-	struct thread *thread = NULL;
-	struct thread *thread_list = NULL;
+	struct thread *thread, **threads;
 	struct thread *last = NULL;
-	int rc, i = 0;
-	struct stat s;
+	struct dirent *de;
+	DIR *d;
 	char path[DR_PATH_MAX];
-	int nr_threads, thread_cnt = 0;
+	char *end;
+	int rc, id, thread_cnt = 0;
 
-	if (stat("/sys/devices/system/cpu", &s)) {
+	d = opendir(DR_ROOT "/sys/devices/system/cpu");
+	if (d == NULL) {
 		say(ERROR, "Cannot gather CPU thread information,\n"
-		    "stat(\"/sys/devices/system/cpu\"): %s\n",
+		    "opendir(\"/sys/devices/system/cpu\"): %s\n",
 		    strerror(errno));
 		return -1;
 	}
 
-	nr_threads = s.st_nlink - 2;
+	while ((de = readdir(d)) != NULL) {
+		if (strncmp(de->d_name, "cpu", 3) ||
+		    de->d_name[3] < '0' || de->d_name[3] > '9')
+			continue;
+
+		id = strtol(de->d_name + 3, &end, 10);
+		if (*end != '\0')
+			continue;
+
+		if (id >= dr_info->nr_threads) {
+			int nr = id + 256;
+
+			threads = realloc(dr_info->threads,
+					  nr * sizeof(*threads));
+			if (threads == NULL) {
+				say(ERROR, "Could not allocate thread table\n");
+				closedir(d);
+				return -1;
+			}
+
+			memset(&threads[dr_info->nr_threads], 0,
+			       (nr - dr_info->nr_threads) * sizeof(*threads));
+			dr_info->threads = threads;
+			dr_info->nr_threads = nr;
+		}
 
-	sprintf(path, DR_THREAD_DIR_PATH, i);
-	for (i = 0; 0 == stat(path, &s); i++) {
 		thread = zalloc(sizeof(*thread));
+		if (thread == NULL) {
+			closedir(d);
+			return -1;
+		}
 
-		thread->id = i;
+		thread->id = id;
+		sprintf(path, DR_THREAD_DIR_PATH, id);
 		snprintf(thread->path, DR_PATH_MAX, "%s", path);
 
 		rc = get_int_attribute(thread->path, "physical_id",
@@ -141,23 +241,131 @@ init_thread_info(struct dr_info *dr_info)
 			say(ERROR, "Could not get \"physical_id\" of thread "
 			    "%s\n", thread->path);
 			free(thread);
+			closedir(d);
 			return -1;
 		}
 
-		if (thread_list)
+		dr_info->threads[id] = thread;
+		thread_cnt++;
+	}
+
+	closedir(d);
+
+	dr_info->phys_ids = zalloc((thread_cnt ? thread_cnt : 1) *
+				   sizeof(*dr_info->phys_ids));
+	if (dr_info->phys_ids == NULL)
+		return -1;
+
+	/* The thread list is kept in logical id order */
+	for (id = 0; id < dr_info->nr_threads; id++) {
+		thread = dr_info->threads[id];
+		if (thread == NULL)
+			continue;
+
+		if (last)
 			last->next = thread;
 		else
-			thread_list = thread;
+			dr_info->all_threads = thread;
 
 		last = thread;
 
-		sprintf(path, DR_THREAD_DIR_PATH, i + 1);
-		thread_cnt++;
+		dr_info->phys_ids[dr_info->nr_phys_ids].key = thread->phys_id;
+		dr_info->phys_ids[dr_info->nr_phys_ids].thread = thread;
+		dr_info->nr_phys_ids++;
+	}
+
+	qsort(dr_info->phys_ids, dr_info->nr_phys_ids,
+	      sizeof(*dr_info->phys_ids), cpu_index_cmp);
+
+	say(EXTRA_DEBUG, "Found %d threads.\n", thread_cnt);
+	return 0;
+}
+
+/**
+ * free_cache_info
+ * @brief free the cache list and any associated allocated memory
+ *
+ * @param cache_list list of cache structs to free
+ */
+void
+free_cache_info(struct cache_info *cache_list)
+{
+	struct cache_info *tmp = cache_list;
+
+	while (tmp != NULL) {
+		cache_list = cache_list->next;
+		free((char *)tmp->path);
+		free(tmp);
+		tmp = cache_list;
+	}
+}
+
+/**
+ * is_cpus_subdir
+ * @brief Is a directory entry of CPU_OFDT_BASE a device tree node
+ *
+ * @param de directory entry
+ * @returns 1 if the entry is a directory, 0 otherwise
+ */
+static int
+is_cpus_subdir(struct dirent *de)
+{
+	char path[DR_PATH_MAX];
+	struct stat sb;
+
+	if (de->d_type != DT_UNKNOWN)
+		return de->d_type == DT_DIR;
+
+	snprintf(path, DR_PATH_MAX, "%s/%s", CPU_OFDT_BASE, de->d_name);
+	if (lstat(path, &sb))
+		return 0;
+
+	return S_ISDIR(sb.st_mode);
+}
+
+/**
+ * add_cache_node
+ * @brief Add a cache device tree node to a cache list
+ *
+ * @param cache_list list to add the cache to
+ * @param name name of the cache node under CPU_OFDT_BASE
+ * @returns 0 on success, !0 otherwise
+ */
+static int
+add_cache_node(struct cache_info **cache_list, const char *name)
+{
+	struct cache_info *cache;
+	char path[DR_PATH_MAX];
+	int rc;
+
+	cache = zalloc(sizeof(*cache));
+	if (cache == NULL) {
+		say(ERROR, "Could not allocate cache info.\n%s\n",
+		    strerror(errno));
+		return -1;
+	}
+
+	snprintf(path, DR_PATH_MAX, "%s/%s", CPU_OFDT_BASE, name);
+	snprintf(cache->name, DR_BUF_SZ, "%s", name);
+	cache->path = strdup(path);
+
+	cache->removed = 0;
+	cache->next = *cache_list;
+	*cache_list = cache;
+
+	rc = get_ofdt_uint_property(cache->path, "ibm,phandle",
+				    &cache->phandle);
+	if (rc) {
+		say(ERROR, "Could not retreive ibm,phandle property for %s\n",
+		    cache->path);
+		return -1;
 	}
 
-	say(EXTRA_DEBUG, "Expecting %d threads...found %d.\n", nr_threads,
-	    thread_cnt);
-	dr_info->all_threads = thread_list;
+	/* l3-caches do not have a l2-cache property */
+	cache->l2cache = 0xffffffff;
+	get_ofdt_uint_property(cache->path, "l2-cache", &cache->l2cache);
+
+	say(EXTRA_DEBUG, "Found cache %s\n", cache->name);
 	return 0;
 }
 
@@ -253,7 +461,7 @@ update_cpu_node(struct dr_node *cpu, const char *path, struct dr_info *dr_info)
 	 * cpu's ibm,ppc-interrupt-server#s property.
 	 */
 	sprintf(intserv_path,
-		"/proc/device-tree/cpus/%s/ibm,ppc-interrupt-server#s",
+		DR_ROOT "/proc/device-tree/cpus/%s/ibm,ppc-interrupt-server#s",
 		strstr(cpu->name, "PowerPC"));
 
 	if (stat(intserv_path, &sb))
@@ -273,7 +481,7 @@ update_cpu_node(struct dr_node *cpu, const char *path, struct dr_info *dr_info)
 	cpu->cpu_l2cache = 0xffffffff;
 	get_ofdt_uint_property(cpu->ofdt_path, "l2-cache", &cpu->cpu_l2cache);
 
-	get_cpu_threads(cpu, dr_info->all_threads);
+	get_cpu_threads(cpu, dr_info);
 	cpu->is_owned = 1;
 	return 0;
 }
@@ -289,8 +497,10 @@ init_cpu_info(struct dr_info *dr_info)
 {
 	struct dr_connector *drc_list, *drc;
 	struct dr_node *cpu, *cpu_list = NULL;
+	struct cache_info *cache_list = NULL;
 	DIR *d;
 	struct dirent *de;
+	int nr_drcs = 0;
 	int rc = 0;
 
 	drc_list = get_drc_info(CPU_OFDT_BASE);
@@ -311,8 +521,26 @@ init_cpu_info(struct dr_info *dr_info)
 
 		cpu->next = cpu_list;
 		cpu_list = cpu;
+		nr_drcs++;
+	}
+
+	dr_info->drc_indexes = zalloc((nr_drcs ? nr_drcs : 1) *
+				      sizeof(*dr_info->drc_indexes));
+	if (dr_info->drc_indexes == NULL) {
+		free_node(cpu_list);
+		return -1;
+	}
+
+	for (cpu = cpu_list; cpu; cpu = cpu->next) {
+		dr_info->drc_indexes[dr_info->nr_drc_indexes].key =
+							cpu->drc_index;
+		dr_info->drc_indexes[dr_info->nr_drc_indexes].cpu = cpu;
+		dr_info->nr_drc_indexes++;
 	}
 
+	qsort(dr_info->drc_indexes, dr_info->nr_drc_indexes,
+	      sizeof(*dr_info->drc_indexes), cpu_index_cmp);
+
 	d = opendir(CPU_OFDT_BASE);
 	if (d == NULL) {
 		say(ERROR, "Could not open %s: %s\n", CPU_OFDT_BASE,
@@ -321,13 +549,20 @@ init_cpu_info(struct dr_info *dr_info)
 		return -1;
 	}
 
+	/* The cpu and cache nodes are found in the same pass over the
+	 * device tree.
+	 */
 	while ((de = readdir(d)) != NULL) {
 		char path[DR_PATH_MAX];
 
-		if ((de->d_type != DT_DIR) || is_dot_dir(de->d_name))
+		if (!is_cpus_subdir(de) || is_dot_dir(de->d_name))
 			continue;
 
-		if (! strncmp(de->d_name, "PowerPC", 7)) {
+		if (strstr(de->d_name, "-cache@")) {
+			rc = add_cache_node(&cache_list, de->d_name);
+			if (rc)
+				break;
+		} else if (! strncmp(de->d_name, "PowerPC", 7)) {
 			uint32_t my_drc_index;
 
 			memset(path, 0, 1024);
@@ -340,11 +575,7 @@ init_cpu_info(struct dr_info *dr_info)
 				break;
 			}
 
-			for (cpu = cpu_list; cpu; cpu = cpu->next) {
-				if (cpu->drc_index == my_drc_index)
-					break;
-			}
-
+			cpu = cpu_by_drc_index(dr_info, my_drc_index);
 			if (cpu == NULL) {
 				say(ERROR, "Could not find cpu with drc index "
 				    "%x\n", my_drc_index);
@@ -362,10 +593,16 @@ init_cpu_info(struct dr_info *dr_info)
 
 	closedir(d);
 
-	if (rc)
+	if (rc) {
 		free_node(cpu_list);
-	else
+		free_cache_info(cache_list);
+		free(dr_info->drc_indexes);
+		dr_info->drc_indexes = NULL;
+		dr_info->nr_drc_indexes = 0;
+	} else {
 		dr_info->all_cpus = cpu_list;
+		dr_info->all_caches = cache_list;
+	}
 
 	return rc;
 }
@@ -488,29 +725,10 @@ cache_get_use_count(struct cache_info *cache, struct dr_info *dr_info)
 	return count;
 }
 
-/**
- * free_cache_info
- * @brief free the cache list and any associated allocated memory
- *
- * @param cache_list list of cache structs to free
- */
-void
-free_cache_info(struct cache_info *cache_list)
-{
-	struct cache_info *tmp = cache_list;
-
-	while (tmp != NULL) {
-		cache_list = cache_list->next;
-		free((char *)tmp->path);
-		free(tmp);
-		tmp = cache_list;
-	}
-}
-
 /**
  * init_cache_info
  *
- * @returns pointer to cache_info on success, NULL otherwise
+ * @returns 0 on success, !0 otherwise
  */
 static int
 init_cache_info(struct dr_info *dr_info)
@@ -518,7 +736,6 @@ init_cache_info(struct dr_info *dr_info)
 	struct cache_info *cache_list = NULL;
 	DIR *d;
 	struct dirent *ent;
-	int rc;
 
 	d = opendir(CPU_OFDT_BASE);
 	if (d == NULL) {
@@ -528,53 +745,13 @@ init_cache_info(struct dr_info *dr_info)
 	}
 
 	while ((ent = readdir(d))) {
-		char path[DR_PATH_MAX];
-		struct stat sb;
-
-		/* skip everything but directories */
-		sprintf(path, "/proc/device-tree/cpus/%s", ent->d_name);
-		if (lstat(path, &sb)) {
-			say(ERROR, "Could not access %s,\nstat(): %s\n",
-			    path, strerror(errno));
-			break;
-		}
-
-		if (!S_ISDIR(sb.st_mode))
+		if (!is_cpus_subdir(ent) || !strstr(ent->d_name, "-cache@"))
 			continue;
 
-		if (strstr(ent->d_name, "-cache@")) {
-			struct cache_info *cache;
-
-			cache = zalloc(sizeof(*cache));
-			if (cache == NULL) {
-				say(ERROR, "Could not allocate cache info."
-				    "\n%s\n", strerror(errno));
-				free_cache_info(cache_list);
-				return -1;
-			}
-
-			snprintf(cache->name, DR_BUF_SZ, "%s", ent->d_name);
-			cache->path = strdup(path);
-
-			cache->removed = 0;
-			cache->next = cache_list;
-			cache_list = cache;
-
-			rc = get_ofdt_uint_property(cache->path, "ibm,phandle",
-						    &cache->phandle);
-			if (rc) {
-				say(ERROR, "Could not retreive ibm,phandle "
-				    "property for %s\n", cache->path);
-				free_cache_info(cache_list);
-				return -1;
-			}
-
-			/* l3-caches do not have a l2-cache property */
-			cache->l2cache = 0xffffffff;
-			get_ofdt_uint_property(cache->path, "l2-cache",
-					       &cache->l2cache);
-
-			say(EXTRA_DEBUG, "Found cache %s\n", cache->name);
+		if (add_cache_node(&cache_list, ent->d_name)) {
+			free_cache_info(cache_list);
+			closedir(d);
+			return -1;
 		}
 	}
 
@@ -651,9 +828,6 @@ acquire_cpu(struct dr_node *cpu, struct dr_info *dr_info)
 		return rc;
 	}
 
-	update_cpu_node(cpu, NULL, dr_info);
-	refresh_cache_info(dr_info);
-
 	return 0;
 }
 
@@ -681,62 +855,222 @@ int do_cpu_kernel_dlpar(struct dr_node *cpu, int action)
 	return do_kernel_dlpar(cmdbuf, offset);
 }
 
-int
-probe_cpu(struct dr_node *cpu, struct dr_info *dr_info)
+/**
+ * add_cpu_device
+ * @brief Bring a cpu into the partition
+ *
+ * When the kernel brings the cpu in, it also onlines its threads.
+ * Otherwise the threads are left for the caller to online.
+ *
+ * @param cpu cpu to add
+ * @param dr_info cpu drc information
+ * @param user_online set if the caller has to online the threads
+ * @returns 0 on success, !0 otherwise
+ */
+static int
+add_cpu_device(struct dr_node *cpu, struct dr_info *dr_info, int *user_online)
 {
 	char drc_index[DR_STR_MAX];
 	int probe_file;
 	int write_len;
 	int rc = 0;
 
-	if (kernel_dlpar_exists()) {
-		rc = do_cpu_kernel_dlpar(cpu, ADD);
-	} else {
-		probe_file = open(CPU_PROBE_FILE, O_WRONLY);
-		if (probe_file <= 0) {
-			/* Attempt to add cpu from user-space, this may be
-			 * an older kernel without the infrastructure to
-			 * handle dlpar.
-			 */
-			rc = acquire_cpu(cpu, dr_info);
-			if (rc)
-				return rc;
+	*user_online = 0;
 
-			rc = online_cpu(cpu, dr_info);
-			if (rc) {
-				/* Roll back the operation.  Is this the
-				 * correct behavior?
-				 */
-				say(ERROR, "Unable to online %s\n",
-				    cpu->drc_name);
-				offline_cpu(cpu);
-				release_cpu(cpu, dr_info);
-				cpu->unusable = 1;
-			}
-		} else {
-			memset(drc_index, 0, DR_STR_MAX);
-			write_len = sprintf(drc_index, "0x%x", cpu->drc_index);
-
-			say(DEBUG, "Probing cpu 0x%x\n", cpu->drc_index);
-			rc = write(probe_file, drc_index, write_len);
-			if (rc != write_len)
-				say(ERROR, "Probe failed! rc = %x\n", rc);
-			else
-				/* reset rc to success */
-				rc = 0;
-
-			close(probe_file);
-		}
+	if (kernel_dlpar_exists())
+		return do_cpu_kernel_dlpar(cpu, ADD);
+
+	probe_file = open(CPU_PROBE_FILE, O_WRONLY);
+	if (probe_file <= 0) {
+		/* Attempt to add cpu from user-space, this may be
+		 * an older kernel without the infrastructure to
+		 * handle dlpar.
+		 */
+		rc = acquire_cpu(cpu, dr_info);
+		if (!rc)
+			*user_online = 1;
+
+		return rc;
 	}
 
-	if (!rc) {
-		update_cpu_node(cpu, NULL, dr_info);
-		refresh_cache_info(dr_info);
+	memset(drc_index, 0, DR_STR_MAX);
+	write_len = sprintf(drc_index, "0x%x", cpu->drc_index);
+
+	say(DEBUG, "Probing cpu 0x%x\n", cpu->drc_index);
+	rc = write(probe_file, drc_index, write_len);
+	if (rc != write_len)
+		say(ERROR, "Probe failed! rc = %x\n", rc);
+	else
+		/* reset rc to success */
+		rc = 0;
+
+	close(probe_file);
+	return rc;
+}
+
+/**
+ * online_added_cpu
+ * @brief Online the threads of a cpu added from user-space
+ *
+ * The cpu is released again if its threads can not be onlined.
+ *
+ * @returns 0 on success, !0 otherwise
+ */
+static int
+online_added_cpu(struct dr_node *cpu, struct dr_info *dr_info)
+{
+	int rc;
+
+	rc = online_cpu(cpu, dr_info);
+	if (rc) {
+		/* Roll back the operation.  Is this the
+		 * correct behavior?
+		 */
+		say(ERROR, "Unable to online %s\n", cpu->drc_name);
+		offline_cpu(cpu);
+		release_cpu(cpu, dr_info);
+		cpu->unusable = 1;
 	}
 
 	return rc;
 }
 
+int
+probe_cpu(struct dr_node *cpu, struct dr_info *dr_info)
+{
+	int user_online;
+	int rc;
+
+	rc = add_cpu_device(cpu, dr_info, &user_online);
+	if (rc)
+		return rc;
+
+	update_cpu_node(cpu, NULL, dr_info);
+
+	if (user_online) {
+		rc = online_added_cpu(cpu, dr_info);
+		if (rc)
+			return rc;
+	}
+
+	refresh_cache_info(dr_info);
+	return 0;
+}
+
+/**
+ * find_cpu_paths
+ * @brief Find the device tree nodes of a batch of newly added cpus
+ *
+ * This needs a single pass over the device tree for the whole batch,
+ * rather than one per cpu.
+ *
+ * @param cpus cpus to find the nodes of
+ * @param status per cpu, only those that are 0 are looked up
+ * @param nr number of cpus
+ * @param dr_info cpu drc information
+ */
+static void
+find_cpu_paths(struct dr_node **cpus, int *status, int nr,
+	       struct dr_info *dr_info)
+{
+	struct dirent *de;
+	uint32_t my_drc_index;
+	char path[DR_PATH_MAX];
+	int i, found = 0;
+	DIR *d;
+
+	d = opendir(CPU_OFDT_BASE);
+	if (d == NULL)
+		return;
+
+	while (found < nr && (de = readdir(d)) != NULL) {
+		if ((de->d_type != DT_DIR) || strncmp(de->d_name, "PowerPC", 7))
+			continue;
+
+		sprintf(path, "%s/%s", CPU_OFDT_BASE, de->d_name);
+		if (get_my_drc_index(path, &my_drc_index))
+			continue;
+
+		for (i = 0; i < nr; i++) {
+			if (status[i] || cpus[i]->drc_index != my_drc_index)
+				continue;
+
+			update_cpu_node(cpus[i], path, dr_info);
+			found++;
+			break;
+		}
+	}
+
+	closedir(d);
+}
+
+/**
+ * probe_cpus
+ * @brief Add a batch of cpus to the partition
+ *
+ * All of the cpus are brought into the partition before the threads
+ * of any of them are onlined, and the cache information is refreshed
+ * once for the whole batch.  Cpus that could not be added are marked
+ * unusable.
+ *
+ * @param cpus cpus to add
+ * @param nr number of cpus
+ * @param dr_info cpu drc information
+ * @returns number of cpus added
+ */
+int
+probe_cpus(struct dr_node **cpus, int nr, struct dr_info *dr_info)
+{
+	int *status, *user_online;
+	int i, added = 0;
+
+	status = zalloc(nr * sizeof(*status));
+	user_online = zalloc(nr * sizeof(*user_online));
+	if (status == NULL || user_online == NULL) {
+		free(status);
+		free(user_online);
+		return 0;
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (drmgr_timed_out()) {
+			for (; i < nr; i++)
+				status[i] = 1;
+			break;
+		}
+
+		if (add_cpu_device(cpus[i], dr_info, &user_online[i])) {
+			say(DEBUG, "Unable to acquire CPU with drc index %x\n",
+			    cpus[i]->drc_index);
+			cpus[i]->unusable = 1;
+			status[i] = -1;
+		}
+	}
+
+	find_cpu_paths(cpus, status, nr, dr_info);
+
+	for (i = 0; i < nr; i++) {
+		if (status[i])
+			continue;
+
+		/* A cpu whose node was not found is looked up alone */
+		if (!cpus[i]->is_owned)
+			update_cpu_node(cpus[i], NULL, dr_info);
+
+		if (user_online[i] && online_added_cpu(cpus[i], dr_info))
+			continue;
+
+		added++;
+	}
+
+	if (added)
+		refresh_cache_info(dr_info);
+
+	free(status);
+	free(user_online);
+	return added;
+}
+
 /**
  * release_caches
  * Remove any unused cache info.  Failure to remove the cache, while not
@@ -863,29 +1197,24 @@ release_cpu(struct dr_node *cpu, struct dr_info *dr_info)
 int
 init_cpu_drc_info(struct dr_info *dr_info)
 {
+	struct trace_span span;
 	struct dr_node *cpu;
 	struct thread *t;
 	int rc;
 
 	memset(dr_info, 0, sizeof(*dr_info));
 
+	trace_begin(&span, TRACE_DISCOVERY, "cpu-discovery");
 	rc = init_thread_info(dr_info);
-	if (rc) {
-		return -1;
-	}
+	if (!rc)
+		rc = init_cpu_info(dr_info);
+	trace_end(&span);
 
-	rc = init_cpu_info(dr_info);
 	if (rc) {
 		free_cpu_drc_info(dr_info);
 		return -1;
 	}
 
-	rc = init_cache_info(dr_info);
-	if (rc) {
-		free_cpu_drc_info(dr_info);
-		return -1;
-	}
-	
 	if (output_level >= EXTRA_DEBUG) {
 		say(EXTRA_DEBUG, "Start CPU List.\n");
 		for (cpu = dr_info->all_cpus; cpu; cpu = cpu->next) {
@@ -910,10 +1239,19 @@ init_cpu_drc_info(struct dr_info *dr_info)
 void
 free_cpu_drc_info(struct dr_info *dr_info)
 {
+	int i;
+
 	free_cache_info(dr_info->all_caches);
-	free_thread_info(dr_info->all_threads);
 	free_node(dr_info->all_cpus);
 
+	/* The thread table holds every thread, linked or not */
+	for (i = 0; i < dr_info->nr_threads; i++)
+		free(dr_info->threads[i]);
+
+	free(dr_info->threads);
+	free(dr_info->phys_ids);
+	free(dr_info->drc_indexes);
+
 	memset(dr_info, 0, sizeof(*dr_info));
 }
 
@@ -931,6 +1269,7 @@ free_cpu_drc_info(struct dr_info *dr_info)
 int
 set_thread_state(struct thread *thread, int state)
 {
+	struct trace_span span;
 	char path[DR_PATH_MAX];
 	FILE *file;
 	int rc = 0;
@@ -945,8 +1284,10 @@ set_thread_state(struct thread *thread, int state)
 		return -1;
 	}
 
+	trace_begin(&span, TRACE_SYSFS, "thread-online");
 	fprintf(file, "%d", state);
 	fclose(file);
+	trace_end(&span);
 
 	/* fprintf apparently does not return negative number
 	 * if the write() gets an -EBUSY, so explicitly check the
@@ -1106,13 +1447,9 @@ online_cpu(struct dr_node *cpu, struct dr_info *dr_info)
 	    cpu->cpu_nthreads);
 
 	/* Hack to work around kernel brain damage (LTC 7692) */
-	for (thread = dr_info->all_threads; thread; thread = thread->next) {
-		if (thread->cpu == cpu) {
-			found = 1;
-			break;
-		}
-	}
-	
+	if (cpu->cpu_threads && cpu->cpu_threads->cpu == cpu)
+		found = 1;
+
 	if (!found) {
 		/* There are no threads which match this cpu because
 		 * the physical_id attribute is not updated until the
@@ -25,6 +25,8 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <endian.h>
+#include <ctype.h>
+#include <pthread.h>
 #include "dr.h"
 #include "ofdt.h"
 
@@ -51,7 +53,35 @@ struct drc_info {
 	int	drc_power_domain;
 };
 
+/* The sequences of an ibm,drc-info property.  Connectors are computed
+ * from these on demand, the strings point into the property data.
+ */
+struct drc_info_seqs {
+	char			ofdt_path[DR_PATH_MAX];
+	char			*prop_data;
+	struct drc_info		*seqs;
+	int			n_seqs;
+	struct drc_info_seqs	*next;
+};
+
+static struct drc_info_seqs *all_drc_info_seqs = NULL;
+
+/* Open addressed lookup tables of a connector list by name, index and
+ * power domain.  Each table holds the first connector in list order for
+ * a given key.
+ */
+struct drc_hash {
+	unsigned int		mask;
+	struct dr_connector	**by_name;
+	struct dr_connector	**by_index;
+	struct dr_connector	**by_domain;
+};
+
+/* Connector lists shorter than this are searched linearly */
+#define DRC_HASH_MIN	32
+
 struct dr_connector *all_drc_lists = NULL;
+static pthread_mutex_t drc_info_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * get_of_list_prop
@@ -243,122 +273,399 @@ done:
 }
 
 /**
- * drc_info_connectors_v2
+ * get_drc_info_seqs
+ * @brief Retrieve the sequences of the ibm,drc-info property of a node
  *
- * @param full_path
- * @param ofdt_path
- * @param list
- * @returns 0 on success, !0 otherwise
+ * Must be called with drc_info_lock held.
+ *
+ * @param full_path full path of the node
+ * @param ofdt_path device tree path the sequences are looked up by
+ * @returns pointer to the sequences, NULL if the node has no ibm,drc-info
  */
-static int drc_info_connectors_v2(char *full_path, char *ofdt_path,
-				struct dr_connector **list)
+static struct drc_info_seqs *get_drc_info_seqs(const char *full_path,
+					       const char *ofdt_path)
 {
-	struct dr_connector *out_list = NULL;
-	struct drc_info info;
-	char *prop_name = "ibm,drc-info";
-	char *prop_data, *data_ptr;
-	int i, j, n_entries, size, connector_size, ics, rc;
-
-	size = get_property_size(full_path, prop_name);
-	prop_data = zalloc(size);
-	if (prop_data == NULL)
-		return -1;
-	rc = get_property(full_path, prop_name, prop_data, size);
-	if (rc) {
-		free(prop_data);
-		return -1;
+	struct drc_info_seqs *info_seqs;
+	struct drc_info *info;
+	char *prop_data, *data_ptr, *data_end;
+	int j, n_entries, size;
+	size_t len;
+
+	for (info_seqs = all_drc_info_seqs; info_seqs;
+	     info_seqs = info_seqs->next) {
+		if (!strcmp(info_seqs->ofdt_path, ofdt_path))
+			return info_seqs;
 	}
 
+	size = get_property_alloc(full_path, "ibm,drc-info", &prop_data);
+	if (size < 4)
+		return NULL;
+
 	/* Num of DRC-info sets */
 	data_ptr = prop_data;
-	n_entries  = be32toh(*(uint *)data_ptr);
+	data_end = prop_data + size;
+	n_entries = be32toh(*(uint *)data_ptr);
 	data_ptr += 4;
 
-	/* Extract drc-info data */
-	for (j = 0, connector_size = 0; j < n_entries; j++) {
-		info.drc_type = data_ptr;
-		data_ptr += strlen(info.drc_type)+1;
-		info.drc_name_prefix = data_ptr;
-		data_ptr += strlen(info.drc_name_prefix)+1;
-		data_ptr += 4;	/* Skip drc-index-start */
-		data_ptr += 4;	/* Skip drc-name-suffix-start */
-		info.n_seq_elems = be32toh(*(uint *)data_ptr);
-		data_ptr += 4;	/* Advance over n-seq-elems */
-		data_ptr += 4;	/* Skip sequential-increment */
-		data_ptr += 4;	/* Skip drc-power-domain */
-		if (info.n_seq_elems <= 0)
-			continue;
-		connector_size += info.n_seq_elems;
+	/* Each set takes at least two terminators and five cells */
+	if (n_entries < 0 || n_entries > (size - 4) / 22) {
+		say(ERROR, "Invalid ibm,drc-info property in %s\n", full_path);
+		free(prop_data);
+		return NULL;
 	}
 
-	/* Allocate list entry */
-	out_list = zalloc(connector_size * sizeof(struct dr_connector));
-	if (out_list == NULL) {
-		rc = -1;
-		goto done;
+	info_seqs = zalloc(sizeof(*info_seqs) + n_entries * sizeof(*info));
+	if (info_seqs == NULL) {
+		free(prop_data);
+		return NULL;
 	}
 
-	/* Extract drc-info data */
-	data_ptr = prop_data;
-	data_ptr += 4;
-	for (j = 0, ics = 0; j < n_entries; j++) {
-		info.drc_type = data_ptr;
-		data_ptr += strlen(info.drc_type)+1;
-		info.drc_name_prefix = data_ptr;
-		data_ptr += strlen(info.drc_name_prefix)+1;
+	info_seqs->seqs = (struct drc_info *)(info_seqs + 1);
+	info_seqs->prop_data = prop_data;
+	snprintf(info_seqs->ofdt_path, DR_PATH_MAX, "%s", ofdt_path);
 
-		info.drc_index_start  = be32toh(*(uint *)data_ptr);
+	/* Extract drc-info data */
+	for (j = 0; j < n_entries; j++) {
+		info = &info_seqs->seqs[j];
+
+		info->drc_type = data_ptr;
+		if (data_ptr >= data_end)
+			goto invalid;
+		len = strnlen(data_ptr, data_end - data_ptr);
+		if (data_ptr + len >= data_end)
+			goto invalid;
+		data_ptr += len + 1;
+
+		info->drc_name_prefix = data_ptr;
+		if (data_ptr >= data_end)
+			goto invalid;
+		len = strnlen(data_ptr, data_end - data_ptr);
+		if (data_ptr + len >= data_end)
+			goto invalid;
+		data_ptr += len + 1;
+
+		if (data_ptr + 20 > data_end)
+			goto invalid;
+
+		info->drc_index_start = be32toh(*(uint *)data_ptr);
 		data_ptr += 4;
 
-		info.drc_name_suffix_start = be32toh(*(uint *)data_ptr);
+		info->drc_name_suffix_start = be32toh(*(uint *)data_ptr);
 		data_ptr += 4;
 
-		info.n_seq_elems = be32toh(*(uint *)data_ptr);
+		info->n_seq_elems = be32toh(*(uint *)data_ptr);
 		data_ptr += 4;
 
-		info.seq_inc = be32toh(*(uint *)data_ptr);
+		info->seq_inc = be32toh(*(uint *)data_ptr);
 		data_ptr += 4;
 
-		info.drc_power_domain = be32toh(*(uint *)data_ptr);
+		info->drc_power_domain = be32toh(*(uint *)data_ptr);
 		data_ptr += 4;
+	}
+
+	info_seqs->n_seqs = n_entries;
+	info_seqs->next = all_drc_info_seqs;
+	all_drc_info_seqs = info_seqs;
+	return info_seqs;
+
+invalid:
+	say(ERROR, "Invalid ibm,drc-info property in %s\n", full_path);
+	free(prop_data);
+	free(info_seqs);
+	return NULL;
+}
+
+/**
+ * drc_info_seq_connector
+ * @brief Compute a connector of an ibm,drc-info sequence
+ *
+ * @param info sequence the connector belongs to
+ * @param i position of the connector in the sequence
+ * @param drc connector to fill in
+ */
+static void drc_info_seq_connector(struct drc_info *info, int i,
+				   struct dr_connector *drc)
+{
+	drc->index = info->drc_index_start + (i * info->seq_inc);
+	drc->powerdomain = info->drc_power_domain;
 
-		/* Build connector list */
-		if (info.n_seq_elems <= 0)
+	snprintf(drc->name, DRC_STR_MAX, "%s%d", info->drc_name_prefix,
+		 info->drc_name_suffix_start + (i * info->seq_inc));
+
+	strncpy(drc->type, info->drc_type, DRC_STR_MAX - 1);
+	drc->type[DRC_STR_MAX - 1] = '\0';
+}
+
+/**
+ * drc_info_seqs_search
+ * @brief Find a connector in the sequences of an ibm,drc-info property
+ *
+ * The position of the connector is computed from the name or index of
+ * each sequence, no connector list is built.
+ *
+ * @param info_seqs sequences to search
+ * @param search_type DRC_NAME, DRC_TYPE, DRC_INDEX or DRC_POWERDOMAIN
+ * @param key key to search for
+ * @param drc connector to fill in
+ * @returns 0 if found, !0 otherwise
+ */
+static int drc_info_seqs_search(struct drc_info_seqs *info_seqs,
+				int search_type, void *key,
+				struct dr_connector *drc)
+{
+	struct drc_info *info;
+	int i, j;
+
+	for (j = 0; j < info_seqs->n_seqs; j++) {
+		info = &info_seqs->seqs[j];
+		if (info->n_seq_elems <= 0)
 			continue;
 
-		for (i = 0; i < info.n_seq_elems; i++, ics++) {
-			out_list[ics].index = info.drc_index_start+
-					 (i*info.seq_inc);
-			out_list[ics].powerdomain = info.drc_power_domain;
+		switch (search_type) {
+		    case DRC_NAME: {
+			char *name = key;
+			int len = strlen(info->drc_name_prefix);
+			char *end;
+			long suffix;
+
+			if (strncmp(name, info->drc_name_prefix, len) ||
+			    !isdigit(name[len]))
+				continue;
+
+			suffix = strtol(&name[len], &end, 10);
+			if (*end != '\0')
+				continue;
+
+			suffix -= info->drc_name_suffix_start;
+			if (info->seq_inc == 0) {
+				if (suffix != 0)
+					continue;
+				i = 0;
+			} else {
+				if (suffix % info->seq_inc)
+					continue;
+				i = suffix / info->seq_inc;
+			}
+			break;
+		    }
 
-			sprintf(out_list[ics].name, "%s%d",
-				info.drc_name_prefix,
-				info.drc_name_suffix_start+(i*info.seq_inc));
+		    case DRC_TYPE:
+			if (strcmp(info->drc_type, (char *)key))
+				continue;
+			i = 0;
+			break;
 
-			strncpy(out_list[ics].type, info.drc_type, DRC_STR_MAX - 1);
-			out_list[ics].type[DRC_STR_MAX - 1] = '\0';
+		    case DRC_INDEX: {
+			long offset = (long)*(uint32_t *)key -
+				      (uint32_t)info->drc_index_start;
+
+			if (info->seq_inc == 0) {
+				if (offset != 0)
+					continue;
+				i = 0;
+			} else {
+				if (offset % info->seq_inc)
+					continue;
+				i = offset / info->seq_inc;
+			}
+			break;
+		    }
 
+		    case DRC_POWERDOMAIN:
+			if (info->drc_power_domain != *(uint32_t *)key)
+				continue;
+			i = 0;
+			break;
+
+		    default:
+			return -1;
+		}
+
+		if (i < 0 || i >= info->n_seq_elems)
+			continue;
+
+		drc_info_seq_connector(info, i, drc);
+
+		/* Names are formatted from the suffix, make sure the
+		 * computed name is really the one that was asked for.
+		 */
+		if (search_type == DRC_NAME && strcmp(drc->name, (char *)key))
+			continue;
+
+		return 0;
+	}
+
+	return -1;
+}
+
+/**
+ * drc_info_connectors_v2
+ *
+ * @param full_path
+ * @param ofdt_path
+ * @param list
+ * @returns 0 on success, !0 otherwise
+ */
+static int drc_info_connectors_v2(char *full_path, char *ofdt_path,
+				struct dr_connector **list)
+{
+	struct dr_connector *out_list = NULL;
+	struct drc_info_seqs *info_seqs;
+	struct drc_info *info;
+	int i, j, connector_size, ics;
+
+	info_seqs = get_drc_info_seqs(full_path, ofdt_path);
+	if (info_seqs == NULL)
+		return -1;
+
+	for (j = 0, connector_size = 0; j < info_seqs->n_seqs; j++) {
+		info = &info_seqs->seqs[j];
+		if (info->n_seq_elems <= 0)
+			continue;
+		connector_size += info->n_seq_elems;
+	}
+
+	if (connector_size == 0)
+		return -1;
+
+	/* Allocate list entry */
+	out_list = zalloc(connector_size * sizeof(struct dr_connector));
+	if (out_list == NULL)
+		return -1;
+
+	/* Build connector list */
+	for (j = 0, ics = 0; j < info_seqs->n_seqs; j++) {
+		info = &info_seqs->seqs[j];
+
+		for (i = 0; i < info->n_seq_elems; i++, ics++) {
+			drc_info_seq_connector(info, i, &out_list[ics]);
 			out_list[ics].next = &out_list[ics+1];
 		}
 	}
-        if (ics > 0)
-                out_list[ics-1].next = NULL;
 
-done:
-	if (prop_data)
-		free(prop_data);
+	out_list[ics-1].next = NULL;
 
-	if (rc) {
-		free(out_list);
-		*list = NULL;
-	} else {
-		snprintf(out_list->ofdt_path, DR_PATH_MAX, "%s", ofdt_path);
-		*list = out_list;
+	snprintf(out_list->ofdt_path, DR_PATH_MAX, "%s", ofdt_path);
+	*list = out_list;
+	return 0;
+}
+
+static unsigned int drc_hash_name(const char *name)
+{
+	unsigned int hash = 2166136261U;
+
+	/* FNV-1a */
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
 	}
 
-	return rc;
+	return hash;
 }
 
+static unsigned int drc_hash_int(unsigned int val)
+{
+	return val * 2654435761U;
+}
+
+/**
+ * build_drc_hash
+ * @brief Build the lookup tables of a connector list
+ *
+ * Failing to allocate the tables is not an error, lookups then fall
+ * back to walking the list.
+ *
+ * @param list connector list to build the tables for
+ */
+static void build_drc_hash(struct dr_connector *list)
+{
+	struct drc_hash *hash;
+	struct dr_connector *drc;
+	unsigned int n_drcs = 0, sz = 1;
+	unsigned int i;
+
+	for (drc = list; drc; drc = drc->next)
+		n_drcs++;
+
+	if (n_drcs < DRC_HASH_MIN)
+		return;
+
+	/* keep the tables at most half full */
+	while (sz < n_drcs * 2)
+		sz <<= 1;
+
+	hash = zalloc(sizeof(*hash) + 3 * sz * sizeof(drc));
+	if (hash == NULL)
+		return;
+
+	hash->mask = sz - 1;
+	hash->by_name = (struct dr_connector **)(hash + 1);
+	hash->by_index = hash->by_name + sz;
+	hash->by_domain = hash->by_index + sz;
+
+	for (drc = list; drc; drc = drc->next) {
+		i = drc_hash_name(drc->name) & hash->mask;
+		while (hash->by_name[i] &&
+		       strcmp(hash->by_name[i]->name, drc->name))
+			i = (i + 1) & hash->mask;
+		if (!hash->by_name[i])
+			hash->by_name[i] = drc;
+
+		i = drc_hash_int(drc->index) & hash->mask;
+		while (hash->by_index[i] &&
+		       hash->by_index[i]->index != drc->index)
+			i = (i + 1) & hash->mask;
+		if (!hash->by_index[i])
+			hash->by_index[i] = drc;
+
+		i = drc_hash_int(drc->powerdomain) & hash->mask;
+		while (hash->by_domain[i] &&
+		       hash->by_domain[i]->powerdomain != drc->powerdomain)
+			i = (i + 1) & hash->mask;
+		if (!hash->by_domain[i])
+			hash->by_domain[i] = drc;
+	}
+
+	list->hash = hash;
+}
+
+static struct dr_connector *drc_hash_find(struct drc_hash *hash,
+					  int search_type, void *key)
+{
+	struct dr_connector *drc;
+	unsigned int i;
+
+	switch (search_type) {
+	    case DRC_NAME:
+		i = drc_hash_name((char *)key) & hash->mask;
+		while ((drc = hash->by_name[i]) != NULL) {
+			if (!strcmp(drc->name, (char *)key))
+				return drc;
+			i = (i + 1) & hash->mask;
+		}
+		break;
+
+	    case DRC_INDEX:
+		i = drc_hash_int(*(uint32_t *)key) & hash->mask;
+		while ((drc = hash->by_index[i]) != NULL) {
+			if (drc->index == *(uint32_t *)key)
+				return drc;
+			i = (i + 1) & hash->mask;
+		}
+		break;
+
+	    case DRC_POWERDOMAIN:
+		i = drc_hash_int(*(uint32_t *)key) & hash->mask;
+		while ((drc = hash->by_domain[i]) != NULL) {
+			if (drc->powerdomain == *(uint32_t *)key)
+				return drc;
+			i = (i + 1) & hash->mask;
+		}
+		break;
+	}
+
+	return NULL;
+}
 
 /**
  * of_to_full_path
@@ -403,14 +710,15 @@ of_to_full_path(const char *of_path)
  * @param n_drcs
  * @returns 0 on success, !0 otherwise
  */
-struct dr_connector *
-get_drc_info(const char *of_path)
+static struct dr_connector *
+_get_drc_info(const char *of_path)
 {
 	struct stat sbuf;
 	char fname[DR_PATH_MAX];
 	char ofdt_path[DR_PATH_MAX];
 	char *full_path = NULL;
 	struct dr_connector *list = NULL;
+	int v2;
 	int rc;
 
 	for (list = all_drc_lists; list; list = list->all_next) {
@@ -425,13 +733,25 @@ get_drc_info(const char *of_path)
 	/* ibm,drc-info vs the old implementation */
 	sprintf(fname, "%s/%s", full_path, "ibm,drc-info");
 	snprintf(ofdt_path, DR_PATH_MAX, "%s", of_path);
-	rc = stat(fname, &sbuf);
-	if (rc)
-		rc = drc_info_connectors_v1(full_path, ofdt_path, &list);
-	else
-		rc = drc_info_connectors_v2(full_path, ofdt_path, &list);
+	v2 = !stat(fname, &sbuf);
+
+	list = drc_cache_load(full_path, ofdt_path, v2);
+	if (list) {
+		rc = 0;
+	} else {
+		if (v2)
+			rc = drc_info_connectors_v2(full_path, ofdt_path,
+						    &list);
+		else
+			rc = drc_info_connectors_v1(full_path, ofdt_path,
+						    &list);
+
+		if (rc == 0)
+			drc_cache_store(full_path, ofdt_path, v2, list);
+	}
 
 	if (rc == 0) {
+		build_drc_hash(list);
 		list->all_next = all_drc_lists;
 		all_drc_lists = list;
 	} else {
@@ -443,6 +763,19 @@ get_drc_info(const char *of_path)
 	return list;
 }
 
+struct dr_connector *
+get_drc_info(const char *of_path)
+{
+	struct dr_connector *list;
+
+	/* Device discovery looks up connector lists from several threads */
+	pthread_mutex_lock(&drc_info_lock);
+	list = _get_drc_info(of_path);
+	pthread_mutex_unlock(&drc_info_lock);
+
+	return list;
+}
+
 /**
  * free_drc_info
  *
@@ -457,8 +790,137 @@ free_drc_info(void)
 		list = all_drc_lists;
 		all_drc_lists = list->all_next;
 
+		if (list->hash)
+			free(list->hash);
 		free(list);
 	}
+
+	while (all_drc_info_seqs) {
+		struct drc_info_seqs *info_seqs = all_drc_info_seqs;
+
+		all_drc_info_seqs = info_seqs->next;
+		free(info_seqs->prop_data);
+		free(info_seqs);
+	}
+}
+
+/**
+ * drop_drc_info
+ * @brief Forget the connector information of a single device tree node
+ *
+ * The next lookup rebuilds it from the device tree.
+ *
+ * @param of_path device tree path the information is looked up by
+ */
+void
+drop_drc_info(const char *of_path)
+{
+	struct dr_connector **listp, *list;
+	struct drc_info_seqs **seqsp, *info_seqs;
+
+	pthread_mutex_lock(&drc_info_lock);
+
+	for (listp = &all_drc_lists; *listp; listp = &(*listp)->all_next) {
+		list = *listp;
+		if (strcmp(list->ofdt_path, of_path))
+			continue;
+
+		*listp = list->all_next;
+		if (list->hash)
+			free(list->hash);
+		free(list);
+		break;
+	}
+
+	for (seqsp = &all_drc_info_seqs; *seqsp; seqsp = &(*seqsp)->next) {
+		info_seqs = *seqsp;
+		if (strcmp(info_seqs->ofdt_path, of_path))
+			continue;
+
+		*seqsp = info_seqs->next;
+		free(info_seqs->prop_data);
+		free(info_seqs);
+		break;
+	}
+
+	pthread_mutex_unlock(&drc_info_lock);
+}
+
+/**
+ * drc_lookup
+ * @brief Find a connector of a device tree node
+ *
+ * Nodes with an ibm,drc-info property are searched without building
+ * their connector list, unless it was already built by get_drc_info().
+ * The connector found is copied to drc, its next pointer is NULL.
+ *
+ * @param of_path device tree path of the node
+ * @param search_type DRC_NAME, DRC_TYPE, DRC_INDEX or DRC_POWERDOMAIN
+ * @param key key to search for
+ * @param drc connector to fill in
+ * @returns 0 if found, 1 if not found, -1 if the node has no connectors
+ */
+int
+drc_lookup(const char *of_path, int search_type, void *key,
+	   struct dr_connector *drc)
+{
+	struct drc_info_seqs *info_seqs = NULL;
+	struct dr_connector *list;
+	char fname[DR_PATH_MAX];
+	char *full_path;
+	struct stat sbuf;
+	int rc = 0;
+
+	memset(drc, 0, sizeof(*drc));
+
+	pthread_mutex_lock(&drc_info_lock);
+
+	for (list = all_drc_lists; list; list = list->all_next) {
+		if (!strcmp(list->ofdt_path, of_path))
+			break;
+	}
+
+	if (list == NULL) {
+		full_path = of_to_full_path(of_path);
+		if (full_path == NULL) {
+			rc = -1;
+			goto out;
+		}
+
+		snprintf(fname, DR_PATH_MAX, "%s/%s", full_path,
+			 "ibm,drc-info");
+		if (!stat(fname, &sbuf))
+			info_seqs = get_drc_info_seqs(full_path, of_path);
+
+		free(full_path);
+
+		if (info_seqs) {
+			rc = drc_info_seqs_search(info_seqs, search_type,
+						  key, drc) ? 1 : 0;
+			goto out;
+		}
+
+		list = _get_drc_info(of_path);
+		if (list == NULL) {
+			rc = -1;
+			goto out;
+		}
+	}
+
+	list = search_drc_list(list, NULL, search_type, key);
+	if (list == NULL) {
+		rc = 1;
+		goto out;
+	}
+
+	memcpy(drc, list, sizeof(*drc));
+	drc->next = NULL;
+	drc->all_next = NULL;
+	drc->hash = NULL;
+
+out:
+	pthread_mutex_unlock(&drc_info_lock);
+	return rc;
 }
 
 /**
@@ -478,6 +940,11 @@ search_drc_list(struct dr_connector *drc_list, struct dr_connector *start,
 {
 	struct dr_connector *drc;
 
+	/* Searches from the start of a list can use its lookup tables */
+	if (drc_list && drc_list->hash && search_type != DRC_TYPE &&
+	    (start == NULL || start == drc_list))
+		return drc_hash_find(drc_list->hash, search_type, key);
+
 	if (start)
 		drc = start;
 	else
@@ -545,10 +1012,9 @@ drc_name_to_index(const char *name, struct dr_connector *drc_list)
 {
 	struct dr_connector *drc;
 
-	for (drc = drc_list; drc != NULL; drc = drc->next) {
-		if (!strcmp(name, drc->name))
-			return drc->index;
-	}
+	drc = search_drc_list(drc_list, NULL, DRC_NAME, (void *)name);
+	if (drc)
+		return drc->index;
 
 	return 0; /* hopefully 0 isn't a valid index... */
 }
@@ -565,53 +1031,49 @@ drc_index_to_name(uint32_t index, struct dr_connector *drc_list)
 {
 	struct dr_connector *drc;
 
-	for (drc = drc_list; drc != NULL; drc = drc->next) {
-		if (index == drc->index)
-			return drc->name;
-	}
+	drc = search_drc_list(drc_list, NULL, DRC_INDEX, &index);
+	if (drc)
+		return drc->name;
 
 	return NULL;
 }
 
 /**
- * get_drc_by_name
- * @brief Retrieve a dr_connector with the specified drc_name
+ * get_drc_by_key
+ * @brief Retrieve a dr_connector by name or index
  *
- * This routine searches the drc lists for a dr_connector with the
- * specified name starting at the specified directory.  If a dr_connector
- * is found the root_dir that the dr_connector was found in is also
- * filled out.
+ * This routine searches the drc lists for a dr_connector matching the
+ * key starting at the specified directory.  Only subdirectories that
+ * have connectors themselves are searched.  If a dr_connector is found
+ * the root_dir that the dr_connector was found in is also filled out.
  *
- * @param drc_name name of the dr_connector to search for
+ * @param search_type DRC_NAME or DRC_INDEX
+ * @param key name or index of the dr_connector to search for
  * @param drc pointer to a drc to point to the found dr_connector
  * @param root_dir pointer to buf to fill in with root directory
  * @param start_dir, directory to start searching
  * @returns 0 on success (drc and root_dir filled in), !0 on failure
  */
 int
-get_drc_by_name(char *drc_name, struct dr_connector *drc, char *root_dir,
-		char *start_dir)
+get_drc_by_key(int search_type, void *key, struct dr_connector *drc,
+	       char *root_dir, const char *start_dir)
 {
-        struct dr_connector *drc_list = NULL;
-        struct dr_connector *drc_entry;
 	struct dirent *de;
 	DIR *d;
         int rc = -1;
 
-	memset(drc, 0, sizeof(*drc));
-
 	/* Try to get the drc in this directory */
-        drc_list = get_drc_info(start_dir);
-        if (drc_list == NULL)
+	rc = drc_lookup(start_dir, search_type, key, drc);
+	if (rc < 0)
 		return -1;
 
-	drc_entry = search_drc_list(drc_list, NULL, DRC_NAME, drc_name);
-	if (drc_entry != NULL) {
-		memcpy(drc, drc_entry, sizeof(*drc));
+	if (rc == 0) {
 		sprintf(root_dir, "%s", start_dir);
                 return 0;
         }
 
+	rc = -1;
+
 	/* If we didn't find it here, check the subdirs */
 	d = opendir(start_dir);
 	if (d == NULL)
@@ -624,7 +1086,7 @@ get_drc_by_name(char *drc_name, struct dr_connector *drc, char *root_dir,
 			continue;
 
 		sprintf(dir_path, "%s/%s", start_dir, de->d_name);
-		rc = get_drc_by_name(drc_name, drc, root_dir, dir_path);
+		rc = get_drc_by_key(search_type, key, drc, root_dir, dir_path);
 		if (rc == 0)
 			break;
 	}
@@ -633,15 +1095,25 @@ get_drc_by_name(char *drc_name, struct dr_connector *drc, char *root_dir,
 	return rc;
 }
 
+/**
+ * get_drc_by_name
+ * @brief Retrieve a dr_connector with the specified drc_name
+ *
+ * @param drc_name name of the dr_connector to search for
+ * @param drc pointer to a drc to point to the found dr_connector
+ * @param root_dir pointer to buf to fill in with root directory
+ * @param start_dir, directory to start searching
+ * @returns 0 on success (drc and root_dir filled in), !0 on failure
+ */
+int
+get_drc_by_name(char *drc_name, struct dr_connector *drc, char *root_dir,
+		char *start_dir)
+{
+	return get_drc_by_key(DRC_NAME, drc_name, drc, root_dir, start_dir);
+}
+
 struct dr_connector *
 get_drc_by_index(uint32_t drc_index, struct dr_connector *drc_list)
 {
-	struct dr_connector *drc;
-
-	for (drc = drc_list; drc; drc = drc->next) {
-		if (drc->index == drc_index)
-			return drc;
-	}
-
-	return NULL;
+	return search_drc_list(drc_list, NULL, DRC_INDEX, &drc_index);
 }
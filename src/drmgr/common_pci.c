@@ -23,10 +23,13 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <librtas.h>
 #include "dr.h"
 #include "drpci.h"
@@ -35,6 +38,20 @@
 /* maximum seconds to wait for pci device removal */
 #define PCI_REMOVE_TIMEOUT_MAX 60
 
+/* Upper limit on the threads walking independent subtrees of the
+ * device tree or sysfs during device discovery
+ */
+#define DISCOVER_MAX_THREADS	8
+
+/* Index of the nodes being discovered by their full ofdt path, for
+ * matching the devspec of sysfs devices against them
+ */
+struct devspec_hash {
+	struct dr_node	**nodes;
+	unsigned int	mask;
+	pthread_mutex_t	lock;		/* serializes sysfs_dev_path updates */
+};
+
 /**
  * alloc_node
  *
@@ -271,10 +288,7 @@ add_child_node(struct dr_node *parent, char *child_path)
 	drc_list = get_drc_info(child_path);
 	*slash = '/';
 
-	for (drc = drc_list; drc != NULL; drc = drc->next) {
-		if (drc->index == my_drc_index)
-			break;
-	}
+	drc = get_drc_by_index(my_drc_index, drc_list);
 
 	/* Allocate space for the Open Firmware node information.  */
 	child = alloc_dr_node(drc, parent->dev_type, child_path);
@@ -513,65 +527,110 @@ free_node(struct dr_node *node_list)
 	}
 }
 
+static unsigned int
+devspec_hash_fn(const char *path)
+{
+	unsigned int hash = 5381;
+
+	while (*path)
+		hash = (hash * 33) ^ (unsigned char)*path++;
+
+	return hash;
+}
+
+static void
+devspec_hash_insert(struct devspec_hash *hash, struct dr_node *node)
+{
+	unsigned int i = devspec_hash_fn(node->ofdt_path) & hash->mask;
+
+	while (hash->nodes[i]) {
+		/* The first node in list order wins, as with a list walk */
+		if (!strcmp(hash->nodes[i]->ofdt_path, node->ofdt_path))
+			return;
+
+		i = (i + 1) & hash->mask;
+	}
+
+	hash->nodes[i] = node;
+}
+
 /**
- * devspec_check_node
+ * init_devspec_hash
+ * @brief Index a node list and the children of its nodes by ofdt path
  *
- * @param node
- * @param sysfs_path
- * @param full_of_path
- * @param found
+ * @param hash hash to initialize
+ * @param node_list
  * @returns 0 on success, !0 otherwise
  */
 static int
-devspec_check_node(struct dr_node *node, char *sysfs_path,
-		   char *full_of_path, int *found)
+init_devspec_hash(struct devspec_hash *hash, struct dr_node *node_list)
 {
-	struct dr_node *child;
+	struct dr_node *node, *child;
+	unsigned int nr_nodes = 0;
+	unsigned int sz = 64;
+
+	for (node = node_list; node; node = node->next) {
+		nr_nodes++;
+		for (child = node->children; child; child = child->next)
+			nr_nodes++;
+	}
 
-	*found = 0;
+	/* keep the table at most half full */
+	while (sz < nr_nodes * 2)
+		sz *= 2;
 
-	if (node->ofdt_path == NULL)
-		return 0;
+	hash->nodes = zalloc(sz * sizeof(*hash->nodes));
+	if (hash->nodes == NULL)
+		return -1;
 
-	if (! strcmp(full_of_path, node->ofdt_path)) {
-		snprintf(node->sysfs_dev_path, DR_PATH_MAX, "%s", sysfs_path);
-		*found = 1;
-		return 0;
-	}
+	hash->mask = sz - 1;
+	pthread_mutex_init(&hash->lock, NULL);
 
-	for (child = node->children; child; child = child->next) {
-		if (! strcmp(full_of_path, child->ofdt_path)) {
-			snprintf(child->sysfs_dev_path, DR_PATH_MAX, "%s",
-				 sysfs_path);
-			*found = 1;
-			return 0;
-		}
+	for (node = node_list; node; node = node->next) {
+		devspec_hash_insert(hash, node);
+		for (child = node->children; child; child = child->next)
+			devspec_hash_insert(hash, child);
 	}
 
 	return 0;
 }
 
+static void
+free_devspec_hash(struct devspec_hash *hash)
+{
+	pthread_mutex_destroy(&hash->lock);
+	free(hash->nodes);
+}
+
 /**
  * correlate_devspec
  *
  * @param sysfs_path
  * @param ofdt_path
+ * @param hash index of the nodes to correlate with
  */
 static int
-correlate_devspec(char *sysfs_path, char *ofdt_path, struct dr_node *node_list)
+correlate_devspec(char *sysfs_path, char *ofdt_path, struct devspec_hash *hash)
 {
 	struct dr_node *node;
 	char *full_of_path;
-	int found;
-	int rc;
+	unsigned int i;
 
 	full_of_path = of_to_full_path(ofdt_path);
-	for (node = node_list; node != NULL; node = node->next) {
-		rc = devspec_check_node(node, sysfs_path, full_of_path, &found);
-		if (rc)
-			return rc;
-		if (found)
+	if (full_of_path == NULL)
+		return 0;
+
+	i = devspec_hash_fn(full_of_path) & hash->mask;
+	while ((node = hash->nodes[i]) != NULL) {
+		if (!strcmp(node->ofdt_path, full_of_path)) {
+			pthread_mutex_lock(&hash->lock);
+			snprintf(node->sysfs_dev_path, DR_PATH_MAX, "%s",
+				 sysfs_path);
+			pthread_mutex_unlock(&hash->lock);
 			break;
+		}
+
+		i = (i + 1) & hash->mask;
 	}
 
 	free(full_of_path);
@@ -583,18 +642,12 @@ correlate_devspec(char *sysfs_path, char *ofdt_path, struct dr_node *node_list)
  *
  */
 static void
-add_linux_devices(char *start_dir, struct dr_node *node_list)
+add_linux_devices(char *dir, struct devspec_hash *hash)
 {
 	struct dirent *de;
 	DIR *d;
-	char *dir;
 	int rc;
 
-	if (start_dir == NULL)
-		dir = "/sys/devices";
-	else
-		dir = start_dir;
-
 	d = opendir(dir);
 	if (d == NULL) {
 		say(ERROR, "failed to open %s\n%s\n", dir, strerror(errno));
@@ -609,55 +662,237 @@ add_linux_devices(char *start_dir, struct dr_node *node_list)
 
 		if (de->d_type == DT_DIR) {
 			sprintf(buf, "%s/%s", dir, de->d_name);
-			add_linux_devices(buf, node_list);
+			add_linux_devices(buf, hash);
 		} else if (! strcmp(de->d_name, "devspec")) {
 			char devspec[DR_PATH_MAX];
 
 			sprintf(buf, "%s/%s", dir, de->d_name);
 			rc = get_str_attribute(buf, NULL, devspec, DR_PATH_MAX);
 			if (rc == 0)
-				rc = correlate_devspec(dir, devspec, node_list);
+				rc = correlate_devspec(dir, devspec, hash);
 		}
 	}
 	closedir(d);
 }
 
+/* Work shared by the threads walking independent subtrees */
+struct discover_work {
+	char		**paths;
+	struct dr_node	**lists;	/* nodes found under each path */
+	int		nr_paths;
+	int		next;
+	int		dev_type;
+	struct devspec_hash *hash;
+	void		(*fn)(struct discover_work *, int);
+	pthread_mutex_t	lock;
+};
+
+static void *discover_worker(void *arg)
+{
+	struct discover_work *work = arg;
+	int i;
+
+	while (1) {
+		pthread_mutex_lock(&work->lock);
+		i = work->next++;
+		pthread_mutex_unlock(&work->lock);
+
+		if (i >= work->nr_paths)
+			break;
+
+		work->fn(work, i);
+	}
+
+	return NULL;
+}
+
+/**
+ * run_discover_work
+ * @brief Walk the subtrees of a discovery in parallel
+ *
+ * @param work discovery to run
+ */
+static void
+run_discover_work(struct discover_work *work)
+{
+	pthread_t threads[DISCOVER_MAX_THREADS];
+	long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int nr_threads, i;
+
+	nr_threads = (nr_cpus < DISCOVER_MAX_THREADS) ? nr_cpus :
+							DISCOVER_MAX_THREADS;
+	if (nr_threads > work->nr_paths)
+		nr_threads = work->nr_paths;
+
+	work->next = 0;
+	pthread_mutex_init(&work->lock, NULL);
+
+	/* The calling thread is one of the workers */
+	for (i = 0; i < nr_threads - 1; i++) {
+		if (pthread_create(&threads[i], NULL, discover_worker, work))
+			break;
+	}
+	nr_threads = i;
+
+	discover_worker(work);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&work->lock);
+}
+
+/**
+ * add_discover_path
+ * @brief Add a subtree to walk to a discovery
+ *
+ * @param work
+ * @param dir parent directory
+ * @param name subtree directory name
+ * @returns 0 on success, !0 otherwise
+ */
+static int
+add_discover_path(struct discover_work *work, const char *dir,
+		  const char *name)
+{
+	char **paths;
+	char *path;
+
+	if ((work->nr_paths % 64) == 0) {
+		paths = realloc(work->paths,
+				(work->nr_paths + 64) * sizeof(*paths));
+		if (paths == NULL)
+			return -1;
+		work->paths = paths;
+	}
+
+	path = zalloc(strlen(dir) + strlen(name) + 2);
+	if (path == NULL)
+		return -1;
+
+	sprintf(path, "%s/%s", dir, name);
+	work->paths[work->nr_paths++] = path;
+	return 0;
+}
+
+static void
+free_discover_work(struct discover_work *work)
+{
+	int i;
+
+	for (i = 0; i < work->nr_paths; i++)
+		free(work->paths[i]);
+
+	free(work->paths);
+	free(work->lists);
+}
+
+/**
+ * discover_lists
+ * @brief Join the node lists found under each path of a discovery
+ *
+ * Later paths go first, like the nodes prepended by a serial walk.
+ *
+ * @param work
+ * @param node_list list to prepend the nodes to
+ */
+static void
+discover_lists(struct discover_work *work, struct dr_node **node_list)
+{
+	struct dr_node *last;
+	int i;
+
+	for (i = 0; i < work->nr_paths; i++) {
+		if (work->lists[i] == NULL)
+			continue;
+
+		for (last = work->lists[i]; last->next; last = last->next)
+			;
+
+		last->next = *node_list;
+		*node_list = work->lists[i];
+	}
+}
+
+static void
+linux_devices_fn(struct discover_work *work, int i)
+{
+	add_linux_devices(work->paths[i], work->hash);
+}
+
+/**
+ * correlate_linux_devices
+ * @brief Find the sysfs devices of a list of nodes
+ *
+ * The top level directories of /sys/devices, i.e. the PCI host bridges
+ * and the vio bus, are walked in parallel.
+ *
+ * @param node_list
+ */
+static void
+correlate_linux_devices(struct dr_node *node_list)
+{
+	struct devspec_hash hash;
+	struct discover_work work;
+	struct dirent *de;
+	DIR *d;
+
+	if (init_devspec_hash(&hash, node_list))
+		return;
+
+	memset(&work, 0, sizeof(work));
+	work.hash = &hash;
+	work.fn = linux_devices_fn;
+
+	d = opendir(DR_ROOT "/sys/devices");
+	if (d == NULL) {
+		say(ERROR, "failed to open %s\n%s\n", DR_ROOT "/sys/devices",
+		    strerror(errno));
+		free_devspec_hash(&hash);
+		return;
+	}
+
+	while ((de = readdir(d)) != NULL) {
+		if (is_dot_dir(de->d_name) || de->d_type != DT_DIR)
+			continue;
+
+		if (add_discover_path(&work, DR_ROOT "/sys/devices", de->d_name))
+			break;
+	}
+	closedir(d);
+
+	run_discover_work(&work);
+
+	free_discover_work(&work);
+	free_devspec_hash(&hash);
+}
+
 /**
  * add_hea_node
  * @brief Add a node for an HEA adapter
  *
  * @param path ofdt_path to this node
- * @param drc_list list of drc's at OFDT_BASE
  * @param pointer to the node list to add new nodes to
  * @return 0 on success, !0 otherwise
  */
 static int
-add_hea_node(char *path, struct dr_connector *drc_list,
-	     struct dr_node **node_list)
+add_hea_node(char *path, struct dr_node **node_list)
 {
-	struct dr_connector *drc;
+	struct dr_connector drc;
 	struct dr_node *hea_node;
 	uint my_drc_index;
 	int rc;
 
-	if (drc_list == NULL)
-		return -1;
-
 	if (get_my_drc_index(path, &my_drc_index))
 		return -1;
 
-	for (drc = drc_list; drc != NULL; drc = drc->next) {
-		if (drc->index == my_drc_index)
-			break;
-	}
-
-	if (drc == NULL) {
+	if (drc_lookup(OFDT_BASE, DRC_INDEX, &my_drc_index, &drc)) {
 		say(ERROR, "Could not find drc index 0x%x to add to hea list\n",
 		    my_drc_index);
 		return -1;
 	}
 
-	hea_node = alloc_dr_node(drc, HEA_DEV, path);
+	hea_node = alloc_dr_node(&drc, HEA_DEV, path);
 	if (hea_node == NULL) {
 		say(ERROR, "Could not allocate hea node for drc index 0x%x\n",
 		    my_drc_index);
@@ -787,33 +1022,26 @@ add_pci_vio_node(const char *path, int dev_type, struct dr_node **node_list)
  * @brief Add a PHB node to the node list
  *
  * @param ofdt_poath, ofdt path to this node
- * @param drc_list list of drc's at OFDT_BASE
  * @param node_list list of nodes to add node to
  * @returns 0 on success, !0 otherwise
  */
 static int
-add_phb_node(char *ofdt_path, struct dr_connector *drc_list,
-	     struct dr_node **node_list)
+add_phb_node(char *ofdt_path, struct dr_node **node_list)
 {
 	struct dr_node *phb_node;
-	struct dr_connector *drc;
+	struct dr_connector drc;
 	uint my_drc_index;
 
 	if (get_my_drc_index(ofdt_path, &my_drc_index))
 		return -1;
 
-	for (drc = drc_list; drc; drc = drc->next) {
-		if (drc->index == my_drc_index)
-			break;
-	}
-
-	if (drc == NULL) {
+	if (drc_lookup(OFDT_BASE, DRC_INDEX, &my_drc_index, &drc)) {
 		say(ERROR, "Could not find drc index 0x%x to add to phb list\n",
 		    my_drc_index);
 		return -1;
 	}
 
-	phb_node = alloc_dr_node(drc, PHB_DEV, ofdt_path);
+	phb_node = alloc_dr_node(&drc, PHB_DEV, ofdt_path);
 	if (phb_node == NULL) {
 		say(ERROR, "Could not allocate PHB node for drc index 0x%x\n",
 		    my_drc_index);
@@ -888,6 +1116,12 @@ update_phb_ic_info(struct dr_node *node_list)
 	return 0;
 }
 
+static void
+pci_vio_nodes_fn(struct discover_work *work, int i)
+{
+	add_pci_vio_node(work->paths[i], work->dev_type, &work->lists[i]);
+}
+
 /**
  * get_dlpar_nodes
  *
@@ -897,14 +1131,19 @@ update_phb_ic_info(struct dr_node *node_list)
 struct dr_node *
 get_dlpar_nodes(uint32_t node_types)
 {
-	struct dr_connector *drc_list = NULL;
 	struct dr_node *node_list = NULL;
+	struct discover_work work;
+	struct trace_span span;
 	struct dirent *de;
 	DIR *d;
 	char path[1024];
 
 	say(DEBUG, "Getting node types 0x%08x\n", node_types);
 
+	memset(&work, 0, sizeof(work));
+	work.dev_type = PCI_DLPAR_DEV;
+	work.fn = pci_vio_nodes_fn;
+
 	d = opendir(OFDT_BASE);
 	if (d == NULL) {
 		say(ERROR, "failed to open %s\n%s\n", OFDT_BASE,
@@ -912,6 +1151,8 @@ get_dlpar_nodes(uint32_t node_types)
 		return NULL;
 	}
 
+	trace_begin(&span, TRACE_DISCOVERY, "dlpar-nodes");
+
 	while ((de = readdir(d)) != NULL) {
 		if ((de->d_type != DT_DIR) || is_dot_dir(de->d_name))
 			continue;
@@ -923,32 +1164,37 @@ get_dlpar_nodes(uint32_t node_types)
 		    && (node_types & VIO_NODES))
 			add_pci_vio_node(path, VIO_DEV, &node_list);
 		else if (! strncmp(de->d_name, "pci@", 4)) {
+			/* The PHBs are searched for slots in parallel below */
 			if (node_types & PCI_NODES)
-				add_pci_vio_node(path, PCI_DLPAR_DEV,
-						 &node_list);
-			else if (node_types & PHB_NODES) {
-				if (drc_list == NULL)
-					drc_list = get_drc_info(OFDT_BASE);
-				add_phb_node(path, drc_list, &node_list);
-			}
+				add_discover_path(&work, OFDT_BASE,
+						  de->d_name);
+			else if (node_types & PHB_NODES)
+				add_phb_node(path, &node_list);
 		} else if ((! strncmp(de->d_name, "lhea@", 5))
 			 && (node_types & HEA_NODES)) {
-			if (drc_list == NULL)
-				drc_list = get_drc_info(OFDT_BASE);
-
-			add_hea_node(path, drc_list, &node_list);
+			add_hea_node(path, &node_list);
 		}
 	}
 
 	closedir(d);
 
+	if (work.nr_paths) {
+		work.lists = zalloc(work.nr_paths * sizeof(*work.lists));
+		if (work.lists) {
+			run_discover_work(&work);
+			discover_lists(&work, &node_list);
+		}
+	}
+	free_discover_work(&work);
+
 	if (node_list != NULL) {
-		add_linux_devices(NULL, node_list);
+		correlate_linux_devices(node_list);
 
 		if (node_types & PHB_NODES)
 			update_phb_ic_info(node_list);
 	}
 
+	trace_end(&span);
 	return node_list;
 }
 
@@ -991,6 +1237,13 @@ _get_hp_nodes(char *dir, struct dr_node **list)
 	return 0;
 }
 
+static void
+hp_nodes_fn(struct discover_work *work, int i)
+{
+	add_pci_vio_node(work->paths[i], PCI_HP_DEV, &work->lists[i]);
+	_get_hp_nodes(work->paths[i], &work->lists[i]);
+}
+
 
 /**
  * get_hp_nodes
@@ -1002,16 +1255,265 @@ struct dr_node *
 get_hp_nodes()
 {
 	struct dr_node *node_list = NULL;
+	struct discover_work work;
+	struct trace_span span;
+	struct dirent *de;
+	DIR *d;
 
 	say(DEBUG, "Retrieving hotplug nodes\n");
 
-	_get_hp_nodes(OFDT_BASE, &node_list);
+	d = opendir(OFDT_BASE);
+	if (d == NULL) {
+		say(ERROR, "failed to open %s\n%s\n", OFDT_BASE,
+		    strerror(errno));
+		return NULL;
+	}
+
+	trace_begin(&span, TRACE_DISCOVERY, "hp-nodes");
+
+	/* Each PHB is searched for hotplug slots by its own thread */
+	memset(&work, 0, sizeof(work));
+	work.fn = hp_nodes_fn;
+
+	while ((de = readdir(d)) != NULL) {
+		if ((de->d_type != DT_DIR) || is_dot_dir(de->d_name))
+			continue;
+
+		if (strncmp(de->d_name, "pci@", 4))
+			continue;
+
+		if (add_discover_path(&work, OFDT_BASE, de->d_name))
+			break;
+	}
+	closedir(d);
+
+	if (work.nr_paths) {
+		work.lists = zalloc(work.nr_paths * sizeof(*work.lists));
+		if (work.lists) {
+			run_discover_work(&work);
+			discover_lists(&work, &node_list);
+		}
+	}
+	free_discover_work(&work);
+
 	if (node_list != NULL)
-		add_linux_devices(NULL, node_list);
+		correlate_linux_devices(node_list);
 
+	trace_end(&span);
 	return node_list;
 }
 
+/* Buses whose devices have a devspec attribute */
+static char *devspec_buses[] = {DR_ROOT "/sys/bus/pci/devices",
+				DR_ROOT "/sys/bus/vio/devices",
+				DR_ROOT "/sys/bus/ibmebus/devices", NULL};
+
+/**
+ * correlate_bus_devices
+ * @brief Find the sysfs devices of a few nodes
+ *
+ * Rather than walking all of /sys/devices, only the devices on the
+ * buses DLPAR nodes can live on are checked.
+ *
+ * @param node_list
+ */
+static void
+correlate_bus_devices(struct dr_node *node_list)
+{
+	struct devspec_hash hash;
+	char path[DR_PATH_MAX];
+	char devspec[DR_PATH_MAX];
+	char *sysfs_path;
+	struct dirent *de;
+	struct dr_node *node;
+	char *full_of_path;
+	unsigned int i;
+	int nr_buses = 0;
+	int b;
+	DIR *d;
+
+	if (init_devspec_hash(&hash, node_list))
+		return;
+
+	for (b = 0; devspec_buses[b]; b++) {
+		d = opendir(devspec_buses[b]);
+		if (d == NULL)
+			continue;
+
+		nr_buses++;
+		while ((de = readdir(d)) != NULL) {
+			if (is_dot_dir(de->d_name))
+				continue;
+
+			snprintf(path, DR_PATH_MAX, "%s/%s/devspec",
+				 devspec_buses[b], de->d_name);
+			if (get_str_attribute(path, NULL, devspec,
+					      DR_PATH_MAX))
+				continue;
+
+			full_of_path = of_to_full_path(devspec);
+			if (full_of_path == NULL)
+				continue;
+
+			i = devspec_hash_fn(full_of_path) & hash.mask;
+			while ((node = hash.nodes[i]) != NULL) {
+				if (!strcmp(node->ofdt_path, full_of_path))
+					break;
+				i = (i + 1) & hash.mask;
+			}
+			free(full_of_path);
+
+			if (node == NULL)
+				continue;
+
+			/* The bus entries link to the device directories
+			 * a walk of /sys/devices would have found.
+			 */
+			*strrchr(path, '/') = '\0';
+			sysfs_path = realpath(path, NULL);
+			if (sysfs_path) {
+				snprintf(node->sysfs_dev_path, DR_PATH_MAX,
+					 "%s", sysfs_path);
+				free(sysfs_path);
+			}
+		}
+		closedir(d);
+	}
+
+	free_devspec_hash(&hash);
+
+	if (nr_buses == 0)
+		correlate_linux_devices(node_list);
+}
+
+/**
+ * find_drc_child
+ * @brief Find the device tree node of a connector
+ *
+ * @param parent path of the node to search the children of
+ * @param prefix name prefix of the children to check
+ * @param drc_index connector index to look for
+ * @param path buffer for the path of the child, DR_PATH_MAX bytes
+ * @returns 0 if found, !0 otherwise
+ */
+static int
+find_drc_child(const char *parent, const char *prefix, uint32_t drc_index,
+	       char *path)
+{
+	struct dirent *de;
+	uint32_t my_drc_index;
+	DIR *d;
+	int rc = -1;
+
+	d = opendir(parent);
+	if (d == NULL)
+		return -1;
+
+	while ((de = readdir(d)) != NULL) {
+		if ((de->d_type != DT_DIR) || is_dot_dir(de->d_name))
+			continue;
+
+		if (prefix && strncmp(de->d_name, prefix, strlen(prefix)))
+			continue;
+
+		snprintf(path, DR_PATH_MAX, "%s/%s", parent, de->d_name);
+		if (get_my_drc_index(path, &my_drc_index))
+			continue;
+
+		if (my_drc_index == drc_index) {
+			rc = 0;
+			break;
+		}
+	}
+
+	closedir(d);
+	return rc;
+}
+
+/**
+ * find_node_by_drc
+ * @brief Build the node of a single connector
+ *
+ * The connector is looked up by name, or by index if drc_name is a
+ * number, and only the node of that connector and its children are
+ * built.  This covers the nodes get_dlpar_nodes() would list for the
+ * connector itself.  Matches on the connectors of children are left to
+ * a full discovery.
+ *
+ * @param drc_name name or index of the connector
+ * @param node_types node types to consider
+ * @returns pointer to node on success, NULL if not found this way
+ */
+static struct dr_node *
+find_node_by_drc(const char *drc_name, uint32_t node_types)
+{
+	struct dr_connector drc;
+	struct dr_node *node = NULL;
+	char parent[DR_PATH_MAX];
+	char path[DR_PATH_MAX];
+	const char *name;
+	uint32_t drc_index;
+	char *end;
+
+	if (get_drc_by_key(DRC_NAME, (void *)drc_name, &drc, parent,
+			   OFDT_BASE)) {
+		drc_index = strtoul(drc_name, &end, 0);
+		if (*drc_name == '\0' || *end != '\0')
+			return NULL;
+
+		if (get_drc_by_key(DRC_INDEX, &drc_index, &drc, parent,
+				   OFDT_BASE))
+			return NULL;
+	}
+
+	if (!strcmp(parent, OFDT_BASE)) {
+		/* PHBs and HEA adapters are children of the root node */
+		if ((node_types & PHB_NODES) &&
+		    !find_drc_child(OFDT_BASE, "pci@", drc.index, path)) {
+			if (add_phb_node(path, &node) == 0)
+				update_phb_ic_info(node);
+		} else if ((node_types & HEA_NODES) &&
+			   !find_drc_child(OFDT_BASE, "lhea@", drc.index,
+					   path)) {
+			add_hea_node(path, &node);
+		}
+	} else if (!strncmp(parent, OFDT_BASE "/", strlen(OFDT_BASE) + 1) &&
+		   strchr(parent + strlen(OFDT_BASE) + 1, '/') == NULL &&
+		   is_logical_type(drc.type)) {
+		/* Slots of PHBs and virtual devices */
+		name = parent + strlen(OFDT_BASE) + 1;
+
+		if ((node_types & VIO_NODES) && !strcmp(name, "vdevice")) {
+			if (!find_drc_child(parent, NULL, drc.index, path)) {
+				node = alloc_dr_node(&drc, VIO_DEV, path);
+				if (node) {
+					node->is_owned = 1;
+					if (init_node(node)) {
+						free(node);
+						node = NULL;
+					}
+				}
+			} else {
+				node = alloc_dr_node(&drc, VIO_DEV, parent);
+			}
+		} else if ((node_types & PCI_NODES) &&
+			   !strncmp(name, "pci@", 4)) {
+			node = alloc_dr_node(&drc, PCI_DLPAR_DEV, parent);
+			if (node && init_node(node)) {
+				free(node);
+				node = NULL;
+			}
+		}
+	}
+
+	if (node) {
+		say(DEBUG, "Found %s under %s\n", drc_name, parent);
+		correlate_bus_devices(node);
+	}
+
+	return node;
+}
+
 struct dr_node *
 get_node_by_name(const char *drc_name, uint32_t node_type)
 {
@@ -1019,6 +1521,12 @@ get_node_by_name(const char *drc_name, uint32_t node_type)
 	struct dr_node *prev_node = NULL;
 	int child_found = 0;
 
+	node = find_node_by_drc(drc_name, node_type);
+	if (node) {
+		print_node_list(node);
+		return node;
+	}
+
 	all_nodes = get_dlpar_nodes(node_type);
 	if (all_nodes == NULL) {
 		say(ERROR, "There are no DR capable slots on this system\n");
@@ -1117,7 +1625,7 @@ get_bus_id(char *loc_code)
 {
 	DIR *d;
 	struct dirent *ent;
-	char *dir = "/sys/bus/pci/slots";
+	char *dir = DR_ROOT "/sys/bus/pci/slots";
 	int inlen;
 	char *ptr;
 
@@ -1141,7 +1649,7 @@ get_bus_id(char *loc_code)
 		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
 			continue;
 
-		sprintf(path, "/sys/bus/pci/slots/%s/phy_location",
+		sprintf(path, DR_ROOT "/sys/bus/pci/slots/%s/phy_location",
 			ent->d_name);
 		f = fopen(path, "r");
 		if (f == NULL)
@@ -1223,6 +1731,7 @@ get_hp_adapter_status(char *drc_name)
 int
 set_hp_adapter_status(uint operation, char *slot_name)
 {
+	struct trace_span span;
 	int rc = 0;
 	FILE *file;
 	char *bus_id;
@@ -1244,6 +1753,8 @@ set_hp_adapter_status(uint operation, char *slot_name)
 		return -ENODEV;
 	}
 
+	/* The hotplug driver powers the slot before the write returns */
+	trace_begin(&span, TRACE_SYSFS, "slot-power");
 	rc = fwrite((operation+1 - 1) ? "1" : "0", 1, 1, file);
 	if (rc != 1)
 		rc = -EACCES;
@@ -1251,31 +1762,216 @@ set_hp_adapter_status(uint operation, char *slot_name)
 		rc = 0;
 
 	fclose(file);
+	trace_end(&span);
 	return rc;
 }
 
 /**
- * pci_rescan_bus
-*
+ * pci_write_rescan
+ * @brief Trigger a PCI rescan through a sysfs rescan attribute
+ *
+ * @param path path of the rescan attribute
  * @returns 0 on success, !0 otherwise
  */
-int
-pci_rescan_bus()
+static int pci_write_rescan(const char *path)
 {
+	struct trace_span span;
 	int rc = 0;
 	FILE *file;
 
-	file = fopen(PCI_RESCAN_PATH, "w");
+	file = fopen(path, "w");
 	if (file == NULL) {
-		say(ERROR, "failed ot open %s: %s\n", PCI_RESCAN_PATH, strerror(errno));
+		say(ERROR, "failed ot open %s: %s\n", path, strerror(errno));
 		return -ENODEV;
 	}
 
+	trace_begin(&span, TRACE_SYSFS, "pci-rescan");
 	rc = fwrite("1", 1, 1, file);
-	if (rc != 1)
+	rc = (rc == 1) ? 0 : -EACCES;
+
+	if (fclose(file))
 		rc = -EACCES;
+	trace_end(&span);
 
-	fclose(file);
+	return rc;
+}
+
+/**
+ * pci_rescan_bus
+ * @brief Rescan all PCI domains
+ *
+ * @returns 0 on success, !0 otherwise
+ */
+int
+pci_rescan_bus()
+{
+	return pci_write_rescan(PCI_RESCAN_PATH);
+}
+
+/* Rescans deferred until pci_rescan_flush(), by device tree path of the
+ * bridge whose bus is rescanned.  A global rescan supersedes them all.
+ */
+static char **rescan_paths;
+static int nr_rescan_paths;
+static int rescan_global;
+static pthread_mutex_t rescan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * pci_bus_rescan_path
+ * @brief Find the rescan attribute of the PCI bus below a bridge node
+ *
+ * The pci_bus class devices link to the device tree node of their
+ * bridge, for a root bus that is the PHB node.
+ *
+ * @param ofdt_path device tree path of the bridge
+ * @param path buffer for the rescan attribute path, DR_PATH_MAX bytes
+ * @returns 0 on success, !0 if the bus could not be found
+ */
+static int pci_bus_rescan_path(const char *ofdt_path, char *path)
+{
+	char target[PATH_MAX], link[PATH_MAX];
+	char *ofdt_real, *node_real;
+	struct dirent *de;
+	DIR *d;
+	int rc = -1;
+
+	ofdt_real = realpath(ofdt_path, target);
+	if (ofdt_real == NULL)
+		return -1;
+
+	d = opendir(PCI_BUS_CLASS_PATH);
+	if (d == NULL)
+		return -1;
+
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		snprintf(path, DR_PATH_MAX, "%s/%s/of_node",
+			 PCI_BUS_CLASS_PATH, de->d_name);
+		node_real = realpath(path, link);
+		if (node_real == NULL || strcmp(node_real, ofdt_real))
+			continue;
+
+		snprintf(path, DR_PATH_MAX, "%s/%s/rescan",
+			 PCI_BUS_CLASS_PATH, de->d_name);
+		rc = 0;
+		break;
+	}
+
+	closedir(d);
+	return rc;
+}
+
+/**
+ * pci_rescan_node
+ * @brief Rescan the PCI bus below a bridge device tree node
+ *
+ * Falls back to rescanning all PCI domains if the bus of the bridge
+ * can not be found in sysfs.
+ *
+ * @param ofdt_path device tree path of the bridge
+ * @returns 0 on success, !0 otherwise
+ */
+int pci_rescan_node(const char *ofdt_path)
+{
+	char path[DR_PATH_MAX];
+
+	if (pci_bus_rescan_path(ofdt_path, path)) {
+		say(DEBUG, "No PCI bus found for %s, rescanning all buses\n",
+		    ofdt_path);
+		return pci_rescan_bus();
+	}
+
+	say(DEBUG, "Rescanning PCI bus of %s\n", ofdt_path);
+	return pci_write_rescan(path);
+}
+
+/**
+ * pci_rescan_schedule
+ * @brief Queue a rescan of the PCI bus below a bridge node
+ *
+ * The rescan is done by pci_rescan_flush().  Rescans of the same bus
+ * are merged, a rescan of a bridge covers the buses below it.
+ *
+ * @param ofdt_path device tree path of the bridge, NULL to rescan all
+ *	  PCI buses
+ */
+void pci_rescan_schedule(const char *ofdt_path)
+{
+	char **paths;
+	size_t len;
+	int i;
+
+	pthread_mutex_lock(&rescan_lock);
+
+	if (ofdt_path == NULL) {
+		rescan_global = 1;
+		goto out;
+	}
+
+	len = strlen(ofdt_path);
+	for (i = 0; i < nr_rescan_paths; i++) {
+		size_t qlen = strlen(rescan_paths[i]);
+
+		/* Already covered by a queued rescan of this or a parent bridge */
+		if (!strncmp(ofdt_path, rescan_paths[i], qlen) &&
+		    (ofdt_path[qlen] == '\0' || ofdt_path[qlen] == '/'))
+			goto out;
+
+		/* Covers a queued rescan of a child bridge */
+		if (!strncmp(ofdt_path, rescan_paths[i], len) &&
+		    rescan_paths[i][len] == '/') {
+			free(rescan_paths[i]);
+			rescan_paths[i--] = rescan_paths[--nr_rescan_paths];
+		}
+	}
+
+	paths = realloc(rescan_paths, (nr_rescan_paths + 1) * sizeof(*paths));
+	if (paths == NULL) {
+		rescan_global = 1;
+		goto out;
+	}
+
+	rescan_paths = paths;
+	rescan_paths[nr_rescan_paths] = strdup(ofdt_path);
+	if (rescan_paths[nr_rescan_paths] == NULL)
+		rescan_global = 1;
+	else
+		nr_rescan_paths++;
+
+out:
+	pthread_mutex_unlock(&rescan_lock);
+}
+
+/**
+ * pci_rescan_flush
+ * @brief Do the PCI bus rescans queued by pci_rescan_schedule()
+ *
+ * @returns 0 on success, !0 if any of the rescans failed
+ */
+int pci_rescan_flush(void)
+{
+	int rc = 0;
+	int i;
+
+	pthread_mutex_lock(&rescan_lock);
+
+	if (rescan_global)
+		rc = pci_rescan_bus();
+
+	for (i = 0; i < nr_rescan_paths; i++) {
+		if (!rescan_global && pci_rescan_node(rescan_paths[i]))
+			rc = -1;
+		free(rescan_paths[i]);
+	}
+
+	free(rescan_paths);
+	rescan_paths = NULL;
+	nr_rescan_paths = 0;
+	rescan_global = 0;
+
+	pthread_mutex_unlock(&rescan_lock);
 	return rc;
 }
 
@@ -1353,6 +2049,7 @@ pci_remove_device(struct dr_node *node)
  */
 static int dlpar_io_kernel_op(const char *interface_file, const char *drc_name)
 {
+	struct trace_span span;
 	int rc = 0, len;
 	FILE *file;
 	int my_errno;
@@ -1371,9 +2068,11 @@ static int dlpar_io_kernel_op(const char *interface_file, const char *drc_name)
 			return -1;
     		}
 
+		trace_begin(&span, TRACE_SYSFS, "dlpar-io");
     		rc = fwrite(drc_name, 1, len, file);
 		my_errno = errno;
 		fclose(file);
+		trace_end(&span);
 
 		/* Success, note we do fwrite with the values
 		 * size = 1 and nitems = len.
@@ -27,8 +27,10 @@
 #include <unistd.h>
 #include <stdarg.h>
 #include <limits.h>
+#include <time.h>
 #include "rtas_calls.h"
 #include "drpci.h"
+#include "drtrace.h"
 
 extern int output_level;
 extern int log_fd;
@@ -54,9 +56,32 @@ static inline int is_dot_dir(char * _p)
 void * __zalloc(size_t, const char *, int);
 #define zalloc(x)	__zalloc((x), __func__, __LINE__);
 
-#define DR_LOCK_FILE    	"/var/lock/dr_config_lock"
-#define PLATFORMPATH    	"/proc/device-tree/device_type"
-#define OFDTPATH    		"/proc/ppc64/ofdt"
+/* Simple arena allocator for large numbers of small, same lifetime
+ * allocations (i.e. LMBs and their memory sections).  Memory handed out
+ * by an arena is zeroed and is only released by dr_arena_free().
+ */
+struct dr_arena_chunk {
+	struct dr_arena_chunk	*next;
+	size_t			size;
+	size_t			used;
+	/* DR_ARENA_ALIGN aligned, as malloc() aligns the chunk itself */
+	char			data[] __attribute__((aligned(16)));
+};
+
+struct dr_arena {
+	struct dr_arena_chunk	*chunks;
+	size_t			chunk_sz;
+};
+
+void dr_arena_init(struct dr_arena *, size_t);
+void *__dr_arena_zalloc(struct dr_arena *, size_t, const char *, int);
+#define dr_arena_zalloc(a, x)	__dr_arena_zalloc((a), (x), __func__, __LINE__)
+void dr_arena_free(struct dr_arena *);
+
+#define DR_LOCK_FILE    	DR_ROOT "/var/lock/dr_config_lock"
+#define DR_STATE_DIR		DR_ROOT "/var/lib/powerpc-utils"
+#define PLATFORMPATH    	DR_ROOT "/proc/device-tree/device_type"
+#define OFDTPATH    		DR_ROOT "/proc/ppc64/ofdt"
 #define DR_COMMAND		"drslot_chrp_%s"
 #define DRMIG_COMMAND		"drmig_chrp_%s"
 
@@ -78,6 +103,9 @@ extern char *usr_drc_name;
 extern uint32_t usr_drc_index;
 extern int usr_prompt;
 extern int usr_drc_count;
+extern int usr_batch_size;
+extern int usr_jobs;
+extern int usr_numa_node;
 extern enum drc_type usr_drc_type;
 extern char *usr_p_option;
 extern int pci_virtio;     /* qemu virtio device (legacy guest workaround) */
@@ -96,6 +124,7 @@ int say(enum say_level, char *, ...);
 void report_unknown_error(char *, int);
 int dr_init(void);
 void dr_fini(void);
+int load_dlpar_kmods(void);
 void set_timeout(int);
 int drmgr_timed_out(void);
 int dr_lock(void);
@@ -107,11 +136,17 @@ int add_device_tree_nodes(char *, struct of_node *);
 int remove_device_tree_nodes(const char *path);
 
 int update_property(const char *, size_t);
+void ofdt_close(void);
+int ofdt_txn_begin(void);
+int ofdt_txn_commit(void);
+int ofdt_txn_commit_all(void);
+void ofdt_txn_abort(void);
 int get_property(const char *, const char *, void *, size_t);
 int get_int_attribute(const char *, const char *, void *, size_t);
 int get_str_attribute(const char *, const char *, void *, size_t);
 int get_ofdt_uint_property(const char *, const char *, uint *);
 int get_property_size(const char *, const char *);
+int get_property_alloc(const char *, const char *, char **);
 int signal_handler(int, int, struct sigcontext *);
 int sig_setup(void);
 char *node_type(struct dr_node *);
@@ -171,7 +206,14 @@ enum drc_type to_drc_type(const char *);
 
 #define PRRN_TIMEOUT 30
 int handle_prrn(void);
+long elapsed_ms(struct timespec *);
+void prrn_progress(const char *, uint32_t *, int, int, int,
+		   struct timespec *);
 
 int kernel_dlpar_exists(void);
 int do_kernel_dlpar(const char *, int);
+
+int drmgr_request(int, char **);
+int drmgr_daemon(void);
+int drmgr_client(int, char **);
 #endif
@@ -0,0 +1,269 @@
+/**
+ * @file drc_cache.c
+ * @brief Persistent cache of the DRC connector lists of device tree nodes
+ *
+ * Copyright (c) 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "dr.h"
+#include "ofdt.h"
+
+/*
+ * The cache holds one file per device tree node, named after a hash of
+ * the node path.  A cache file is only used if the properties the list
+ * was built from are unchanged.  The kernel re-creates the sysfs file
+ * of a device tree property whenever the property is updated, so the
+ * inode number, size and ctime of the property files tell us that
+ * without having to read them.
+ */
+#define DRC_CACHE_DIR		DR_STATE_DIR "/drc_cache"
+#define DRC_CACHE_MAGIC		0x44524343	/* "DRCC" */
+#define DRC_CACHE_VERSION	1
+
+/* Connector lists smaller than this are cheap enough to rebuild */
+#define DRC_CACHE_MIN_DRCS	256
+
+static char *drc_v1_props[] = {"ibm,drc-names", "ibm,drc-types",
+			       "ibm,drc-indexes", "ibm,drc-power-domains",
+			       NULL};
+static char *drc_v2_props[] = {"ibm,drc-info", NULL};
+
+struct drc_cache_hdr {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	n_drcs;
+	uint32_t	n_props;
+	struct drc_cache_stamp stamps[DRC_CACHE_MAX_PROPS];
+	char		ofdt_path[DR_PATH_MAX];
+};
+
+struct drc_cache_entry {
+	uint32_t	index;
+	uint32_t	powerdomain;
+	char		name[DRC_STR_MAX];
+	char		type[DRC_STR_MAX];
+};
+
+/**
+ * drc_cache_file
+ * @brief Build the name of the cache file for a device tree node
+ *
+ * @param ofdt_path device tree path of the node
+ * @param fname buffer for the file name, DR_PATH_MAX bytes
+ */
+static void drc_cache_file(const char *ofdt_path, char *fname)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	const char *p;
+
+	/* FNV-1a */
+	for (p = ofdt_path; *p; p++) {
+		hash ^= (unsigned char)*p;
+		hash *= 0x100000001b3ULL;
+	}
+
+	snprintf(fname, DR_PATH_MAX, "%s/%016llx", DRC_CACHE_DIR,
+		 (unsigned long long)hash);
+}
+
+/**
+ * drc_cache_stamps
+ * @brief Fingerprint the properties a connector list is built from
+ *
+ * @param full_path full path of the device tree node
+ * @param v2 non-zero if the node has an ibm,drc-info property
+ * @param stamps DRC_CACHE_MAX_PROPS fingerprints to fill in
+ * @param n_props number of fingerprints filled in
+ * @returns 0 on success, !0 otherwise
+ */
+int drc_cache_stamps(const char *full_path, int v2,
+		     struct drc_cache_stamp *stamps, uint32_t *n_props)
+{
+	char fname[DR_PATH_MAX];
+	struct stat sbuf;
+	char **props;
+	int i;
+
+	props = v2 ? drc_v2_props : drc_v1_props;
+
+	for (i = 0; props[i]; i++) {
+		snprintf(fname, DR_PATH_MAX, "%s/%s", full_path, props[i]);
+		if (stat(fname, &sbuf))
+			return -1;
+
+		stamps[i].ino = sbuf.st_ino;
+		stamps[i].size = sbuf.st_size;
+		stamps[i].ctime_sec = sbuf.st_ctim.tv_sec;
+		stamps[i].ctime_nsec = sbuf.st_ctim.tv_nsec;
+	}
+
+	*n_props = i;
+	return 0;
+}
+
+/**
+ * drc_cache_load
+ * @brief Retrieve the connector list of a device tree node from the cache
+ *
+ * @param full_path full path of the device tree node
+ * @param ofdt_path device tree path the list is looked up by
+ * @param v2 non-zero if the node has an ibm,drc-info property
+ * @returns connector list on success, NULL if there is no valid cache entry
+ */
+struct dr_connector *drc_cache_load(const char *full_path,
+				    const char *ofdt_path, int v2)
+{
+	struct drc_cache_hdr *hdr, cur;
+	struct drc_cache_entry *entries;
+	struct dr_connector *list = NULL;
+	char fname[DR_PATH_MAX];
+	char *buf = NULL;
+	int size;
+	int i;
+
+	memset(&cur, 0, sizeof(cur));
+	if (drc_cache_stamps(full_path, v2, cur.stamps, &cur.n_props))
+		return NULL;
+
+	drc_cache_file(ofdt_path, fname);
+	size = get_property_alloc(fname, NULL, &buf);
+	if (size < (int)sizeof(*hdr))
+		goto out;
+
+	hdr = (struct drc_cache_hdr *)buf;
+	entries = (struct drc_cache_entry *)(hdr + 1);
+
+	if (hdr->magic != DRC_CACHE_MAGIC ||
+	    hdr->version != DRC_CACHE_VERSION ||
+	    hdr->n_drcs == 0 ||
+	    hdr->n_props != cur.n_props ||
+	    memcmp(hdr->stamps, cur.stamps, sizeof(cur.stamps)) ||
+	    strncmp(hdr->ofdt_path, ofdt_path, DR_PATH_MAX) ||
+	    (size - sizeof(*hdr)) / sizeof(*entries) != hdr->n_drcs)
+		goto out;
+
+	list = zalloc(hdr->n_drcs * sizeof(*list));
+	if (list == NULL)
+		goto out;
+
+	for (i = 0; i < hdr->n_drcs; i++) {
+		list[i].index = entries[i].index;
+		list[i].powerdomain = entries[i].powerdomain;
+		memcpy(list[i].name, entries[i].name, DRC_STR_MAX);
+		list[i].name[DRC_STR_MAX - 1] = '\0';
+		memcpy(list[i].type, entries[i].type, DRC_STR_MAX);
+		list[i].type[DRC_STR_MAX - 1] = '\0';
+		list[i].next = &list[i + 1];
+	}
+
+	list[hdr->n_drcs - 1].next = NULL;
+	snprintf(list->ofdt_path, DR_PATH_MAX, "%s", ofdt_path);
+	say(DEBUG, "Using cached DRC information for %s\n", ofdt_path);
+
+out:
+	if (buf)
+		free(buf);
+
+	return list;
+}
+
+/**
+ * drc_cache_store
+ * @brief Save the connector list of a device tree node to the cache
+ *
+ * Failures to update the cache are not fatal, the next invocation
+ * simply builds the list from the device tree again.
+ *
+ * @param full_path full path of the device tree node
+ * @param ofdt_path device tree path the list is looked up by
+ * @param v2 non-zero if the node has an ibm,drc-info property
+ * @param list connector list to save
+ */
+void drc_cache_store(const char *full_path, const char *ofdt_path, int v2,
+		     struct dr_connector *list)
+{
+	struct drc_cache_hdr *hdr;
+	struct drc_cache_entry *entries;
+	struct dr_connector *drc;
+	char fname[DR_PATH_MAX];
+	char tmpname[DR_PATH_MAX + 8];
+	size_t size;
+	int n_drcs = 0;
+	int fd, rc;
+
+	for (drc = list; drc; drc = drc->next)
+		n_drcs++;
+
+	if (n_drcs < DRC_CACHE_MIN_DRCS)
+		return;
+
+	size = sizeof(*hdr) + n_drcs * sizeof(*entries);
+	hdr = zalloc(size);
+	if (hdr == NULL)
+		return;
+
+	if (drc_cache_stamps(full_path, v2, hdr->stamps, &hdr->n_props)) {
+		free(hdr);
+		return;
+	}
+
+	hdr->magic = DRC_CACHE_MAGIC;
+	hdr->version = DRC_CACHE_VERSION;
+	hdr->n_drcs = n_drcs;
+	snprintf(hdr->ofdt_path, DR_PATH_MAX, "%s", ofdt_path);
+
+	entries = (struct drc_cache_entry *)(hdr + 1);
+	for (drc = list; drc; drc = drc->next, entries++) {
+		entries->index = drc->index;
+		entries->powerdomain = drc->powerdomain;
+		memcpy(entries->name, drc->name, DRC_STR_MAX);
+		memcpy(entries->type, drc->type, DRC_STR_MAX);
+	}
+
+	mkdir(DR_STATE_DIR, 0755);
+	mkdir(DRC_CACHE_DIR, 0755);
+
+	/* Write a temporary file and rename it so that concurrent readers
+	 * never see a partially written cache file.
+	 */
+	drc_cache_file(ofdt_path, fname);
+	snprintf(tmpname, sizeof(tmpname), "%s.%d", fname, getpid());
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		say(DEBUG, "Could not create DRC cache file %s: %s\n",
+		    tmpname, strerror(errno));
+		free(hdr);
+		return;
+	}
+
+	rc = write(fd, hdr, size);
+	close(fd);
+
+	if (rc != size || rename(tmpname, fname)) {
+		say(DEBUG, "Could not write DRC cache file %s\n", fname);
+		unlink(tmpname);
+	}
+
+	free(hdr);
+}
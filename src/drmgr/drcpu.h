@@ -23,8 +23,8 @@
 
 #include "dr.h"
 
-#define CPU_PROBE_FILE		"/sys/devices/system/cpu/probe"
-#define CPU_RELEASE_FILE	"/sys/devices/system/cpu/release"
+#define CPU_PROBE_FILE		DR_ROOT "/sys/devices/system/cpu/probe"
+#define CPU_RELEASE_FILE	DR_ROOT "/sys/devices/system/cpu/release"
 
 struct cache_info {
 	char		name[DR_BUF_SZ];	/* node name */
@@ -35,10 +35,24 @@ struct cache_info {
 	struct cache_info *next;		/* global list */
 };
 
+/* Entry of the sorted lookup tables of a dr_info */
+struct cpu_index {
+	uint32_t	key;			/* drc index or physical id */
+	struct dr_node	*cpu;
+	struct thread	*thread;
+};
+
 struct dr_info {
 	struct dr_node *all_cpus;
 	struct cache_info *all_caches;
 	struct thread *all_threads;
+
+	struct thread	**threads;		/* indexed by logical id */
+	int		nr_threads;
+	struct cpu_index *phys_ids;		/* threads by physical id */
+	int		nr_phys_ids;
+	struct cpu_index *drc_indexes;		/* cpus by drc index */
+	int		nr_drc_indexes;
 };
 
 int init_cpu_drc_info(struct dr_info *);
@@ -63,6 +77,11 @@ struct cache_info * cache_get_dependent_cache(struct cache_info *,
 					      struct dr_info *);
 int release_cpu(struct dr_node *, struct dr_info *);
 int probe_cpu(struct dr_node *, struct dr_info *);
+int probe_cpus(struct dr_node **, int, struct dr_info *);
 struct dr_node *get_available_cpu(struct dr_info *);
+struct dr_node *cpu_by_drc_index(struct dr_info *, uint32_t);
+struct thread *thread_by_id(struct dr_info *, int);
+
+int prrn_cpu(uint32_t *, int);
 
 #endif /* _H_DRCPU */
@@ -17,18 +17,9 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
+#include <time.h>
 #include "drpci.h"
 
-struct lmb_list_head {
-	struct dr_node	*lmbs;
-	struct dr_node	*last;
-	char		*drconf_buf;
-	int		drconf_buf_sz;
-	int		lmbs_modified;
-	int		sort;
-	int		lmbs_found;
-};
-
 struct drconf_mem {
 	uint64_t	address;
 	uint32_t	drc_index;
@@ -45,18 +36,75 @@ struct drconf_mem_v2 {
 	uint32_t	flags;
 } __attribute__((packed));
 
+/* Entry of the drc_index sorted lookup table of a lmb list */
+struct lmb_index {
+	uint32_t		drc_index;
+	struct dr_node		*lmb;
+	struct drconf_mem	*drmem;	/* NULL if not drconf memory */
+};
+
+/* Candidate lmb for a remove operation, see drmem_select.c */
+struct lmb_candidate {
+	struct dr_node	*lmb;
+	int		removable;
+	time_t		last_failure;	/* 0 if not failed recently */
+	int		tiebreak;
+};
+
+/* Priority queue of removal candidates, kept as a binary heap */
+struct lmb_queue {
+	struct lmb_candidate *heap;
+	int		nr;
+	int		sz;
+};
+
+struct lmb_list_head {
+	struct dr_node	*lmbs;
+	struct dr_node	*last;
+	char		*drconf_buf;
+	int		drconf_buf_sz;
+	int		lmbs_modified;
+	int		sort;
+	int		lmbs_found;
+	struct lmb_index *index;
+	int		index_cnt;
+	int		index_sz;
+	struct dr_arena	arena;	/* lmbs and memory sections */
+	int		scns_mode;
+	struct lmb_queue remove_queue;
+	struct dr_node	*queue_next;	/* next lmb to consider for the queue */
+	int		queue_active;
+};
+
 #define DRMEM_ASSIGNED		0x00000008
 #define DRMEM_DRC_INVALID	0x00000020
 
-#define MEM_PROBE_FILE		"/sys/devices/system/memory/probe"
-#define MEM_BLOCK_SIZE_BYTES	"/sys/devices/system/memory/block_size_bytes"
-#define DYNAMIC_RECONFIG_MEM	"/proc/device-tree/ibm,dynamic-reconfiguration-memory"
+#define MEM_PROBE_FILE		DR_ROOT "/sys/devices/system/memory/probe"
+#define MEM_BLOCK_SIZE_BYTES	DR_ROOT "/sys/devices/system/memory/block_size_bytes"
+#define DYNAMIC_RECONFIG_MEM	DR_ROOT "/proc/device-tree/ibm,dynamic-reconfiguration-memory"
 #define DYNAMIC_RECONFIG_MEM_V1	DYNAMIC_RECONFIG_MEM "/ibm,dynamic-memory"
 #define DYNAMIC_RECONFIG_MEM_V2	DYNAMIC_RECONFIG_MEM "/ibm,dynamic-memory-v2"
 
+#define LMB_FAILURE_FILE	DR_STATE_DIR "/drmgr_lmb_failures"
+
 #define LMB_NORMAL_SORT		0
 #define LMB_REVERSE_SORT	1
 #define LMB_RANDOM_SORT		2
 
-struct lmb_list_head *get_lmbs(unsigned int);
+/* When to discover the memory sections of owned LMBs */
+#define LMB_SCNS_LAZY		0	/* only for LMBs selected for DLPAR */
+#define LMB_SCNS_EAGER		1	/* for all LMBs when building the list */
+
+struct lmb_list_head *get_lmbs(unsigned int, int);
 void free_lmbs(struct lmb_list_head *);
+struct dr_node *find_lmb(struct lmb_list_head *, uint32_t);
+
+int lmb_node(struct dr_node *);
+time_t lmb_last_failure(uint32_t);
+void record_lmb_failure(uint32_t);
+void save_lmb_failures(void);
+int lmb_queue_push(struct lmb_queue *, struct dr_node *);
+struct dr_node *lmb_queue_pop(struct lmb_queue *);
+void lmb_queue_free(struct lmb_queue *);
+
+int prrn_mem(uint32_t *, int);
@@ -0,0 +1,401 @@
+/**
+ * @file drmem_select.c
+ * @brief Ranking of LMB candidates for memory DLPAR remove operations
+ *
+ * Copyright (c) 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <endian.h>
+#include <sys/stat.h>
+#include "dr.h"
+#include "ofdt.h"
+#include "drmem.h"
+
+/* Offline failures older than this no longer lower an LMB's priority */
+#define LMB_FAILURE_EXPIRE	(24 * 60 * 60)
+
+struct lmb_failure {
+	uint32_t	drc_index;
+	time_t		time;
+};
+
+static struct lmb_failure *lmb_failures;
+static int nr_lmb_failures;
+static int lmb_failures_sz;
+static int lmb_failures_loaded;
+
+static int *aa_index_nodes;
+static int nr_aa_index_nodes = -1;
+
+/**
+ * lmb_failure_add
+ * @brief Record an offline failure time for the specified drc index
+ *
+ * @param drc_index drc index of the failed lmb
+ * @param t time of the failure
+ */
+static void lmb_failure_add(uint32_t drc_index, time_t t)
+{
+	int i;
+
+	for (i = 0; i < nr_lmb_failures; i++) {
+		if (lmb_failures[i].drc_index == drc_index) {
+			if (lmb_failures[i].time < t)
+				lmb_failures[i].time = t;
+			return;
+		}
+	}
+
+	if (nr_lmb_failures == lmb_failures_sz) {
+		struct lmb_failure *failures;
+		int sz = lmb_failures_sz ? lmb_failures_sz * 2 : 64;
+
+		failures = realloc(lmb_failures, sz * sizeof(*failures));
+		if (failures == NULL)
+			return;
+
+		lmb_failures = failures;
+		lmb_failures_sz = sz;
+	}
+
+	lmb_failures[nr_lmb_failures].drc_index = drc_index;
+	lmb_failures[nr_lmb_failures].time = t;
+	nr_lmb_failures++;
+}
+
+/**
+ * load_lmb_failures
+ * @brief Read the history of LMBs that recently failed to offline
+ */
+static void load_lmb_failures(void)
+{
+	time_t now = time(NULL);
+	unsigned int drc_index;
+	long t;
+	FILE *fp;
+
+	if (lmb_failures_loaded)
+		return;
+
+	lmb_failures_loaded = 1;
+
+	fp = fopen(LMB_FAILURE_FILE, "r");
+	if (fp == NULL)
+		return;
+
+	while (fscanf(fp, "%x %ld\n", &drc_index, &t) == 2) {
+		if ((now - t) < LMB_FAILURE_EXPIRE)
+			lmb_failure_add(drc_index, t);
+	}
+
+	fclose(fp);
+}
+
+/**
+ * lmb_last_failure
+ * @brief Find the last time the specified LMB failed to offline
+ *
+ * @param drc_index drc index of the lmb
+ * @returns time of the last failure, 0 if it has not failed recently
+ */
+time_t lmb_last_failure(uint32_t drc_index)
+{
+	int i;
+
+	load_lmb_failures();
+
+	for (i = 0; i < nr_lmb_failures; i++) {
+		if (lmb_failures[i].drc_index == drc_index)
+			return lmb_failures[i].time;
+	}
+
+	return 0;
+}
+
+/**
+ * record_lmb_failure
+ * @brief Note that the specified LMB failed to offline
+ *
+ * @param drc_index drc index of the lmb
+ */
+void record_lmb_failure(uint32_t drc_index)
+{
+	load_lmb_failures();
+	lmb_failure_add(drc_index, time(NULL));
+}
+
+/**
+ * save_lmb_failures
+ * @brief Write the history of LMBs that failed to offline
+ *
+ * Failures to write the history are not fatal, they only mean that
+ * the next remove operation can not deprioritize these LMBs.
+ */
+void save_lmb_failures(void)
+{
+	time_t now = time(NULL);
+	FILE *fp;
+	int i;
+
+	if (!lmb_failures_loaded)
+		return;
+
+	mkdir(DR_STATE_DIR, 0755);
+	fp = fopen(LMB_FAILURE_FILE, "w");
+	if (fp == NULL) {
+		say(DEBUG, "Could not save LMB failure history to %s: %s\n",
+		    LMB_FAILURE_FILE, strerror(errno));
+	} else {
+		for (i = 0; i < nr_lmb_failures; i++) {
+			if ((now - lmb_failures[i].time) >= LMB_FAILURE_EXPIRE)
+				continue;
+
+			fprintf(fp, "%x %ld\n", lmb_failures[i].drc_index,
+				(long)lmb_failures[i].time);
+		}
+
+		fclose(fp);
+	}
+
+	free(lmb_failures);
+	lmb_failures = NULL;
+	nr_lmb_failures = lmb_failures_sz = 0;
+	lmb_failures_loaded = 0;
+}
+
+/**
+ * init_aa_index_nodes
+ * @brief Build the associativity index to NUMA node mapping
+ *
+ * Like the kernel, the node of an associativity array is the domain
+ * found at the first entry of ibm,associativity-reference-points.
+ */
+static void init_aa_index_nodes(void)
+{
+	uint32_t ref_points[2];
+	uint32_t *assoc_prop;
+	uint32_t assoc_entries, assoc_entry_sz;
+	uint32_t depth;
+	int assoc_prop_sz;
+	int i;
+
+	nr_aa_index_nodes = 0;
+
+	if (get_property(OFDT_BASE "/rtas", "ibm,associativity-reference-points",
+			 ref_points, sizeof(ref_points)))
+		return;
+
+	depth = be32toh(ref_points[0]);
+	if (depth == 0)
+		return;
+
+	assoc_prop_sz = get_property_size(DYNAMIC_RECONFIG_MEM,
+					  "ibm,associativity-lookup-arrays");
+	if (assoc_prop_sz <= 0)
+		return;
+
+	assoc_prop = zalloc(assoc_prop_sz);
+	if (!assoc_prop)
+		return;
+
+	if (get_property(DYNAMIC_RECONFIG_MEM,
+			 "ibm,associativity-lookup-arrays", assoc_prop,
+			 assoc_prop_sz)) {
+		free(assoc_prop);
+		return;
+	}
+
+	assoc_entries = be32toh(assoc_prop[0]);
+	assoc_entry_sz = be32toh(assoc_prop[1]);
+
+	if (depth > assoc_entry_sz ||
+	    (2 + assoc_entries * assoc_entry_sz) * sizeof(uint32_t) >
+							assoc_prop_sz) {
+		free(assoc_prop);
+		return;
+	}
+
+	aa_index_nodes = zalloc(assoc_entries * sizeof(*aa_index_nodes));
+	if (aa_index_nodes) {
+		for (i = 0; i < assoc_entries; i++)
+			aa_index_nodes[i] = be32toh(assoc_prop[2 +
+					(i * assoc_entry_sz) + depth - 1]);
+
+		nr_aa_index_nodes = assoc_entries;
+	}
+
+	free(assoc_prop);
+}
+
+/**
+ * lmb_node
+ * @brief Find the NUMA node of an LMB from its associativity index
+ *
+ * @param lmb lmb to find the node of
+ * @returns node id, -1 if it can not be determined
+ */
+int lmb_node(struct dr_node *lmb)
+{
+	if (nr_aa_index_nodes == -1)
+		init_aa_index_nodes();
+
+	if (lmb->lmb_aa_index >= nr_aa_index_nodes)
+		return -1;
+
+	return aa_index_nodes[lmb->lmb_aa_index];
+}
+
+/**
+ * lmb_candidate_cmp
+ * @brief Compare the priority of two candidate LMBs for removal
+ *
+ * Removable LMBs go first, then LMBs that have not failed to offline
+ * recently, then those whose failure is longest ago.  Remaining ties
+ * are broken randomly to spread removals across the partition.
+ *
+ * @returns <0 if a should be removed before b, >0 otherwise
+ */
+static int lmb_candidate_cmp(struct lmb_candidate *a, struct lmb_candidate *b)
+{
+	if (a->removable != b->removable)
+		return b->removable - a->removable;
+
+	if (a->last_failure != b->last_failure)
+		return (a->last_failure < b->last_failure) ? -1 : 1;
+
+	if (a->tiebreak != b->tiebreak)
+		return (a->tiebreak < b->tiebreak) ? -1 : 1;
+
+	return 0;
+}
+
+static void lmb_queue_swap(struct lmb_queue *queue, int i, int j)
+{
+	struct lmb_candidate tmp = queue->heap[i];
+
+	queue->heap[i] = queue->heap[j];
+	queue->heap[j] = tmp;
+}
+
+/**
+ * lmb_queue_push
+ * @brief Add a candidate LMB to the removal queue
+ *
+ * @param queue queue to add the lmb to
+ * @param lmb lmb to add
+ * @returns 0 on success, !0 otherwise
+ */
+int lmb_queue_push(struct lmb_queue *queue, struct dr_node *lmb)
+{
+	struct lmb_candidate *c;
+	int i;
+
+	if (queue->nr == queue->sz) {
+		struct lmb_candidate *heap;
+		int sz = queue->sz ? queue->sz * 2 : 256;
+
+		heap = realloc(queue->heap, sz * sizeof(*heap));
+		if (heap == NULL) {
+			say(ERROR, "Could not allocate LMB removal queue\n");
+			return -1;
+		}
+
+		queue->heap = heap;
+		queue->sz = sz;
+	}
+
+	i = queue->nr++;
+	c = &queue->heap[i];
+	c->lmb = lmb;
+	c->removable = lmb->is_removable;
+	c->last_failure = lmb_last_failure(lmb->drc_index);
+	c->tiebreak = rand();
+
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+
+		if (lmb_candidate_cmp(&queue->heap[i],
+				      &queue->heap[parent]) >= 0)
+			break;
+
+		lmb_queue_swap(queue, i, parent);
+		i = parent;
+	}
+
+	return 0;
+}
+
+/**
+ * lmb_queue_pop
+ * @brief Remove the highest priority LMB from the removal queue
+ *
+ * @param queue queue to take the lmb from
+ * @returns pointer to lmb, NULL if the queue is empty
+ */
+struct dr_node *lmb_queue_pop(struct lmb_queue *queue)
+{
+	struct dr_node *lmb;
+	int i = 0;
+
+	if (queue->nr == 0)
+		return NULL;
+
+	lmb = queue->heap[0].lmb;
+	queue->heap[0] = queue->heap[--queue->nr];
+
+	while (1) {
+		int left = 2 * i + 1;
+		int right = left + 1;
+		int min = i;
+
+		if (left < queue->nr &&
+		    lmb_candidate_cmp(&queue->heap[left],
+				      &queue->heap[min]) < 0)
+			min = left;
+
+		if (right < queue->nr &&
+		    lmb_candidate_cmp(&queue->heap[right],
+				      &queue->heap[min]) < 0)
+			min = right;
+
+		if (min == i)
+			break;
+
+		lmb_queue_swap(queue, i, min);
+		i = min;
+	}
+
+	return lmb;
+}
+
+/**
+ * lmb_queue_free
+ * @brief Free the memory referenced by a removal queue
+ *
+ * @param queue queue to free
+ */
+void lmb_queue_free(struct lmb_queue *queue)
+{
+	free(queue->heap);
+	queue->heap = NULL;
+	queue->nr = queue->sz = 0;
+}
@@ -30,7 +30,7 @@
 
 #include "options.c"
 
-#define DRMGR_ARGS	"ac:d:Iimnp:P:Qq:Rrs:w:t:hCVH"
+#define DRMGR_ARGS	"ab:c:d:Iij:mN:np:P:Qq:Rrs:w:t:hCVH"
 
 int output_level = 1; /* default to lowest output level */
 
@@ -41,6 +41,7 @@ int is_lsslot_cmd = 0;
 
 static int handle_prrn_event = 0;
 static int display_usage = 0;
+static int run_daemon = 0;
 
 typedef int (cmd_func_t)(void);
 typedef int (cmd_args_t)(void);
@@ -106,8 +107,14 @@ static struct command commands[] = {
 };
 
 static struct option long_options[] = {
+	{"batch",		required_argument, NULL, 'b'},
 	{"capabilities",	no_argument,	NULL, 'C'},
+	{"daemon",		no_argument,	NULL, 'D'},
 	{"help",		no_argument,	NULL, 'h'},
+	{"jobs",		required_argument, NULL, 'j'},
+	{"local",		no_argument,	NULL, 'L'},
+	{"node",		required_argument, NULL, 'N'},
+	{"trace",		required_argument, NULL, 'T'},
 	{0,0,0,0}
 };
 #define MAX_USAGE_LENGTH 512
@@ -118,7 +125,9 @@ command_usage(struct command *command) {
 	 * Display the common usage options
 	 */
 	fprintf(stderr, "Usage: drmgr %s",
-			"[-w minutes] [-d detail_level] [-C | --capabilities] [-h | --help]\n");
+			"[-w minutes] [-d detail_level] [-C | --capabilities] [-h | --help]\n"
+			"\t[--trace {summary | json:<file> | chrome:<file>}]\n"
+			"\t[--daemon | --local]\n");
 
 	/*
 	 * Now retrieve the command specific usage text
@@ -190,6 +199,9 @@ int parse_options(int argc, char *argv[])
 			usr_action = ADD;
 			action_cnt++;
 			break;
+		    case 'b':
+			usr_batch_size = strtol(optarg, NULL, 0);
+			break;
 		    case 'c':
 			usr_drc_type = to_drc_type(optarg);
 			break;
@@ -206,6 +218,12 @@ int parse_options(int argc, char *argv[])
 			usr_action = IDENTIFY;
 			action_cnt++;
 			break;
+		    case 'j':
+			usr_jobs = strtol(optarg, NULL, 0);
+			break;
+		    case 'N':
+			usr_numa_node = strtol(optarg, NULL, 0);
+			break;
 		    case 'n':
 			  /* The -n option is also used to specify a number of
 			   * seconds to attempt a self-arp.  Linux ignores this
@@ -257,6 +275,15 @@ int parse_options(int argc, char *argv[])
 		    case 'V': /* qemu virtio pci device (workaround) */
                         pci_virtio = 1;
                         break;
+		    case 'T': /* --trace only */
+			if (trace_init(optarg))
+				return -1;
+			break;
+		    case 'D': /* --daemon only */
+			run_daemon = 1;
+			break;
+		    case 'L': /* --local only, handled in main */
+			break;
 
 		    default:
 			say(ERROR, "Invalid option specified '%c'\n", optopt);
@@ -328,22 +355,32 @@ int drmgr(void) {
 	return -1;
 }
 
-int main(int argc, char *argv[])
+/**
+ * drmgr_request
+ * @brief Parse and run a drmgr command line
+ *
+ * This is run directly by main() and by the drmgr daemon on behalf of
+ * a client.
+ *
+ * @param argc
+ * @param argv
+ * @returns exit status of drmgr
+ */
+int drmgr_request(int argc, char *argv[])
 {
 	char log_msg[DR_PATH_MAX];
 	struct command *command;
 	int i, rc, offset;
 
-	switch (get_platform()) {
-	case PLATFORM_UNKNOWN:
-	case PLATFORM_POWERNV:
-	   fprintf(stderr, "%s: is not supported on the %s platform\n",
-						argv[0], platform_name);
-	   exit(1);
-	}
+	/* Requests run by the daemon do not inherit the daemon's options */
+	run_daemon = 0;
+	output_level = 1;
 
 	parse_options(argc, argv);
 
+	if (run_daemon)
+		return drmgr_daemon() ? 1 : 0;
+
 	rc = dr_init();
 	if (rc) {
 		if (handle_prrn_event) {
@@ -406,3 +443,30 @@ int main(int argc, char *argv[])
 	dr_fini();
 	return rc;
 }
+
+int main(int argc, char *argv[])
+{
+	int i, rc;
+
+	switch (get_platform()) {
+	case PLATFORM_UNKNOWN:
+	case PLATFORM_POWERNV:
+	   fprintf(stderr, "%s: is not supported on the %s platform\n",
+						argv[0], platform_name);
+	   exit(1);
+	}
+
+	/* Hand the request to the drmgr daemon if one is running */
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--local") || !strcmp(argv[i], "--daemon"))
+			break;
+	}
+
+	if (i == argc) {
+		rc = drmgr_client(argc, argv);
+		if (rc >= 0)
+			return rc;
+	}
+
+	return drmgr_request(argc, argv);
+}
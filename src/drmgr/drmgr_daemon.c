@@ -0,0 +1,812 @@
+/**
+ * @file drmgr_daemon.c
+ * @brief Long running drmgr that serves requests over a local socket
+ *
+ * Copyright (c) 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <linux/netlink.h>
+#include "dr.h"
+#include "ofdt.h"
+
+/*
+ * drmgr --daemon keeps the connector lists of the partition in memory.
+ * A plain drmgr invocation connects to the daemon and hands it its
+ * command line, working directory and stdin, stdout and stderr.  Each
+ * request runs in a child forked from the daemon, so it starts with
+ * the lists already built and with none of the state left behind by
+ * earlier requests.  The child takes the DR lock like any other drmgr,
+ * the daemon goes back to accepting requests as soon as it is forked
+ * and sends the exit status to the client once the child is reaped.
+ *
+ * The lists are fingerprinted before they are built, see
+ * drc_cache_stamps().  After each request, and shortly after a memory,
+ * cpu or pci uevent, the lists whose properties changed are rebuilt.
+ */
+#define DRMGR_SOCKET		DR_ROOT "/var/run/drmgr.sock"
+#define DRMGR_REQ_MAGIC		0x44524d52	/* "DRMR" */
+#define DRMGR_REQ_MAX		(64 * 1024)
+
+/* Time to wait for more uevents before refreshing the model, in ms */
+#define DRMGR_REFRESH_DELAY	100
+
+struct drmgr_req_hdr {
+	uint32_t	magic;
+	uint32_t	argc;
+	uint32_t	len;	/* cwd and arguments, each NUL terminated */
+};
+
+/* A device tree node whose connector list is kept in memory */
+struct model_node {
+	char			ofdt_path[DR_PATH_MAX];
+	int			v2;
+	uint32_t		n_props;
+	struct drc_cache_stamp	stamps[DRC_CACHE_MAX_PROPS];
+	int			seen;
+	struct model_node	*next;
+};
+
+/* A request running in a child of the daemon */
+struct drmgr_child {
+	pid_t			pid;
+	int			conn;	/* client waiting for the status */
+	char			*args;
+	const char		*op;	/* first argument, for messages */
+	struct drmgr_child	*next;
+};
+
+static struct model_node *model_nodes;
+static struct drmgr_child *drmgr_children;
+static volatile sig_atomic_t daemon_exit;
+static sigset_t daemon_sigmask;	/* signal mask outside of ppoll() */
+
+/**
+ * model_stamp
+ * @brief Fingerprint the connector properties of a device tree node
+ *
+ * @param ofdt_path device tree path of the node
+ * @param node model node to fill in the fingerprint of
+ * @returns 0 on success, !0 if the node has no connectors
+ */
+static int model_stamp(const char *ofdt_path, struct model_node *node)
+{
+	char fname[DR_PATH_MAX];
+	struct stat sbuf;
+	char *full_path;
+	int rc;
+
+	full_path = of_to_full_path(ofdt_path);
+	if (full_path == NULL)
+		return -1;
+
+	snprintf(fname, DR_PATH_MAX, "%s/ibm,drc-info", full_path);
+	node->v2 = !stat(fname, &sbuf);
+
+	rc = drc_cache_stamps(full_path, node->v2, node->stamps,
+			      &node->n_props);
+	free(full_path);
+	return rc;
+}
+
+/**
+ * model_add
+ * @brief Keep the connector list of a device tree node up to date
+ *
+ * The node is fingerprinted before its list is built, a change made
+ * while building the list is caught by the next refresh.
+ *
+ * @param ofdt_path device tree path of the node
+ */
+static void model_add(const char *ofdt_path)
+{
+	struct model_node cur, *node;
+
+	memset(&cur, 0, sizeof(cur));
+	if (model_stamp(ofdt_path, &cur))
+		return;
+
+	for (node = model_nodes; node; node = node->next) {
+		if (strcmp(node->ofdt_path, ofdt_path))
+			continue;
+
+		node->seen = 1;
+		if (node->v2 == cur.v2 && node->n_props == cur.n_props &&
+		    !memcmp(node->stamps, cur.stamps, sizeof(cur.stamps)))
+			return;
+
+		say(DEBUG, "Connectors of %s changed\n", ofdt_path);
+		drop_drc_info(ofdt_path);
+		break;
+	}
+
+	if (node == NULL) {
+		node = zalloc(sizeof(*node));
+		if (node == NULL)
+			return;
+
+		snprintf(node->ofdt_path, DR_PATH_MAX, "%s", ofdt_path);
+		node->next = model_nodes;
+		model_nodes = node;
+	}
+
+	node->v2 = cur.v2;
+	node->n_props = cur.n_props;
+	memcpy(node->stamps, cur.stamps, sizeof(cur.stamps));
+	node->seen = 1;
+
+	get_drc_info(ofdt_path);
+}
+
+/**
+ * model_refresh
+ * @brief Bring the in memory connector lists up to date
+ *
+ * These are the lists needed to find memory, cpus, PHBs, PCI slots
+ * and virtual devices.  Lists of nodes that went away are dropped.
+ */
+static void model_refresh(void)
+{
+	struct model_node **nodep, *node;
+	char path[DR_PATH_MAX];
+	struct dirent *de;
+	DIR *d;
+
+	for (node = model_nodes; node; node = node->next)
+		node->seen = 0;
+
+	model_add(OFDT_BASE);
+	model_add(CPU_OFDT_BASE);
+	model_add(OFDT_BASE "/vdevice");
+
+	d = opendir(OFDT_BASE);
+	if (d != NULL) {
+		while ((de = readdir(d)) != NULL) {
+			if (de->d_type != DT_DIR ||
+			    strncmp(de->d_name, "pci@", 4))
+				continue;
+
+			snprintf(path, DR_PATH_MAX, "%s/%s", OFDT_BASE,
+				 de->d_name);
+			model_add(path);
+		}
+		closedir(d);
+	}
+
+	nodep = &model_nodes;
+	while ((node = *nodep) != NULL) {
+		if (node->seen) {
+			nodep = &node->next;
+			continue;
+		}
+
+		drop_drc_info(node->ofdt_path);
+		*nodep = node->next;
+		free(node);
+	}
+}
+
+/**
+ * uevent_open
+ * @brief Listen for kernel uevents
+ *
+ * @returns socket on success, -1 if uevents are not available
+ */
+static int uevent_open(void)
+{
+	struct sockaddr_nl addr;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+		    NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * uevent_read
+ * @brief Drain the pending uevents
+ *
+ * @param fd uevent socket
+ * @returns 1 if the model may need a refresh, 0 otherwise
+ */
+static int uevent_read(int fd)
+{
+	char buf[4096];
+	ssize_t len;
+	char *p, *end;
+	int changed = 0;
+
+	while ((len = recv(fd, buf, sizeof(buf) - 1, 0)) != 0) {
+		if (len < 0) {
+			/* Events were lost if the socket buffer overran */
+			if (errno == ENOBUFS)
+				changed = 1;
+			if (errno != EINTR)
+				break;
+			continue;
+		}
+
+		buf[len] = '\0';
+		end = buf + len;
+
+		for (p = buf; p < end; p += strlen(p) + 1) {
+			if (!strcmp(p, "SUBSYSTEM=memory") ||
+			    !strcmp(p, "SUBSYSTEM=cpu") ||
+			    !strcmp(p, "SUBSYSTEM=pci") ||
+			    !strcmp(p, "SUBSYSTEM=vio"))
+				changed = 1;
+		}
+	}
+
+	return changed;
+}
+
+/**
+ * daemon_socket
+ * @brief Create the socket requests are accepted on
+ *
+ * @returns socket on success, -1 on failure
+ */
+static int daemon_socket(void)
+{
+	struct sockaddr_un addr;
+	mode_t old_mode;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", DRMGR_SOCKET);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		say(ERROR, "Could not create socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	/* A socket left behind by a daemon that went away is replaced,
+	 * one that a daemon still listens on is not.
+	 */
+	if (!connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		say(ERROR, "A drmgr daemon is already running\n");
+		close(fd);
+		return -1;
+	}
+	unlink(DRMGR_SOCKET);
+
+	old_mode = umask(077);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(fd, 16)) {
+		say(ERROR, "Could not listen on %s: %s\n", DRMGR_SOCKET,
+		    strerror(errno));
+		umask(old_mode);
+		close(fd);
+		return -1;
+	}
+	umask(old_mode);
+
+	return fd;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	ssize_t rc;
+
+	while (len) {
+		rc = read(fd, buf, len);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			return -1;
+
+		buf = (char *)buf + rc;
+		len -= rc;
+	}
+
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	ssize_t rc;
+
+	while (len) {
+		rc = write(fd, buf, len);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			return -1;
+
+		buf = (const char *)buf + rc;
+		len -= rc;
+	}
+
+	return 0;
+}
+
+/**
+ * recv_request
+ * @brief Receive the header and standard descriptors of a request
+ *
+ * @param conn client connection
+ * @param hdr request header to fill in
+ * @param fds stdin, stdout and stderr of the client
+ * @returns 0 on success, !0 otherwise
+ */
+static int recv_request(int conn, struct drmgr_req_hdr *hdr, int *fds)
+{
+	char cbuf[CMSG_SPACE(3 * sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t len;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = hdr;
+	iov.iov_len = sizeof(*hdr);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	len = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+	if (len != sizeof(*hdr))
+		return -1;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+		return -1;
+
+	memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+
+	if (hdr->magic != DRMGR_REQ_MAGIC || hdr->argc == 0 ||
+	    hdr->len == 0 || hdr->len > DRMGR_REQ_MAX) {
+		close(fds[0]);
+		close(fds[1]);
+		close(fds[2]);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * run_request
+ * @brief Start a request in a child of the daemon
+ *
+ * @param argc number of arguments
+ * @param args working directory followed by the arguments
+ * @param fds stdin, stdout and stderr of the client
+ * @returns pid of the child, -1 on failure
+ */
+static pid_t run_request(int argc, char *args, int *fds)
+{
+	char *cwd = args;
+	char **argv;
+	pid_t pid;
+	int i;
+
+	argv = zalloc((argc + 1) * sizeof(*argv));
+	if (argv == NULL)
+		return -1;
+
+	args += strlen(args) + 1;
+	for (i = 0; i < argc; i++) {
+		argv[i] = args;
+		args += strlen(args) + 1;
+	}
+	argv[argc] = NULL;
+
+	fflush(NULL);
+
+	pid = fork();
+	if (pid < 0) {
+		say(ERROR, "Could not fork request: %s\n", strerror(errno));
+		free(argv);
+		return -1;
+	}
+
+	if (pid == 0) {
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		signal(SIGCHLD, SIG_DFL);
+		sigprocmask(SIG_SETMASK, &daemon_sigmask, NULL);
+
+		if (dup2(fds[0], 0) < 0 || dup2(fds[1], 1) < 0 ||
+		    dup2(fds[2], 2) < 0 || chdir(cwd))
+			_exit(1);
+
+		/* Restart option parsing for the request */
+		optind = 0;
+		exit(drmgr_request(argc, argv));
+	}
+
+	free(argv);
+	return pid;
+}
+
+/**
+ * reap_children
+ * @brief Send the exit status of finished requests to their clients
+ *
+ * @param wait_all wait for every running request to finish
+ * @returns number of requests reaped
+ */
+static int reap_children(int wait_all)
+{
+	struct drmgr_child **pp, *child;
+	int32_t status;
+	int wstatus, reaped = 0;
+	pid_t pid;
+
+	while (drmgr_children) {
+		pid = waitpid(-1, &wstatus, wait_all ? 0 : WNOHANG);
+		if (pid < 0 && errno == EINTR)
+			continue;
+		if (pid <= 0)
+			break;
+
+		for (pp = &drmgr_children; *pp; pp = &(*pp)->next) {
+			if ((*pp)->pid == pid)
+				break;
+		}
+
+		child = *pp;
+		if (child == NULL)
+			continue;
+		*pp = child->next;
+
+		if (WIFEXITED(wstatus)) {
+			status = WEXITSTATUS(wstatus);
+		} else {
+			say(ERROR, "drmgr request %s killed by signal %d\n",
+			    child->op, WTERMSIG(wstatus));
+			status = 1;
+		}
+
+		write_full(child->conn, &status, sizeof(status));
+		close(child->conn);
+		free(child->args);
+		free(child);
+		reaped++;
+	}
+
+	return reaped;
+}
+
+/**
+ * serve_request
+ * @brief Handle a connection from a drmgr client
+ *
+ * The connection is closed here, or once the request is reaped if it
+ * was started.
+ *
+ * @param conn client connection
+ */
+static void serve_request(int conn)
+{
+	struct drmgr_child *child = NULL;
+	struct drmgr_req_hdr hdr;
+	struct ucred cred;
+	socklen_t cred_len = sizeof(cred);
+	char *args = NULL, *p;
+	int32_t status = 1;
+	int fds[3];
+	int i, n;
+
+	if (recv_request(conn, &hdr, fds)) {
+		close(conn);
+		return;
+	}
+
+	/* The cwd and each of the arguments must be NUL terminated */
+	args = zalloc(hdr.len);
+	if (args == NULL || read_full(conn, args, hdr.len) ||
+	    args[hdr.len - 1] != '\0')
+		goto out;
+
+	for (p = args, n = 0; p < args + hdr.len; p += strlen(p) + 1)
+		n++;
+
+	if (n != hdr.argc + 1)
+		goto out;
+
+	if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) ||
+	    (cred.uid != 0 && cred.uid != getuid())) {
+		dprintf(fds[2], "drmgr: permission denied\n");
+		goto out;
+	}
+
+	child = zalloc(sizeof(*child));
+	if (child == NULL)
+		goto out;
+
+	child->pid = run_request(hdr.argc, args, fds);
+	if (child->pid < 0)
+		goto out;
+
+	/* skip the cwd and the program name */
+	p = args + strlen(args) + 1;
+	p += strlen(p) + 1;
+	child->op = hdr.argc > 1 ? p : "";
+	child->conn = conn;
+	child->args = args;
+	child->next = drmgr_children;
+	drmgr_children = child;
+
+	for (i = 0; i < 3; i++)
+		close(fds[i]);
+	return;
+
+out:
+	for (i = 0; i < 3; i++)
+		close(fds[i]);
+
+	write_full(conn, &status, sizeof(status));
+	close(conn);
+
+	if (child)
+		free(child);
+	if (args)
+		free(args);
+}
+
+static void daemon_sighandler(int sig)
+{
+	daemon_exit = 1;
+}
+
+/* Only there to interrupt ppoll(), the children are reaped by the
+ * main loop.
+ */
+static void daemon_sigchld(int sig)
+{
+}
+
+/**
+ * drmgr_daemon
+ * @brief Serve drmgr requests until terminated
+ *
+ * @returns 0 on success, !0 otherwise
+ */
+int drmgr_daemon(void)
+{
+	struct sigaction sigact;
+	struct pollfd pfds[2];
+	struct timespec delay;
+	sigset_t sigchld;
+	int sock, uevent_fd;
+	int dirty = 0;
+	int conn, rc;
+
+	if (!valid_platform("chrp"))
+		return -1;
+
+	sock = daemon_socket();
+	if (sock < 0)
+		return -1;
+
+	uevent_fd = uevent_open();
+	if (uevent_fd < 0)
+		say(WARN, "Could not listen for uevents, the device tree is "
+		    "only checked for changes after each request\n");
+
+	if (load_dlpar_kmods())
+		say(WARN, "The rpadlpar_io module is not available\n");
+
+	memset(&sigact, 0, sizeof(sigact));
+	sigact.sa_handler = daemon_sighandler;
+	sigaction(SIGTERM, &sigact, NULL);
+	sigaction(SIGINT, &sigact, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	/* SIGCHLD is only delivered while waiting in ppoll(), so a request
+	 * finishing can not be missed between reaping and polling.
+	 */
+	sigact.sa_handler = daemon_sigchld;
+	sigaction(SIGCHLD, &sigact, NULL);
+	sigemptyset(&sigchld);
+	sigaddset(&sigchld, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &sigchld, &daemon_sigmask);
+
+	delay.tv_sec = DRMGR_REFRESH_DELAY / 1000;
+	delay.tv_nsec = (DRMGR_REFRESH_DELAY % 1000) * 1000000;
+
+	model_refresh();
+	say(INFO, "drmgr daemon listening on %s\n", DRMGR_SOCKET);
+
+	pfds[0].fd = sock;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = uevent_fd;
+	pfds[1].events = POLLIN;
+
+	while (!daemon_exit) {
+		rc = ppoll(pfds, uevent_fd < 0 ? 1 : 2,
+			   dirty ? &delay : NULL, &daemon_sigmask);
+
+		/* The requests most likely changed the device tree */
+		if (reap_children(0))
+			dirty = 1;
+
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+
+			say(ERROR, "ppoll failed: %s\n", strerror(errno));
+			break;
+		}
+
+		/* Wait for a burst of uevents to settle before refreshing */
+		if (rc == 0) {
+			model_refresh();
+			dirty = 0;
+			continue;
+		}
+
+		if (uevent_fd >= 0 && (pfds[1].revents & POLLIN))
+			dirty |= uevent_read(uevent_fd);
+
+		if (!(pfds[0].revents & POLLIN))
+			continue;
+
+		conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+		if (conn < 0)
+			continue;
+
+		/* Checking the fingerprints is cheap, do it before every
+		 * request in case a drmgr --local changed the device tree.
+		 */
+		model_refresh();
+		dirty = 0;
+
+		serve_request(conn);
+	}
+
+	/* Let the clients of the running requests know how they ended */
+	reap_children(1);
+
+	close(sock);
+	unlink(DRMGR_SOCKET);
+	if (uevent_fd >= 0)
+		close(uevent_fd);
+
+	free_drc_info();
+	return 0;
+}
+
+/**
+ * drmgr_client
+ * @brief Hand a drmgr invocation to the drmgr daemon
+ *
+ * @param argc
+ * @param argv
+ * @returns exit status of the request, -1 if no daemon is running
+ */
+int drmgr_client(int argc, char *argv[])
+{
+	char cbuf[CMSG_SPACE(3 * sizeof(int))];
+	int fds[3] = {0, 1, 2};
+	struct drmgr_req_hdr hdr;
+	struct sockaddr_un addr;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	char cwd[DR_PATH_MAX];
+	char *args, *p;
+	int32_t status;
+	size_t len;
+	int fd, i;
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", DRMGR_SOCKET);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+
+	len = strlen(cwd) + 1;
+	for (i = 0; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+
+	if (len > DRMGR_REQ_MAX) {
+		close(fd);
+		return -1;
+	}
+
+	args = zalloc(len);
+	if (args == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	p = stpcpy(args, cwd) + 1;
+	for (i = 0; i < argc; i++)
+		p = stpcpy(p, argv[i]) + 1;
+
+	hdr.magic = DRMGR_REQ_MAGIC;
+	hdr.argc = argc;
+	hdr.len = len;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(cbuf, 0, sizeof(cbuf));
+	iov.iov_base = &hdr;
+	iov.iov_len = sizeof(hdr);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	/* Nothing has run yet if the request could not be sent, it is
+	 * safe to run it here instead.
+	 */
+	if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(hdr) ||
+	    write_full(fd, args, len)) {
+		free(args);
+		close(fd);
+		return -1;
+	}
+	free(args);
+
+	if (read_full(fd, &status, sizeof(status))) {
+		fprintf(stderr, "drmgr: lost the connection to the drmgr "
+			"daemon\n");
+		status = 1;
+	}
+
+	close(fd);
+	return status;
+}
@@ -29,6 +29,7 @@
 #include <inttypes.h>
 #include <dirent.h>
 #include <time.h>
+#include <pthread.h>
 #include <librtas.h>
 #include "dr.h"
 #include "ofdt.h"
@@ -41,9 +42,33 @@ struct pmap_struct {
 	char			*name;
 };
 
-#define SYSFS_HIBERNATION_FILE	"/sys/devices/system/power/hibernate"
-#define SYSFS_MIGRATION_FILE	"/sys/kernel/mobility/migration"
-#define SYSFS_MIGRATION_API_FILE "/sys/kernel/mobility/api_version"
+/* After a migration, one thread retrieves the device tree updates from
+ * firmware while another applies them, connected by a queue of ops.
+ */
+#define DEVTREE_OP_DEL		1
+#define DEVTREE_OP_PROP		2
+#define DEVTREE_OP_ADD		3
+
+struct devtree_op {
+	struct devtree_op	*next;
+	int			type;
+	unsigned int		phandle;	/* parent phandle for adds */
+	char			*cmd;		/* property update command */
+	size_t			len;
+	struct of_node		*nodes;		/* nodes to add */
+};
+
+struct devtree_queue {
+	struct devtree_op	*head;
+	struct devtree_op	**tail;
+	int			done;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+};
+
+#define SYSFS_HIBERNATION_FILE	DR_ROOT "/sys/devices/system/power/hibernate"
+#define SYSFS_MIGRATION_FILE	DR_ROOT "/sys/kernel/mobility/migration"
+#define SYSFS_MIGRATION_API_FILE DR_ROOT "/sys/kernel/mobility/api_version"
 
 /* drmgr must call ibm,suspend-me and is responsible for postmobility fixups */
 #define MIGRATION_API_V0	0
@@ -53,7 +78,19 @@ struct pmap_struct {
  */
 #define MIGRATION_API_V1	1
 
-static struct pmap_struct *plist;
+/* Phandles are looked up in a hash table that is filled lazily, the
+ * device tree is only scanned as far as needed to find the phandles
+ * firmware reports updates for.
+ */
+#define PHANDLE_HASH_BITS	12
+#define PHANDLE_HASH_SIZE	(1 << PHANDLE_HASH_BITS)
+
+static struct pmap_struct *phandle_hash[PHANDLE_HASH_SIZE];
+
+/* device tree directories not yet scanned for phandles */
+static char **phandle_dirs;
+static int nr_phandle_dirs;
+static int phandle_dirs_sz;
 static char *pmig_usagestr = "-m -p {check | pre} -s <stream_id>";
 static char *phib_usagestr = "-m -p {check | pre} -s <stream_id> -n <self-arp secs>";
 
@@ -77,6 +114,12 @@ phib_usage(char **pusage)
 	*pusage = phib_usagestr;
 }
 
+static unsigned int
+phandle_hash_fn(unsigned int phandle)
+{
+	return (phandle * 2654435761U) >> (32 - PHANDLE_HASH_BITS);
+}
+
 /**
  * add_phandle
  *
@@ -85,146 +128,299 @@ phib_usage(char **pusage)
  * @param ibmphandle
  */
 static void
-add_phandle(char *name, unsigned int phandle, int ibmphandle)
+add_phandle(const char *name, unsigned int phandle, int ibmphandle)
 {
 	struct pmap_struct *pm = zalloc(sizeof(struct pmap_struct));
+	unsigned int hash = phandle_hash_fn(phandle);
+
+	if (pm == NULL)
+		return;
 
 	if (strlen(name) == 0)
 		name = "/";
 
 	pm->name = zalloc(strlen(name)+strlen(OFDT_BASE)+1);
+	if (pm->name == NULL) {
+		free(pm);
+		return;
+	}
 	sprintf(pm->name, "%s%s", OFDT_BASE, name);
 
 	pm->phandle = phandle;
 	pm->ibmphandle = ibmphandle;
-	pm->next = plist;
-	plist = pm;
+	pm->next = phandle_hash[hash];
+	phandle_hash[hash] = pm;
 }
 
 /**
- * find_phandle
+ * push_phandle_dir
+ * @brief Queue a device tree directory to be scanned for phandles
  *
- * @param ph
- * @returns
+ * @param path full path of the directory
+ * @returns 0 on success, !0 otherwise
  */
-static char *
-find_phandle(unsigned int ph)
+static int
+push_phandle_dir(const char *path)
 {
-	struct pmap_struct *pms = plist;
+	char *dir;
 
-	while (pms && pms->phandle != ph)
-		pms = pms->next;
+	if (nr_phandle_dirs == phandle_dirs_sz) {
+		char **dirs;
+		int sz = phandle_dirs_sz ? phandle_dirs_sz * 2 : 256;
 
-	return pms ? pms->name : NULL;
+		dirs = realloc(phandle_dirs, sz * sizeof(*dirs));
+		if (dirs == NULL)
+			return -1;
+
+		phandle_dirs = dirs;
+		phandle_dirs_sz = sz;
+	}
+
+	dir = strdup(path);
+	if (dir == NULL)
+		return -1;
+
+	phandle_dirs[nr_phandle_dirs++] = dir;
+	return 0;
 }
 
 /**
- * add_phandles
+ * read_phandle
  *
- * @param parent
- * @param p
- * @returns
+ * @param path full path of the node
+ * @param prop phandle property name
+ * @param phandle phandle value on return
+ * @returns 0 on success, !0 otherwise
  */
 static int
-add_phandles(char *parent, char *p)
+read_phandle(const char *path, const char *prop, unsigned int *phandle)
 {
-	DIR *d;
-	struct dirent *de;
-	char path[PATH_MAX];
-	unsigned int phandle;
-	char *pend;
-	FILE *fd;
+	char fname[PATH_MAX];
+	int fd, rc;
 
-	strcpy(path,parent);
-	if (strlen(p)) {
-		strcat(path,"/");
-		strcat(path,p);
+	snprintf(fname, PATH_MAX, "%s/%s", path, prop);
+	fd = open(fname, O_RDONLY);
+	if (fd < 0) {
+		perror(fname);
+		return -1;
+	}
+
+	rc = read(fd, phandle, sizeof(*phandle));
+	close(fd);
+
+	if (rc != sizeof(*phandle)) {
+		perror(fname);
+		say(DEBUG, "Error reading phandle data!\n");
+		return -1;
 	}
-	pend = path + strlen(path);
+
+	return 0;
+}
+
+/**
+ * scan_phandle_dir
+ * @brief Add the phandles of one device tree node to the hash table
+ *
+ * Subdirectories are queued to be scanned later.
+ *
+ * @param path full path of the node
+ */
+static void
+scan_phandle_dir(const char *path)
+{
+	struct dirent *de;
+	unsigned int phandle;
+	char subdir[PATH_MAX];
+	const char *name = path + strlen(DR_ROOT "/proc/device-tree");
+	int have_linux = 0, have_ibm = 0;
+	DIR *d;
 
 	d = opendir(path);
 	if (d == NULL) {
 		perror(path);
-		return 1;
+		return;
 	}
 
+	/* One pass over the directory finds both the child nodes and the
+	 * phandle properties, without probing for the property files.
+	 */
 	while ((de = readdir(d))) {
-		if ((de->d_type == DT_DIR) &&
-		    (strcmp(de->d_name,".")) &&
-		    (strcmp(de->d_name,"..")))
-			add_phandles(path,de->d_name);
-	}
-
-	strcpy(pend,"/linux,phandle");
-	fd = fopen(path,"r");
-	if (fd != NULL) {
-		if (fread(&phandle,sizeof(phandle),1,fd) != 1) {
-			perror(path);
-			say(DEBUG, "Error reading phandle data!\n");
-			fclose(fd);
-			return 1;
+		if (de->d_type == DT_DIR) {
+			if (!strcmp(de->d_name, ".") ||
+			    !strcmp(de->d_name, ".."))
+				continue;
+
+			snprintf(subdir, PATH_MAX, "%s/%s", path, de->d_name);
+			push_phandle_dir(subdir);
+		} else if (!strcmp(de->d_name, "linux,phandle")) {
+			have_linux = 1;
+		} else if (!strcmp(de->d_name, "ibm,phandle")) {
+			have_ibm = 1;
 		}
-		*pend = '\0';
-		add_phandle(path + strlen("/proc/device-tree"),phandle, 0);
-		fclose(fd);
 	}
 
-	strcpy(pend,"/ibm,phandle");
-	fd = fopen(path,"r");
-	if (fd != NULL) {
-		if (fread(&phandle,sizeof(phandle),1,fd) != 1) {
-			perror(path);
-			say(DEBUG, "Error reading phandle data!\n");
-			fclose(fd);
-			return 1;
-		}
-		*pend = '\0';
-		add_phandle(path + strlen("/proc/device-tree"), phandle, 1);
-		fclose(fd);
+	closedir(d);
+
+	/* ibm,phandle is added last so that it is found first, as it
+	 * has always been.
+	 */
+	if (have_linux && !read_phandle(path, "linux,phandle", &phandle))
+		add_phandle(name, phandle, 0);
+
+	if (have_ibm && !read_phandle(path, "ibm,phandle", &phandle))
+		add_phandle(name, phandle, 1);
+}
+
+/**
+ * find_phandle
+ *
+ * Scans queued device tree directories until the phandle is found.
+ *
+ * @param ph
+ * @returns
+ */
+static char *
+find_phandle(unsigned int ph)
+{
+	struct pmap_struct *pms;
+	char *dir;
+
+	while (1) {
+		pms = phandle_hash[phandle_hash_fn(ph)];
+		while (pms && pms->phandle != ph)
+			pms = pms->next;
+
+		if (pms || nr_phandle_dirs == 0)
+			break;
+
+		dir = phandle_dirs[--nr_phandle_dirs];
+		scan_phandle_dir(dir);
+		free(dir);
 	}
 
-	closedir(d);
-	return 0;
+	return pms ? pms->name : NULL;
 }
 
 /**
- * do_update
+ * add_phandles
+ * @brief Start a lazy phandle lookup of the device tree
  *
- * @param cmd
- * @param len
+ * @param path
  * @returns 0 on success, !0 otherwise
  */
 static int
-do_update(char *cmd, int len)
+add_phandles(const char *path)
 {
-	int rc;
-	int i, fd;
+	struct stat sbuf;
 
-	fd = open(OFDTPATH, O_WRONLY);
-	if (fd == -1) {
-		say(ERROR, "Failed to open %s: %s\n", OFDTPATH,
-		    strerror(errno));
-		return -1;
+	if (stat(path, &sbuf)) {
+		perror(path);
+		return 1;
 	}
 
-	say(DEBUG, "len %d\n", len);
+	return push_phandle_dir(path);
+}
 
-	if ((rc = write(fd, cmd, len)) != len)
-		say(ERROR, "Error writing to ofdt file! rc %d errno %d\n",
-		    rc, errno);
+/**
+ * free_phandles
+ *
+ */
+static void
+free_phandles(void)
+{
+	struct pmap_struct *pm;
+	int i;
+
+	for (i = 0; i < PHANDLE_HASH_SIZE; i++) {
+		while ((pm = phandle_hash[i]) != NULL) {
+			phandle_hash[i] = pm->next;
+			free(pm->name);
+			free(pm);
+		}
+	}
+
+	while (nr_phandle_dirs)
+		free(phandle_dirs[--nr_phandle_dirs]);
+
+	free(phandle_dirs);
+	phandle_dirs = NULL;
+	phandle_dirs_sz = 0;
+}
+
+/**
+ * devtree_queue_push
+ * @brief Hand a list of ops to the thread applying them
+ *
+ * @param queue
+ * @param ops first op of the list
+ * @param tail next pointer of the last op of the list
+ */
+static void
+devtree_queue_push(struct devtree_queue *queue, struct devtree_op *ops,
+		   struct devtree_op **tail)
+{
+	if (ops == NULL)
+		return;
+
+	pthread_mutex_lock(&queue->lock);
+	*queue->tail = ops;
+	queue->tail = tail;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * devtree_queue_op
+ * @brief Queue a single op
+ *
+ * @param queue
+ * @param type DEVTREE_OP_* type of the op
+ * @param phandle
+ * @param nodes nodes to add for DEVTREE_OP_ADD
+ */
+static void
+devtree_queue_op(struct devtree_queue *queue, int type, unsigned int phandle,
+		 struct of_node *nodes)
+{
+	struct devtree_op *op = zalloc(sizeof(*op));
 
-	for (i = 0; i < len; i++) {
-		if (! isprint(cmd[i]))
-			cmd[i] = '.';
-		if (isspace(cmd[i]))
-			cmd[i] = ' ';
+	if (op == NULL) {
+		if (nodes)
+			free_of_node(nodes);
+		return;
 	}
-	cmd[len-1] = 0x00;
 
-	say(DEBUG, "<%s>\n", cmd);
+	op->type = type;
+	op->phandle = phandle;
+	op->nodes = nodes;
+	devtree_queue_push(queue, op, &op->next);
+}
 
-	close(fd);
-	return rc;
+/**
+ * devtree_queue_pop
+ * @brief Wait for the next op to apply
+ *
+ * @param queue
+ * @returns next op, NULL once all ops have been retrieved
+ */
+static struct devtree_op *
+devtree_queue_pop(struct devtree_queue *queue)
+{
+	struct devtree_op *op;
+
+	pthread_mutex_lock(&queue->lock);
+	while (queue->head == NULL && !queue->done)
+		pthread_cond_wait(&queue->cond, &queue->lock);
+
+	op = queue->head;
+	if (op) {
+		queue->head = op->next;
+		if (queue->head == NULL)
+			queue->tail = &queue->head;
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return op;
 }
 
 /**
@@ -236,27 +432,56 @@ static void
 del_node(unsigned int phandle)
 {
 	char *name = find_phandle(phandle);
-	char delcmd[128] = "remove_node ";
 
 	if (name == NULL)
 		say(DEBUG, "Delete node error: Invalid phandle %8.8x", phandle);
-	else {
-		strcat(delcmd,name);
-		do_update(delcmd, strlen(delcmd));
+	else
+		remove_device_tree_nodes(name);
+}
+
+/**
+ * prop_op_add
+ * @brief Add a property update command to a list of ops
+ *
+ * @param tail next pointer of the last op of the list, updated on return
+ * @param cmd allocated command, the op takes ownership
+ * @param len length of the command
+ */
+static void
+prop_op_add(struct devtree_op ***tail, char *cmd, size_t len)
+{
+	struct devtree_op *op = zalloc(sizeof(*op));
+
+	if (op == NULL) {
+		free(cmd);
+		return;
 	}
+
+	op->type = DEVTREE_OP_PROP;
+	op->cmd = cmd;
+	op->len = len;
+	**tail = op;
+	*tail = &op->next;
 }
 
 /**
  * update_properties
  *
+ * The property updates of the node are queued as one batch once all
+ * of them have been retrieved.
+ *
+ * @param queue
  * @param phandle
  * @returns 0 on success, !0 otherwise
  */
 static int
-update_properties(unsigned int phandle)
+update_properties(struct devtree_queue *queue, unsigned int phandle)
 {
+	struct trace_span span;
 	int rc;
-	char cmd[DR_PATH_MAX];
+	struct devtree_op *ops = NULL;
+	struct devtree_op **tail = &ops;
+	char *cmd;
 	char *longcmd = NULL;
 	char *newcmd;
 	int cmdlen = 0;
@@ -269,7 +494,6 @@ update_properties(unsigned int phandle)
 	char *pname;
 	unsigned int i;
 	int more = 0;
-	char *name = find_phandle(phandle);
 	int initial = 1;
 
 	memset(wa, 0x00, 16);
@@ -277,15 +501,17 @@ update_properties(unsigned int phandle)
 
 	do {
 		say(DEBUG, "about to call rtas_update_properties.  work area:\n"
-		    "phandle %8.8x, node %s\n"
+		    "phandle %8.8x\n"
 		    " %8.8x %8.8x %8.8x %8.8x\n",
-		    phandle, name ? name : "NULL", wa[0], wa[1], wa[2], wa[3]);
+		    phandle, wa[0], wa[1], wa[2], wa[3]);
 
+		trace_begin(&span, TRACE_RTAS, "update-properties");
 		rc = rtas_update_properties((char *)wa, 1);
+		trace_end(&span);
 		if (rc && rc != 1) {
 			say(DEBUG, "Error %d from rtas_update_properties()\n",
 			    rc);
-			return 1;
+			break;
 		}
 
 		say(DEBUG, "successful rtas_update_properties (more %d)\n", rc);
@@ -323,16 +549,20 @@ update_properties(unsigned int phandle)
 
 			switch (vd) {
 			    case 0x00000000:
-				say(DEBUG, "%s - name only property %s\n",
-				    name, pname);
+				say(DEBUG, "%8.8x - name only property %s\n",
+				    phandle, pname);
 				break;
 
 			    case 0x80000000:
-				say(DEBUG, "%s - delete property %s\n", name,
-				    pname);
+				say(DEBUG, "%8.8x - delete property %s\n",
+				    phandle, pname);
+				cmd = zalloc(strlen(pname) + 32);
+				if (cmd == NULL)
+					break;
+
 				sprintf(cmd,"remove_property %u %s",
 					phandle, pname);
-				do_update(cmd, strlen(cmd) + 1);
+				prop_op_add(&tail, cmd, strlen(cmd) + 1);
 				break;
 
 			default:
@@ -346,8 +576,8 @@ update_properties(unsigned int phandle)
 					more = 0;
 				}
 
-				say(DEBUG, "%s - updating property %s length "
-				    "%d\n", name, pname, vd);
+				say(DEBUG, "%8.8x - updating property %s length "
+				    "%d\n", phandle, pname, vd);
 
 				/* See if we have a partially completed
 				 * command
@@ -383,8 +613,7 @@ update_properties(unsigned int phandle)
 					sprintf(longcmd+lenpos,"%06d",proplen);
 					longcmd[lenpos+6] = ' ';
 
-					do_update(longcmd, cmdlen);
-					free(longcmd);
+					prop_op_add(&tail, longcmd, cmdlen);
 					longcmd = NULL;
 					cmdlen = 0;
 					proplen = 0;
@@ -395,24 +624,24 @@ update_properties(unsigned int phandle)
 		}
 	} while (rc == 1);
 
-	return 0;
+	free(longcmd);
+	devtree_queue_push(queue, ops, tail);
+
+	return (rc && rc != 1) ? 1 : 0;
 }
 
 /**
  * add_new_node
  *
  * @param phandle
- * @param drcindex
+ * @param new_nodes nodes returned from configure_connector
  */
 static void
-add_new_node(unsigned int phandle, unsigned int drcindex)
+add_new_node(unsigned int phandle, struct of_node *new_nodes)
 {
 	char *path;
 	int rtas_rc;
-	struct of_node *new_nodes;/* nodes returned from configure_connector */
 
-	new_nodes = configure_connector(drcindex);
-	
 	path = find_phandle(phandle);
 	if (path == NULL) {
 		say(DEBUG, "Cannot find pnahdle %x\n", phandle);
@@ -427,82 +656,102 @@ add_new_node(unsigned int phandle, unsigned int drcindex)
 /**
  * del_nodes
  *
+ * @param queue
  * @param op
  * @param n
  */
 static void
-del_nodes(unsigned int *op, unsigned int n)
+del_nodes(struct devtree_queue *queue, unsigned int *op, unsigned int n)
 {
 	unsigned int i, phandle;
 
 	for (i = 0; i < n; i++) {
 		phandle = *op++;
 		say(DEBUG, "Delete node with phandle %8.8x\n", phandle);
-		del_node(phandle);
+		devtree_queue_op(queue, DEVTREE_OP_DEL, phandle, NULL);
 	}
 }
 
 /**
  * update_nodes
  *
+ * @param queue
  * @param op
  * @param n
  */
 static void
-update_nodes(unsigned int *op, unsigned int n)
+update_nodes(struct devtree_queue *queue, unsigned int *op, unsigned int n)
 {
 	unsigned int i, phandle;
 
 	for (i = 0; i < n; i++) {
 		phandle = *op++;
 		say(DEBUG, "Update node with phandle %8.8x\n", phandle);
-		update_properties(phandle);
+		update_properties(queue, phandle);
 	}
 }
 
 /**
  * add_nodes
  *
+ * @param queue
  * @param op
  * @param n
  */
 static void
-add_nodes(unsigned int *op, unsigned int n)
+add_nodes(struct devtree_queue *queue, unsigned int *op, unsigned int n)
 {
 	unsigned int i, pphandle, drcindex;
+	struct of_node *new_nodes;
 
 	for (i = 0; i < n; i++) {
 		pphandle = *op++;
 		drcindex = *op++;
 		say(DEBUG, "Add node with parent phandle %8.8x and drc index "
 		    "%8.8x\n", pphandle, drcindex);
-		add_new_node(pphandle, drcindex);
+
+		new_nodes = configure_connector(drcindex);
+		if (new_nodes == NULL) {
+			say(DEBUG, "configure_connector failed for %8.8x\n",
+			    drcindex);
+			continue;
+		}
+
+		devtree_queue_op(queue, DEVTREE_OP_ADD, pphandle, new_nodes);
 	}
 }
 
 /**
- * devtree_update
+ * devtree_fetch
+ * @brief Retrieve the device tree updates from firmware
+ *
+ * All RTAS calls of the update are made here, the ops are queued for
+ * devtree_update() to apply.
  *
+ * @param arg device tree op queue
  */
-static void
-devtree_update(void)
+static void *
+devtree_fetch(void *arg)
 {
+	struct devtree_queue *queue = arg;
+	struct trace_span span;
 	int rc;
 	unsigned int wa[1024];
 	unsigned int *op;
 
-	say(DEBUG, "Updating device_tree\n");
-	if (add_phandles("/proc/device-tree",""))
-		return;
-
 	/* First 16 bytes of work area must be initialized to zero */
 	memset(wa, 0x00, 16);
 
 	do {
+		trace_begin(&span, TRACE_RTAS, "update-nodes");
 		rc = rtas_update_nodes((char *)wa, 1);
+		trace_end(&span);
 		if (rc && rc != 1) {
+			/* Firmware has already made the updates reported
+			 * so far, apply them anyway.
+			 */
 			say(DEBUG, "Error %d from rtas_update_nodes()\n", rc);
-			return;
+			break;
 		}
 
 		say(DEBUG, "successful rtas_update_nodes (more %d)\n", rc);
@@ -518,15 +767,15 @@ devtree_update(void)
 
 			switch (*op & 0xFF000000) {
 			    case 0x01000000:
-				del_nodes(op+1, *op & 0x00FFFFFF);
+				del_nodes(queue, op+1, *op & 0x00FFFFFF);
 				break;
 
 			    case 0x02000000:
-				update_nodes(op+1, *op & 0x00FFFFFF);
+				update_nodes(queue, op+1, *op & 0x00FFFFFF);
 				break;
 
 			    case 0x03000000:
-				add_nodes(op+1, *op & 0x00FFFFFF);
+				add_nodes(queue, op+1, *op & 0x00FFFFFF);
 				break;
 
 			    case 0x00000000:
@@ -541,6 +790,83 @@ devtree_update(void)
 		}
 	} while (rc == 1);
 
+	pthread_mutex_lock(&queue->lock);
+	queue->done = 1;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+
+	return NULL;
+}
+
+/**
+ * devtree_update
+ *
+ * Firmware is asked for the next updates while the previous ones are
+ * applied.  The updates are collected in one device tree transaction,
+ * so that repeated updates of a property are merged and the kernel's
+ * tree is updated in a single pass.  An update the kernel rejects is
+ * skipped, as firmware has already applied it.
+ */
+static void
+devtree_update(void)
+{
+	struct devtree_queue queue;
+	struct devtree_op *op;
+	pthread_t fetcher;
+	int threaded;
+
+	say(DEBUG, "Updating device_tree\n");
+	if (add_phandles(DR_ROOT "/proc/device-tree"))
+		return;
+
+	if (ofdt_txn_begin()) {
+		free_phandles();
+		return;
+	}
+
+	memset(&queue, 0, sizeof(queue));
+	queue.tail = &queue.head;
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_cond_init(&queue.cond, NULL);
+
+	threaded = !pthread_create(&fetcher, NULL, devtree_fetch, &queue);
+	if (!threaded)
+		devtree_fetch(&queue);
+
+	while ((op = devtree_queue_pop(&queue)) != NULL) {
+		switch (op->type) {
+		    case DEVTREE_OP_DEL:
+			del_node(op->phandle);
+			break;
+
+		    case DEVTREE_OP_PROP:
+			update_property(op->cmd, op->len);
+			break;
+
+		    case DEVTREE_OP_ADD:
+			add_new_node(op->phandle, op->nodes);
+			break;
+		}
+
+		if (op->nodes)
+			free_of_node(op->nodes);
+		free(op->cmd);
+		free(op);
+	}
+
+	if (threaded)
+		pthread_join(fetcher, NULL);
+
+	pthread_cond_destroy(&queue.cond);
+	pthread_mutex_destroy(&queue.lock);
+
+	/* Firmware has already made these changes, write every update
+	 * the kernel takes rather than reverting on the first failure.
+	 */
+	if (ofdt_txn_commit_all())
+		say(ERROR, "Could not update the device tree\n");
+
+	free_phandles();
 	say(DEBUG, "leaving\n");
 }
 
@@ -25,12 +25,13 @@
 #include "ofdt.h"
 
 /* PCI Hot Plug  defs  */
-#define PHP_SYSFS_ADAPTER_PATH	"/sys/bus/pci/slots/%s/adapter"
-#define PHP_SYSFS_POWER_PATH	"/sys/bus/pci/slots/%s/power"
+#define PHP_SYSFS_ADAPTER_PATH	DR_ROOT "/sys/bus/pci/slots/%s/adapter"
+#define PHP_SYSFS_POWER_PATH	DR_ROOT "/sys/bus/pci/slots/%s/power"
 #define PHP_CONFIG_ADAPTER	1
 #define PHP_UNCONFIG_ADAPTER	0
 
-#define PCI_RESCAN_PATH         "/sys/bus/pci/rescan"
+#define PCI_RESCAN_PATH         DR_ROOT "/sys/bus/pci/rescan"
+#define PCI_BUS_CLASS_PATH	DR_ROOT "/sys/class/pci_bus"
 
 /* The following defines are used for adapter status */
 #define EMPTY		0
@@ -47,21 +48,21 @@
 #define CPU_DEV		8
 #define MEM_DEV		9
 
-#define ADD_SLOT_FNAME    	"/sys/bus/pci/slots/control/add_slot"
-#define ADD_SLOT_FNAME2    	"/sys/bus/pci/slots/control/\"add_slot\""
-#define REMOVE_SLOT_FNAME    	"/sys/bus/pci/slots/control/remove_slot"
-#define REMOVE_SLOT_FNAME2    	"/sys/bus/pci/slots/control/\"remove_slot\""
+#define ADD_SLOT_FNAME    	DR_ROOT "/sys/bus/pci/slots/control/add_slot"
+#define ADD_SLOT_FNAME2    	DR_ROOT "/sys/bus/pci/slots/control/\"add_slot\""
+#define REMOVE_SLOT_FNAME    	DR_ROOT "/sys/bus/pci/slots/control/remove_slot"
+#define REMOVE_SLOT_FNAME2    	DR_ROOT "/sys/bus/pci/slots/control/\"remove_slot\""
 
-#define IGNORE_HP_PO_PROP	"/proc/device-tree/ibm,ignore-hp-po-fails-for-dlpar"
+#define IGNORE_HP_PO_PROP	DR_ROOT "/proc/device-tree/ibm,ignore-hp-po-fails-for-dlpar"
 
 extern char *add_slot_fname;
 extern char *remove_slot_fname;
 
-#define HEA_ADD_SLOT		"/sys/bus/ibmebus/probe"
-#define HEA_REMOVE_SLOT		"/sys/bus/ibmebus/remove"
+#define HEA_ADD_SLOT		DR_ROOT "/sys/bus/ibmebus/probe"
+#define HEA_REMOVE_SLOT		DR_ROOT "/sys/bus/ibmebus/remove"
 /* %s is the loc-code of the HEA adapter for *_PORT defines */
-#define HEA_ADD_PORT		"/sys/bus/ibmebus/devices/%s/probe_port"
-#define HEA_REMOVE_PORT		"/sys/bus/ibmebus/devices/%s/remove_port"
+#define HEA_ADD_PORT		DR_ROOT "/sys/bus/ibmebus/devices/%s/probe_port"
+#define HEA_REMOVE_PORT		DR_ROOT "/sys/bus/ibmebus/devices/%s/remove_port"
 
 #define PCI_NODES	0x00000001
 #define VIO_NODES	0x00000002
@@ -77,6 +78,9 @@ void free_node(struct dr_node *);
 int get_hp_adapter_status(char *);
 int set_hp_adapter_status(uint, char *);
 int pci_rescan_bus();
+int pci_rescan_node(const char *);
+void pci_rescan_schedule(const char *);
+int pci_rescan_flush(void);
 int pci_remove_device(struct dr_node *);
 int release_hp_children_from_node(struct dr_node *);
 int release_hp_children(char *);
@@ -25,6 +25,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <time.h>
 #include <librtas.h>
 #include "dr.h"
 #include "drcpu.h"
@@ -66,20 +67,6 @@ get_cpu_by_name(struct dr_info *drinfo, const char *name)
 	return cpu;
 }
 
-static struct dr_node *
-get_cpu_by_index(struct dr_info *drinfo, uint32_t index)
-{
-	struct dr_node *cpu;
-
-	for (cpu = drinfo->all_cpus; cpu; cpu = cpu->next) {
-		if (cpu->drc_index == index) {
-			break;
-		}
-	}
-
-	return cpu;
-}
-
 /**
  * cpu_count
  *
@@ -134,7 +121,7 @@ static struct dr_node *get_available_cpu_by_index(struct dr_info *dr_info)
 {
 	struct dr_node *cpu;
 
-	cpu = get_cpu_by_index(dr_info, usr_drc_index);
+	cpu = cpu_by_drc_index(dr_info, usr_drc_index);
 	if (!cpu) {
 		say(ERROR, "Could not locate CPU with drc index %x\n",
 		    usr_drc_index);
@@ -217,6 +204,75 @@ struct dr_node *get_available_cpu(struct dr_info *dr_info)
 	return cpu;
 }
 
+/**
+ * add_cpu_batch
+ *
+ * Add the requested number of cpus in batches, see probe_cpus().  The
+ * available cpus are taken from the end of the cpu list, like
+ * get_next_available_cpu() does.  Cpus that fail are replaced by the
+ * next batch.
+ *
+ * @returns 0 on success, !0 otherwise
+ */
+static int add_cpu_batch(struct dr_info *dr_info)
+{
+	struct dr_node **cpus, *cpu;
+	uint count = 0;
+	int i, nr, nr_avail;
+
+	cpus = zalloc(usr_drc_count * sizeof(*cpus));
+	if (cpus == NULL)
+		return 1;
+
+	while (count < usr_drc_count) {
+		if (drmgr_timed_out())
+			break;
+
+		nr_avail = 0;
+		for (cpu = dr_info->all_cpus; cpu; cpu = cpu->next) {
+			if (!cpu->unusable && !cpu->is_owned)
+				nr_avail++;
+		}
+
+		nr = usr_drc_count - count;
+		if (nr > nr_avail)
+			nr = nr_avail;
+		if (nr == 0) {
+			say(ERROR, "Could not find available cpu.\n");
+			break;
+		}
+
+		/* skip the available cpus that are not needed */
+		i = 0;
+		for (cpu = dr_info->all_cpus; cpu; cpu = cpu->next) {
+			if (cpu->unusable || cpu->is_owned)
+				continue;
+
+			if (nr_avail-- <= nr)
+				cpus[i++] = cpu;
+		}
+
+		probe_cpus(cpus, nr, dr_info);
+
+		for (i = 0; i < nr; i++) {
+			/* do not pick a cpu that failed again */
+			if (!cpus[i]->is_owned)
+				cpus[i]->unusable = 1;
+
+			if (cpus[i]->unusable)
+				continue;
+
+			fprintf(stdout, "%s\n", cpus[i]->drc_name);
+			count++;
+		}
+	}
+
+	free(cpus);
+	say(DEBUG, "Acquired %d of %d requested cpu(s).\n", count,
+	    usr_drc_count);
+	return count < usr_drc_count ? 1 : 0;
+}
+
 /**
  * add_cpus
  *
@@ -237,6 +293,10 @@ static int add_cpus(struct dr_info *dr_info)
 	uint count;
 	struct dr_node *cpu = NULL;
 
+	/* Without a specific cpu to add, add all of them at once */
+	if (usr_drc_count > 1 && !usr_drc_name && !usr_drc_index)
+		return add_cpu_batch(dr_info);
+
 	count = 0;
 	while (count < usr_drc_count) {
 		if (drmgr_timed_out())
@@ -361,7 +421,7 @@ static int smt_threads_func(struct dr_info *dr_info)
 			rc = cpu_disable_smt(cpu);
 
 	} else if (usr_drc_index) {
-		cpu = get_cpu_by_index(dr_info, usr_drc_index);
+		cpu = cpu_by_drc_index(dr_info, usr_drc_index);
 		if (cpu == NULL) {
 			say(ERROR, "Could not find cpu %x\n", usr_drc_index);
 			return -1;
@@ -403,6 +463,94 @@ int valid_cpu_options(void)
 	return 0;
 }
 
+/**
+ * prrn_cpu
+ * @brief Remove and re-add the cpus named by a PRRN event
+ *
+ * The cpu information is gathered once for all of the cpus.  They are
+ * then cycled usr_batch_size at a time, the cpus of a batch are released
+ * one after the other and probed again together, see probe_cpus().
+ *
+ * @param drc_indexes drc indexes of the cpus, without duplicates
+ * @param nr number of cpus
+ * @returns 0 on success, !0 if the cpus could not be updated at all
+ */
+int prrn_cpu(uint32_t *drc_indexes, int nr)
+{
+	struct dr_info dr_info;
+	struct dr_node **batch, *cpu;
+	struct timespec start;
+	int batch_sz = MAX(usr_batch_size, 1);
+	int nr_batch, nr_done = 0, nr_updated = 0;
+	int i, j;
+
+	if (!cpu_dlpar_capable()) {
+		say(ERROR, "CPU DLPAR capability is not enabled on this "
+		    "platform.\n");
+		return -1;
+	}
+
+	if (init_cpu_drc_info(&dr_info)) {
+		say(ERROR, "Could not initialize Dynamic Reconfiguration "
+		    "information.\n");
+		return -1;
+	}
+
+	batch = zalloc(batch_sz * sizeof(*batch));
+	if (batch == NULL) {
+		free_cpu_drc_info(&dr_info);
+		return -1;
+	}
+
+	for (i = 0; i < nr; i += j) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		set_timeout(PRRN_TIMEOUT);
+
+		nr_batch = 0;
+		for (j = 0; j < batch_sz && i + j < nr; j++) {
+			cpu = cpu_by_drc_index(&dr_info, drc_indexes[i + j]);
+			if (cpu == NULL) {
+				say(ERROR, "Could not locate CPU with drc "
+				    "index %x\n", drc_indexes[i + j]);
+				continue;
+			}
+
+			if (!cpu->is_owned) {
+				say(DEBUG, "CPU %s is not present\n",
+				    cpu->drc_name);
+				continue;
+			}
+
+			if (cpu_count(&dr_info) == 1) {
+				say(WARN, "Cannot remove the last CPU\n");
+				continue;
+			}
+
+			if (release_cpu(cpu, &dr_info)) {
+				say(ERROR, "Could not release CPU %s\n",
+				    cpu->drc_name);
+				online_cpu(cpu, &dr_info);
+				continue;
+			}
+
+			cpu->is_owned = 0;
+			batch[nr_batch++] = cpu;
+		}
+
+		if (nr_batch)
+			nr_updated += probe_cpus(batch, nr_batch, &dr_info);
+
+		nr_done += j;
+		prrn_progress("CPU", &drc_indexes[i], j, nr_done, nr, &start);
+	}
+
+	say(INFO, "Updated %d of %d CPUs\n", nr_updated, nr);
+
+	free(batch);
+	free_cpu_drc_info(&dr_info);
+	return 0;
+}
+
 int drslot_chrp_cpu(void)
 {
 	struct dr_info dr_info;
@@ -26,6 +26,7 @@
 #include <dirent.h>
 #include <inttypes.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include "dr.h"
@@ -35,7 +36,7 @@
 static int block_sz_bytes = 0;
 static char *state_strs[] = {"offline", "online"};
 
-static char *usagestr = "-c mem {-a | -r} {-q <quantity> -p {variable_weight | ent_capacity} | {-q <quantity> | -s [<drc_name> | <drc_index>]}}";
+static char *usagestr = "-c mem {-a | -r} {-q <quantity> -p {variable_weight | ent_capacity} | {-q <quantity> [-b <batch_size>] [-j <jobs>] [-N <node>] | -s [<drc_name> | <drc_index>]}}";
 
 /**
  * mem_usage
@@ -96,7 +97,22 @@ get_phandle(char *path, uint *phandle)
 void
 free_lmbs(struct lmb_list_head *lmb_list)
 {
-	free_node(lmb_list->lmbs);
+	struct dr_node *lmb;
+
+	/* The lmbs and their memory sections are allocated from the
+	 * lmb_list arena, only the OF nodes hanging off of them need
+	 * to be freed separately.
+	 */
+	for (lmb = lmb_list->lmbs; lmb; lmb = lmb->next) {
+		if (lmb->lmb_of_node)
+			free_of_node(lmb->lmb_of_node);
+	}
+
+	dr_arena_free(&lmb_list->arena);
+	lmb_queue_free(&lmb_list->remove_queue);
+
+	if (lmb_list->index)
+		free(lmb_list->index);
 
 	if (lmb_list->drconf_buf)
 		free(lmb_list->drconf_buf);
@@ -109,10 +125,11 @@ free_lmbs(struct lmb_list_head *lmb_list)
  * @brief Find the memory sections associated with the specified lmb
  *
  * @param lmb lmb to find memory sections of
+ * @param lmb_list lmb list head the lmb belongs to
  * @return 0 on success, !0 otherwise
  */
 static int
-get_mem_scns(struct dr_node *lmb)
+get_mem_scns(struct dr_node *lmb, struct lmb_list_head *lmb_list)
 {
 	uint32_t lmb_sz = lmb->lmb_size;
 	uint64_t phys_addr = lmb->lmb_address;
@@ -121,6 +138,9 @@ get_mem_scns(struct dr_node *lmb)
 
 	mem_scn = phys_addr / block_sz_bytes;
 
+	lmb->lmb_mem_scns = NULL;
+	lmb->lmb_scns_valid = 1;
+
 	/* Assume the lmb is removable.  If we find a non-removable memory
 	 * section then we flip the lmb back to not removable.
 	 */
@@ -128,15 +148,20 @@ get_mem_scns(struct dr_node *lmb)
 
 	lmb_sz = lmb->lmb_size;
 	while (lmb_sz > 0) {
-		char *sysfs_path = "/sys/devices/system/memory/memory%d";
+		char *sysfs_path = DR_ROOT "/sys/devices/system/memory/memory%d";
+		char path[DR_PATH_MAX];
 		struct mem_scn *scn;
 		struct stat sbuf;
+		int len;
+
+		len = sprintf(path, sysfs_path, mem_scn);
 
-		scn = zalloc(sizeof(*scn));
+		scn = dr_arena_zalloc(&lmb_list->arena, sizeof(*scn) + len + 1);
 		if (scn == NULL)
 			return -1;
 
-		sprintf(scn->sysfs_path, sysfs_path, mem_scn);
+		scn->sysfs_path = (char *)(scn + 1);
+		memcpy(scn->sysfs_path, path, len + 1);
 		scn->phys_addr = phys_addr;
 
 		if (!stat(scn->sysfs_path, &sbuf)) {
@@ -164,6 +189,27 @@ get_mem_scns(struct dr_node *lmb)
 	return rc;
 }
 
+/**
+ * discover_mem_scns
+ * @brief Find the memory sections of an owned lmb if not already known
+ *
+ * For lists built with LMB_SCNS_LAZY the memory sections and
+ * removability of an lmb are only determined once the lmb is considered
+ * for a DLPAR operation.
+ *
+ * @param lmb lmb to find memory sections of
+ * @param lmb_list lmb list head the lmb belongs to
+ * @return 0 on success, !0 otherwise
+ */
+static int
+discover_mem_scns(struct dr_node *lmb, struct lmb_list_head *lmb_list)
+{
+	if (!lmb->is_owned || lmb->lmb_scns_valid)
+		return 0;
+
+	return get_mem_scns(lmb, lmb_list);
+}
+
 /**
  * get_lmb_size
  * @brief Retrieve the size of the lmb
@@ -189,26 +235,154 @@ get_lmb_size(struct dr_node *lmb)
 	return 0;
 }
 
+/**
+ * lmb_index_add
+ * @brief add an entry to the drc_index lookup table of a lmb list
+ *
+ * The table is not sorted until sort_lmb_index() is called.
+ *
+ * @param lmb lmb to add
+ * @param drmem ibm,dynamic-memory entry of the lmb, or NULL
+ * @param lmb_list lmb list head to add the entry to
+ * @return 0 on success, !0 on failure
+ */
+static int lmb_index_add(struct dr_node *lmb, struct drconf_mem *drmem,
+			 struct lmb_list_head *lmb_list)
+{
+	struct lmb_index *entry;
+
+	if (lmb_list->index_cnt == lmb_list->index_sz) {
+		struct lmb_index *index;
+		int index_sz;
+
+		index_sz = lmb_list->index_sz ? lmb_list->index_sz * 2 : 256;
+		index = realloc(lmb_list->index, index_sz * sizeof(*index));
+		if (index == NULL) {
+			say(ERROR, "Could not allocate LMB lookup table\n");
+			return -1;
+		}
+
+		lmb_list->index = index;
+		lmb_list->index_sz = index_sz;
+	}
+
+	entry = &lmb_list->index[lmb_list->index_cnt++];
+	entry->drc_index = lmb->drc_index;
+	entry->lmb = lmb;
+	entry->drmem = drmem;
+	return 0;
+}
+
+static int lmb_index_cmp(const void *a, const void *b)
+{
+	const struct lmb_index *ia = a;
+	const struct lmb_index *ib = b;
+
+	if (ia->drc_index < ib->drc_index)
+		return -1;
+
+	return ia->drc_index > ib->drc_index;
+}
+
+/**
+ * sort_lmb_index
+ * @brief sort the drc_index lookup table of a lmb list
+ *
+ * @param lmb_list lmb list head to sort the table of
+ */
+static void sort_lmb_index(struct lmb_list_head *lmb_list)
+{
+	if (lmb_list->index_cnt)
+		qsort(lmb_list->index, lmb_list->index_cnt,
+		      sizeof(*lmb_list->index), lmb_index_cmp);
+}
+
+/**
+ * find_lmb_index
+ * @brief find the lookup table entry for the specified drc_index
+ *
+ * @param lmb_list lmb list head to search
+ * @param drc_index drc index to find
+ * @return pointer to the lookup table entry, NULL if not found
+ */
+static struct lmb_index *find_lmb_index(struct lmb_list_head *lmb_list,
+					uint32_t drc_index)
+{
+	struct lmb_index key = { .drc_index = drc_index };
+
+	if (!lmb_list->index_cnt)
+		return NULL;
+
+	return bsearch(&key, lmb_list->index, lmb_list->index_cnt,
+		       sizeof(*lmb_list->index), lmb_index_cmp);
+}
+
+/**
+ * init_lmb_arena
+ * @brief Size the lmb list arena and lookup table for the expected lmbs
+ *
+ * This allows the lmbs, and the memory sections of the lmbs owned by the
+ * partition, to be allocated from a single chunk of memory.
+ *
+ * @param lmb_list lmb list head to initialize
+ * @param nr_lmbs number of lmbs expected
+ * @param nr_owned number of those lmbs owned by the partition
+ * @param lmb_sz size of the lmbs, 0 if unknown
+ */
+static void init_lmb_arena(struct lmb_list_head *lmb_list, int nr_lmbs,
+			   int nr_owned, uint64_t lmb_sz)
+{
+	size_t scns_per_lmb = 1;
+	size_t scn_sz, sz;
+
+	if (block_sz_bytes && lmb_sz)
+		scns_per_lmb = lmb_sz / block_sz_bytes;
+
+	/* Only a few memory sections are discovered for lazy lists */
+	if (lmb_list->scns_mode != LMB_SCNS_EAGER)
+		nr_owned = 0;
+
+	/* memory section plus its "/sys/devices/system/memory/memoryN"
+	 * path, and rounding for alignment.
+	 */
+	scn_sz = sizeof(struct mem_scn) + 64;
+
+	sz = nr_lmbs * (sizeof(struct dr_node) + 16);
+	sz += nr_owned * scns_per_lmb * scn_sz;
+	dr_arena_init(&lmb_list->arena, sz);
+
+	if (lmb_list->index == NULL && nr_lmbs > 0) {
+		lmb_list->index = malloc(nr_lmbs * sizeof(*lmb_list->index));
+		if (lmb_list->index)
+			lmb_list->index_sz = nr_lmbs;
+	}
+}
+
 /**
  * lmb_list_add
  * @ brief add a dr_node to the specified lmb_list for the indicated drc_index
  *
  * @param drc_index drc index of the LMB to add
+ * @param drmem ibm,dynamic-memory entry of the LMB, or NULL
  * @param lmb_list lmb list head to add the lmb to
  * @return pointer to allocated lmb node on success, NULL on failure
  */
 static struct dr_node *lmb_list_add(uint32_t drc_index,
+				    struct drconf_mem *drmem,
 				    struct lmb_list_head *lmb_list)
 {
 	struct dr_node *lmb;
 
-	lmb = zalloc(sizeof(*lmb));
+	lmb = dr_arena_zalloc(&lmb_list->arena, sizeof(*lmb));
 	if (lmb == NULL)
 		return NULL;
 
 	lmb->drc_index = drc_index;
 	lmb->dev_type = MEM_DEV;
 
+	if (lmb_index_add(lmb, drmem, lmb_list))
+		return NULL;
+
 	if (lmb_list->sort == LMB_REVERSE_SORT) {
 		if (lmb_list->last)
 			lmb->next = lmb_list->last;
@@ -234,6 +408,7 @@ static struct dr_node *lmb_list_add(uint32_t drc_index,
 int
 get_mem_node_lmbs(struct lmb_list_head *lmb_list)
 {
+	struct lmb_index *entry;
 	struct dr_node *lmb;
 	struct dirent *de;
 	DIR *d;
@@ -263,18 +438,15 @@ get_mem_node_lmbs(struct lmb_list_head *lmb_list)
 		if (get_my_drc_index(path, &my_drc_index))
 			continue;
 
-		for (lmb = lmb_list->lmbs; lmb; lmb = lmb->next) {
-			if (lmb->drc_index == my_drc_index)
-				break;
-		}
-
-		if (lmb == NULL) {
+		entry = find_lmb_index(lmb_list, my_drc_index);
+		if (entry == NULL) {
 			say(DEBUG, "Could not find LMB with drc-index of %x\n",
 			    my_drc_index);
 			rc = -1;
 			break;
 		}
 
+		lmb = entry->lmb;
 		snprintf(lmb->ofdt_path, DR_PATH_MAX, "%s", path);
 		lmb->is_owned = 1;
 
@@ -297,9 +469,11 @@ get_mem_node_lmbs(struct lmb_list_head *lmb_list)
 		lmb->lmb_address = strtoull(tmp + 1, NULL, 16);
 
 		/* find the associated sysfs memory blocks */
-		rc = get_mem_scns(lmb);
-		if (rc)
-			break;
+		if (lmb_list->scns_mode == LMB_SCNS_EAGER) {
+			rc = get_mem_scns(lmb, lmb_list);
+			if (rc)
+				break;
+		}
 	}
 
 	closedir(d);
@@ -308,11 +482,11 @@ get_mem_node_lmbs(struct lmb_list_head *lmb_list)
 
 int add_lmb(struct lmb_list_head *lmb_list, uint32_t drc_index,
 	    uint64_t address, uint64_t lmb_sz, uint32_t aa_index,
-	    uint32_t flags)
+	    uint32_t flags, struct drconf_mem *drmem)
 {
 	struct dr_node *lmb;
 
-	lmb = lmb_list_add(drc_index, lmb_list);
+	lmb = lmb_list_add(drc_index, drmem, lmb_list);
 	if (lmb == NULL) {
 		say(DEBUG, "Could not find LMB with drc-index of %x\n",
 		    drc_index);
@@ -325,13 +499,11 @@ int add_lmb(struct lmb_list_head *lmb_list, uint32_t drc_index,
 	lmb->lmb_aa_index = aa_index;
 
 	if (flags & DRMEM_ASSIGNED) {
-		int rc;
-
 		lmb->is_owned = 1;
 
 		/* find the associated sysfs memory blocks */
-		rc = get_mem_scns(lmb);
-		if (rc)
+		if (lmb_list->scns_mode == LMB_SCNS_EAGER &&
+		    get_mem_scns(lmb, lmb_list))
 			return -1;
 	}
 
@@ -351,21 +523,13 @@ int
 get_dynamic_reconfig_lmbs_v1(uint64_t lmb_sz, struct lmb_list_head *lmb_list)
 {
 	struct drconf_mem *drmem;
-	int i, num_entries;
+	int i, num_entries, nr_owned;
 	int rc = 0;
 
-	lmb_list->drconf_buf_sz = get_property_size(DYNAMIC_RECONFIG_MEM,
-						   "ibm,dynamic-memory");
-	lmb_list->drconf_buf = zalloc(lmb_list->drconf_buf_sz);
-	if (lmb_list->drconf_buf == NULL) {
-		say(DEBUG, "Could not allocate buffer to get dynamic "
-		    "reconfigurable memory\n");
-		return -1;
-	}
-
-	rc = get_property(DYNAMIC_RECONFIG_MEM, "ibm,dynamic-memory",
-			  lmb_list->drconf_buf, lmb_list->drconf_buf_sz);
-	if (rc) {
+	lmb_list->drconf_buf_sz = get_property_alloc(DYNAMIC_RECONFIG_MEM,
+						     "ibm,dynamic-memory",
+						     &lmb_list->drconf_buf);
+	if (lmb_list->drconf_buf_sz < (int)sizeof(num_entries)) {
 		say(DEBUG, "Could not retrieve dynamic reconfigurable memory "
 		    "property\n");
 		return -1;
@@ -377,14 +541,28 @@ get_dynamic_reconfig_lmbs_v1(uint64_t lmb_sz, struct lmb_list_head *lmb_list)
 	/* convert for LE systems */
 	num_entries = be32toh(num_entries);
 
+	if (num_entries > (lmb_list->drconf_buf_sz - sizeof(num_entries)) /
+							sizeof(*drmem)) {
+		say(DEBUG, "Invalid ibm,dynamic-memory property\n");
+		return -1;
+	}
+
 	/* Followed by the actual entries */
 	drmem = (struct drconf_mem *)
 				(lmb_list->drconf_buf + sizeof(num_entries));
+
+	for (i = 0, nr_owned = 0; i < num_entries; i++) {
+		if (be32toh(drmem[i].flags) & DRMEM_ASSIGNED)
+			nr_owned++;
+	}
+
+	init_lmb_arena(lmb_list, num_entries, nr_owned, lmb_sz);
+
 	for (i = 0; i < num_entries; i++) {
 		rc = add_lmb(lmb_list, be32toh(drmem->drc_index),
 			     be64toh(drmem->address), lmb_sz,
 			     be32toh(drmem->assoc_index),
-			     be32toh(drmem->flags));
+			     be32toh(drmem->flags), drmem);
 		if (rc)
 			break;
 
@@ -395,71 +573,19 @@ get_dynamic_reconfig_lmbs_v1(uint64_t lmb_sz, struct lmb_list_head *lmb_list)
 }
 
 /**
- * get_dynamic_reconfig_lmbs_v2
- * @brief Retrieve the LMBs from the ibm,dynamic-memory-v2 property
+ * find_lmb
+ * @brief find the lmb of a list for the specified drc index
  *
- * @param lmb_sz LMB size
- * @param lmb_list pointer to lmb_list head to populate
- * @returns 0 on success, !0 on failure.
+ * @param lmb_list lmb list head to search
+ * @param drc_index drc index to find
+ * @returns pointer to the lmb, NULL if not found
  */
-int get_dynamic_reconfig_lmbs_v2(uint64_t lmb_sz,
-				 struct lmb_list_head *lmb_list)
+struct dr_node *find_lmb(struct lmb_list_head *lmb_list, uint32_t drc_index)
 {
-	struct drconf_mem_v2 *drmem;
-	uint32_t lmb_sets;
-	int i, rc = 0;
-
-	lmb_list->drconf_buf_sz = get_property_size(DYNAMIC_RECONFIG_MEM,
-						   "ibm,dynamic-memory-v2");
-	lmb_list->drconf_buf = zalloc(lmb_list->drconf_buf_sz);
-	if (lmb_list->drconf_buf == NULL) {
-		say(DEBUG, "Could not allocate buffer to get dynamic "
-		    "reconfigurable memory\n");
-		return -1;
-	}
-
-	rc = get_property(DYNAMIC_RECONFIG_MEM, "ibm,dynamic-memory-v2",
-			  lmb_list->drconf_buf, lmb_list->drconf_buf_sz);
-	if (rc) {
-		say(DEBUG, "Could not retrieve dynamic reconfigurable memory "
-		    "property\n");
-		return -1;
-	}
-
-	/* The first integer of the buffer is the number of lmb sets */
-	lmb_sets = *(int *)lmb_list->drconf_buf;
-	lmb_sets = be32toh(lmb_sets);
-
-	/* Followed by the actual entries */
-	drmem = (struct drconf_mem_v2 *)
-				(lmb_list->drconf_buf + sizeof(lmb_sets));
-
-	for (i = 0; i < lmb_sets; i++) {
-		uint32_t drc_index, seq_lmbs;
-		uint64_t address;
-		int j;
-
-		address = be64toh(drmem->base_addr);
-		drc_index = be32toh(drmem->drc_index);
-		seq_lmbs = be32toh(drmem->seq_lmbs);
-
-		for (j = 0; j < seq_lmbs; j++) {
-			uint32_t aa_index = be32toh(drmem->aa_index);
-			uint32_t flags = be32toh(drmem->flags);
-
-			rc = add_lmb(lmb_list, drc_index, address,
-				     lmb_sz, aa_index, flags);
-			if (rc)
-				break;
+	struct lmb_index *entry;
 
-			drc_index++;
-			address += lmb_sz;
-		}
-
-		drmem++; /* trust your compiler */
-	}
-
-	return rc;
+	entry = find_lmb_index(lmb_list, drc_index);
+	return entry ? entry->lmb : NULL;
 }
 
 /**
@@ -490,9 +616,6 @@ get_dynamic_reconfig_lmbs(struct lmb_list_head *lmb_list)
 
 	if (stat(DYNAMIC_RECONFIG_MEM_V1, &sbuf) == 0) {
 		rc = get_dynamic_reconfig_lmbs_v1(lmb_sz, lmb_list);
-	} else if (is_lsslot_cmd &&
-		   stat(DYNAMIC_RECONFIG_MEM_V2, &sbuf) == 0) {
-		rc = get_dynamic_reconfig_lmbs_v2(lmb_sz, lmb_list);
 	} else {
 		say(ERROR, "No dynamic reconfiguration LMBs found\n");
 		return -1;
@@ -544,14 +667,17 @@ static void shuffle_lmbs(struct lmb_list_head *lmb_list)
  * @brief Build a list of all possible lmbs for the system
  *
  * @param sort LMB_NORMAL_SORT or LMB_REVERSE_SORT to control sort order
+ * @param scns_mode LMB_SCNS_EAGER to find the memory sections of all owned
+ *        lmbs now, LMB_SCNS_LAZY to defer it until an lmb is selected
  *
  * @return list of lmbs, NULL on failure
  */
 struct lmb_list_head *
-get_lmbs(unsigned int sort)
+get_lmbs(unsigned int sort, int scns_mode)
 {
 	struct lmb_list_head *lmb_list = NULL;
 	struct dr_node *lmb = NULL;
+	struct trace_span span;
 	struct stat sbuf;
 	char buf[DR_STR_MAX];
 	int rc = 0;
@@ -563,8 +689,9 @@ get_lmbs(unsigned int sort)
 	}
 
 	lmb_list->sort = sort;
+	lmb_list->scns_mode = scns_mode;
 
-	rc = get_str_attribute("/sys/devices/system/memory",
+	rc = get_str_attribute(DR_ROOT "/sys/devices/system/memory",
 			       "/block_size_bytes", &buf, DR_STR_MAX);
 	if (rc) {
 		say(DEBUG,
@@ -575,6 +702,8 @@ get_lmbs(unsigned int sort)
 
 	block_sz_bytes = strtoul(buf, NULL, 16);
 
+	trace_begin(&span, TRACE_DISCOVERY, "lmb-discovery");
+
 	/* We also need to know which lmbs are already allocated to
 	 * the system and their corresponding memory sections as defined
 	 * by sysfs.  Walk the device tree and update the appropriate
@@ -589,6 +718,15 @@ get_lmbs(unsigned int sort)
 			report_unknown_error(__FILE__, __LINE__);
 			rc = -1;
 		} else {
+			int nr_lmbs = 0;
+
+			for (drc = drc_list; drc; drc = drc->next) {
+				if (!strncmp(drc->name, "LMB", 3))
+					nr_lmbs++;
+			}
+
+			init_lmb_arena(lmb_list, nr_lmbs, nr_lmbs, 0);
+
 			/* For memory dlpar, we need a list of all
 			 * posiible memory nodes for the system, initalize
 			 * those here.
@@ -597,7 +735,7 @@ get_lmbs(unsigned int sort)
 				if (strncmp(drc->name, "LMB", 3))
 					continue;
 
-				lmb = lmb_list_add(drc->index, lmb_list);
+				lmb = lmb_list_add(drc->index, NULL, lmb_list);
 				if (!lmb) {
 					say(ERROR, "Failed to add LMB (%x)\n",
 					    drc->index);
@@ -610,6 +748,7 @@ get_lmbs(unsigned int sort)
 		}
 
 		say(INFO, "Maximum of %d LMBs\n", lmb_list->lmbs_found);
+		sort_lmb_index(lmb_list);
 		rc = get_mem_node_lmbs(lmb_list);
 	} else {
 		/* A small hack to here to allow memory add to work in
@@ -619,10 +758,14 @@ get_lmbs(unsigned int sort)
 		 * update the lmb_list.
 		 */
 		rc = get_dynamic_reconfig_lmbs(lmb_list);
-		if (! rc)
+		if (! rc) {
+			sort_lmb_index(lmb_list);
 			rc = get_mem_node_lmbs(lmb_list);
+		}
 	}
 
+	trace_end(&span);
+
 	if (rc) {
 		free_lmbs(lmb_list);
 		lmb_list = NULL;
@@ -633,6 +776,115 @@ get_lmbs(unsigned int sort)
 	return lmb_list;
 }
 
+/**
+ * lmb_is_available
+ *
+ * Determine if the specified lmb is available for the requested action,
+ * i.e an lmb not already owned by the partition for add, or a removable
+ * lmb owned by the partition for remove.
+ *
+ * @param lmb lmb to check
+ * @param lmb_list list of all lmbs
+ * @param balloon_active result of ams_balloon_active()
+ * @returns 1 if the lmb is available, 0 otherwise
+ */
+static int lmb_is_available(struct dr_node *lmb,
+			    struct lmb_list_head *lmb_list, int balloon_active)
+{
+	if (lmb->unusable)
+		return 0;
+
+	if ((usr_numa_node >= 0) && (lmb_node(lmb) != usr_numa_node))
+		return 0;
+
+	if (usr_action == ADD) {
+		if (lmb->is_owned)
+			return 0;
+
+		if (dr_entity_sense(lmb->drc_index) != STATE_UNUSABLE)
+			return 0;
+	} else if (usr_action == REMOVE) {
+		if (discover_mem_scns(lmb, lmb_list))
+			return 0;
+
+		/* removable is ignored if AMS ballooning is active. */
+		if ((!balloon_active && !lmb->is_removable) ||
+		    (!lmb->is_owned))
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * fill_remove_queue
+ * @brief Add lmbs that are candidates for removal to the removal queue
+ *
+ * The lmb list is scanned from where the previous call stopped.  The scan
+ * stops once the queue holds enough removable lmbs that have not recently
+ * failed to offline, these are the ones popped first from the queue so
+ * there is no need to look at the rest of the list until the queue runs
+ * dry.
+ *
+ * @param lmb_list list of all lmbs
+ * @param count number of preferred candidates wanted in the queue
+ * @returns number of removable lmbs added to the queue
+ */
+static int fill_remove_queue(struct lmb_list_head *lmb_list, int count)
+{
+	struct dr_node *lmb;
+	int balloon_active = ams_balloon_active();
+	int removable = 0;
+	int preferred = 0;
+
+	for (lmb = lmb_list->queue_next; lmb; lmb = lmb->next) {
+		if (preferred >= count)
+			break;
+
+		if (!lmb_is_available(lmb, lmb_list, balloon_active))
+			continue;
+
+		if (lmb_queue_push(&lmb_list->remove_queue, lmb))
+			break;
+
+		removable++;
+		if (!lmb_last_failure(lmb->drc_index))
+			preferred++;
+	}
+
+	lmb_list->queue_next = lmb;
+	return removable;
+}
+
+/**
+ * get_queued_lmb
+ * @brief Take the best candidate for removal from the removal queue
+ *
+ * @param lmb_list list of all lmbs
+ * @returns pointer to lmb on success, NULL if there are no candidates left
+ */
+static struct dr_node *get_queued_lmb(struct lmb_list_head *lmb_list)
+{
+	struct dr_node *lmb;
+	int balloon_active = ams_balloon_active();
+
+	while (1) {
+		lmb = lmb_queue_pop(&lmb_list->remove_queue);
+		if (lmb == NULL) {
+			if (lmb_list->queue_next == NULL)
+				return NULL;
+
+			fill_remove_queue(lmb_list, usr_drc_count -
+					  lmb_list->lmbs_modified);
+			continue;
+		}
+
+		/* An lmb may have become unusable since it was queued */
+		if (lmb_is_available(lmb, lmb_list, balloon_active))
+			return lmb;
+	}
+}
+
 /**
  * get_available_lmb
  *
@@ -640,54 +892,45 @@ get_lmbs(unsigned int sort)
  * already owned by the partition and is available, or the lmb
  * matching the one specified by the user.
  *
+ * @param lmb_list list of all lmbs
  * @param start_lmb first lmbs to be searched for an available lmb
  * @returns pointer to avaiable lmb on success, NULL otherwise
  */
-static struct dr_node *get_available_lmb(struct dr_node *start_lmb)
+static struct dr_node *get_available_lmb(struct lmb_list_head *lmb_list,
+					 struct dr_node *start_lmb)
 {
 	uint32_t drc_index;
 	struct dr_node *lmb;
 	struct dr_node *usable_lmb = NULL;
 	int balloon_active = ams_balloon_active();
 
-	for (lmb = start_lmb; lmb; lmb = lmb->next) {
-		int rc;
-
-		if (usr_drc_name) {
-			drc_index = strtoul(usr_drc_name, NULL, 0);
-
-			if ((strcmp(lmb->drc_name, usr_drc_name))
-			    && (lmb->drc_index != drc_index))
-				continue;
-		} else if (usr_drc_index) {
-			if (lmb->drc_index != usr_drc_index)
-				continue;
-		}
-
-		if (lmb->unusable)
-			continue;
+	if (lmb_list->queue_active) {
+		usable_lmb = get_queued_lmb(lmb_list);
+	} else if (!usr_drc_name && usr_drc_index) {
+		struct lmb_index *entry;
 
-		if (usr_action == ADD) {
-			if (lmb->is_owned)
-				continue;
+		/* A specific drc index was requested, look it up directly */
+		entry = find_lmb_index(lmb_list, usr_drc_index);
+		if (entry && lmb_is_available(entry->lmb, lmb_list,
+					     balloon_active))
+			usable_lmb = entry->lmb;
+	} else {
+		for (lmb = start_lmb; lmb; lmb = lmb->next) {
+			if (usr_drc_name) {
+				drc_index = strtoul(usr_drc_name, NULL, 0);
 
-			rc = dr_entity_sense(lmb->drc_index);
-			if (rc != STATE_UNUSABLE)
-				continue;
+				if ((strcmp(lmb->drc_name, usr_drc_name))
+				    && (lmb->drc_index != drc_index))
+					continue;
+			}
 
-			usable_lmb = lmb;
-		} else if (usr_action == REMOVE) {
-			/* removable is ignored if AMS ballooning is active. */
-			if ((!balloon_active && !lmb->is_removable) ||
-			    (!lmb->is_owned))
+			if (!lmb_is_available(lmb, lmb_list, balloon_active))
 				continue;
 
+			/* Found an available lmb */
 			usable_lmb = lmb;
 			break;
 		}
-
-		/* Found an available lmb */
-		break;
 	}
 
 	if (usable_lmb)
@@ -711,6 +954,9 @@ static void update_drconf_affinity(struct dr_node *lmb,
 
 	/* find the ibm,associativity property */
 	node = lmb->lmb_of_node;
+	if (!node)
+		return;
+
 	for (prop = node->properties; prop; prop = prop->next) {
 		if (!strcmp(prop->name, "ibm,associativity"))
 			break;
@@ -748,51 +994,57 @@ static void update_drconf_affinity(struct dr_node *lmb,
 }
 	
 /**
- * update_drconf_node
- * @brief update the ibm,dynamic-memory property for added/removed memory
+ * set_drconf_lmb_flags
+ * @brief update the in-memory ibm,dynamic-memory entry for an lmb
+ *
+ * This only modifies the copy of the property held in the lmb_list
+ * drconf buffer, the caller is responsible for writing the updated
+ * property to the kernel via write_drconf_node().
  *
  * @param lmb pointer to updated lmb
  * @param lmb_list pointer to all lmbs
  * @param action ADD or REMOVE
+ */
+static void
+set_drconf_lmb_flags(struct dr_node *lmb, struct lmb_list_head *lmb_list,
+		     int action)
+{
+	struct lmb_index *entry;
+	struct drconf_mem *drmem;
+
+	entry = find_lmb_index(lmb_list, lmb->drc_index);
+	if (entry == NULL || entry->drmem == NULL)
+		return;
+
+	drmem = entry->drmem;
+	if (action == ADD) {
+		drmem->flags |= be32toh(DRMEM_ASSIGNED);
+		update_drconf_affinity(lmb, drmem);
+	} else {
+		drmem->flags &= be32toh(~DRMEM_ASSIGNED);
+	}
+}
+
+/**
+ * write_drconf_node
+ * @brief write the ibm,dynamic-memory property held in the lmb_list to
+ * the kernel
+ *
+ * @param lmb lmb reported to the kernel as the one being added/removed
+ * @param lmb_list pointer to all lmbs
+ * @param action ADD or REMOVE
  * @returns 0 on success, !0 on failure
  */
 static int
-update_drconf_node(struct dr_node *lmb, struct lmb_list_head *lmb_list,
-		   int action)
+write_drconf_node(struct dr_node *lmb, struct lmb_list_head *lmb_list,
+		  int action)
 {
 	char *prop_buf;
 	size_t prop_buf_sz;
 	char *tmp;
-	struct drconf_mem *drmem;
 	uint phandle;
-	int i, entries;
 	int rc;
 
-	/* The first int of the buffer is the number of entries */
-	entries = *(int *)lmb_list->drconf_buf;
-
-	/* convert for LE systems */
-	entries = be32toh(entries);
-
-	drmem = (struct drconf_mem *)(lmb_list->drconf_buf + sizeof(entries));
-
-	for (i = 0; i < entries; i++) {
-
-		if (be32toh(drmem->drc_index) != lmb->drc_index) {
-			drmem++;
-			continue;
-		}
-
-		if (action == ADD) {
-			drmem->flags |= be32toh(DRMEM_ASSIGNED);
-			update_drconf_affinity(lmb, drmem);
-		} else {
-			drmem->flags &= be32toh(~DRMEM_ASSIGNED);
-		}
-
-		break;
-	}
-
 	/* Now create the buffer we pass to the kernel to have this
 	 * property updated.  This buffer has the format
 	 * "update_property <phandle> ibm,dynamic-memory <prop_len> <prop> \
@@ -813,6 +1065,7 @@ update_drconf_node(struct dr_node *lmb, struct lmb_list_head *lmb_list,
 	if (rc) {
 		say(DEBUG, "Failed to get phandle for %s under %s. (rc=%d)\n", 
 				lmb->drc_name, lmb->ofdt_path, rc);
+		free(prop_buf);
 		return rc;
 	}
 
@@ -837,32 +1090,83 @@ update_drconf_node(struct dr_node *lmb, struct lmb_list_head *lmb_list,
 }
 
 /**
- * remove_device_tree_lmb
- * @brief Update the device tree for the lmb being removed.
+ * update_drconf_node
+ * @brief update the ibm,dynamic-memory property for added/removed memory
  *
- * @param lmb memory block to be removed from the device tree
- * @param lmb_list list of all lmbs
- * @returns 0 on success, !o otherwise
+ * @param lmb pointer to updated lmb
+ * @param lmb_list pointer to all lmbs
+ * @param action ADD or REMOVE
+ * @returns 0 on success, !0 on failure
  */
 static int
-remove_device_tree_lmb(struct dr_node *lmb, struct lmb_list_head *lmb_list)
+update_drconf_node(struct dr_node *lmb, struct lmb_list_head *lmb_list,
+		   int action)
 {
-	if (lmb_list->drconf_buf)
-		return update_drconf_node(lmb, lmb_list, REMOVE);
-
-	return remove_device_tree_nodes(lmb->ofdt_path);
+	set_drconf_lmb_flags(lmb, lmb_list, action);
+	return write_drconf_node(lmb, lmb_list, action);
 }
 
 /**
- * add_device_tree_lmb
- * @brief Update the device tree for the lmb being added..
+ * update_drconf_lmbs
+ * @brief update the ibm,dynamic-memory property for several lmbs
  *
- * @param lmb lmb to acquire
- * @param lmb_list list of all lmbs
- * @returns 0 on success, !0 otherwise
+ * Without kernel DLPAR support the kernel only acts on the first entry
+ * that changed in an update of the property, and on the one address
+ * passed along with it.  Each lmb is therefore written in an update of
+ * its own, changing a single entry of the in-memory property at a time.
+ *
+ * @param lmbs lmbs to update, in the order they are written
+ * @param nr_lmbs number of lmbs
+ * @param lmb_list pointer to all lmbs
+ * @param action ADD or REMOVE
+ * @returns number of lmbs updated, the entries of the others are left
+ *	    unchanged
  */
 static int
-add_device_tree_lmb(struct dr_node *lmb, struct lmb_list_head *lmb_list)
+update_drconf_lmbs(struct dr_node **lmbs, int nr_lmbs,
+		   struct lmb_list_head *lmb_list, int action)
+{
+	int i;
+
+	for (i = 0; i < nr_lmbs; i++) {
+		if (update_drconf_node(lmbs[i], lmb_list, action)) {
+			report_unknown_error(__FILE__, __LINE__);
+			set_drconf_lmb_flags(lmbs[i], lmb_list,
+					     action == ADD ? REMOVE : ADD);
+			break;
+		}
+	}
+
+	return i;
+}
+
+/**
+ * remove_device_tree_lmb
+ * @brief Update the device tree for the lmb being removed.
+ *
+ * @param lmb memory block to be removed from the device tree
+ * @param lmb_list list of all lmbs
+ * @returns 0 on success, !o otherwise
+ */
+static int
+remove_device_tree_lmb(struct dr_node *lmb, struct lmb_list_head *lmb_list)
+{
+	if (lmb_list->drconf_buf)
+		return update_drconf_node(lmb, lmb_list, REMOVE);
+
+	return remove_device_tree_nodes(lmb->ofdt_path);
+}
+
+/**
+ * add_device_tree_lmb
+ * @brief Update the device tree for the lmb being added..
+ *
+ * @param lmb lmb to acquire
+ * @param lmb_list list of all lmbs
+ * @returns 0 on success, !0 otherwise
+ */
+static int
+add_device_tree_lmb(struct dr_node *lmb, struct lmb_list_head *lmb_list)
 {
         int rc;
 
@@ -924,7 +1228,7 @@ add_device_tree_lmb(struct dr_node *lmb, struct lmb_list_head *lmb_list)
 		}
 	}
 
-	rc = get_mem_scns(lmb);
+	rc = get_mem_scns(lmb, lmb_list);
 	if (rc) 
 		remove_device_tree_lmb(lmb, lmb_list);
 
@@ -980,15 +1284,17 @@ get_mem_scn_state(struct mem_scn *mem_scn)
 static int
 set_mem_scn_state(struct mem_scn *mem_scn, int state)
 {
+	struct trace_span span;
 	int file;
 	char path[PATH_MAX];
 	int rc = 0;
 	time_t t;
 	char tbuf[128];
+	struct tm tm;
 	int my_errno;
 
 	time(&t);
-	strftime(tbuf, 128, "%T", localtime(&t));
+	strftime(tbuf, 128, "%T", localtime_r(&t, &tm));
 	memset(path, 0, DR_PATH_MAX);
 	sprintf(path, "%s/state", mem_scn->sysfs_path);
 	say(DEBUG, "%s Marking %s %s\n", tbuf, mem_scn->sysfs_path,
@@ -1002,9 +1308,11 @@ set_mem_scn_state(struct mem_scn *mem_scn, int state)
 		return -1;
 	}
 
+	trace_begin(&span, TRACE_SYSFS, "memory-state");
 	rc = write(file, state_strs[state], strlen(state_strs[state]));
 	my_errno = errno;
 	close(file);
+	trace_end(&span);
 
 	if (rc < 0) {
 		say(ERROR, "Could not write to %s to %s memory\n\t%s\n",
@@ -1014,13 +1322,13 @@ set_mem_scn_state(struct mem_scn *mem_scn, int state)
 
 	if (get_mem_scn_state(mem_scn) != state) {
 		time(&t);
-		strftime(tbuf, 128, "%T", localtime(&t));
+		strftime(tbuf, 128, "%T", localtime_r(&t, &tm));
 		say(DEBUG, "%s Could not %s %s.\n", tbuf, state_strs[state],
 		    mem_scn->sysfs_path);
 		rc = EAGAIN;
 	} else {
 		time(&t);
-		strftime(tbuf, 128, "%T", localtime(&t));
+		strftime(tbuf, 128, "%T", localtime_r(&t, &tm));
 		say(DEBUG, "%s Completed marking %s %s.\n", tbuf,
 				mem_scn->sysfs_path, state_strs[state]);
 		rc = 0;
@@ -1128,15 +1436,120 @@ set_lmb_state(struct dr_node *lmb, int state)
 	return rc;
 }
 
+/* Work shared by the threads onlining/offlining a group of lmbs */
+struct lmb_state_work {
+	struct dr_node	**lmbs;
+	int		*rcs;
+	int		nr_lmbs;
+	int		state;
+	int		next;
+	pthread_mutex_t	lock;
+};
+
+static void *lmb_state_worker(void *arg)
+{
+	struct lmb_state_work *work = arg;
+	int i;
+
+	while (1) {
+		pthread_mutex_lock(&work->lock);
+		i = work->next++;
+		pthread_mutex_unlock(&work->lock);
+
+		if (i >= work->nr_lmbs)
+			break;
+
+		work->rcs[i] = set_lmb_state(work->lmbs[i], work->state);
+	}
+
+	return NULL;
+}
+
+/**
+ * set_lmbs_state
+ * @brief Online or offline a group of lmbs
+ *
+ * The lmbs are handed out to up to usr_jobs threads so that the kernel
+ * can online or offline (i.e. migrate pages out of) several independent
+ * lmbs at the same time.  The result of set_lmb_state() for each lmb is
+ * returned in the corresponding entry of rcs so that callers can roll
+ * back failed lmbs individually.
+ *
+ * @param lmbs array of lmbs to update
+ * @param rcs array to return the result for each lmb in
+ * @param nr_lmbs number of lmbs
+ * @param state ONLINE or OFFLINE
+ */
+static void
+set_lmbs_state(struct dr_node **lmbs, int *rcs, int nr_lmbs, int state)
+{
+	struct lmb_state_work work;
+	pthread_t *threads;
+	int nr_threads, i;
+
+	nr_threads = (usr_jobs < nr_lmbs) ? usr_jobs : nr_lmbs;
+	if (nr_threads <= 1) {
+		for (i = 0; i < nr_lmbs; i++)
+			rcs[i] = set_lmb_state(lmbs[i], state);
+		return;
+	}
+
+	memset(&work, 0, sizeof(work));
+	work.lmbs = lmbs;
+	work.rcs = rcs;
+	work.nr_lmbs = nr_lmbs;
+	work.state = state;
+	pthread_mutex_init(&work.lock, NULL);
+
+	threads = zalloc(nr_threads * sizeof(*threads));
+	if (threads) {
+		say(DEBUG, "Setting %d LMBs %s with %d threads\n", nr_lmbs,
+		    state_strs[state], nr_threads);
+
+		for (i = 0; i < nr_threads; i++) {
+			if (pthread_create(&threads[i], NULL, lmb_state_worker,
+					   &work))
+				break;
+		}
+		nr_threads = i;
+	} else {
+		nr_threads = 0;
+	}
+
+	/* Lend a hand, this also covers any threads we failed to create */
+	lmb_state_worker(&work);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&work.lock);
+	free(threads);
+}
+
+/**
+ * free_mem_scns
+ * @brief Release the memory sections associated with the specified lmb
+ *
+ * The memory sections are allocated from the lmb_list arena and are
+ * reclaimed when the lmb list is freed, this just detaches them.
+ *
+ * @param lmb lmb to release memory sections of
+ */
+static void
+free_mem_scns(struct dr_node *lmb)
+{
+	lmb->lmb_mem_scns = NULL;
+	lmb->lmb_scns_valid = 0;
+}
+
 /**
  * add_lmbs
  *
- * Attempt to acquire and online the given number of LMBs.
- * This function calls itself recursively to simplify recovery
- * actions in case of an error.  This is intended only for the case
- * where the user does not specify a drc-name.
+ * Attempt to acquire and online the given number of LMBs.  LMBs are
+ * acquired and added to the device tree one at a time, up to usr_jobs
+ * of them are then onlined concurrently.  Any LMB that cannot be onlined
+ * is removed from the device tree and released again.
  *
- * @param nr_lmbs number of lmbs to add
  * @param lmb_list list of lmbs on the partition
  * @returns 0 on success, !0 otherwise
  */
@@ -1144,47 +1557,220 @@ static int add_lmbs(struct lmb_list_head *lmb_list)
 {
 	int rc = 0;
 	struct dr_node *lmb_head = lmb_list->lmbs;
+	struct dr_node **group;
 	struct dr_node *lmb;
+	int nr_jobs = MAX(usr_jobs, 1);
+	int nr_group, i;
+	int *rcs;
+
+	group = zalloc(nr_jobs * (sizeof(*group) + sizeof(*rcs)));
+	if (group == NULL)
+		return -1;
+
+	rcs = (int *)(group + nr_jobs);
 
 	lmb_list->lmbs_modified = 0;
 	while (lmb_list->lmbs_modified < usr_drc_count) {
 		if (drmgr_timed_out())
 			break;
 
-		lmb = get_available_lmb(lmb_head);
-		if (lmb == NULL)
-			return -1;
+		nr_group = 0;
+		while ((nr_group < nr_jobs) &&
+		       (lmb_list->lmbs_modified + nr_group < usr_drc_count)) {
+			lmb = get_available_lmb(lmb_list, lmb_head);
+			if (lmb == NULL)
+				break;
 
-		/* Iterate only over the remaining LMBs */
-		lmb_head = lmb->next;
+			/* Iterate only over the remaining LMBs */
+			lmb_head = lmb->next;
 
-		rc = acquire_drc(lmb->drc_index);
-		if (rc) {
-			report_unknown_error(__FILE__, __LINE__);
-			lmb->unusable = 1;
-			continue;
+			rc = acquire_drc(lmb->drc_index);
+			if (rc) {
+				report_unknown_error(__FILE__, __LINE__);
+				lmb->unusable = 1;
+				continue;
+			}
+
+			rc = add_device_tree_lmb(lmb, lmb_list);
+			if (rc) {
+				report_unknown_error(__FILE__, __LINE__);
+				release_drc(lmb->drc_index, MEM_DEV);
+				lmb->unusable = 1;
+				continue;
+			}
+
+			group[nr_group++] = lmb;
 		}
 
-		rc = add_device_tree_lmb(lmb, lmb_list);
-		if (rc) {
-			report_unknown_error(__FILE__, __LINE__);
-			release_drc(lmb->drc_index, MEM_DEV);
-			lmb->unusable = 1;
-			continue;
+		if (nr_group == 0) {
+			rc = -1;
+			break;
 		}
 
-		rc = set_lmb_state(lmb, ONLINE);
-		if (rc) {
-			report_unknown_error(__FILE__, __LINE__);
-			remove_device_tree_lmb(lmb, lmb_list);
+		set_lmbs_state(group, rcs, nr_group, ONLINE);
+
+		rc = 0;
+		for (i = 0; i < nr_group; i++) {
+			lmb = group[i];
+
+			if (rcs[i]) {
+				report_unknown_error(__FILE__, __LINE__);
+				remove_device_tree_lmb(lmb, lmb_list);
+				release_drc(lmb->drc_index, MEM_DEV);
+				lmb->unusable = 1;
+				rc = rcs[i];
+				continue;
+			}
+
+			lmb_list->lmbs_modified++;
+		}
+	}
+
+	free(group);
+	return rc;
+}
+
+/**
+ * add_lmbs_batched
+ *
+ * Attempt to acquire and online the given number of LMBs, usr_batch_size
+ * LMBs at a time.  The LMBs of a batch are acquired and configured, then
+ * added to the ibm,dynamic-memory property one after the other, and
+ * finally onlined concurrently.  Any LMBs of a batch that cannot be
+ * onlined are removed from the property and released again.
+ *
+ * This is only valid for drconf memory.
+ *
+ * @param lmb_list list of lmbs on the partition
+ * @returns 0 on success, !0 otherwise
+ */
+static int add_lmbs_batched(struct lmb_list_head *lmb_list)
+{
+	struct dr_node **batch;
+	struct dr_node *lmb_head = lmb_list->lmbs;
+	struct dr_node *lmb;
+	int nr_batch, nr_written, nr_online, nr_failed;
+	int i, rc = 0, stop = 0;
+	int *rcs;
+
+	batch = zalloc(usr_batch_size * (sizeof(*batch) + sizeof(*rcs)));
+	if (batch == NULL)
+		return -1;
+
+	rcs = (int *)(batch + usr_batch_size);
+
+	lmb_list->lmbs_modified = 0;
+	while (lmb_list->lmbs_modified < usr_drc_count) {
+		if (drmgr_timed_out())
+			break;
+
+		/* Acquire and configure the LMBs for this batch */
+		nr_batch = 0;
+		while ((nr_batch < usr_batch_size) &&
+		       (lmb_list->lmbs_modified + nr_batch < usr_drc_count)) {
+			lmb = get_available_lmb(lmb_list, lmb_head);
+			if (lmb == NULL)
+				break;
+
+			/* Iterate only over the remaining LMBs */
+			lmb_head = lmb->next;
+
+			rc = acquire_drc(lmb->drc_index);
+			if (rc) {
+				report_unknown_error(__FILE__, __LINE__);
+				lmb->unusable = 1;
+				continue;
+			}
+
+			lmb->lmb_of_node = configure_connector(lmb->drc_index);
+			if (lmb->lmb_of_node == NULL) {
+				report_unknown_error(__FILE__, __LINE__);
+				release_drc(lmb->drc_index, MEM_DEV);
+				lmb->unusable = 1;
+				continue;
+			}
+
+			batch[nr_batch++] = lmb;
+		}
+
+		if (nr_batch == 0) {
+			rc = -1;
+			break;
+		}
+
+		say(DEBUG, "Updating device tree for batch of %d LMBs\n",
+		    nr_batch);
+		nr_written = update_drconf_lmbs(batch, nr_batch, lmb_list, ADD);
+		for (i = nr_written; i < nr_batch; i++) {
+			lmb = batch[i];
 			release_drc(lmb->drc_index, MEM_DEV);
+			free_of_node(lmb->lmb_of_node);
+			lmb->lmb_of_node = NULL;
 			lmb->unusable = 1;
-			continue;
 		}
 
-		lmb_list->lmbs_modified++;
+		/* Finish the LMBs already added, then stop */
+		if (nr_written < nr_batch) {
+			stop = 1;
+			nr_batch = nr_written;
+		}
+
+		/* Find the memory sections of the new LMBs, those we
+		 * cannot find them for are moved to the end of the batch.
+		 */
+		nr_online = nr_batch;
+		for (i = 0; i < nr_online; ) {
+			lmb = batch[i];
+
+			if (get_mem_scns(lmb, lmb_list)) {
+				batch[i] = batch[--nr_online];
+				batch[nr_online] = lmb;
+				continue;
+			}
+
+			i++;
+		}
+
+		for (i = nr_online; i < nr_batch; i++)
+			rcs[i] = -1;
+
+		set_lmbs_state(batch, rcs, nr_online, ONLINE);
+
+		/* Collect any failures at the front of the batch so they
+		 * can be rolled back together.
+		 */
+		nr_failed = 0;
+		for (i = 0; i < nr_batch; i++) {
+			lmb = batch[i];
+
+			rc = rcs[i];
+			if (rc) {
+				report_unknown_error(__FILE__, __LINE__);
+				free_mem_scns(lmb);
+				batch[nr_failed++] = lmb;
+				continue;
+			}
+
+			lmb_list->lmbs_modified++;
+		}
+
+		if (nr_failed) {
+			say(DEBUG, "Rolling back %d LMBs of batch\n", nr_failed);
+			update_drconf_lmbs(batch, nr_failed, lmb_list, REMOVE);
+
+			for (i = 0; i < nr_failed; i++) {
+				release_drc(batch[i]->drc_index, MEM_DEV);
+				batch[i]->unusable = 1;
+			}
+		}
+
+		if (stop) {
+			rc = -1;
+			break;
+		}
 	}
 
+	free(batch);
 	return rc;
 }
 
@@ -1199,7 +1785,7 @@ static int mem_add(void)
 	struct lmb_list_head *lmb_list;
 	int rc;
 
-	lmb_list = get_lmbs(LMB_NORMAL_SORT);
+	lmb_list = get_lmbs(LMB_NORMAL_SORT, LMB_SCNS_LAZY);
 	if (lmb_list == NULL) {
 		say(ERROR, "Could not gather LMB (logical memory block "
 				"information.\n");
@@ -1207,7 +1793,10 @@ static int mem_add(void)
 	}
 
 	say(DEBUG, "Attempting to add %d LMBs\n", usr_drc_count);
-	rc = add_lmbs(lmb_list);
+	if ((usr_batch_size > 1) && lmb_list->drconf_buf)
+		rc = add_lmbs_batched(lmb_list);
+	else
+		rc = add_lmbs(lmb_list);
 
 	say(DEBUG, "Added %d of %d requested LMB(s)\n", lmb_list->lmbs_modified,
 	    usr_drc_count);
@@ -1220,60 +1809,188 @@ static int mem_add(void)
 /**
  * remove_lmbs
  *
- * @param nr_lmbs
- * @param lmb_list
+ * Offline and release the given number of LMBs.  Up to usr_jobs LMBs are
+ * offlined concurrently, each LMB that was offlined is then removed from
+ * the device tree and released one at a time.
+ *
+ * @param lmb_list list of lmbs on the partition
  * @return 0 on success, !0 otherwise
  */
 static int remove_lmbs(struct lmb_list_head *lmb_list)
 {
 	struct dr_node *lmb_head = lmb_list->lmbs;
+	struct dr_node **group;
 	struct dr_node *lmb;
+	int nr_jobs = MAX(usr_jobs, 1);
+	int nr_group, i;
+	int *rcs;
 	int rc;
 
+	group = zalloc(nr_jobs * (sizeof(*group) + sizeof(*rcs)));
+	if (group == NULL)
+		return -1;
+
+	rcs = (int *)(group + nr_jobs);
+
 	while (lmb_list->lmbs_modified < usr_drc_count) {
 		if (drmgr_timed_out())
 			break;
 
-		lmb = get_available_lmb(lmb_head);
-		if (!lmb)
+		nr_group = 0;
+		while ((nr_group < nr_jobs) &&
+		       (lmb_list->lmbs_modified + nr_group < usr_drc_count)) {
+			lmb = get_available_lmb(lmb_list, lmb_head);
+			if (!lmb)
+				break;
+
+			/* Iterate only over the remaining LMBs */
+			lmb_head = lmb->next;
+			group[nr_group++] = lmb;
+		}
+
+		if (nr_group == 0) {
+			free(group);
 			return -1;
+		}
 
-		/* Iterate only over the remaining LMBs */
-		lmb_head = lmb->next;
+		set_lmbs_state(group, rcs, nr_group, OFFLINE);
 
-		rc = set_lmb_state(lmb, OFFLINE);
-		if (rc) {
-			lmb->unusable = 1;
-			continue;
+		for (i = 0; i < nr_group; i++) {
+			lmb = group[i];
+
+			if (rcs[i]) {
+				record_lmb_failure(lmb->drc_index);
+				lmb->unusable = 1;
+				continue;
+			}
+
+			rc = remove_device_tree_lmb(lmb, lmb_list);
+			if (rc) {
+				report_unknown_error(__FILE__, __LINE__);
+				set_lmb_state(lmb, ONLINE);
+				lmb->unusable = 1;
+				continue;
+			}
+
+			free_mem_scns(lmb);
+
+			rc = release_drc(lmb->drc_index, 0);
+			if (rc) {
+				report_unknown_error(__FILE__, __LINE__);
+				add_device_tree_lmb(lmb, lmb_list);
+				set_lmb_state(lmb, ONLINE);
+				lmb->unusable = 1;
+				continue;
+			}
+
+			lmb->is_removable = 0;
+			lmb_list->lmbs_modified++;
 		}
+	}
 
-		rc = remove_device_tree_lmb(lmb, lmb_list);
-		if (rc) {
-			report_unknown_error(__FILE__, __LINE__);
-			set_lmb_state(lmb, ONLINE);
-			lmb->unusable = 1;
-			continue;
+	free(group);
+	return 0;
+}
+
+/**
+ * remove_lmbs_batched
+ *
+ * Offline and release the given number of LMBs, usr_batch_size LMBs at a
+ * time.  The LMBs of a batch are offlined concurrently, then removed from
+ * the ibm,dynamic-memory property one after the other and released.  An
+ * LMB that cannot be removed from the property is brought back online.
+ *
+ * This is only valid for drconf memory.
+ *
+ * @param lmb_list list of lmbs on the partition
+ * @return 0 on success, !0 otherwise
+ */
+static int remove_lmbs_batched(struct lmb_list_head *lmb_list)
+{
+	struct dr_node **batch;
+	struct dr_node *lmb_head = lmb_list->lmbs;
+	struct dr_node *lmb;
+	int nr_batch, nr_offline, nr_written;
+	int i, rc;
+	int *rcs;
+
+	batch = zalloc(usr_batch_size * (sizeof(*batch) + sizeof(*rcs)));
+	if (batch == NULL)
+		return -1;
+
+	rcs = (int *)(batch + usr_batch_size);
+
+	while (lmb_list->lmbs_modified < usr_drc_count) {
+		if (drmgr_timed_out())
+			break;
+
+		/* Select and offline the LMBs for this batch */
+		nr_batch = 0;
+		while ((nr_batch < usr_batch_size) &&
+		       (lmb_list->lmbs_modified + nr_batch < usr_drc_count)) {
+			lmb = get_available_lmb(lmb_list, lmb_head);
+			if (lmb == NULL)
+				break;
+
+			/* Iterate only over the remaining LMBs */
+			lmb_head = lmb->next;
+			batch[nr_batch++] = lmb;
 		}
 
-		while (lmb->lmb_mem_scns) {
-			struct mem_scn *scn = lmb->lmb_mem_scns;
-			lmb->lmb_mem_scns = scn->next;
-			free(scn);
+		if (nr_batch == 0) {
+			free(batch);
+			return -1;
 		}
 
-		rc = release_drc(lmb->drc_index, 0);
-		if (rc) {
-			report_unknown_error(__FILE__, __LINE__);
-			add_device_tree_lmb(lmb, lmb_list);
+		set_lmbs_state(batch, rcs, nr_batch, OFFLINE);
+
+		for (i = 0, nr_offline = 0; i < nr_batch; i++) {
+			lmb = batch[i];
+
+			if (rcs[i]) {
+				record_lmb_failure(lmb->drc_index);
+				lmb->unusable = 1;
+				continue;
+			}
+
+			batch[nr_offline++] = lmb;
+		}
+
+		nr_batch = nr_offline;
+		if (nr_batch == 0)
+			continue;
+
+		say(DEBUG, "Updating device tree for batch of %d LMBs\n",
+		    nr_batch);
+		nr_written = update_drconf_lmbs(batch, nr_batch, lmb_list,
+						REMOVE);
+		for (i = nr_written; i < nr_batch; i++) {
+			lmb = batch[i];
 			set_lmb_state(lmb, ONLINE);
 			lmb->unusable = 1;
-			continue;
 		}
+		nr_batch = nr_written;
 
-		lmb->is_removable = 0;
-		lmb_list->lmbs_modified++;
+		for (i = 0; i < nr_batch; i++) {
+			lmb = batch[i];
+
+			free_mem_scns(lmb);
+
+			rc = release_drc(lmb->drc_index, 0);
+			if (rc) {
+				report_unknown_error(__FILE__, __LINE__);
+				add_device_tree_lmb(lmb, lmb_list);
+				set_lmb_state(lmb, ONLINE);
+				lmb->unusable = 1;
+				continue;
+			}
+
+			lmb->is_removable = 0;
+			lmb_list->lmbs_modified++;
+		}
 	}
 
+	free(batch);
 	return 0;
 }
 
@@ -1289,23 +2006,61 @@ static int mem_remove(void)
 	unsigned int removable = 0;
 	int rc = 0;
 
-	lmb_list = get_lmbs(LMB_RANDOM_SORT);
+	lmb_list = get_lmbs(LMB_RANDOM_SORT, LMB_SCNS_LAZY);
 	if (lmb_list == NULL) {
 		say(ERROR, "Could not gather LMB (logical memory block "
 				"information.\n");
 		return -1;
 	}
 
-	/* Can not know which lmbs are removable by the is_removable field
-	 * if AMS ballooning is active.
-	 */
-	if (!ams_balloon_active()) {
-		/* Make sure we have enough removable memory to fulfill
-		 * this request
+	if (!usr_drc_name && !usr_drc_index) {
+		/* Rank the candidates for removal so that lmbs which
+		 * recently failed to offline are tried last.  This also
+		 * makes sure we have enough removable memory to fulfill
+		 * this request.
+		 */
+		lmb_list->queue_next = lmb_list->lmbs;
+		lmb_list->queue_active = 1;
+		removable = fill_remove_queue(lmb_list, usr_drc_count);
+
+		/* Keep counting if too many of the queued lmbs failed to
+		 * offline recently to know whether there is enough.
+		 */
+		for (lmb = lmb_list->queue_next;
+		     lmb && (removable < usr_drc_count); lmb = lmb->next) {
+			if (lmb_is_available(lmb, lmb_list,
+					     ams_balloon_active()))
+				removable++;
+		}
+
+		if (removable == 0) {
+			say(ERROR, "There is not enough removable memory "
+			    "available to fulfill the request.\n");
+			rc = -1;
+		}
+
+		if (removable < usr_drc_count) {
+			say(INFO, "Only %u LMBs are currently candidates "
+					"for removal.\n", removable);
+			usr_drc_count = removable;
+		}
+	} else if (!ams_balloon_active()) {
+		/* Can not know which lmbs are removable by the is_removable
+		 * field if AMS ballooning is active.
+		 *
+		 * Make sure we have enough removable memory to fulfill
+		 * this request.  Memory sections are only discovered
+		 * until we know there is enough.
 		 */
 		for (lmb = lmb_list->lmbs; lmb; lmb = lmb->next) {
+			if (discover_mem_scns(lmb, lmb_list))
+				continue;
+
 			if (lmb->is_removable)
 				removable++;
+
+			if (removable >= usr_drc_count)
+				break;
 		}
 
 		if (removable == 0) {
@@ -1323,7 +2078,10 @@ static int mem_remove(void)
 
 	if (!rc) {
 		say(DEBUG, "Attempting removal of %d LMBs\n", usr_drc_count);
-		rc = remove_lmbs(lmb_list);
+		if ((usr_batch_size > 1) && lmb_list->drconf_buf)
+			rc = remove_lmbs_batched(lmb_list);
+		else
+			rc = remove_lmbs(lmb_list);
 	}
 
 	say(ERROR, "Removed %d of %d requested LMB(s)\n",
@@ -1333,6 +2091,7 @@ static int mem_remove(void)
 		    usr_drc_count - lmb_list->lmbs_modified);
 	report_resource_count(lmb_list->lmbs_modified);
 
+	save_lmb_failures();
 	free_lmbs(lmb_list);
 	return rc;
 }
@@ -1374,7 +2133,7 @@ static int ehea_compatable(void)
 	/* The module is loaded, now we need to see if it
 	 * can handle memory dlpar operations.
 	 */
-	fp = fopen("/sys/bus/ibmebus/drivers/ehea/capabilities", "r");
+	fp = fopen(DR_ROOT "/sys/bus/ibmebus/drivers/ehea/capabilities", "r");
 	if (fp == NULL) {
 		/* File doesn't exist, memory dlpar operations are not
 		 * supported by this version of the ehea driver.
@@ -1415,6 +2174,23 @@ int valid_mem_options(void)
 		return -1;
 	}
 
+	if (usr_jobs < 0) {
+		say(ERROR, "Invalid number of jobs specified: %d\n",
+		    usr_jobs);
+		return -1;
+	}
+
+	if (usr_batch_size < 0) {
+		say(ERROR, "Invalid batch size specified: %d\n",
+		    usr_batch_size);
+		return -1;
+	}
+
+	if ((usr_numa_node >= 0) && usr_drc_name) {
+		say(ERROR, "The -N and -s flags are mutually exclusive\n");
+		return -1;
+	}
+
 	/* The -s option can specify a drc name or drc index */
 	if (usr_drc_name && !strncmp(usr_drc_name, "0x", 2)) {
 		usr_drc_index = strtoul(usr_drc_name, NULL, 16);
@@ -1463,6 +2239,296 @@ int do_mem_kernel_dlpar(void)
 	return rc;
 }
 
+/**
+ * prrn_remove_lmbs
+ * @brief Offline and release a batch of LMBs named by a PRRN event
+ *
+ * @param lmb_list list of all lmbs
+ * @param batch lmbs to remove, the removed ones are moved to the front
+ * @param rcs scratch array of nr_batch results
+ * @param nr_batch number of lmbs
+ * @returns number of lmbs removed
+ */
+static int prrn_remove_lmbs(struct lmb_list_head *lmb_list,
+			    struct dr_node **batch, int *rcs, int nr_batch)
+{
+	struct dr_node *lmb;
+	int i, nr_offline = 0, nr_removed = 0, nr_written;
+
+	set_lmbs_state(batch, rcs, nr_batch, OFFLINE);
+
+	for (i = 0; i < nr_batch; i++) {
+		lmb = batch[i];
+
+		if (rcs[i]) {
+			say(ERROR, "Could not offline LMB %s\n", lmb->drc_name);
+			record_lmb_failure(lmb->drc_index);
+			continue;
+		}
+
+		if (!lmb_list->drconf_buf &&
+		    remove_device_tree_lmb(lmb, lmb_list)) {
+			report_unknown_error(__FILE__, __LINE__);
+			set_lmb_state(lmb, ONLINE);
+			continue;
+		}
+
+		batch[nr_offline++] = lmb;
+	}
+
+	if (lmb_list->drconf_buf) {
+		nr_written = update_drconf_lmbs(batch, nr_offline, lmb_list,
+						REMOVE);
+		for (i = nr_written; i < nr_offline; i++)
+			set_lmb_state(batch[i], ONLINE);
+		nr_offline = nr_written;
+	}
+
+	for (i = 0; i < nr_offline; i++) {
+		lmb = batch[i];
+
+		free_mem_scns(lmb);
+
+		if (release_drc(lmb->drc_index, 0)) {
+			report_unknown_error(__FILE__, __LINE__);
+			add_device_tree_lmb(lmb, lmb_list);
+			set_lmb_state(lmb, ONLINE);
+			continue;
+		}
+
+		lmb->is_owned = 0;
+		lmb->is_removable = 0;
+		batch[nr_removed++] = lmb;
+	}
+
+	return nr_removed;
+}
+
+/**
+ * prrn_add_lmbs
+ * @brief Acquire and online a batch of LMBs removed for a PRRN event
+ *
+ * LMBs that cannot be onlined are removed from the device tree and
+ * released again.
+ *
+ * @param lmb_list list of all lmbs
+ * @param batch lmbs to add
+ * @param rcs scratch array of nr_batch results
+ * @param nr_batch number of lmbs
+ * @returns number of lmbs added
+ */
+static int prrn_add_lmbs(struct lmb_list_head *lmb_list,
+			 struct dr_node **batch, int *rcs, int nr_batch)
+{
+	struct dr_node *lmb;
+	int i, nr_acquired = 0, nr_online, nr_written, nr_added = 0;
+
+	for (i = 0; i < nr_batch; i++) {
+		lmb = batch[i];
+
+		if (acquire_drc(lmb->drc_index)) {
+			say(ERROR, "Could not acquire LMB %s\n", lmb->drc_name);
+			continue;
+		}
+
+		if (lmb_list->drconf_buf) {
+			lmb->lmb_of_node = configure_connector(lmb->drc_index);
+			if (lmb->lmb_of_node == NULL) {
+				release_drc(lmb->drc_index, MEM_DEV);
+				continue;
+			}
+		} else if (add_device_tree_lmb(lmb, lmb_list)) {
+			release_drc(lmb->drc_index, MEM_DEV);
+			continue;
+		}
+
+		batch[nr_acquired++] = lmb;
+	}
+
+	nr_online = nr_acquired;
+	if (lmb_list->drconf_buf) {
+		nr_written = update_drconf_lmbs(batch, nr_acquired, lmb_list,
+						ADD);
+		for (i = nr_written; i < nr_acquired; i++) {
+			lmb = batch[i];
+			release_drc(lmb->drc_index, MEM_DEV);
+			free_of_node(lmb->lmb_of_node);
+			lmb->lmb_of_node = NULL;
+		}
+		nr_acquired = nr_written;
+
+		/* LMBs without memory sections are moved to the end of
+		 * the batch and rolled back with those that fail to online.
+		 */
+		nr_online = nr_acquired;
+		for (i = 0; i < nr_online; ) {
+			lmb = batch[i];
+
+			if (get_mem_scns(lmb, lmb_list)) {
+				say(ERROR, "Could not find the memory sections "
+				    "of LMB %s\n", lmb->drc_name);
+				batch[i] = batch[--nr_online];
+				batch[nr_online] = lmb;
+				continue;
+			}
+
+			i++;
+		}
+	}
+
+	for (i = nr_online; i < nr_acquired; i++)
+		rcs[i] = -1;
+
+	set_lmbs_state(batch, rcs, nr_online, ONLINE);
+
+	for (i = 0; i < nr_acquired; i++) {
+		lmb = batch[i];
+
+		if (rcs[i]) {
+			if (i < nr_online)
+				say(ERROR, "Could not online LMB %s\n",
+				    lmb->drc_name);
+			free_mem_scns(lmb);
+			if (remove_device_tree_lmb(lmb, lmb_list))
+				report_unknown_error(__FILE__, __LINE__);
+			release_drc(lmb->drc_index, MEM_DEV);
+			continue;
+		}
+
+		lmb->is_owned = 1;
+		nr_added++;
+	}
+
+	return nr_added;
+}
+
+/**
+ * prrn_mem
+ * @brief Remove and re-add the LMBs named by a PRRN event
+ *
+ * The LMB information is gathered once for all of the LMBs.  They are
+ * then cycled usr_batch_size at a time, the LMBs of a batch are
+ * offlined and onlined by up to usr_jobs threads.  The device tree
+ * is updated one LMB at a time, see update_drconf_lmbs().
+ *
+ * @param drc_indexes drc indexes of the LMBs, without duplicates
+ * @param nr number of LMBs
+ * @returns 0 on success, !0 if the LMBs could not be updated at all
+ */
+int prrn_mem(uint32_t *drc_indexes, int nr)
+{
+	struct lmb_list_head *lmb_list = NULL;
+	struct dr_node **batch;
+	struct timespec start;
+	int batch_sz = MAX(usr_batch_size, 1);
+	int nr_batch, nr_done = 0, nr_updated = 0;
+	int i, j;
+	int *rcs;
+
+	if (!mem_dlpar_capable()) {
+		say(ERROR, "DLPAR memory operations are not supported on "
+		    "this kernel.\n");
+		return -1;
+	}
+
+	usr_action = REMOVE;
+	if (!ehea_compatable())
+		return -1;
+
+	usr_action = ADD;
+	if (!ehea_compatable())
+		return -1;
+
+	/* The kernel does the whole update of each LMB */
+	if (kernel_dlpar_exists()) {
+		usr_drc_count = 1;
+		usr_drc_name = NULL;
+
+		for (i = 0; i < nr; i++) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			set_timeout(PRRN_TIMEOUT);
+
+			usr_drc_index = drc_indexes[i];
+			usr_action = REMOVE;
+			if (!do_mem_kernel_dlpar()) {
+				usr_action = ADD;
+				if (!do_mem_kernel_dlpar())
+					nr_updated++;
+			}
+
+			prrn_progress("LMB", &drc_indexes[i], 1, i + 1, nr,
+				      &start);
+		}
+
+		say(INFO, "Updated %d of %d LMBs\n", nr_updated, nr);
+		return 0;
+	}
+
+	lmb_list = get_lmbs(LMB_NORMAL_SORT, LMB_SCNS_LAZY);
+	if (lmb_list == NULL) {
+		say(ERROR, "Could not gather LMB (logical memory block "
+				"information.\n");
+		return -1;
+	}
+
+	batch = zalloc(batch_sz * (sizeof(*batch) + sizeof(*rcs)));
+	if (batch == NULL) {
+		free_lmbs(lmb_list);
+		return -1;
+	}
+
+	rcs = (int *)(batch + batch_sz);
+
+	for (i = 0; i < nr; i += j) {
+		int balloon_active = ams_balloon_active();
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		set_timeout(PRRN_TIMEOUT);
+
+		nr_batch = 0;
+		for (j = 0; j < batch_sz && i + j < nr; j++) {
+			struct lmb_index *entry;
+			struct dr_node *lmb;
+
+			entry = find_lmb_index(lmb_list, drc_indexes[i + j]);
+			if (entry == NULL) {
+				say(ERROR, "Could not find LMB with drc index "
+				    "%x\n", drc_indexes[i + j]);
+				continue;
+			}
+
+			lmb = entry->lmb;
+			if (!lmb->is_owned || discover_mem_scns(lmb, lmb_list)) {
+				say(DEBUG, "LMB %s is not assigned to this "
+				    "partition\n", lmb->drc_name);
+				continue;
+			}
+
+			/* removable is ignored if AMS ballooning is active */
+			if (!balloon_active && !lmb->is_removable) {
+				say(ERROR, "LMB %s is not removable\n",
+				    lmb->drc_name);
+				continue;
+			}
+
+			batch[nr_batch++] = lmb;
+		}
+
+		nr_batch = prrn_remove_lmbs(lmb_list, batch, rcs, nr_batch);
+		nr_updated += prrn_add_lmbs(lmb_list, batch, rcs, nr_batch);
+
+		nr_done += j;
+		prrn_progress("LMB", &drc_indexes[i], j, nr_done, nr, &start);
+	}
+
+	say(INFO, "Updated %d of %d LMBs\n", nr_updated, nr);
+
+	save_lmb_failures();
+	free(batch);
+	free_lmbs(lmb_list);
+	return 0;
+}
+
 int drslot_chrp_mem(void)
 {
 	int rc = -1;
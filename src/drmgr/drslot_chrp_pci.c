@@ -25,6 +25,7 @@
 #include <signal.h>
 #include <errno.h>
 #include <locale.h>
+#include <pthread.h>
 #include <librtas.h>
 
 #include "rtas_calls.h"
@@ -45,7 +46,16 @@ static char *speed_error = "Add operation failed. The 33MHz PCI card may\n"
 #define USER_QUIT  0		/* user wants to bail out of operation	 */
 #define USER_CONT  1		/* user wants to continue with operation */
 
-static char *usagestr = 	"-c pci -s <drc_name | drc_index> {-i | -a [-I] | -r [-I] | -R [-I]}";
+static char *usagestr = 	"-c pci -s <drc_name | drc_index>[,...] {-i | -a [-I] | -r [-I] | -R [-I]} [-n [-j <jobs>]]";
+
+/* Slots that are added, removed or replaced concurrently take turns
+ * for configure-connector and the device tree updates.
+ */
+static pthread_mutex_t slot_ofdt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int add_slot(struct dr_node *node);
+static int replace_slot(struct dr_node *repl_node);
+
 /**
  * pci_usage
  *
@@ -425,8 +435,10 @@ static int add_work(struct dr_node *node)
 	 * the return status requires a message, print it out
 	 * and exit, otherwise, add the nodes to the OF tree.
 	 */
+	pthread_mutex_lock(&slot_ofdt_lock);
 	new_nodes = configure_connector(node->drc_index);
 	if (new_nodes == NULL) {
+		pthread_mutex_unlock(&slot_ofdt_lock);
 		rtas_set_indicator(ISOLATION_STATE, node->drc_index, ISOLATE);
 		set_power(node->drc_power, POWER_OFF);
 		return -1;
@@ -434,6 +446,7 @@ static int add_work(struct dr_node *node)
 
 	say(DEBUG, "Adding %s to %s\n", new_nodes->name, node->ofdt_path);
 	rc = add_device_tree_nodes(node->ofdt_path, new_nodes);
+	pthread_mutex_unlock(&slot_ofdt_lock);
 	if (rc) {
 		say(DEBUG, "add_device_tree_nodes failed at %s\n",
 		    node->ofdt_path);
@@ -528,7 +541,6 @@ static int do_add(struct dr_node *all_nodes)
 {
 	struct dr_node *node;
 	int usr_key = USER_CONT;
-	int rc;
 
 	node = find_slot(usr_drc_name, all_nodes);
 	if (node == NULL)
@@ -562,6 +574,20 @@ static int do_add(struct dr_node *all_nodes)
 		return -1;
 	}
 
+	return add_slot(node);
+}
+
+/**
+ * add_slot
+ * @brief Add the adapter in a slot once it has been validated
+ *
+ * @param node slot to add
+ * @returns 0 on success, !0 otherwise
+ */
+static int add_slot(struct dr_node *node)
+{
+	int rc;
+
 	if (!pci_hotplug_only) {
 		rc = do_insert_card_work(node);
 		if (rc)
@@ -579,12 +605,13 @@ static int do_add(struct dr_node *all_nodes)
 
 	/* Try to config the adapter. The rpaphp module doesn't play well with
 	 * qemu pci slots so we let the generic kernel pci code probe the device
-	 * by rescanning the bus in the qemu virtio case.
+	 * by rescanning the bus in the qemu virtio case.  The rescan is
+	 * deferred so that the rescans of several slots are merged.
 	 */
 	if (!pci_virtio)
 		set_hp_adapter_status(PHP_CONFIG_ADAPTER, node->drc_name);
 	else
-		pci_rescan_bus();
+		pci_rescan_schedule(node->ofdt_path);
 
 	return 0;
 }
@@ -602,19 +629,15 @@ static int do_add(struct dr_node *all_nodes)
  * Open Firmware device tree. The slot is isolated and powered off,
  * and the LED is turned off.
  *
+ * @param node slot to remove
  * @returns pointer slot on success, NULL on failure
  */
-static struct dr_node *remove_work(struct dr_node *all_nodes)
+static struct dr_node *remove_work(struct dr_node *node)
 {
-	struct dr_node *node;
 	struct dr_node *child;
 	int rc;
 	int usr_key = USER_CONT;
 
-	node = find_slot(usr_drc_name, all_nodes);
-	if (node == NULL)
-		return NULL;
-
 	say(DEBUG, "found node: drc name=%s, index=0x%x, path=%s\n",
 	     node->drc_name, node->drc_index, node->ofdt_path);
 
@@ -688,17 +711,29 @@ static struct dr_node *remove_work(struct dr_node *all_nodes)
 	}
 
 	/* Call subroutine to remove node(s) from
-	 * the device tree.
+	 * the device tree, all children in one transaction.
 	 */
-	for (child = node->children; child; child = child->next) {
-		rc = remove_device_tree_nodes(child->ofdt_path);
-		if (rc) {
-			say(ERROR, "%s", sw_error);
-			rtas_set_indicator(ISOLATION_STATE, node->drc_index,
-					   ISOLATE);
-			set_power(node->drc_power, POWER_OFF);
-			return NULL;
+	pthread_mutex_lock(&slot_ofdt_lock);
+	rc = ofdt_txn_begin();
+	if (!rc) {
+		for (child = node->children; child; child = child->next) {
+			rc = remove_device_tree_nodes(child->ofdt_path);
+			if (rc)
+				break;
 		}
+
+		if (rc)
+			ofdt_txn_abort();
+		else
+			rc = ofdt_txn_commit();
+	}
+	pthread_mutex_unlock(&slot_ofdt_lock);
+
+	if (rc) {
+		say(ERROR, "%s", sw_error);
+		rtas_set_indicator(ISOLATION_STATE, node->drc_index, ISOLATE);
+		set_power(node->drc_power, POWER_OFF);
+		return NULL;
 	}
 
 	if (pci_hotplug_only)
@@ -761,8 +796,12 @@ static int do_remove(struct dr_node *all_nodes)
 {
 	struct dr_node *node;
 
+	node = find_slot(usr_drc_name, all_nodes);
+	if (node == NULL)
+		return -1;
+
 	/* Remove the specified slot and update the device-tree */
-	node = remove_work(all_nodes);
+	node = remove_work(node);
 	if (node == NULL)
 		return -1;
 
@@ -808,12 +847,15 @@ static int do_remove(struct dr_node *all_nodes)
 static int do_replace(struct dr_node *all_nodes)
 {
 	struct dr_node *repl_node;
-	int rc;
 
 	/* Call the routine which does the work of getting the node info,
 	 * then removing it from the OF device tree.
 	 */
-	repl_node = remove_work(all_nodes);
+	repl_node = find_slot(usr_drc_name, all_nodes);
+	if (repl_node == NULL)
+		return -1;
+
+	repl_node = remove_work(repl_node);
 	if (repl_node == NULL)
 		return -1;
 
@@ -845,6 +887,20 @@ static int do_replace(struct dr_node *all_nodes)
 		}
 	}
 
+	return replace_slot(repl_node);
+}
+
+/**
+ * replace_slot
+ * @brief Add the new adapter of a slot whose old adapter was removed
+ *
+ * @param repl_node slot being replaced
+ * @returns 0 on success, !0 otherwise
+ */
+static int replace_slot(struct dr_node *repl_node)
+{
+	int rc;
+
 	rc = add_work(repl_node);
 	if (rc)
 		return rc;
@@ -862,6 +918,11 @@ static int do_replace(struct dr_node *all_nodes)
 		usr_prompt = 0;;
 
 		repl_node = remove_work(repl_node);
+		if (repl_node == NULL) {
+			usr_prompt = prompt_save;
+			return -1;
+		}
+
 		rc = add_work(repl_node);
 		if (!rc)
 			set_hp_adapter_status(PHP_CONFIG_ADAPTER,
@@ -873,6 +934,228 @@ static int do_replace(struct dr_node *all_nodes)
 	return rc;
 }
 
+/* Slots worked on concurrently in multi-slot mode, one power domain
+ * at a time per worker.
+ */
+struct slot_work {
+	struct dr_node	**slots;	/* sorted by power domain */
+	int		*rcs;
+	int		nr_slots;
+	int		*groups;	/* first slot of each power domain */
+	int		nr_groups;
+	int		next;		/* next power domain to work on */
+	pthread_mutex_t	lock;
+};
+
+/**
+ * slot_op
+ * @brief Add, remove or replace one slot of a multi-slot operation
+ *
+ * @param node slot to work on
+ * @returns 0 on success, !0 otherwise
+ */
+static int slot_op(struct dr_node *node)
+{
+	switch (usr_action) {
+	    case ADD:
+		return add_slot(node);
+	    case REMOVE:
+		return remove_work(node) ? 0 : -1;
+	    case REPLACE:
+		node = remove_work(node);
+		if (node == NULL)
+			return -1;
+
+		if (!node->children) {
+			say(ERROR, "Bad node struct.\n");
+			return -1;
+		}
+
+		return replace_slot(node);
+	    default:
+		return -1;
+	}
+}
+
+static void *slot_worker(void *arg)
+{
+	struct slot_work *work = arg;
+	int i, j;
+
+	while (1) {
+		pthread_mutex_lock(&work->lock);
+		i = work->next++;
+		pthread_mutex_unlock(&work->lock);
+
+		if (i >= work->nr_groups)
+			break;
+
+		for (j = work->groups[i]; j < work->groups[i + 1]; j++)
+			work->rcs[j] = slot_op(work->slots[j]);
+	}
+
+	return NULL;
+}
+
+/**
+ * do_multi_slot
+ * @brief Add, remove or replace a list of slots
+ *
+ * All of the slots are validated before any of them is touched.  The
+ * slots are then powered, isolated and configured concurrently, with
+ * up to usr_jobs slots at a time, or all of them if no limit is given.
+ * Slots that share a power domain could power each other off in the
+ * middle of a configure, so they are worked on one after the other.
+ * For qemu virtio devices the PCI buses are rescanned once at the end.
+ *
+ * @param all_nodes
+ * @returns 0 on success, !0 otherwise
+ */
+static int do_multi_slot(struct dr_node *all_nodes)
+{
+	struct slot_work work;
+	pthread_t *threads = NULL;
+	char *names, *name, *saveptr;
+	int nr_threads, i, j;
+	int rc = 0;
+
+	if (usr_prompt || usr_action == IDENTIFY) {
+		say(ERROR, "Multiple PCI slots can only be added, removed or "
+		    "replaced\nwith the -n option\n");
+		return -1;
+	}
+
+	names = strdup(usr_drc_name);
+	if (names == NULL)
+		return -1;
+
+	memset(&work, 0, sizeof(work));
+	work.nr_slots = 1;
+	for (name = names; *name; name++) {
+		if (*name == ',')
+			work.nr_slots++;
+	}
+
+	work.slots = zalloc(work.nr_slots * sizeof(*work.slots));
+	work.rcs = zalloc(work.nr_slots * sizeof(*work.rcs));
+	work.groups = zalloc((work.nr_slots + 1) * sizeof(*work.groups));
+	if (work.slots == NULL || work.rcs == NULL || work.groups == NULL) {
+		rc = -1;
+		goto out;
+	}
+
+	i = 0;
+	for (name = strtok_r(names, ",", &saveptr); name;
+	     name = strtok_r(NULL, ",", &saveptr)) {
+		char *drc_name = name;
+		struct dr_node *node;
+
+		if (!strncmp(drc_name, "0x", 2)) {
+			drc_name = find_drc_name(strtoul(drc_name, NULL, 16),
+						 all_nodes);
+			if (drc_name == NULL) {
+				rc = -1;
+				goto out;
+			}
+		}
+
+		node = find_slot(drc_name, all_nodes);
+		if (node == NULL) {
+			rc = -1;
+			goto out;
+		}
+
+		for (j = 0; j < i; j++) {
+			if (work.slots[j] == node)
+				break;
+		}
+
+		if (j < i) {
+			say(ERROR, "PCI slot %s is specified more than once.\n",
+			    node->drc_name);
+			rc = -1;
+			goto out;
+		}
+
+		if (is_display_adapter(node)) {
+			say(ERROR, "DLPAR of display adapters is not "
+			    "supported.\n");
+			rc = -1;
+			goto out;
+		}
+
+		if (usr_action == ADD && node->children != NULL) {
+			say(ERROR, "PCI slot %s is already occupied.\n",
+			    node->drc_name);
+			rc = -1;
+			goto out;
+		}
+
+		work.slots[i++] = node;
+	}
+	work.nr_slots = i;
+
+	/* Keep the slots of a power domain together, in the order they
+	 * were given.
+	 */
+	for (i = 1; i < work.nr_slots; i++) {
+		struct dr_node *node = work.slots[i];
+
+		for (j = i; j > 0 &&
+		     work.slots[j - 1]->drc_power > node->drc_power; j--)
+			work.slots[j] = work.slots[j - 1];
+		work.slots[j] = node;
+	}
+
+	for (i = 0; i < work.nr_slots; i++) {
+		if (!i || work.slots[i]->drc_power !=
+			  work.slots[i - 1]->drc_power)
+			work.groups[work.nr_groups++] = i;
+	}
+	work.groups[work.nr_groups] = work.nr_slots;
+
+	nr_threads = (usr_jobs > 0 && usr_jobs < work.nr_groups) ?
+						usr_jobs : work.nr_groups;
+
+	say(DEBUG, "Working on %d PCI slots in %d power domains with %d "
+	    "threads\n", work.nr_slots, work.nr_groups, nr_threads);
+
+	pthread_mutex_init(&work.lock, NULL);
+
+	/* The calling thread is one of the workers */
+	threads = zalloc(nr_threads * sizeof(*threads));
+	for (i = 0; threads && i < nr_threads - 1; i++) {
+		if (pthread_create(&threads[i], NULL, slot_worker, &work))
+			break;
+	}
+	nr_threads = threads ? i : 0;
+
+	slot_worker(&work);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&work.lock);
+
+	for (i = 0; i < work.nr_slots; i++) {
+		if (work.rcs[i]) {
+			say(ERROR, "Could not %s PCI slot %s\n",
+			    usr_action == ADD ? "add" :
+			    usr_action == REMOVE ? "remove" : "replace",
+			    work.slots[i]->drc_name);
+			rc = -1;
+		}
+	}
+
+out:
+	free(threads);
+	free(work.slots);
+	free(work.rcs);
+	free(work.groups);
+	free(names);
+	return rc;
+}
+
 int valid_pci_options(void)
 {
 	if ((usr_action == IDENTIFY) && (!usr_slot_identification)) {
@@ -880,8 +1163,11 @@ int valid_pci_options(void)
 		return -1;
 	}
 
-	/* The -s option can specify a drc name or drc index */
-	if (usr_drc_name && !strncmp(usr_drc_name, "0x", 2)) {
+	/* The -s option can specify a drc name or drc index, a list of
+	 * slots is resolved by do_multi_slot().
+	 */
+	if (usr_drc_name && !strchr(usr_drc_name, ',') &&
+	    !strncmp(usr_drc_name, "0x", 2)) {
 		usr_drc_index = strtoul(usr_drc_name, NULL, 16);
 		usr_drc_name = NULL;
 	}
@@ -919,25 +1205,32 @@ int drslot_chrp_pci(void)
 	if (!usr_drc_name)
 		usr_drc_name = find_drc_name(usr_drc_index, all_nodes);
 
-	switch (usr_action) {
-	    case ADD:
-		rc = do_add(all_nodes);
-		break;
-	    case REMOVE:
-		rc = do_remove(all_nodes);
-		break;
-	    case REPLACE:
-		rc = do_replace(all_nodes);
-		break;
-	    case IDENTIFY:
-		rc = do_identify(all_nodes);
-		break;
-	    default:
-		say(ERROR, "Invalid operation specified!\n");
-		rc = -1;
-		break;
+	if (usr_drc_name && strchr(usr_drc_name, ',')) {
+		rc = do_multi_slot(all_nodes);
+	} else {
+		switch (usr_action) {
+		    case ADD:
+			rc = do_add(all_nodes);
+			break;
+		    case REMOVE:
+			rc = do_remove(all_nodes);
+			break;
+		    case REPLACE:
+			rc = do_replace(all_nodes);
+			break;
+		    case IDENTIFY:
+			rc = do_identify(all_nodes);
+			break;
+		    default:
+			say(ERROR, "Invalid operation specified!\n");
+			rc = -1;
+			break;
+		}
 	}
 
+	/* Rescan the PCI buses of the added qemu virtio slots */
+	pci_rescan_flush();
+
 	free_node(all_nodes);
 	return rc;
 }
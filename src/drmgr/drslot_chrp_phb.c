@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include <pthread.h>
 #include <librtas.h>
 #include <errno.h>
 #include "dr.h"
@@ -108,16 +109,24 @@ release_phb(struct dr_node *phb)
 {
 	int rc;
 
-	rc = remove_device_tree_nodes(phb->ofdt_path);
+	/* The PHB and its interrupt controller are removed together */
+	rc = ofdt_txn_begin();
 	if (rc)
 		return rc;
 
-	if (phb->phb_ic_ofdt_path[0] != '\0') {
+	rc = remove_device_tree_nodes(phb->ofdt_path);
+	if (!rc && phb->phb_ic_ofdt_path[0] != '\0')
 		rc = remove_device_tree_nodes(phb->phb_ic_ofdt_path);
-		if (rc)
-			return rc;
+
+	if (rc) {
+		ofdt_txn_abort();
+		return rc;
 	}
 
+	rc = ofdt_txn_commit();
+	if (rc)
+		return rc;
+
 	rc = release_drc(phb->drc_index, PHB_DEV);
 
 	return rc;
@@ -129,7 +138,7 @@ struct hpdev {
 	char devspec[256];
 };
 
-#define SYSFS_PCI_DEV_PATH	"/sys/bus/pci/devices"
+#define SYSFS_PCI_DEV_PATH	DR_ROOT "/sys/bus/pci/devices"
 
 static void free_hpdev_list(struct hpdev *hpdev_list)
 {
@@ -143,12 +152,23 @@ static void free_hpdev_list(struct hpdev *hpdev_list)
 	}
 }
 
-static int get_os_hp_devices(struct hpdev **hpdev_list)
+/**
+ * get_os_hp_devices
+ * @brief Find the PCI devices below a PHB
+ *
+ * @param phb PHB to find the devices of
+ * @param hpdev_list list of devices found
+ * @returns 0 on success, !0 otherwise
+ */
+static int get_os_hp_devices(struct dr_node *phb, struct hpdev **hpdev_list)
 {
 	struct hpdev *hp_list = NULL;
 	struct hpdev *hpdev;
 	DIR *d;
 	struct dirent *de;
+	char *phb_devspec = phb->ofdt_path + strlen(OFDT_BASE);
+	size_t phb_len = strlen(phb_devspec);
+	char devspec[256];
 	int rc = 0;
 
 	d = opendir(SYSFS_PCI_DEV_PATH);
@@ -158,27 +178,39 @@ static int get_os_hp_devices(struct hpdev **hpdev_list)
 	}
 
 	while ((de = readdir(d)) != NULL) {
+		char *path;
+
 		if (is_dot_dir(de->d_name))
 			continue;
 
+		rc = asprintf(&path, "%s/%s", SYSFS_PCI_DEV_PATH, de->d_name);
+		if (rc == -1)
+			break;
+
+		rc = get_str_attribute(path, "devspec", devspec, 256);
+		if (rc) {
+			free(path);
+			break;
+		}
+
+		/* Only the devices of this PHB are of interest */
+		if (strncmp(devspec, phb_devspec, phb_len) ||
+		    devspec[phb_len] != '/') {
+			free(path);
+			continue;
+		}
+
 		hpdev = zalloc(sizeof(*hpdev));
 		if (!hpdev) {
+			free(path);
 			rc = -1;
 			break;
 		}
 
 		hpdev->next = hp_list;
 		hp_list = hpdev;
-
-		rc = asprintf(&hpdev->path, "%s/%s", SYSFS_PCI_DEV_PATH,
-			      de->d_name);
-		if (rc == -1)
-			break;
-
-		rc = get_str_attribute(hpdev->path, "devspec", hpdev->devspec,
-				       256);
-		if (rc)
-			break;
+		hpdev->path = path;
+		strcpy(hpdev->devspec, devspec);
 
 		say(EXTRA_DEBUG, "HPDEV: %s\n       %s\n", hpdev->path,
 		    hpdev->devspec);
@@ -217,8 +249,99 @@ static int hp_remove_os_device(struct hpdev *hpdev)
 	return rc;
 }
 
-static int disable_os_hp_children_recurse(struct dr_node *phb,
-					  struct hpdev *hpdev_list, char *ofpath)
+/* Independent subtrees of a PHB that are torn down concurrently */
+struct subtree_work {
+	void		**items;
+	int		*rcs;
+	int		nr_items;
+	int		next;
+	int		(*fn)(void *, void *);
+	void		*data;
+	pthread_mutex_t	lock;
+};
+
+static void *subtree_worker(void *arg)
+{
+	struct subtree_work *work = arg;
+	int i;
+
+	while (1) {
+		pthread_mutex_lock(&work->lock);
+		i = work->next++;
+		pthread_mutex_unlock(&work->lock);
+
+		if (i >= work->nr_items)
+			break;
+
+		work->rcs[i] = work->fn(work->items[i], work->data);
+	}
+
+	return NULL;
+}
+
+/**
+ * run_subtree_work
+ * @brief Call a function for each subtree of a PHB
+ *
+ * The subtrees are handed out to up to usr_jobs threads, or one thread
+ * per subtree if no limit is given.  The order within a subtree is up
+ * to the function.
+ *
+ * @param work subtrees and function to call for each of them
+ * @returns 0 on success, the first failure otherwise
+ */
+static int run_subtree_work(struct subtree_work *work)
+{
+	pthread_t *threads;
+	int nr_threads, i;
+	int rc = 0;
+
+	if (work->nr_items == 0)
+		return 0;
+
+	nr_threads = (usr_jobs > 0 && usr_jobs < work->nr_items) ?
+						usr_jobs : work->nr_items;
+
+	work->next = 0;
+	pthread_mutex_init(&work->lock, NULL);
+
+	/* The calling thread is one of the workers */
+	threads = zalloc(nr_threads * sizeof(*threads));
+	for (i = 0; threads && i < nr_threads - 1; i++) {
+		if (pthread_create(&threads[i], NULL, subtree_worker, work))
+			break;
+	}
+	nr_threads = threads ? i : 0;
+
+	subtree_worker(work);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&work->lock);
+	free(threads);
+
+	for (i = 0; i < work->nr_items; i++) {
+		if (work->rcs[i]) {
+			rc = work->rcs[i];
+			break;
+		}
+	}
+
+	return rc;
+}
+
+/**
+ * disable_os_hp_subtree
+ * @brief Hotplug remove the OS devices of a device tree subtree
+ *
+ * Devices are removed below their children.
+ *
+ * @param hpdev_list PCI devices of the PHB
+ * @param ofpath device tree path of the subtree
+ * @returns 0 on success, !0 otherwise
+ */
+static int disable_os_hp_subtree(struct hpdev *hpdev_list, char *ofpath)
 {
 	struct hpdev *hpdev;
 	DIR *d;
@@ -230,52 +353,139 @@ static int disable_os_hp_children_recurse(struct dr_node *phb,
 		return -1;
 
 	while ((de = readdir(d)) != NULL) {
-		char devspec[PATH_MAX] = { 0 };
+		char lpath[4096];
 
-		if (is_dot_dir(de->d_name))
+		if (is_dot_dir(de->d_name) || de->d_type != DT_DIR)
 			continue;
 
-		if (de->d_type == DT_DIR) {
-			char lpath[4096];
-			sprintf(lpath, "%s/%s", ofpath, de->d_name);
-			rc = disable_os_hp_children_recurse(phb, hpdev_list, lpath);
-		}
-
-		sprintf(devspec, "%s/%s", ofpath + strlen(OFDT_BASE),
-			de->d_name);
+		sprintf(lpath, "%s/%s", ofpath, de->d_name);
+		rc = disable_os_hp_subtree(hpdev_list, lpath);
+		if (rc)
+			break;
+	}
 
-		for (hpdev = hpdev_list; hpdev; hpdev = hpdev->next) {
-			if (!strcmp(hpdev->devspec, devspec)) {
-				rc = hp_remove_os_device(hpdev);
-				break;
-			}
-		}
+	closedir(d);
+	if (rc)
+		return rc;
 
-		if (rc) {
-			say(ERROR, "Failed to hotplug remove %s\n",
-			    hpdev->path);
+	for (hpdev = hpdev_list; hpdev; hpdev = hpdev->next) {
+		if (!strcmp(hpdev->devspec, ofpath + strlen(OFDT_BASE))) {
+			rc = hp_remove_os_device(hpdev);
+			if (rc)
+				say(ERROR, "Failed to hotplug remove %s\n",
+				    hpdev->path);
 			break;
 		}
 	}
 
-	closedir(d);
 	return rc;
 }
 
+static int disable_os_hp_subtree_fn(void *item, void *data)
+{
+	return disable_os_hp_subtree(data, item);
+}
+
 static int disable_os_hp_children(struct dr_node *phb)
 {
+	struct subtree_work work;
 	struct hpdev *hpdev_list;
-	int rc = 0;
+	DIR *d;
+	struct dirent *de;
+	int i, rc = 0;
 
-	rc = get_os_hp_devices(&hpdev_list);
+	rc = get_os_hp_devices(phb, &hpdev_list);
 	if (rc)
 		return -1;
 
-	rc = disable_os_hp_children_recurse(phb, hpdev_list, phb->ofdt_path);
+	if (hpdev_list == NULL)
+		return 0;
+
+	d = opendir(phb->ofdt_path);
+	if (!d) {
+		free_hpdev_list(hpdev_list);
+		return -1;
+	}
+
+	memset(&work, 0, sizeof(work));
+	work.fn = disable_os_hp_subtree_fn;
+	work.data = hpdev_list;
+
+	while ((de = readdir(d)) != NULL) {
+		void **items;
+		char *path;
+
+		if (is_dot_dir(de->d_name) || de->d_type != DT_DIR)
+			continue;
+
+		if (asprintf(&path, "%s/%s", phb->ofdt_path, de->d_name) < 0) {
+			rc = -1;
+			break;
+		}
+
+		items = realloc(work.items,
+				(work.nr_items + 1) * sizeof(*items));
+		if (items == NULL) {
+			free(path);
+			rc = -1;
+			break;
+		}
+
+		work.items = items;
+		work.items[work.nr_items++] = path;
+	}
+
+	closedir(d);
+
+	if (!rc) {
+		work.rcs = zalloc(work.nr_items * sizeof(*work.rcs) + 1);
+		rc = work.rcs ? run_subtree_work(&work) : -1;
+	}
+
+	for (i = 0; i < work.nr_items; i++)
+		free(work.items[i]);
+	free(work.items);
+	free(work.rcs);
 	free_hpdev_list(hpdev_list);
 	return rc;
 }
 
+/**
+ * release_hp_slot
+ * @brief Unconfigure and release the children of a PHB's hotplug slot
+ *
+ * @param item hotplug slot child of the PHB
+ * @param data list of all hotplug slots
+ * @returns 0 on success, !0 otherwise
+ */
+static int release_hp_slot(void *item, void *data)
+{
+	struct dr_node *child = item;
+	struct dr_node *slot;
+	int rc;
+
+	rc = disable_hp_children(child->drc_name);
+	if (rc)
+		say(ERROR, "failed to disable hotplug children\n");
+
+	/* find dr_node corresponding to child slot's drc_name */
+	for (slot = data; slot; slot = slot->next)
+		if (!strcmp(child->drc_name, slot->drc_name))
+			break;
+
+	if (slot == NULL)
+		return 0;
+
+	/* release any hp children from the slot */
+	rc = release_hp_children_from_node(slot);
+	if (rc && rc != -EINVAL) {
+		say(ERROR, "failed to release hotplug children\n");
+		return rc;
+	}
+
+	return 0;
+}
+
 /**
  * remove_phb
  *
@@ -286,6 +496,7 @@ static int remove_phb(void)
 	struct dr_node *phb;
 	struct dr_node *child;
 	struct dr_node *hp_list = NULL;
+	struct subtree_work work;
 	int rc = 0;
 
 	phb = get_node_by_name(usr_drc_name, PHB_NODES);
@@ -305,33 +516,41 @@ static int remove_phb(void)
 		goto phb_remove_error;
 	}
 
-	/* Now, disable any hotplug children */
+	/* Now, disable any hotplug children.  The slots are independent
+	 * of each other and are released concurrently.
+	 */
 	hp_list = get_hp_nodes();
 
+	memset(&work, 0, sizeof(work));
+	work.fn = release_hp_slot;
+	work.data = hp_list;
+
 	for (child = phb->children; child; child = child->next) {
-		struct dr_node *slot;
+		if (child->dev_type == PCI_HP_DEV)
+			work.nr_items++;
+	}
 
-		if (child->dev_type == PCI_HP_DEV) {
-			rc = disable_hp_children(child->drc_name);
-			if (rc)
-				say(ERROR,
-				    "failed to disable hotplug children\n");
-
-			/* find dr_node corresponding to child slot's drc_name */
-			for (slot = hp_list; slot; slot = slot->next)
-				if (!strcmp(child->drc_name, slot->drc_name))
-					break;
-
-			/* release any hp children from the slot */
-			rc = release_hp_children_from_node(slot);
-			if (rc && rc != -EINVAL) {
-				say(ERROR,
-				    "failed to release hotplug children\n");
-				goto phb_remove_error;
-			}
-		}
+	work.items = zalloc(work.nr_items * sizeof(*work.items) + 1);
+	work.rcs = zalloc(work.nr_items * sizeof(*work.rcs) + 1);
+	if (work.items == NULL || work.rcs == NULL) {
+		free(work.items);
+		free(work.rcs);
+		rc = -1;
+		goto phb_remove_error;
+	}
+
+	work.nr_items = 0;
+	for (child = phb->children; child; child = child->next) {
+		if (child->dev_type == PCI_HP_DEV)
+			work.items[work.nr_items++] = child;
 	}
 
+	rc = run_subtree_work(&work);
+	free(work.items);
+	free(work.rcs);
+	if (rc)
+		goto phb_remove_error;
+
 	/* If there are any directories under the phb left at this point,
 	 * they are OS hotplug devies.  Note: this is different from DR
 	 * hotplug devices.  This really occurs on systems that do not
@@ -529,8 +748,10 @@ int drslot_chrp_phb(void)
 	}
 
 	if (!usr_drc_name) {
-		struct dr_connector *drc_list = get_drc_info(OFDT_BASE);
-		usr_drc_name = drc_index_to_name(usr_drc_index, drc_list);
+		struct dr_connector drc;
+
+		if (!drc_lookup(OFDT_BASE, DRC_INDEX, &usr_drc_index, &drc))
+			usr_drc_name = strdup(drc.name);
 		if (!usr_drc_name) {
 			say(ERROR,
 			    "Could not locate DRC name for DRC index: 0x%x",
@@ -0,0 +1,380 @@
+/**
+ * @file drtrace.c
+ * @brief Timing of the phases of DLPAR operations
+ *
+ * Copyright (c) 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "dr.h"
+
+/*
+ * Spans are timed with the monotonic clock.  Every span is added to the
+ * statistics of its phase and name, which make up the summary written
+ * to the drmgr log at the end of the operation.  For the json and
+ * chrome formats the spans themselves are kept as well and written to
+ * the trace file, the chrome format can be loaded in chrome://tracing
+ * or Perfetto.
+ */
+#define TRACE_HIST_BUCKETS	24	/* log2 of the duration in usecs */
+#define TRACE_MAX_NAMES		64
+
+enum trace_format {
+	TRACE_SUMMARY,
+	TRACE_JSON,
+	TRACE_CHROME,
+};
+
+struct trace_stats {
+	const char	*name;
+	enum trace_phase phase;
+	uint64_t	count;
+	uint64_t	total_us;
+	uint64_t	max_us;
+	uint64_t	hist[TRACE_HIST_BUCKETS];
+};
+
+struct trace_record {
+	const char	*name;
+	enum trace_phase phase;
+	uint64_t	start_us;
+	uint64_t	dur_us;
+	pid_t		tid;
+};
+
+static const char *trace_phase_names[TRACE_NR_PHASES] = {
+	"rtas", "ofdt", "sysfs", "discovery"
+};
+
+int trace_enabled = 0;
+
+static enum trace_format trace_format;
+static char *trace_file;
+static struct timespec trace_base;
+
+static struct trace_stats trace_phases[TRACE_NR_PHASES];
+static struct trace_stats trace_names[TRACE_MAX_NAMES];
+static int nr_trace_names;
+
+static struct trace_record *trace_records;
+static size_t nr_trace_records;
+static size_t trace_records_sz;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t trace_usecs(struct timespec *ts)
+{
+	return (ts->tv_sec - trace_base.tv_sec) * 1000000ULL +
+	       (ts->tv_nsec - trace_base.tv_nsec) / 1000;
+}
+
+/**
+ * trace_init
+ * @brief Enable tracing
+ *
+ * @param spec "summary", "json:<file>" or "chrome:<file>"
+ * @returns 0 on success, !0 if the specification is invalid
+ */
+int trace_init(const char *spec)
+{
+	if (!strcmp(spec, "summary")) {
+		trace_format = TRACE_SUMMARY;
+	} else if (!strncmp(spec, "json:", 5) && spec[5]) {
+		trace_format = TRACE_JSON;
+		trace_file = strdup(spec + 5);
+	} else if (!strncmp(spec, "chrome:", 7) && spec[7]) {
+		trace_format = TRACE_CHROME;
+		trace_file = strdup(spec + 7);
+	} else {
+		say(ERROR, "Invalid trace specification \"%s\", expected "
+		    "summary, json:<file> or chrome:<file>\n", spec);
+		return -1;
+	}
+
+	if (trace_format != TRACE_SUMMARY && trace_file == NULL)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &trace_base);
+	trace_enabled = 1;
+	return 0;
+}
+
+void _trace_begin(struct trace_span *span, enum trace_phase phase,
+		  const char *name)
+{
+	span->phase = phase;
+	span->name = name;
+	clock_gettime(CLOCK_MONOTONIC, &span->start);
+}
+
+static void trace_stats_add(struct trace_stats *stats, uint64_t dur_us)
+{
+	int bucket = 0;
+
+	while (bucket < TRACE_HIST_BUCKETS - 1 && (dur_us >> bucket) > 1)
+		bucket++;
+
+	stats->count++;
+	stats->total_us += dur_us;
+	if (dur_us > stats->max_us)
+		stats->max_us = dur_us;
+	stats->hist[bucket]++;
+}
+
+static struct trace_stats *trace_name_stats(struct trace_span *span)
+{
+	int i;
+
+	for (i = 0; i < nr_trace_names; i++) {
+		if (trace_names[i].phase == span->phase &&
+		    !strcmp(trace_names[i].name, span->name))
+			return &trace_names[i];
+	}
+
+	if (nr_trace_names == TRACE_MAX_NAMES)
+		return NULL;
+
+	trace_names[i].name = span->name;
+	trace_names[i].phase = span->phase;
+	nr_trace_names++;
+	return &trace_names[i];
+}
+
+void _trace_end(struct trace_span *span)
+{
+	struct trace_stats *stats;
+	struct timespec now;
+	uint64_t start_us, dur_us;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	start_us = trace_usecs(&span->start);
+	dur_us = trace_usecs(&now) - start_us;
+
+	pthread_mutex_lock(&trace_lock);
+
+	trace_stats_add(&trace_phases[span->phase], dur_us);
+	stats = trace_name_stats(span);
+	if (stats)
+		trace_stats_add(stats, dur_us);
+
+	if (trace_format != TRACE_SUMMARY) {
+		if (nr_trace_records == trace_records_sz) {
+			struct trace_record *records;
+			size_t sz = trace_records_sz ? trace_records_sz * 2
+						     : 1024;
+
+			records = realloc(trace_records, sz * sizeof(*records));
+			if (records) {
+				trace_records = records;
+				trace_records_sz = sz;
+			}
+		}
+
+		if (nr_trace_records < trace_records_sz) {
+			struct trace_record *rec;
+
+			rec = &trace_records[nr_trace_records++];
+			rec->name = span->name;
+			rec->phase = span->phase;
+			rec->start_us = start_us;
+			rec->dur_us = dur_us;
+			rec->tid = syscall(SYS_gettid);
+		}
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+}
+
+static void trace_print_stats(struct trace_stats *stats, const char *name,
+			      int indent)
+{
+	say(INFO, "%*s%-*s %8llu %12.3f %10.3f\n", indent, "",
+	    24 - indent, name, (unsigned long long)stats->count,
+	    stats->total_us / 1000.0, stats->max_us / 1000.0);
+}
+
+static void trace_print_hist(struct trace_stats *stats)
+{
+	uint64_t peak = 0;
+	int i, bars;
+
+	for (i = 0; i < TRACE_HIST_BUCKETS; i++) {
+		if (stats->hist[i] > peak)
+			peak = stats->hist[i];
+	}
+
+	for (i = 0; i < TRACE_HIST_BUCKETS; i++) {
+		if (!stats->hist[i])
+			continue;
+
+		bars = (stats->hist[i] * 40 + peak - 1) / peak;
+		say(INFO, "    %9llu us %8llu %.*s\n",
+		    i ? 1ULL << i : 0ULL, (unsigned long long)stats->hist[i],
+		    bars, "########################################");
+	}
+}
+
+/**
+ * trace_summary
+ * @brief Write the timing statistics of each phase to the log
+ */
+static void trace_summary(void)
+{
+	struct timespec now;
+	int phase, i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	say(INFO, "Trace summary, %.3f ms elapsed\n",
+	    trace_usecs(&now) / 1000.0);
+	say(INFO, "%-24s %8s %12s %10s\n", "phase", "count", "total ms",
+	    "max ms");
+
+	for (phase = 0; phase < TRACE_NR_PHASES; phase++) {
+		struct trace_stats *stats = &trace_phases[phase];
+
+		if (!stats->count)
+			continue;
+
+		trace_print_stats(stats, trace_phase_names[phase], 0);
+		for (i = 0; i < nr_trace_names; i++) {
+			if (trace_names[i].phase == phase)
+				trace_print_stats(&trace_names[i],
+						  trace_names[i].name, 2);
+		}
+
+		trace_print_hist(stats);
+	}
+}
+
+static void trace_write_stats(FILE *fp, struct trace_stats *stats)
+{
+	int i;
+
+	fprintf(fp, "\"count\": %llu, \"total_us\": %llu, \"max_us\": %llu, "
+		"\"histogram_us\": [", (unsigned long long)stats->count,
+		(unsigned long long)stats->total_us,
+		(unsigned long long)stats->max_us);
+
+	for (i = 0; i < TRACE_HIST_BUCKETS; i++)
+		fprintf(fp, "%s%llu", i ? ", " : "",
+			(unsigned long long)stats->hist[i]);
+
+	fprintf(fp, "]");
+}
+
+static void trace_write_json(FILE *fp)
+{
+	struct trace_record *rec;
+	size_t i;
+	int phase, first = 1;
+
+	fprintf(fp, "{\n  \"phases\": {");
+	for (phase = 0; phase < TRACE_NR_PHASES; phase++) {
+		fprintf(fp, "%s\n    \"%s\": { ", phase ? "," : "",
+			trace_phase_names[phase]);
+		trace_write_stats(fp, &trace_phases[phase]);
+		fprintf(fp, " }");
+	}
+
+	fprintf(fp, "\n  },\n  \"names\": [");
+	for (i = 0; i < nr_trace_names; i++) {
+		fprintf(fp, "%s\n    { \"name\": \"%s\", \"phase\": \"%s\", ",
+			first ? "" : ",", trace_names[i].name,
+			trace_phase_names[trace_names[i].phase]);
+		trace_write_stats(fp, &trace_names[i]);
+		fprintf(fp, " }");
+		first = 0;
+	}
+
+	fprintf(fp, "\n  ],\n  \"spans\": [");
+	for (i = 0; i < nr_trace_records; i++) {
+		rec = &trace_records[i];
+		fprintf(fp, "%s\n    { \"name\": \"%s\", \"phase\": \"%s\", "
+			"\"start_us\": %llu, \"dur_us\": %llu, \"tid\": %d }",
+			i ? "," : "", rec->name, trace_phase_names[rec->phase],
+			(unsigned long long)rec->start_us,
+			(unsigned long long)rec->dur_us, (int)rec->tid);
+	}
+
+	fprintf(fp, "\n  ]\n}\n");
+}
+
+static void trace_write_chrome(FILE *fp)
+{
+	struct trace_record *rec;
+	pid_t pid = getpid();
+	size_t i;
+
+	fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	for (i = 0; i < nr_trace_records; i++) {
+		rec = &trace_records[i];
+		fprintf(fp, "%s\n{\"name\": \"%s\", \"cat\": \"%s\", "
+			"\"ph\": \"X\", \"ts\": %llu, \"dur\": %llu, "
+			"\"pid\": %d, \"tid\": %d}",
+			i ? "," : "", rec->name, trace_phase_names[rec->phase],
+			(unsigned long long)rec->start_us,
+			(unsigned long long)rec->dur_us, (int)pid,
+			(int)rec->tid);
+	}
+
+	fprintf(fp, "\n]}\n");
+}
+
+/**
+ * trace_fini
+ * @brief Report the collected timings and disable tracing
+ */
+void trace_fini(void)
+{
+	FILE *fp;
+
+	if (!trace_enabled)
+		return;
+
+	trace_summary();
+
+	if (trace_file) {
+		fp = fopen(trace_file, "w");
+		if (fp == NULL) {
+			say(ERROR, "Could not open trace file %s: %s\n",
+			    trace_file, strerror(errno));
+		} else {
+			if (trace_format == TRACE_JSON)
+				trace_write_json(fp);
+			else
+				trace_write_chrome(fp);
+
+			if (fclose(fp))
+				say(ERROR, "Could not write trace file %s\n",
+				    trace_file);
+		}
+	}
+
+	trace_enabled = 0;
+	free(trace_records);
+	trace_records = NULL;
+	nr_trace_records = trace_records_sz = 0;
+	free(trace_file);
+	trace_file = NULL;
+}
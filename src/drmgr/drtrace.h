@@ -0,0 +1,62 @@
+/**
+ * @file drtrace.h
+ * @brief Timing of the phases of DLPAR operations
+ *
+ * Copyright (c) 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _DRTRACE_H_
+#define _DRTRACE_H_
+
+#include <time.h>
+
+enum trace_phase {
+	TRACE_RTAS,		/* RTAS calls */
+	TRACE_OFDT,		/* writes to /proc/ppc64/ofdt */
+	TRACE_SYSFS,		/* sysfs state and hotplug writes */
+	TRACE_DISCOVERY,	/* device tree and sysfs discovery */
+	TRACE_NR_PHASES
+};
+
+/* A timed span, started by trace_begin() and closed by trace_end() */
+struct trace_span {
+	enum trace_phase	phase;
+	const char		*name;	/* must be a string constant */
+	struct timespec		start;
+};
+
+extern int trace_enabled;
+
+int trace_init(const char *);
+void trace_fini(void);
+void _trace_begin(struct trace_span *, enum trace_phase, const char *);
+void _trace_end(struct trace_span *);
+
+static inline void trace_begin(struct trace_span *span,
+			       enum trace_phase phase, const char *name)
+{
+	if (trace_enabled)
+		_trace_begin(span, phase, name);
+}
+
+static inline void trace_end(struct trace_span *span)
+{
+	if (trace_enabled)
+		_trace_end(span);
+}
+
+#endif /* _DRTRACE_H_ */
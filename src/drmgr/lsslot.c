@@ -19,9 +19,12 @@
  */
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <locale.h>
 #include <linux/types.h>
 #include "rtas_calls.h"
@@ -39,6 +42,20 @@ int is_lsslot_cmd = 1;
 
 extern int lsslot_chrp_cpu(void);
 
+/**
+ * struct loc_seg
+ * @brief parsed segment of a location code, see loc_code_cmp()
+ */
+struct loc_seg {
+	char		type;		/**< location type prefix */
+	ulong		nbr;		/**< instance number */
+	char		delim;		/**< character following nbr, or 0 */
+	char		sub_type;	/**< location type following a '/' */
+	ulong		sub_nbr;	/**< number following the delimiter */
+	size_t		rest;		/**< length left after nbr */
+	size_t		sub_rest;	/**< length left after sub_nbr */
+};
+
 /**
  * struct print_node
  * @ brief struct to track list of nodes to be printed.
@@ -47,9 +64,14 @@ struct print_node {
 	struct dr_node	*node;	/**< node information */
 	char		*desc;	/**< message description from catalog*/
 	struct print_node	*next;
+	int		seq;	/**< insertion order, for a stable sort */
+	int		nr_segs;
+	struct loc_seg	segs[];	/**< parsed location code of the node */
 };
 
 struct print_node *print_list = NULL;
+static struct print_node *print_list_tail = NULL;
+static int print_list_cnt = 0;
 
 /* These are used to determine column widths for output */
 uint32_t max_sname = 0;		/* Max size of node location codes */
@@ -124,145 +146,201 @@ free_print_list(void)
 		print_list = print_list->next;
 		free(pnode);
 	}
+
+	print_list_tail = NULL;
+	print_list_cnt = 0;
 }
 
 /**
- * loc_code_cmp
+ * parse_loc_seg
+ * @brief Parse one hyphen separated segment of a location code
  *
- * loc_code_cmp is used to sort a list of nodes based on their location code.
- * location codes take the form of
+ * Location code segments take the form of
  *
- *      pn[.n][- or /]pn[.n][- or /] ...
+ *      pn[.n][/pn]
  *
  * where p is an alpha location type prefix and n is an instance
  * number (see RS/6000 Processor Architecture, Location Code Format).
- * The location code has to be parsed by hyphens, if any.
+ * The instance numbers are hex values.
  *
- * @param node1
- * @param node2
- * @returns 0 if (node1 = node2), -1 if (node1 < node2), 1 if (node1 > node2)
+ * @param seg start of the segment
+ * @param len length of the segment
+ * @param ls parsed segment to fill in
  */
-static int
-loc_code_cmp(char *node1, char *node2)
+static void
+parse_loc_seg(const char *seg, size_t len, struct loc_seg *ls)
 {
-	char save_n1[64],save_n2[64];	/* for holding node1 and node2       */
-	char *n1, *n2;
-	ulong nbr1,nbr2;		/* hex numbers representing location */
-	size_t dash_cnt;
+	char buf[DR_STR_MAX];
+	char *n = buf;
 
-	n1 = save_n1;
-	n2 = save_n2;
+	if (len >= DR_STR_MAX)
+		len = DR_STR_MAX - 1;
 
-	while (strlen(node1) && strlen(node2)) {
-		dash_cnt = strcspn(node1, "-");
-		strncpy(n1, node1, dash_cnt);
+	memcpy(buf, seg, len);
+	buf[len] = '\0';
 
-		*(n1 + dash_cnt) = '\0';
-		node1 += dash_cnt;
+	memset(ls, 0, sizeof(*ls));
 
-		dash_cnt = strcspn(node2, "-");
-		strncpy(n2, node2, dash_cnt);
+	/* The location type and the hex value of the instance number */
+	ls->type = *n;
+	if (*n)
+		n++;
 
-		*(n2 + dash_cnt) = '\0';
-		node2 += dash_cnt;
+	ls->nbr = strtoul(n, &n, 16);
+	ls->rest = ls->sub_rest = strlen(n);
+	ls->delim = *n;
+	if (*n == '\0')
+		return;
 
-		/* First look at the location type */
-		if (*n1 < *n2)
-			return -1;
-		else if (*n1 > *n2)
-			return 1;
+	/* The slash will have an alpha and hex following it, while the dot
+	 * will have just a hex following it.
+	 */
+	if (*n == '/') {
+		n++;
+		ls->sub_type = *n;
+		if (*n)
+			n++;
+	} else {
+		n++;
+	}
 
-		n1++;
-		n2++;
+	ls->sub_nbr = strtoul(n, &n, 16);
+	ls->sub_rest = strlen(n);
+}
 
-		/* get the hex value of the instance number */
-		nbr1 = strtoul(n1, &n1, 16);
-		nbr2 = strtoul(n2, &n2, 16);
+/**
+ * parse_loc_code
+ * @brief Split a location code into its parsed segments
+ *
+ * @param loc_code location code to parse
+ * @param segs array to fill in, or NULL to only count the segments
+ * @returns number of segments
+ */
+static int
+parse_loc_code(const char *loc_code, struct loc_seg *segs)
+{
+	size_t dash_cnt;
+	int nr_segs = 0;
 
-		if (nbr1 < nbr2)
-			return -1;
-		else if (nbr1 > nbr2)
-			return 1;
+	while (*loc_code) {
+		dash_cnt = strcspn(loc_code, "-");
+		if (segs)
+			parse_loc_seg(loc_code, dash_cnt, &segs[nr_segs]);
 
-		if (strlen(n1) && strlen(n2)) {
-			/* If both strings have more characters, first
-			 * determine if they are the same.
-			 */
-			if (*n1 == *n2) {
-				/* If they're the same, compare whatever
-				 * follows the delimiter. The slash will have
-				 * an alpha and hex following it, while the dot
-				 * will have just a hex following it.
-				 */
-				if (*n1 == '/') {
-					n1++;
-					n2++;
-					/* First look at the location type,
-					 * which is a single character.
-					 */
-					if (*n1 < *n2)
-					  	return -1;
-					else if (*n1 > *n2)
-					   	return 1;
-				}
-
-				n1++;
-				n2++;
-
-				/* get the hex value of the instance number */
-				nbr1 = strtoul(n1, &n1, 16);
-				nbr2 = strtoul(n2, &n2, 16);
-				if (nbr1 < nbr2)
-					return -1;
-				else if (nbr1 > nbr2)
-				   	return 1;
-			}
+		nr_segs++;
+		loc_code += dash_cnt;
+		if (*loc_code == '-')
+			loc_code++;
+	}
 
-			/* The delimiters are not the same, so check
-			 * what they are and return results based on
-			 * order of precedence : slash, then dot.
+	return nr_segs;
+}
+
+/**
+ * loc_seg_cmp
+ *
+ * @param s1
+ * @param s2
+ * @returns 0 if (s1 = s2), -1 if (s1 < s2), 1 if (s1 > s2)
+ */
+static int
+loc_seg_cmp(const struct loc_seg *s1, const struct loc_seg *s2)
+{
+	size_t rest1 = s1->rest, rest2 = s2->rest;
+
+	/* First look at the location type and instance number */
+	if (s1->type != s2->type)
+		return s1->type < s2->type ? -1 : 1;
+
+	if (s1->nbr != s2->nbr)
+		return s1->nbr < s2->nbr ? -1 : 1;
+
+	if (rest1 && rest2) {
+		if (s1->delim == s2->delim) {
+			/* If the delimiters are the same, compare whatever
+			 * follows them.
 			 */
-			else if (*n1 == '/')
-				return -1;
-			else if (*n2 == '/')
-				return 1;
+			if (s1->delim == '/' && s1->sub_type != s2->sub_type)
+				return s1->sub_type < s2->sub_type ? -1 : 1;
+
+			if (s1->sub_nbr != s2->sub_nbr)
+				return s1->sub_nbr < s2->sub_nbr ? -1 : 1;
+
+			rest1 = s1->sub_rest;
+			rest2 = s2->sub_rest;
 		}
 
-		/* If we've reached here, either the strings are
-		 * the same or one of the strings has run out.
-		 * If only one has run out, we can return.
+		/* The delimiters are not the same, so return results
+		 * based on order of precedence : slash, then dot.
 		 */
-		if (strlen(n1) < strlen(n2))
+		else if (s1->delim == '/')
 			return -1;
-		else if (strlen(n1) > strlen(n2))
+		else if (s2->delim == '/')
 			return 1;
+	}
 
-		/* If we get here, we've determined everything
-		 * in the n1 and n2 strings are the same. Now
-		 * increment past the dash, if any, in the
-		 * original strings.
-		 */
-		if (*node1 == '-')
-			node1++;
-		if (*node2 == '-')
-			node2++;
+	/* Either the segments are the same or one of them has run out */
+	if (rest1 != rest2)
+		return rest1 < rest2 ? -1 : 1;
+
+	return 0;
+}
 
+/**
+ * loc_code_cmp
+ *
+ * loc_code_cmp is used to sort a list of nodes based on their location code.
+ * location codes take the form of
+ *
+ *      pn[.n][- or /]pn[.n][- or /] ...
+ *
+ * The location codes are parsed by hyphens when the print node is
+ * created, see parse_loc_code().
+ *
+ * @param p1
+ * @param p2
+ * @returns 0 if (p1 = p2), -1 if (p1 < p2), 1 if (p1 > p2)
+ */
+static int
+loc_code_cmp(const struct print_node *p1, const struct print_node *p2)
+{
+	int i, rc;
+
+	for (i = 0; i < p1->nr_segs && i < p2->nr_segs; i++) {
+		rc = loc_seg_cmp(&p1->segs[i], &p2->segs[i]);
+		if (rc)
+			return rc;
 	}
 
-	if (strlen(node1))
+	if (p1->nr_segs > p2->nr_segs)
 		return 1;
-	else if (strlen(node2))
+	else if (p1->nr_segs < p2->nr_segs)
 		return -1;
 
 	return 0;
 }
 
+static int
+print_node_cmp(const void *a, const void *b)
+{
+	const struct print_node *p1 = *(const struct print_node **)a;
+	const struct print_node *p2 = *(const struct print_node **)b;
+	int rc;
+
+	rc = loc_code_cmp(p1, p2);
+	if (rc)
+		return rc;
+
+	/* Nodes with the same location code stay in insertion order */
+	return p1->seq < p2->seq ? -1 : p1->seq > p2->seq;
+}
 
 /**
  * insert_print_node
  *
- * Insert the node into the list of nodes. The list is
- * sorted by location codes.
+ * Add the node to the list of nodes to print.  The list is sorted
+ * by location codes with sort_print_list() once all of the nodes
+ * have been added.
  *
  * @param node dlpar node to add
  */
@@ -270,8 +348,11 @@ void
 insert_print_node(struct dr_node *node)
 {
 	struct print_node *pnode;
+	int nr_segs;
+
+	nr_segs = parse_loc_code(node->drc_name, NULL);
 
-	pnode = zalloc(sizeof(*pnode));
+	pnode = zalloc(sizeof(*pnode) + nr_segs * sizeof(struct loc_seg));
 	if (pnode == NULL) {
 		fprintf(stderr, "Could not allocate print node for drc %x\n",
 			node->drc_index);
@@ -281,47 +362,52 @@ insert_print_node(struct dr_node *node)
 	pnode->node = node;
 	pnode->desc = node_type(node);
 	pnode->next = NULL;
+	pnode->seq = print_list_cnt++;
+	pnode->nr_segs = parse_loc_code(node->drc_name, pnode->segs);
 
 	max_sname = MAX(max_sname, strlen(node->drc_name));
 	max_desc = MAX(max_desc, strlen(pnode->desc));
 
-	/* Insert the new print_node into the sorted list of print nodes */
-	if (print_list == NULL) {
+	if (print_list == NULL)
 		print_list = pnode;
+	else
+		print_list_tail->next = pnode;
+
+	print_list_tail = pnode;
+}
+
+/**
+ * sort_print_list
+ * @brief Sort the list of nodes to print by location codes
+ */
+static void
+sort_print_list(void)
+{
+	struct print_node **pnodes;
+	struct print_node *pnode;
+	int i;
+
+	if (print_list_cnt < 2)
 		return;
-	}
-	
-	if (loc_code_cmp(print_list->node->drc_name,
-			 pnode->node->drc_name) > 0) {
-		/* The location code for the new node is less than that
-		 * of the first node so insert the new node at the front.
-		 */
-		pnode->next = print_list;
-		print_list = pnode;
-	} else {
-		/* Find the first node in the list where the new node's
-		 * location code is less than the existing node's location
-		 * code and insert the new node before that node.
-		 */
-		struct print_node *last;
-		last = print_list;
-		while (last->next != NULL) {
-			if (loc_code_cmp(last->next->node->drc_name,
-					 pnode->node->drc_name) > 0)
-			{
-				pnode->next = last->next;
-				last->next = pnode;
-				break;
-			}
-			last = last->next;
-		}
 
-		/* Put the new node at the end of the list if itslocation
-		 * code is not less than any other node's location code.
-		 */
-		if (last->next == NULL)
-			last->next = pnode;
+	pnodes = malloc(print_list_cnt * sizeof(*pnodes));
+	if (pnodes == NULL) {
+		fprintf(stderr, "Could not allocate memory to sort slots\n");
+		return;
 	}
+
+	for (i = 0, pnode = print_list; pnode; pnode = pnode->next)
+		pnodes[i++] = pnode;
+
+	qsort(pnodes, print_list_cnt, sizeof(*pnodes), print_node_cmp);
+
+	for (i = 0; i < print_list_cnt - 1; i++)
+		pnodes[i]->next = pnodes[i + 1];
+
+	pnodes[print_list_cnt - 1]->next = NULL;
+	print_list = pnodes[0];
+	print_list_tail = pnodes[print_list_cnt - 1];
+	free(pnodes);
 }
 
 /**
@@ -600,6 +686,8 @@ int lsslot_chrp_pci(void)
 			insert_print_node(node);
 	}
 
+	sort_print_list();
+
 	if (print_list == NULL) {
 		/* If nothing to print, display message based on if
 		 * user specified a slot or a device name.
@@ -711,132 +799,406 @@ int lsslot_chrp_phb(void)
 	return 0;
 }
 
-int print_drconf_mem(struct lmb_list_head *lmb_list)
+/*
+ * The output of lsslot -c mem is collected in a single buffer and
+ * written out whenever it fills up, on a machine with tens of thousands
+ * of LMBs the output is several megabytes.
+ */
+#define OUT_BUF_SZ	(64 * 1024)
+
+static struct {
+	char	buf[OUT_BUF_SZ];
+	size_t	len;
+} out;
+
+static void out_flush(void)
 {
-	struct dr_node *lmb;
-	struct mem_scn *scn;
-	int scn_offset = strlen("/sys/devices/system/memory/memory");
-	char *aa_buf;
-	__be32 *aa;
-	int aa_size, aa_list_sz;
-	int i, rc;
-	uint32_t drc_index = 0;
+	if (out.len)
+		fwrite(out.buf, 1, out.len, stdout);
 
-	aa_size = get_property_size(DYNAMIC_RECONFIG_MEM,
-				    "ibm,associativity-lookup-arrays");
-	aa_buf = zalloc(aa_size);
-	rc = get_property(DYNAMIC_RECONFIG_MEM,
-			  "ibm,associativity-lookup-arrays", aa_buf, aa_size);
-	if (rc) {
-		say(ERROR, "Could not get associativity information.\n");
-		return -1;
+	out.len = 0;
+}
+
+static void out_str(const char *str)
+{
+	size_t len = strlen(str);
+	size_t n;
+
+	while (len) {
+		if (out.len == OUT_BUF_SZ)
+			out_flush();
+
+		n = OUT_BUF_SZ - out.len;
+		if (n > len)
+			n = len;
+
+		memcpy(&out.buf[out.len], str, n);
+		out.len += n;
+		str += n;
+		len -= n;
 	}
+}
 
-	aa = (__be32 *)aa_buf;
-	/* skip past the number of associativity lists */
-	aa++;
-	aa_list_sz = be32toh(*aa++);
+/**
+ * out_num
+ * @brief Write a number in hex or decimal to the output buffer
+ *
+ * @param val value to write
+ * @param base 16 or 10
+ */
+static void out_num(uint64_t val, int base)
+{
+	char num[24];
+	char *p = &num[sizeof(num) - 1];
 
-	if (usr_drc_name)
-		drc_index = strtol(usr_drc_name, NULL, 0);
+	*p = '\0';
+	do {
+		*--p = "0123456789abcdef"[val % base];
+		val /= base;
+	} while (val);
 
-	printf("Dynamic Reconfiguration Memory (LMB size 0x%x)\n",
-	       lmb_list->lmbs->lmb_size);
+	out_str(p);
+}
 
-	for (lmb = lmb_list->lmbs; lmb; lmb = lmb->next) {
-		int first = 1;
-		int aa_start, aa_end;
+static void out_int(int val)
+{
+	if (val < 0) {
+		out_str("-");
+		out_num(-(int64_t)val, 10);
+	} else {
+		out_num(val, 10);
+	}
+}
 
-		if (drc_index && drc_index != lmb->drc_index)
-			continue;
-		else if ((output_level < DEBUG) && !lmb->is_owned)
-			continue;
+/**
+ * struct drconf_out
+ * @brief What is needed to print drconf lmbs as they are decoded
+ */
+struct drconf_out {
+	uint64_t	lmb_sz;
+	uint64_t	block_sz;	/* memory section size */
+	__be32		*aa;		/* associativity lookup arrays */
+	uint32_t	nr_aa_lists;
+	uint32_t	aa_list_sz;
+	uint32_t	drc_index;	/* only print this lmb, or 0 for all */
+};
 
-		printf("%s: %s\n", lmb->drc_name,
-		       lmb->is_owned ? "" : "Not Owned");
+/**
+ * scn_removable
+ * @brief Determine if a memory section can be removed
+ *
+ * @param scn memory section number
+ * @returns 1 if removable or not present in sysfs, 0 otherwise
+ */
+static int scn_removable(uint32_t scn)
+{
+	char path[DR_PATH_MAX];
+	char buf[16];
+	struct stat sbuf;
+	ssize_t len;
+	int fd;
+
+	sprintf(path, DR_ROOT "/sys/devices/system/memory/memory%d/removable",
+		scn);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		/* A section missing from sysfs doesn't make the lmb
+		 * unremovable, one that can't be read does.
+		 */
+		*strrchr(path, '/') = '\0';
+		return stat(path, &sbuf) ? 1 : 0;
+	}
 
-		printf("    DRC Index: %x        Address: %lx\n",
-		       lmb->drc_index, lmb->lmb_address);
-		printf("    Removable: %s             Associativity: ",
-		       lmb->is_removable ? "Yes" : "No ");
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
 
-		if (lmb->lmb_aa_index == 0xffffffff) {
-			printf("Not Set\n");
-		} else {
-			printf("(index: %d) ", lmb->lmb_aa_index);
-			aa_start = lmb->lmb_aa_index * aa_list_sz;
-			aa_end = aa_start + aa_list_sz;
-			for (i = aa_start; i < aa_end; i++)
-				printf("%d ", be32toh(aa[i]));
-			printf("\n");
-		}
+	buf[len] = '\0';
+	return strtol(buf, NULL, 0) != 0;
+}
 
-		if (lmb->is_owned) {
-			printf("    Section(s):");
-			for (scn = lmb->lmb_mem_scns; scn; scn = scn->next) {
-				if (first) {
-					printf(" %s",
-					       &scn->sysfs_path[scn_offset]);
-					first = 0;
-				} else
-					printf(", %s",
-					       &scn->sysfs_path[scn_offset]);
-			}
+/**
+ * print_drconf_lmb
+ * @brief Print the details of a drconf memory lmb
+ *
+ * The lmb is printed straight from its ibm,dynamic-memory entry or
+ * ibm,dynamic-memory-v2 lmb set, drconf lmbs have no drc name.
+ *
+ * @param o output state
+ * @param drc_index drc index of the lmb
+ * @param address address of the lmb
+ * @param aa_index associativity index of the lmb
+ * @param owned whether the partition owns the lmb
+ */
+static void print_drconf_lmb(struct drconf_out *o, uint32_t drc_index,
+			     uint64_t address, uint32_t aa_index, int owned)
+{
+	uint32_t first_scn, nr_scns, scn;
+	int removable = 0;
+	int i;
 
-			printf("\n");
+	if (o->drc_index && o->drc_index != drc_index)
+		return;
+	else if ((output_level < DEBUG) && !owned)
+		return;
+
+	/* Memory sections of the lmb, which are listed highest first */
+	first_scn = address / o->block_sz;
+	nr_scns = (o->lmb_sz + o->block_sz - 1) / o->block_sz;
+
+	if (owned && nr_scns) {
+		removable = 1;
+		for (i = 0; i < nr_scns && removable; i++)
+			removable = scn_removable(first_scn + i);
+	}
+
+	out_str(owned ? ": \n" : ": Not Owned\n");
+
+	out_str("    DRC Index: ");
+	out_num(drc_index, 16);
+	out_str("        Address: ");
+	out_num(address, 16);
+	out_str(removable ? "\n    Removable: Yes             Associativity: "
+			  : "\n    Removable: No              Associativity: ");
+
+	if (aa_index == 0xffffffff || aa_index >= o->nr_aa_lists) {
+		out_str("Not Set\n");
+	} else {
+		out_str("(index: ");
+		out_int(aa_index);
+		out_str(") ");
+		for (i = 0; i < o->aa_list_sz; i++) {
+			out_int(be32toh(o->aa[aa_index * o->aa_list_sz + i]));
+			out_str(" ");
 		}
+		out_str("\n");
 	}
 
-	free(aa_buf);
+	if (owned) {
+		out_str("    Section(s):");
+		for (i = nr_scns - 1; i >= 0; i--) {
+			scn = first_scn + i;
+			out_str(i == nr_scns - 1 ? " " : ", ");
+			out_num(scn, 10);
+		}
+		out_str("\n");
+	}
+}
+
+/**
+ * print_drconf_mem_v1
+ * @brief Print the lmbs of the ibm,dynamic-memory property
+ *
+ * @param o output state
+ * @returns 0 on success, !0 otherwise
+ */
+static int print_drconf_mem_v1(struct drconf_out *o)
+{
+	struct drconf_mem *drmem;
+	uint32_t num_entries;
+	char *buf;
+	int buf_sz, i;
+
+	buf_sz = get_property_alloc(DYNAMIC_RECONFIG_MEM, "ibm,dynamic-memory",
+				    &buf);
+	if (buf_sz < (int)sizeof(num_entries)) {
+		say(ERROR, "Could not retrieve dynamic reconfigurable memory "
+		    "property\n");
+		return -1;
+	}
+
+	/* The first integer of the buffer is the number of entries */
+	num_entries = be32toh(*(uint32_t *)buf);
+	if (num_entries > (buf_sz - sizeof(num_entries)) / sizeof(*drmem)) {
+		say(ERROR, "Invalid ibm,dynamic-memory property\n");
+		free(buf);
+		return -1;
+	}
+
+	drmem = (struct drconf_mem *)(buf + sizeof(num_entries));
+	for (i = 0; i < num_entries; i++, drmem++)
+		print_drconf_lmb(o, be32toh(drmem->drc_index),
+				 be64toh(drmem->address),
+				 be32toh(drmem->assoc_index),
+				 be32toh(drmem->flags) & DRMEM_ASSIGNED);
+
+	free(buf);
+	return 0;
+}
+
+/**
+ * print_drconf_mem_v2
+ * @brief Print the lmbs of the ibm,dynamic-memory-v2 lmb sets
+ *
+ * @param o output state
+ * @returns 0 on success, !0 otherwise
+ */
+static int print_drconf_mem_v2(struct drconf_out *o)
+{
+	struct drconf_mem_v2 *set;
+	uint32_t lmb_sets;
+	char *buf;
+	int buf_sz, i, j;
+
+	buf_sz = get_property_alloc(DYNAMIC_RECONFIG_MEM,
+				    "ibm,dynamic-memory-v2", &buf);
+	if (buf_sz < (int)sizeof(lmb_sets)) {
+		say(ERROR, "Could not retrieve dynamic reconfigurable memory "
+		    "property\n");
+		return -1;
+	}
+
+	/* The first integer of the buffer is the number of lmb sets */
+	lmb_sets = be32toh(*(uint32_t *)buf);
+	if (lmb_sets > (buf_sz - sizeof(lmb_sets)) / sizeof(*set)) {
+		say(ERROR, "Invalid ibm,dynamic-memory-v2 property\n");
+		free(buf);
+		return -1;
+	}
+
+	set = (struct drconf_mem_v2 *)(buf + sizeof(lmb_sets));
+	for (i = 0; i < lmb_sets; i++, set++) {
+		uint32_t first = be32toh(set->drc_index);
+		uint32_t seq_lmbs = be32toh(set->seq_lmbs);
+		uint64_t base_addr = be64toh(set->base_addr);
+		uint32_t aa_index = be32toh(set->aa_index);
+		int owned = be32toh(set->flags) & DRMEM_ASSIGNED;
+
+		for (j = 0; j < seq_lmbs; j++)
+			print_drconf_lmb(o, first + j,
+					 base_addr + j * o->lmb_sz,
+					 aa_index, owned);
+	}
+
+	free(buf);
 	return 0;
 }
 
+/**
+ * print_drconf_mem
+ * @brief Print the drconf lmbs as they are decoded from the device tree
+ *
+ * Unlike drmgr, which needs to build a list of the lmbs, the lmbs are
+ * printed straight from the ibm,dynamic-memory or ibm,dynamic-memory-v2
+ * property.
+ *
+ * @returns 0 on success, !0 otherwise
+ */
+int print_drconf_mem(void)
+{
+	struct drconf_out o;
+	struct stat sbuf;
+	char buf[DR_STR_MAX];
+	char *aa_buf;
+	int aa_size;
+	int rc;
+
+	memset(&o, 0, sizeof(o));
+
+	if (get_str_attribute(DR_ROOT "/sys/devices/system/memory",
+			      "/block_size_bytes", &buf, DR_STR_MAX)) {
+		say(ERROR, "Could not determine block size bytes for "
+		    "memory.\n");
+		return -1;
+	}
+
+	o.block_sz = strtoull(buf, NULL, 16);
+
+	if (get_property(DYNAMIC_RECONFIG_MEM, "ibm,lmb-size", &o.lmb_sz,
+			 sizeof(o.lmb_sz))) {
+		say(ERROR, "Could not retrieve drconf LMB size\n");
+		return -1;
+	}
+
+	o.lmb_sz = be64toh(o.lmb_sz);
+	if (o.block_sz == 0 || o.lmb_sz == 0) {
+		say(ERROR, "Invalid memory block or LMB size\n");
+		return -1;
+	}
+
+	aa_size = get_property_alloc(DYNAMIC_RECONFIG_MEM,
+				     "ibm,associativity-lookup-arrays",
+				     &aa_buf);
+	if (aa_size < 2 * (int)sizeof(__be32)) {
+		say(ERROR, "Could not get associativity information.\n");
+		if (aa_size >= 0)
+			free(aa_buf);
+		return -1;
+	}
+
+	/* The number of associativity lists and the size of each list */
+	o.aa = (__be32 *)aa_buf;
+	o.nr_aa_lists = be32toh(*o.aa++);
+	o.aa_list_sz = be32toh(*o.aa++);
+
+	if (o.aa_list_sz &&
+	    o.nr_aa_lists > (aa_size / sizeof(__be32) - 2) / o.aa_list_sz)
+		o.nr_aa_lists = (aa_size / sizeof(__be32) - 2) / o.aa_list_sz;
+
+	if (usr_drc_name)
+		o.drc_index = strtol(usr_drc_name, NULL, 0);
+
+	out_str("Dynamic Reconfiguration Memory (LMB size 0x");
+	out_num(o.lmb_sz, 16);
+	out_str(")\n");
+
+	if (stat(DYNAMIC_RECONFIG_MEM_V1, &sbuf) == 0) {
+		rc = print_drconf_mem_v1(&o);
+	} else if (stat(DYNAMIC_RECONFIG_MEM_V2, &sbuf) == 0) {
+		rc = print_drconf_mem_v2(&o);
+	} else {
+		say(ERROR, "No dynamic reconfiguration LMBs found\n");
+		rc = -1;
+	}
+
+	out_flush();
+	free(aa_buf);
+	return rc;
+}
+
 int lsslot_chrp_mem(void)
 {
 	struct lmb_list_head *lmb_list;
 	struct dr_node *lmb;
 	struct mem_scn *scn;
-	int scn_offset = strlen("/sys/devices/system/memory/memory");
+	struct stat sbuf;
+	int scn_offset = strlen(DR_ROOT "/sys/devices/system/memory/memory");
 	int lmb_offset = strlen(OFDT_BASE);
 
-	lmb_list = get_lmbs(LMB_NORMAL_SORT);
+	if (stat(DYNAMIC_RECONFIG_MEM, &sbuf) == 0)
+		return print_drconf_mem();
+
+	lmb_list = get_lmbs(LMB_NORMAL_SORT, LMB_SCNS_EAGER);
 	if (lmb_list == NULL || lmb_list->lmbs == NULL)
 		return -1;
 
-	
-	if (lmb_list->drconf_buf) {
-		print_drconf_mem(lmb_list);
-	} else {
-		printf("lmb size: 0x%x\n", lmb_list->lmbs->lmb_size);
-		printf("%-20s  %-5s  %c  %s\n", "Memory Node", "Name", 'R',
-		       "Sections");
-		printf("%-20s  %-5s  %c  %s\n", "-----------", "----", '-',
-		       "--------");
-
-		for (lmb = lmb_list->lmbs; lmb; lmb = lmb->next) {
-			int first = 1;
+	printf("lmb size: 0x%x\n", lmb_list->lmbs->lmb_size);
+	printf("%-20s  %-5s  %c  %s\n", "Memory Node", "Name", 'R',
+	       "Sections");
+	printf("%-20s  %-5s  %c  %s\n", "-----------", "----", '-',
+	       "--------");
 
-			if (!lmb->is_owned)
-				continue;
+	for (lmb = lmb_list->lmbs; lmb; lmb = lmb->next) {
+		int first = 1;
 
-			if (!lmb_list->drconf_buf)
-				printf("%-20s  ", &lmb->ofdt_path[lmb_offset]);
+		if (!lmb->is_owned)
+			continue;
 
-			printf("%-5s  %c ", lmb->drc_name,
-			       lmb->is_removable ? 'Y' : 'N');
-		
-			for (scn = lmb->lmb_mem_scns; scn; scn = scn->next) {
-				if (first) {
-					printf(" %s",
-					       &scn->sysfs_path[scn_offset]);
-					first = 0;
-				} else
-					printf(", %s",
-					       &scn->sysfs_path[scn_offset]);
-			}
+		printf("%-20s  ", &lmb->ofdt_path[lmb_offset]);
+		printf("%-5s  %c ", lmb->drc_name,
+		       lmb->is_removable ? 'Y' : 'N');
 
-			printf("\n");
+		for (scn = lmb->lmb_mem_scns; scn; scn = scn->next) {
+			if (first) {
+				printf(" %s", &scn->sysfs_path[scn_offset]);
+				first = 0;
+			} else
+				printf(", %s", &scn->sysfs_path[scn_offset]);
 		}
+
+		printf("\n");
 	}
 
 	free_lmbs(lmb_list);
@@ -896,6 +1258,8 @@ int lsslot_chrp_port(void)
 		}
 	}
 
+	sort_print_list();
+
 	if (print_list == NULL) {
 		/* If nothing to print, display message based on if
 		 * user specified a slot or a device name.
@@ -138,7 +138,7 @@ int lsslot_chrp_cpu(void)
 	}
 
 	/* Check if this is an LPAR System.  */
-	if (stat("/proc/device-tree/ibm,lpar-capable", &sb)) {
+	if (stat(DR_ROOT "/proc/device-tree/ibm,lpar-capable", &sb)) {
 		fprintf(stderr, "\nThe system is not LPAR.\n\n");
 		return 1;
 	}
@@ -20,9 +20,17 @@
 #ifndef _OFDT_H_
 #define _OFDT_H_
 
+/* The device tree, sysfs and state paths drmgr uses are relative to
+ * DR_ROOT.  It is empty for normal builds, the benchmark is built with
+ * it pointing at a synthetic tree.
+ */
+#ifndef DR_ROOT
+#define DR_ROOT		""
+#endif
+
 #define DRC_STR_MAX 48
-#define OFDT_BASE	"/proc/device-tree"
-#define CPU_OFDT_BASE	"/proc/device-tree/cpus"
+#define OFDT_BASE	DR_ROOT "/proc/device-tree"
+#define CPU_OFDT_BASE	DR_ROOT "/proc/device-tree/cpus"
 
 #define DR_PATH_MAX	1024
 #define DR_STR_MAX	128
@@ -36,13 +44,14 @@ struct dr_connector {
 	unsigned int	powerdomain;
 	struct dr_connector *next;
 	struct dr_connector *all_next;
+	struct drc_hash	*hash;	/* set on the first entry of a list */
 };
 
 struct mem_scn {
 	struct mem_scn	*next;
 	int		removable;
 	uint64_t	phys_addr;
-	char		sysfs_path[DR_PATH_MAX];
+	char		*sysfs_path;
 };
 
 struct thread {
@@ -92,6 +101,7 @@ struct dr_node {
 			uint32_t	_lmb_aa_index;
 			struct mem_scn	*_mem_scns;
 			struct of_node	*_of_node;
+			int		_mem_scns_valid;
 		} _smem;
 
 #define lmb_address	_node_u._smem._address
@@ -99,6 +109,7 @@ struct dr_node {
 #define lmb_aa_index	_node_u._smem._lmb_aa_index
 #define lmb_mem_scns	_node_u._smem._mem_scns
 #define lmb_of_node	_node_u._smem._of_node
+#define lmb_scns_valid	_node_u._smem._mem_scns_valid
 
 		struct hea_info {
 			uint		_port_no;
@@ -153,6 +164,7 @@ set_drc_info(struct dr_node *node, struct dr_connector *drc)
 
 struct dr_connector *get_drc_info(const char *);
 void free_drc_info(void);
+void drop_drc_info(const char *);
 
 char *of_to_full_path(const char *);
 
@@ -168,6 +180,23 @@ struct dr_connector *search_drc_list(struct dr_connector *,
 int get_my_drc_index(char *, uint32_t *);
 int drc_name_to_index(const char *, struct dr_connector *);
 char * drc_index_to_name(uint32_t, struct dr_connector *);
+struct dr_connector *get_drc_by_index(uint32_t, struct dr_connector *);
+int drc_lookup(const char *, int, void *, struct dr_connector *);
 int get_drc_by_name(char *, struct dr_connector *, char *, char *);
+int get_drc_by_key(int, void *, struct dr_connector *, char *, const char *);
+
+/* Fingerprint of a device tree property, see drc_cache.c */
+struct drc_cache_stamp {
+	uint64_t	ino;
+	uint64_t	size;
+	uint64_t	ctime_sec;
+	uint64_t	ctime_nsec;
+};
+
+#define DRC_CACHE_MAX_PROPS	4
+
+struct dr_connector *drc_cache_load(const char *, const char *, int);
+void drc_cache_store(const char *, const char *, int, struct dr_connector *);
+int drc_cache_stamps(const char *, int, struct drc_cache_stamp *, uint32_t *);
 
 #endif /* _OFDT_H_ */
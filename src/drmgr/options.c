@@ -46,6 +46,15 @@ int usr_prompt = 1;
 /* user specified number of devices to add/remove */
 int usr_drc_count = 0;
 
+/* user specified number of devices to process per batch */
+int usr_batch_size = 0;
+
+/* user specified number of concurrent jobs for DLPAR operations */
+int usr_jobs = 0;
+
+/* user specified NUMA node to add or remove memory from */
+int usr_numa_node = -1;
+
 /* user specified drc type to use */
 enum drc_type usr_drc_type = DRC_TYPE_NONE;
 
@@ -19,16 +19,88 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include "dr.h"
 #include "drmem.h"
 #include "drcpu.h"
 
+/* drc indexes named by a PRRN event for one resource type */
+struct prrn_list {
+	uint32_t	*drc_indexes;
+	int		nr;
+	int		sz;
+};
+
+static int prrn_list_add(struct prrn_list *list, uint32_t drc_index)
+{
+	if (list->nr == list->sz) {
+		uint32_t *indexes;
+		int sz = list->sz ? list->sz * 2 : 64;
+
+		indexes = realloc(list->drc_indexes, sz * sizeof(*indexes));
+		if (indexes == NULL)
+			return -1;
+
+		list->drc_indexes = indexes;
+		list->sz = sz;
+	}
+
+	list->drc_indexes[list->nr++] = drc_index;
+	return 0;
+}
+
+static int prrn_index_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * prrn_list_dedup
+ * @brief Sort a list of drc indexes and drop the duplicates
+ *
+ * @param list list to dedup
+ */
+static void prrn_list_dedup(struct prrn_list *list)
+{
+	int i, nr = 0;
+
+	if (list->nr == 0)
+		return;
+
+	qsort(list->drc_indexes, list->nr, sizeof(*list->drc_indexes),
+	      prrn_index_cmp);
+
+	for (i = 1; i < list->nr; i++) {
+		if (list->drc_indexes[i] != list->drc_indexes[nr])
+			list->drc_indexes[++nr] = list->drc_indexes[i];
+	}
+
+	if (nr + 1 < list->nr)
+		say(DEBUG, "Dropped %d duplicate drc indexes\n",
+		    list->nr - nr - 1);
+
+	list->nr = nr + 1;
+}
+
+/**
+ * handle_prrn
+ * @brief Update the resources named in a PRRN event file
+ *
+ * The whole file is read first so that each resource is only updated
+ * once, and the memory and cpu information is gathered once for all
+ * resources of the type rather than once per resource.
+ *
+ * @returns 0 on success, !0 otherwise
+ */
 int handle_prrn(void)
 {
-	char fmt_drc[11];
+	struct prrn_list mem = { 0 }, cpu = { 0 };
+	struct timespec start;
 	char type[4];
 	char drc[9];
-	int rc = 0;
 	FILE *fd;
 
 	fd = fopen(prrn_filename, "r");
@@ -40,34 +112,49 @@ int handle_prrn(void)
 	set_output_level(4);
 
 	while (fscanf(fd, "%3s %8s\n", type, drc) == 2) {
-		usr_drc_type = to_drc_type(type);
-		sprintf(fmt_drc, "0x%s", drc);
-		usr_drc_name = fmt_drc;
-
-		set_timeout(PRRN_TIMEOUT);
+		uint32_t drc_index = strtoul(drc, NULL, 16);
+		int rc;
 
 		if (!strcmp(type, "mem")) {
-			usr_action = REMOVE;
-			rc = drslot_chrp_mem();
-			if (rc)
-				continue;
-
-			usr_action = ADD;
-			drslot_chrp_mem();
+			rc = prrn_list_add(&mem, drc_index);
 		} else if (!strcmp(type, "cpu")) {
-			usr_action = REMOVE;
-			rc = drslot_chrp_cpu();
-			if (rc)
-				continue;
-
-			usr_action = ADD;
-			drslot_chrp_cpu();
+			rc = prrn_list_add(&cpu, drc_index);
 		} else {
 			say(ERROR, "Device type \"%s\" not recognized.\n",
 			    type);
 			continue;
 		}
+
+		if (rc) {
+			say(ERROR, "Could not allocate PRRN resource list\n");
+			break;
+		}
+	}
+
+	fclose(fd);
+
+	prrn_list_dedup(&mem);
+	prrn_list_dedup(&cpu);
+
+	say(INFO, "PRRN: %d LMBs and %d CPUs to update\n", mem.nr, cpu.nr);
+
+	if (mem.nr) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		usr_drc_type = to_drc_type("mem");
+		prrn_mem(mem.drc_indexes, mem.nr);
+		say(INFO, "PRRN: LMB update took %ld ms\n",
+		    elapsed_ms(&start));
+	}
+
+	if (cpu.nr) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		usr_drc_type = to_drc_type("cpu");
+		prrn_cpu(cpu.drc_indexes, cpu.nr);
+		say(INFO, "PRRN: CPU update took %ld ms\n",
+		    elapsed_ms(&start));
 	}
 
+	free(mem.drc_indexes);
+	free(cpu.drc_indexes);
 	return 0;
 }
@@ -167,10 +167,13 @@ get_rtas_property(char *workarea)
 int
 dr_entity_sense(int index)
 {
+	struct trace_span span;
 	int state;
 	int rc;
 
+	trace_begin(&span, TRACE_RTAS, "get-sensor");
 	rc = rtas_get_sensor(DR_ENTITY_SENSE, index, &state);
+	trace_end(&span);
 	say(DEBUG, "get-sensor for %x: %d, %d\n", index, rc, state);
 
 	return (rc >= 0) ? state : rc;
@@ -282,6 +285,7 @@ configure_connector(int index)
 	struct of_node *last_node = NULL;	/* Last node processed */
 	struct of_property *property;
 	struct of_property *last_property = NULL; /* Last property processed */
+	struct trace_span span;
 	int *work_int;
 	int rc;
 
@@ -297,7 +301,9 @@ configure_connector(int index)
 	work_int[1] = 0;
 
 	while (1) {
+		trace_begin(&span, TRACE_RTAS, "configure-connector");
 		rc = rtas_cfg_connector(workarea);
+		trace_end(&span);
 		if (rc == 0)
 			break; /* Success */
 
@@ -433,9 +439,32 @@ configure_connector(int index)
 int
 set_power(int domain, int level)
 {
+	struct trace_span span;
 	int ret_level;
+	int rc;
+
+	trace_begin(&span, TRACE_RTAS, "set-power-level");
+	rc = rtas_set_power_level(domain, level, &ret_level);
+	trace_end(&span);
+
+	return rc;
+}
+
+/**
+ * set_indicator
+ * @brief Timed rtas_set_indicator() call
+ */
+static int
+set_indicator(int indicator, int index, int state)
+{
+	struct trace_span span;
+	int rc;
+
+	trace_begin(&span, TRACE_RTAS, "set-indicator");
+	rc = rtas_set_indicator(indicator, index, state);
+	trace_end(&span);
 
-	return rtas_set_power_level(domain, level, &ret_level);
+	return rc;
 }
 
 /**
@@ -457,7 +486,7 @@ acquire_drc(uint32_t drc_index)
 	}
 
 	say(DEBUG, "Setting allocation state to 'alloc usable'\n");
-	rc = rtas_set_indicator(ALLOCATION_STATE, drc_index, ALLOC_USABLE);
+	rc = set_indicator(ALLOCATION_STATE, drc_index, ALLOC_USABLE);
 	if (rc) {
 		say(ERROR, "Allocation failed for drc %x with %d\n%s\n",
 		    drc_index, rc, set_indicator_error(rc));
@@ -465,14 +494,14 @@ acquire_drc(uint32_t drc_index)
 	}
 
 	say(DEBUG, "Setting indicator state to 'unisolate'\n");
-	rc = rtas_set_indicator(ISOLATION_STATE, drc_index, UNISOLATE);
+	rc = set_indicator(ISOLATION_STATE, drc_index, UNISOLATE);
 	if (rc) {
 		int ret;
 		rc = -1;
 
 		say(ERROR, "Unisolate failed for drc %x with %d\n%s\n",
 		    drc_index, rc, set_indicator_error(rc));
-		ret = rtas_set_indicator(ALLOCATION_STATE, drc_index,
+		ret = set_indicator(ALLOCATION_STATE, drc_index,
 					 ALLOC_UNUSABLE);
 		if (ret) {
 			say(ERROR, "Failed recovery to unusable state after "
@@ -497,7 +526,7 @@ release_drc(int drc_index, uint32_t dev_type)
 		    entity_sense_error(rc));
 
 	say(DEBUG, "Setting isolation state to 'isolate'\n");
-	rc = rtas_set_indicator(ISOLATION_STATE, drc_index, ISOLATE);
+	rc = set_indicator(ISOLATION_STATE, drc_index, ISOLATE);
 	if (rc) {
 		if (dev_type == PHB_DEV) {
 			/* Workaround for CMVC 508114, where success returns
@@ -505,7 +534,7 @@ release_drc(int drc_index, uint32_t dev_type)
 			 */
 			int i = 0;
 			while ((rc != 0) && (i < 20)) {
-				rc = rtas_set_indicator(ISOLATION_STATE,
+				rc = set_indicator(ISOLATION_STATE,
 							drc_index,
 							ISOLATE);
 				sleep(1);
@@ -521,11 +550,11 @@ release_drc(int drc_index, uint32_t dev_type)
 	}
 
 	say(DEBUG, "Setting allocation state to 'alloc unusable'\n");
-	rc = rtas_set_indicator(ALLOCATION_STATE, drc_index, ALLOC_UNUSABLE);
+	rc = set_indicator(ALLOCATION_STATE, drc_index, ALLOC_UNUSABLE);
 	if (rc) {
 		say(ERROR, "Unable to un-allocate drc %x from the partition "
 		    "(%d)\n%s\n", drc_index, rc, set_indicator_error(rc));
-		rc = rtas_set_indicator(ISOLATION_STATE, drc_index, UNISOLATE);
+		rc = set_indicator(ISOLATION_STATE, drc_index, UNISOLATE);
 		say(DEBUG, "UNISOLATE for drc %x, rc = %d\n", drc_index, rc);
 		return -1;
 	}
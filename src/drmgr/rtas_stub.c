@@ -0,0 +1,86 @@
+/**
+ * @file rtas_stub.c
+ * @brief Stub librtas backend for running drmgr without firmware
+ *
+ * Copyright (c) 2020 International Business Machines
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <librtas.h>
+#include "rtas_calls.h"
+
+/*
+ * Every DR connector reports a present, powered entity and every call
+ * succeeds.  The latency of a firmware call can be simulated by setting
+ * RTAS_STUB_DELAY_US to the number of microseconds each call takes.
+ */
+static long rtas_stub_delay_us = -1;
+
+static void rtas_stub_delay(void)
+{
+	char *delay;
+
+	if (rtas_stub_delay_us < 0) {
+		delay = getenv("RTAS_STUB_DELAY_US");
+		rtas_stub_delay_us = delay ? strtol(delay, NULL, 10) : 0;
+	}
+
+	if (rtas_stub_delay_us > 0)
+		usleep(rtas_stub_delay_us);
+}
+
+int rtas_get_sensor(int sensor, int index, int *state)
+{
+	rtas_stub_delay();
+	*state = PRESENT;
+	return 0;
+}
+
+int rtas_set_indicator(int indicator, int index, int new_value)
+{
+	rtas_stub_delay();
+	return 0;
+}
+
+int rtas_cfg_connector(char *workarea)
+{
+	/* Configuration complete, the connector has no new nodes */
+	rtas_stub_delay();
+	return 0;
+}
+
+int rtas_get_power_level(int powerdomain, int *level)
+{
+	rtas_stub_delay();
+	*level = POWER_ON;
+	return 0;
+}
+
+int rtas_set_power_level(int powerdomain, int level, int *setlevel)
+{
+	rtas_stub_delay();
+	*setlevel = level;
+	return 0;
+}
+
+int rtas_set_debug(int level)
+{
+	return 0;
+}
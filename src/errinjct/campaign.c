@@ -0,0 +1,523 @@
+/**
+ * @file campaign.c
+ * @brief Hardware error injection tool - campaign module
+ *
+ * Perform a series of error injections listed in a file, with a single
+ * RTAS error injection session, and report each of them as a record.
+ *
+ * Copyright (c) 2020 IBM Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include "errinjct.h"
+#include "record_output.h"
+#include "sample_timer.h"
+
+/* Options of the injections in a campaign file, -C and the function args */
+#define STEP_OPTS	"+:a:C:c:f:h:l:m:n:p:s:"
+
+static char *campaign_file;	/**< file listing the injections */
+static char *format_name;	/**< format of the records */
+static struct record record;	/**< record of each injection */
+
+enum step_type {
+	STEP_INJECT,		/**< perform an injection */
+	STEP_RATE,		/**< change the rate of the injections */
+	STEP_SLEEP,		/**< pause the campaign */
+};
+
+/**
+ * struct step
+ * @brief one line of a campaign file
+ */
+struct step {
+	enum step_type	type;
+	int		line;		/**< line number in the file */
+	double		value;		/**< injections per second, or
+					 *   seconds to sleep
+					 */
+	ei_function	*func;		/**< function to inject */
+	int		argc;
+	char		**argv;		/**< function name and args, point
+					 *   into buf
+					 */
+	char		*buf;		/**< the line */
+};
+
+/**
+ * ei_campaign_usage
+ * @brief print the "campaign" usage statement
+ *
+ * @param ei_func errinjct functionality
+ */
+static void ei_campaign_usage(ei_function *ei_func)
+{
+	printf("Usage: %s %s [OPTIONS]\n", progname, ei_func->name);
+	printf("%s\n\n", ei_func->desc);
+
+	printf("Mandatory argument:\n");
+	printf(HELP_FMT, "-f file", "file listing the injections, - for stdin");
+
+	print_optional_args();
+	printf(HELP_FMT, "-o format", "format of the records, csv (default)");
+	printf(HELP_FMT, "", "or json");
+	printf(HELP_FMT, "-C cpu", "cpu of the injections that do not");
+	printf(HELP_FMT, "", "specify one");
+	printf(HELP_FMT, "-k token", "token returned from error inject open,");
+	printf(HELP_FMT, "", "the facility is opened for the campaign");
+	printf(HELP_FMT, "", "otherwise");
+
+	printf("\nEach line of the file is one of:\n");
+	printf(HELP_FMT, "func [args]", "injection, as args to errinjct");
+	printf(HELP_FMT, "rate N", "at most N injections per second from");
+	printf(HELP_FMT, "", "here on, 0 for no limit (default)");
+	printf(HELP_FMT, "sleep S", "pause for S seconds");
+	printf("Everything after a # is ignored.\n");
+}
+
+/**
+ * ei_campaign_arg
+ * @brief check for "campaign" specific cmdline args
+ *
+ * @param arg cmdline arg to check
+ * @param optarg optional cmdline argument to 'arg'
+ * @return 0 - indicates this is a campaign arg
+ * @return 1 - indicates this is not a campaign arg
+ */
+int ei_campaign_arg(char arg, char *optarg)
+{
+	switch (arg) {
+	case 'f':
+		campaign_file = optarg;
+		break;
+	case 'o':
+		format_name = optarg;
+		break;
+	default:
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * parse_step_args
+ * @brief parse the args of an injection
+ *
+ * The args are handed to the function as they would be on the command
+ * line, after the args of the previous injection have been forgotten.
+ *
+ * @param step injection to parse
+ * @param cpu cpu to use when the injection does not specify one
+ * @return 0 on success, !0 otherwise
+ */
+static int parse_step_args(struct step *step, int cpu)
+{
+	int c;
+
+	if (step->func->reset)
+		step->func->reset();
+	logical_cpu = cpu;
+
+	optind = 0;
+	opterr = 0;
+	while ((c = getopt(step->argc, step->argv, STEP_OPTS)) != -1) {
+		switch (c) {
+		case 'C':
+			logical_cpu = atoi(optarg);
+			break;
+		case ':':
+			perr(0, "line %d: \"-%c\" requires an argument",
+			     step->line, optopt);
+			return 1;
+		case '?':
+			perr(0, "line %d: \"-%c\" is not a valid option in a "
+			     "campaign", step->line, optopt);
+			return 1;
+		default:
+			if (step->func->arg(c, optarg)) {
+				perr(0, "line %d: \"-%c\" is not a valid option "
+				     "for %s", step->line, c, step->func->name);
+				return 1;
+			}
+			break;
+		}
+	}
+
+	if (optind < step->argc) {
+		perr(0, "line %d: unexpected argument \"%s\"", step->line,
+		     step->argv[optind]);
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * parse_step
+ * @brief split a line of a campaign file and check it
+ *
+ * @param step step to fill in, buf and line are set
+ * @param cpu cpu to use when an injection does not specify one
+ * @return 0 on success, 1 if the line is empty, -1 if it is not valid
+ */
+static int parse_step(struct step *step, int cpu)
+{
+	char *tok, *save, *end;
+	char **argv;
+
+	end = strchr(step->buf, '#');
+	if (end)
+		*end = '\0';
+
+	for (tok = strtok_r(step->buf, " \t\r\n", &save); tok;
+	     tok = strtok_r(NULL, " \t\r\n", &save)) {
+		/* room for the NULL terminator as well */
+		argv = realloc(step->argv, (step->argc + 2) * sizeof(char *));
+		if (!argv) {
+			perr(0, "Could not allocate memory for line %d",
+			     step->line);
+			return -1;
+		}
+		step->argv = argv;
+		step->argv[step->argc++] = tok;
+		step->argv[step->argc] = NULL;
+	}
+
+	if (step->argc == 0)
+		return 1;
+
+	if (!strcmp(step->argv[0], "rate") || !strcmp(step->argv[0], "sleep")) {
+		step->type = strcmp(step->argv[0], "rate") ? STEP_SLEEP
+							   : STEP_RATE;
+		if (step->argc != 2) {
+			perr(0, "line %d: %s takes a single value", step->line,
+			     step->argv[0]);
+			return -1;
+		}
+
+		step->value = strtod(step->argv[1], &end);
+		if (*end != '\0' || end == step->argv[1] ||
+		    !isfinite(step->value) || step->value < 0) {
+			perr(0, "line %d: invalid %s \"%s\"", step->line,
+			     step->argv[0], step->argv[1]);
+			return -1;
+		}
+
+		return 0;
+	}
+
+	step->type = STEP_INJECT;
+	step->func = find_ei_function(step->argv[0]);
+	if (!step->func || step->func->func == ei_campaign ||
+	    step->func->func == ei_open || step->func->func == ei_close) {
+		perr(0, "line %d: \"%s\" is not an error injection function",
+		     step->line, step->argv[0]);
+		return -1;
+	}
+
+	return parse_step_args(step, cpu) ? -1 : 0;
+}
+
+/**
+ * read_campaign
+ * @brief read and check all of the steps of a campaign file
+ *
+ * @param fname file to read, - for stdin
+ * @param cpu cpu to use when an injection does not specify one
+ * @param nsteps number of steps read
+ * @return array of steps on success, NULL otherwise
+ */
+static struct step *read_campaign(const char *fname, int cpu, int *nsteps)
+{
+	struct step *steps = NULL, *tmp;
+	char *line = NULL;
+	size_t sz = 0;
+	int lineno = 0, n = 0, rc = 0;
+	FILE *fp;
+
+	if (!strcmp(fname, "-")) {
+		fp = stdin;
+	} else {
+		fp = fopen(fname, "r");
+		if (!fp) {
+			perr(errno, "Could not open file %s", fname);
+			return NULL;
+		}
+	}
+
+	while (getline(&line, &sz, fp) >= 0) {
+		lineno++;
+
+		tmp = realloc(steps, (n + 1) * sizeof(*steps));
+		if (!tmp) {
+			perr(0, "Could not allocate memory for line %d", lineno);
+			rc = -1;
+			break;
+		}
+		steps = tmp;
+
+		memset(&steps[n], 0, sizeof(*steps));
+		steps[n].line = lineno;
+		steps[n].buf = line;
+		line = NULL;
+		sz = 0;
+
+		rc = parse_step(&steps[n], cpu);
+		if (rc == 1) {
+			free(steps[n].argv);
+			free(steps[n].buf);
+			rc = 0;
+			continue;
+		}
+
+		n++;
+		if (rc)
+			break;
+	}
+
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+
+	if (!rc && n == 0) {
+		perr(0, "No injections in %s", fname);
+		rc = -1;
+	}
+
+	if (rc) {
+		while (n--) {
+			free(steps[n].argv);
+			free(steps[n].buf);
+		}
+		free(steps);
+		return NULL;
+	}
+
+	*nsteps = n;
+	return steps;
+}
+
+/**
+ * check_campaign
+ * @brief check every injection of a campaign with a dry run
+ *
+ * This catches the missing mandatory args of each function before the
+ * first injection is made.
+ *
+ * @param steps steps to check
+ * @param nsteps number of steps
+ * @param cpu cpu to use when an injection does not specify one
+ * @return 0 if every injection is valid, !0 otherwise
+ */
+static int check_campaign(struct step *steps, int nsteps, int cpu)
+{
+	int save_dryrun = dryrun, save_quiet = be_quiet;
+	int save_token = ei_token;
+	int i, rc = 0;
+
+	dryrun = 1;
+	be_quiet = 1;
+	if (ei_token == -1)
+		ei_token = 0;
+
+	for (i = 0; i < nsteps && !rc; i++) {
+		if (steps[i].type != STEP_INJECT)
+			continue;
+
+		parse_step_args(&steps[i], cpu);
+		rc = steps[i].func->func(steps[i].func);
+		if (rc)
+			perr(0, "line %d: invalid %s injection", steps[i].line,
+			     steps[i].func->name);
+	}
+
+	dryrun = save_dryrun;
+	be_quiet = save_quiet;
+	ei_token = save_token;
+
+	return rc;
+}
+
+/**
+ * run_campaign
+ * @brief perform the steps of a campaign and record each injection
+ *
+ * @param steps steps to perform
+ * @param nsteps number of steps
+ * @param cpu cpu to use when an injection does not specify one
+ * @return number of injections that failed, -1 if the campaign stopped
+ */
+static int run_campaign(struct step *steps, int nsteps, int cpu)
+{
+	struct sample_timer timer;
+	struct timespec ts;
+	long long start, now;
+	double rate = 0;
+	int paced = 0;
+	int failed = 0;
+	int i, rc;
+
+	start = monotonic_usecs();
+
+	for (i = 0; i < nsteps; i++) {
+		switch (steps[i].type) {
+		case STEP_RATE:
+			rate = steps[i].value;
+			if (rate)
+				sample_timer_start(&timer, 1 / rate);
+			paced = 0;
+			continue;
+		case STEP_SLEEP:
+			ts.tv_sec = steps[i].value;
+			ts.tv_nsec = (steps[i].value - ts.tv_sec) * 1000000000;
+			if (nanosleep(&ts, NULL))
+				return -1;
+			if (rate)
+				sample_timer_start(&timer, 1 / rate);
+			paced = 0;
+			continue;
+		case STEP_INJECT:
+			break;
+		}
+
+		if (paced && sample_timer_wait(&timer))
+			return -1;
+		paced = rate != 0;
+
+		/* the args were checked when the file was read */
+		parse_step_args(&steps[i], cpu);
+		memset(err_buf, 0, EI_BUFSZ);
+		ei_latency = -1;
+
+		now = monotonic_usecs();
+		rc = steps[i].func->func(steps[i].func);
+		if (rc)
+			failed++;
+
+		record_begin(&record);
+		record_add_int(&record, "line", steps[i].line);
+		record_add_str(&record, "function", steps[i].func->name);
+		if (logical_cpu == -1)
+			record_add_null(&record, "cpu");
+		else
+			record_add_int(&record, "cpu", logical_cpu);
+		record_add_int(&record, "time_us", now - start);
+		record_add_int(&record, "rc", rc);
+		if (ei_latency == -1)
+			record_add_null(&record, "latency_us");
+		else
+			record_add_int(&record, "latency_us", ei_latency);
+		record_end(&record);
+
+		if (record_flush(&record))
+			return -1;
+	}
+
+	return failed;
+}
+
+/**
+ * ei_campaign
+ * @brief "campaign" handler, perform the injections listed in a file
+ *
+ * The whole file is read and checked with a dry run before the first
+ * injection.  The RTAS error injection facility is opened once for all
+ * of the injections unless a token is given, and errinjct is only
+ * rebound when the cpu changes from one injection to the next, so
+ * listing the injections of each cpu together saves rebinding.
+ *
+ * @param ei_func errinjct functionality
+ * @return 0 if every injection succeeded, !0 otherwise
+ */
+int ei_campaign(ei_function *ei_func)
+{
+	struct step *steps;
+	int nsteps, injections = 0;
+	int cpu = logical_cpu;
+	int close_errinjct = 0;
+	int i, rc;
+
+	if (ext_help || !campaign_file) {
+		if (!ext_help)
+			perr(0, "Please specify a file with the -f option");
+		ei_campaign_usage(ei_func);
+		return 1;
+	}
+
+	record.format = RECORD_CSV;
+	if (format_name && record_parse_format(format_name, &record.format)) {
+		perr(0, "Invalid record format \"%s\"", format_name);
+		ei_campaign_usage(ei_func);
+		return 1;
+	}
+
+	steps = read_campaign(campaign_file, cpu, &nsteps);
+	if (!steps)
+		return 1;
+
+	for (i = 0; i < nsteps; i++)
+		if (steps[i].type == STEP_INJECT)
+			injections++;
+
+	rc = check_campaign(steps, nsteps, cpu);
+	if (rc)
+		goto out;
+
+	if (ei_token == -1) {
+		if (dryrun) {
+			/* as in check_campaign, nothing is opened */
+			ei_token = 0;
+		} else {
+			rc = open_rtas_errinjct(ei_func);
+			if (rc)
+				goto out;
+			close_errinjct = 1;
+		}
+	}
+
+	if (verbose)
+		fprintf(stderr, "Performing %d injections%s\n", injections,
+			dryrun ? " (dry run)" : "");
+
+	/* the records are the output, not the messages of each injection */
+	be_quiet = 1;
+
+	rc = run_campaign(steps, nsteps, cpu);
+	if (rc > 0)
+		perr(0, "%d of %d injections failed", rc, injections);
+	else if (rc < 0)
+		perr(0, "The campaign was interrupted");
+
+	if (close_errinjct && close_rtas_errinjct(ei_func))
+		rc = rc ? rc : 1;
+
+out:
+	for (i = 0; i < nsteps; i++) {
+		free(steps[i].argv);
+		free(steps[i].buf);
+	}
+	free(steps);
+	record_free(&record);
+
+	return rc ? 1 : 0;
+}
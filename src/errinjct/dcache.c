@@ -91,6 +91,15 @@ int corrupted_dcache_arg(char arg, char *optarg)
 	return 1;
 }
 
+/**
+ * corrupted_dcache_reset
+ * @brief forget the "corrupted D-cache" cmdline args
+ */
+void corrupted_dcache_reset(void)
+{
+	action = -1;
+}
+
 /**
  * corrupted_dcache
  * @brief "corrupted D-cache" error injection handler
@@ -35,6 +35,7 @@
 #include <sys/stat.h>
 #include "errinjct.h"
 #include "pseries_platform.h"
+#include "sample_timer.h"
 
 #define EI_TOKEN_PROCFILE	"/proc/device-tree/rtas/ibm,errinjct-tokens"
 #define EI_IBM_ERRINJCT		"/proc/device-tree/rtas/ibm,errinjct"
@@ -46,6 +47,7 @@ int logical_cpu = -1;
 int ext_help;
 int be_quiet;
 int debug;
+long long ei_latency = -1;
 
 /**
  * @var progname
@@ -84,7 +86,8 @@ static ei_function ei_funcs[] = {
 		.desc = "Start causing a LI data cache error",
 		.rtas_token = -1,
 		.arg = corrupted_dcache_arg,
-		.func = corrupted_dcache
+		.func = corrupted_dcache,
+		.reset = corrupted_dcache_reset
 	},
 
 	{
@@ -93,7 +96,8 @@ static ei_function ei_funcs[] = {
 		.desc = "Stop causing a LI data cache error",
 		.rtas_token = -1,
 		.arg = corrupted_dcache_arg,
-		.func = corrupted_dcache
+		.func = corrupted_dcache,
+		.reset = corrupted_dcache_reset
 	},
 
 	{
@@ -102,7 +106,8 @@ static ei_function ei_funcs[] = {
 		.desc = "Start causing an instruction cache error",
 		.rtas_token = -1,
 		.arg = corrupted_icache_arg,
-		.func = corrupted_icache
+		.func = corrupted_icache,
+		.reset = corrupted_icache_reset
 	},
 
 	{
@@ -111,7 +116,8 @@ static ei_function ei_funcs[] = {
 		.desc = "Stop causing an instruction cache error",
 		.rtas_token = -1,
 		.arg = corrupted_icache_arg,
-		.func = corrupted_icache
+		.func = corrupted_icache,
+		.reset = corrupted_icache_reset
 	},
 
 	{
@@ -129,7 +135,8 @@ static ei_function ei_funcs[] = {
 		.desc = "Corrupt the SLB entry associated with a specific effective address",
 		.rtas_token = -1,
 		.arg = corrupted_slb_arg,
-		.func = corrupted_slb
+		.func = corrupted_slb,
+		.reset = corrupted_slb_reset
 	},
 
 	{
@@ -165,7 +172,8 @@ static ei_function ei_funcs[] = {
 		.desc = "Simulate an error on an IOA bus",
 		.rtas_token = -1,
 		.arg = ioa_bus_error_arg,
-		.func = ioa_bus_error32
+		.func = ioa_bus_error32,
+		.reset = ioa_bus_error_reset
 	},
 
 	{
@@ -174,7 +182,8 @@ static ei_function ei_funcs[] = {
 		.desc = "Simulate an error on a 64-bit IOA bus",
 		.rtas_token = -1,
 		.arg = ioa_bus_error_arg,
-		.func = ioa_bus_error64
+		.func = ioa_bus_error64,
+		.reset = ioa_bus_error_reset
 	},
 
 	{
@@ -183,7 +192,8 @@ static ei_function ei_funcs[] = {
 		.desc = "Request the firmware perform a platform specific error injection",
 		.rtas_token = -1,
 		.arg = platform_specific_arg,
-		.func = platform_specific
+		.func = platform_specific,
+		.reset = platform_specific_reset
 	},
 
 	{
@@ -220,6 +230,15 @@ static ei_function ei_funcs[] = {
 		.rtas_token = -1,
 		.arg = NULL,
 		.func = NULL
+	},
+
+	{
+		.name = "campaign",
+		.alt_name = NULL,
+		.desc = "Perform the injections listed in a file",
+		.rtas_token = -1,
+		.arg = ei_campaign_arg,
+		.func = ei_campaign
 	}
 };
 
@@ -489,7 +508,9 @@ int close_rtas_errinjct(ei_function *ei_func)
  * @brief bind errinjct to a cpu
  *
  * Bind ourselves to a particular cpu if the cpu binding capability
- * is present on this machine.
+ * is present on this machine.  Nothing is done if we are already bound
+ * to that cpu, and the original affinity is restored when a campaign
+ * moves on to injections that do not specify a cpu.
  *
  * The inability to bind to a cpu is not considered a failure condition,
  * we simply print a message stating that cpu binding is not available
@@ -499,15 +520,31 @@ int close_rtas_errinjct(ei_function *ei_func)
  */
 static int bind_cpu(void)
 {
+	static int bound_cpu = -1;
+	static cpu_set_t orig_mask;
 	cpu_set_t mask;
 	int rc;
 
-	if (logical_cpu == -1)
+	if (logical_cpu == bound_cpu)
 		return 0;
 
+	if (logical_cpu == -1) {
+		rc = sched_setaffinity(getpid(), sizeof(orig_mask), &orig_mask);
+		if (rc)
+			perr(0, "Could not unbind from logical cpu %d",
+			     bound_cpu);
+		else
+			bound_cpu = -1;
+		return rc;
+	}
+
 	if (verbose)
 		printf("Binding to logical cpu %d\n", logical_cpu);
 
+	if (bound_cpu == -1 &&
+	    sched_getaffinity(getpid(), sizeof(orig_mask), &orig_mask))
+		CPU_ZERO(&orig_mask);
+
 	CPU_ZERO(&mask);
 	CPU_SET(logical_cpu, &mask);
 
@@ -515,6 +552,8 @@ static int bind_cpu(void)
 
 	if (rc)
 		perr(0, "Could not bind to logical cpu %d", logical_cpu);
+	else
+		bound_cpu = logical_cpu;
 
 	return rc;
 }
@@ -532,6 +571,7 @@ static int bind_cpu(void)
  */
 int do_rtas_errinjct(ei_function *ei_func)
 {
+	static int hinted;
 	int rc = 0;
 	int close_errinjct = 0;
 
@@ -550,13 +590,16 @@ int do_rtas_errinjct(ei_function *ei_func)
 	}
 
 	/* Make the RTAS call */
+	ei_latency = monotonic_usecs();
 	rc = rtas_errinjct(ei_func->rtas_token, ei_token, (char *)err_buf);
+	ei_latency = monotonic_usecs() - ei_latency;
 	if (rc != 0) {
 		perr(0, "RTAS error injection failed!");
 		check_librtas_returns(rc, ei_func);
-		printf("This error may have occurred because error injection\n"
-		       "is disabled for this partition. Please check the\n"
-		       "FSP and ensure you have error injection enabled.\n");
+		if (!hinted++)
+			printf("This error may have occurred because error injection\n"
+			       "is disabled for this partition. Please check the\n"
+			       "FSP and ensure you have error injection enabled.\n");
 	} else if (!be_quiet) {
 		printf("Call to RTAS errinjct succeeded!\n\n");
 	}
@@ -695,6 +738,30 @@ char *read_file(const char *fname, int *flen)
 	return buf;
 }
 
+/**
+ * find_ei_function
+ * @brief Look up a supported error injection function by name
+ *
+ * @param name name, or alternate name, of the function
+ * @returns pointer to the function, NULL if it is not supported
+ */
+ei_function *find_ei_function(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NUM_ERRINJCT_FUNCS; i++) {
+		if (ei_funcs[i].func == NULL)
+			continue;
+
+		if ((strcmp(name, ei_funcs[i].name) == 0)
+		    || ((ei_funcs[i].alt_name != NULL)
+		    && (strcmp(name, ei_funcs[i].alt_name)) == 0))
+			return &ei_funcs[i];
+	}
+
+	return NULL;
+}
+
 static struct option longopts[] = {
 {
 	name: "dry-run",
@@ -730,7 +797,7 @@ int main(int argc, char *argv[])
 	ei_function *ei_func = NULL;
 	const char *funcname;
 	int	c, rc;
-	int	i, fd;
+	int	fd;
 
 	progname = argv[0];
 
@@ -752,18 +819,7 @@ int main(int argc, char *argv[])
 
 	/* The function name is always first */
 	funcname = argv[1];
-	for (i = 0; i < NUM_ERRINJCT_FUNCS; i++) {
-		if (ei_funcs[i].func == NULL)
-			continue;
-
-		if ((strcmp(funcname, ei_funcs[i].name) == 0)
-		    || ((ei_funcs[i].alt_name != NULL)
-		    && (strcmp(funcname, ei_funcs[i].alt_name)) == 0)) {
-			ei_func = &ei_funcs[i];
-			break;
-		}
-	}
-
+	ei_func = find_ei_function(funcname);
 	if (ei_func == NULL) {
 		perr(0, "Could not find function \'%s\'", funcname);
 		ei_ext_usage();
@@ -774,7 +830,7 @@ int main(int argc, char *argv[])
 	argc--;
 	argv++;
 
-	while ((c = getopt_long(argc, argv, "+a:C:c:f:Hh:k:l:m:n:p:qs:v",
+	while ((c = getopt_long(argc, argv, "+a:C:c:f:Hh:k:l:m:n:o:p:qs:v",
 				longopts, NULL)) != -1) {
 		switch (c) {
 		case 254:
@@ -36,6 +36,8 @@ extern int ei_token;		/**< error injection token */
 extern int logical_cpu;		/**< logical cpu to bind to */
 extern int ext_help;		/**< print the extended help message */
 extern int be_quiet;		/**< Shhh... don't say anything */
+extern long long ei_latency;	/**< usecs of the last RTAS errinjct call,
+				 *   -1 if it was not made */
 
 extern char *progname;		/**< argv[0] */
 
@@ -61,6 +63,8 @@ typedef struct ei_function_s {
 	int (*arg)(char, char *);
 	/*capability function handler*/
 	int (*func)(struct ei_function_s *);
+	/*forget the args, before the next injection of a campaign*/
+	void (*reset)(void);
 } ei_function;
 
 /* Error inject open functions (errinjct.c) */
@@ -74,14 +78,17 @@ int ei_close_arg(char, char *);
 /* D-cache functions (dcache.c) */
 int corrupted_dcache(ei_function *);
 int corrupted_dcache_arg(char, char *);
+void corrupted_dcache_reset(void);
 
 /* I-cache functions (icache.c) */
 int corrupted_icache(ei_function *);
 int corrupted_icache_arg(char, char *);
+void corrupted_icache_reset(void);
 
 /* Corrupted SLB functions (slb.c) */
 int corrupted_slb(ei_function *);
 int corrupted_slb_arg(char, char *);
+void corrupted_slb_reset(void);
 
 /* Corrupted TLB functions (tlb.c) */
 int corrupted_tlb(ei_function *);
@@ -91,12 +98,18 @@ int corrupted_tlb_arg(char, char *);
 int ioa_bus_error32(ei_function *);
 int ioa_bus_error64(ei_function *);
 int ioa_bus_error_arg(char, char *);
+void ioa_bus_error_reset(void);
 
 /* Platform Specific (platform.c) */
 int platform_specific(ei_function *);
 int platform_specific_arg(char, char *);
+void platform_specific_reset(void);
 
-#define NUM_ERRINJCT_FUNCS	17
+/* Injection campaigns (campaign.c) */
+int ei_campaign(ei_function *);
+int ei_campaign_arg(char, char *);
+
+#define NUM_ERRINJCT_FUNCS	19
 
 /* errinjct.c */
 int do_rtas_errinjct(ei_function *);
@@ -110,6 +123,7 @@ int open_rtas_errinjct(ei_function *);
 int close_rtas_errinjct(ei_function *);
 int sysfs_check(void);
 char *read_file(const char *, int *);
+ei_function *find_ei_function(const char *);
 
 #define HELP_FMT    "  %-15s%s\n"  /**< common help format */
 
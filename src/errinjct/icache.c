@@ -114,6 +114,16 @@ int corrupted_icache_arg(char arg, char *optarg)
 	return 0;
 }
 
+/**
+ * corrupted_icache_reset
+ * @brief forget the "corrupted I-cache" cmdline args
+ */
+void corrupted_icache_reset(void)
+{
+	action = -1;
+	nature = -1;
+}
+
 /**
  * corrupted_icache
  * @brief "corrupted I-cache" error injection handler
@@ -186,6 +186,25 @@ int ioa_bus_error_arg(char arg, char *optarg)
 	return 0;
 }
 
+/**
+ * ioa_bus_error_reset
+ * @brief forget the "IOA bus error" cmdline args
+ *
+ * This also forgets the addresses that were looked up from a sysfs
+ * name or a location code.
+ */
+void ioa_bus_error_reset(void)
+{
+	function = -1;
+	phb_id_lo = 0;
+	phb_id_hi = 0;
+	bus_addr = 0;
+	config_addr = 0;
+	mask = 0x0;
+	sysfsname = NULL;
+	loc_code = NULL;
+}
+
 /**
  * get_config_addr_from_reg
  * @brief retrieve the config address from device-tree reg file
@@ -79,6 +79,15 @@ int platform_specific_arg(char arg, char *optarg)
 	return 0;
 }
 
+/**
+ * platform_specific_reset
+ * @brief forget the "platform specific" cmdline args
+ */
+void platform_specific_reset(void)
+{
+	fname = NULL;
+}
+
 /**
  * platform_specific
  * @brief "platform specific" error injection handler
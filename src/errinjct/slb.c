@@ -78,6 +78,16 @@ int corrupted_slb_arg(char arg, char *optarg)
 	return 0;
 }
 
+/**
+ * corrupted_slb_reset
+ * @brief forget the "corrupted slb" cmdline args
+ */
+void corrupted_slb_reset(void)
+{
+	addr = 0;
+	addr_flag = 0;
+}
+
 /**
  * corrupted_slb
  * @brief "corrupted slb" error injection handler
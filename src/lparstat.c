@@ -35,56 +35,112 @@
 #include "lparstat.h"
 #include "pseries_platform.h"
 #include "cpu_info_helpers.h"
+#include "record_output.h"
+#include "sample_timer.h"
+#include "sample_core.h"
 
 #define LPARCFG_FILE	"/proc/ppc64/lparcfg"
 #define SE_NOT_FOUND	"???"
 #define SE_NOT_VALID	"-"
 
+/* size of the value buffers handed to get_sysdata() */
+#define SE_STR_VALUE_MAX	SYSDATA_VALUE_SZ
+
 static bool o_legacy = false;
 static bool o_scaled = false;
+static bool o_cores = false;
+static bool o_threads = false;
+static int o_top;
+static struct record o_record;
 
 static int threads_per_cpu;
 static int cpus_in_system;
 static int threads_in_system;
 
-static cpu_sysfs_fd *cpu_sysfs_fds;
-static cpu_set_t *online_cpus;
+static struct cpu_sampler cpu_sampler;	/* per-cpu sysfs counters */
+static bool partial_sample;		/* cpus changed during the interval */
 
-struct sysentry *get_sysentry(char *name)
+/* Open addressed hash of system_data[] entry names, used to look up
+ * entries by the names found in lparcfg.  Everything else indexes
+ * system_data[] directly by sysentry_id.
+ */
+#define SE_HASH_SZ	256
+static unsigned char se_hash[SE_HASH_SZ];
+static int se_hash_init;
+
+static unsigned int se_hash_name(const char *name)
 {
-	struct sysentry *se = &system_data[0];
+	unsigned int hash = 2166136261U;
 
-	while (se->name[0] != '\0') {
-		if (!strcmp(se->name, name))
-			return se;
-		se++;
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
 	}
 
-	return NULL;
+	return hash & (SE_HASH_SZ - 1);
 }
 
-void get_sysdata(char *name, char **descr, char *value)
+static void init_se_hash(void)
+{
+	unsigned int i;
+	int id;
+
+	/* slots hold the sysentry_id plus one, zero means empty */
+	for (id = 0; id < SE_MAX; id++) {
+		i = se_hash_name(system_data[id].name);
+		while (se_hash[i])
+			i = (i + 1) & (SE_HASH_SZ - 1);
+		se_hash[i] = id + 1;
+	}
+
+	se_hash_init = 1;
+}
+
+struct sysentry *get_sysentry(char *name)
 {
 	struct sysentry *se;
+	unsigned int i;
 
-	se = get_sysentry(name);
-	if (!se) {
-		*descr = name;
-		sprintf(value, SE_NOT_FOUND);
-		return;
+	if (!se_hash_init)
+		init_se_hash();
+
+	for (i = se_hash_name(name); se_hash[i]; i = (i + 1) & (SE_HASH_SZ - 1)) {
+		se = &system_data[se_hash[i] - 1];
+		if (!strcmp(se->name, name))
+			return se;
 	}
 
+	return NULL;
+}
+
+static void get_sysentry_data(struct sysentry *se, char **descr, char *value)
+{
 	if (se->get) {
 		se->get(se, value);
-	} else if (se->value[0] == '\0') {
-		sprintf(value, SE_NOT_VALID);
+	} else if (se->value[0] != '\0') {
+		snprintf(value, SE_STR_VALUE_MAX, "%s", se->value);
+	} else if (se->flags & SE_NUM_VALID) {
+		sprintf(value, "%llu", se->num);
 	} else {
-		sprintf(value, "%s", se->value);
+		sprintf(value, SE_NOT_VALID);
 	}
 
 	*descr = se->descr;
 }
 
+void get_sysdata(enum sysentry_id id, char **descr, char *value)
+{
+	get_sysentry_data(&system_data[id], descr, value);
+}
+
+static void set_sysentry_num(enum sysentry_id id, unsigned long long num)
+{
+	struct sysentry *se = &system_data[id];
+
+	se->num = num;
+	se->flags |= SE_NUM_VALID;
+}
+
 static int is_smt_capable(void)
 {
 	return __is_smt_capable(threads_per_cpu);
@@ -100,207 +156,116 @@ static int get_one_smt_state(int core)
 	return __get_one_smt_state(core, threads_per_cpu);
 }
 
-static int assign_read_fd(const char *path)
-{
-	int rc = 0;
-
-	rc = access(path, R_OK);
-	if (rc)
-		return -1;
-
-	rc = open(path, O_RDONLY);
-	return rc;
-}
+/* Per-cpu sysfs counters, purr is only sampled for the breakdown
+ * reports and comes last so it can be left out.
+ */
+static const struct cpu_counter cpu_counters[CS_MAX] = {
+	[CS_SPURR]	= { .name = "spurr", .base = 16 },
+	[CS_IDLE_PURR]	= { .name = "idle_purr", .base = 16 },
+	[CS_IDLE_SPURR]	= { .name = "idle_spurr", .base = 16 },
+	[CS_PURR]	= { .name = "purr", .base = 16 },
+};
 
-static void close_cpu_sysfs_fds(int threads_in_system)
+static void close_cpu_sysfs_fds(void)
 {
-	int i;
-
-	for (i = 0; i < threads_in_system && cpu_sysfs_fds[i].spurr; i++) {
-		close(cpu_sysfs_fds[i].spurr);
-		close(cpu_sysfs_fds[i].idle_purr);
-		close(cpu_sysfs_fds[i].idle_spurr);
-	}
-
-	free(cpu_sysfs_fds);
+	cpu_sampler_close(&cpu_sampler);
 }
 
-static int assign_cpu_sysfs_fds(int threads_in_system)
+int parse_sysfs_values(void)
 {
-	int cpu_idx, i;
-	char sysfs_file_path[SYSFS_PATH_MAX];
+	unsigned long long sum[CS_MAX], old_sum[CS_MAX];
+	int i, j, rc;
 
-	cpu_sysfs_fds =
-		(cpu_sysfs_fd*)calloc(sizeof(cpu_sysfs_fd), threads_in_system);
-	if (!cpu_sysfs_fds) {
-		fprintf(stderr, "Failed to allocate memory for sysfs file descriptors\n");
+	memset(sum, 0, sizeof(sum));
+	memset(old_sum, 0, sizeof(old_sum));
+
+	/* cpus that went offline since the topology was checked are
+	 * left out of this interval
+	 */
+	rc = cpu_sampler_read(&cpu_sampler);
+	if (rc < 0)
 		return -1;
-	}
+	if (rc)
+		partial_sample = true;
 
-	for (cpu_idx = 0, i = 0; i < threads_in_system; i++) {
-		if (!cpu_online(i))
+	for (i = 0; i < cpu_sampler.nr; i++) {
+		if (!cpu_sampler.sampled[i])
 			continue;
 
-		cpu_sysfs_fds[cpu_idx].cpu = i;
-
-		snprintf(sysfs_file_path, SYSFS_PATH_MAX, SYSFS_PERCPU_SPURR, i);
-		cpu_sysfs_fds[cpu_idx].spurr = assign_read_fd(sysfs_file_path);
-		if (cpu_sysfs_fds[cpu_idx].spurr == -1)
-			goto error;
-
-		snprintf(sysfs_file_path, SYSFS_PATH_MAX, SYSFS_PERCPU_IDLE_PURR, i);
-		cpu_sysfs_fds[cpu_idx].idle_purr = assign_read_fd(sysfs_file_path);
-		if (cpu_sysfs_fds[cpu_idx].idle_purr == -1)
-			goto error;
-
-		snprintf(sysfs_file_path, SYSFS_PATH_MAX, SYSFS_PERCPU_IDLE_SPURR, i);
-		cpu_sysfs_fds[cpu_idx].idle_spurr = assign_read_fd(sysfs_file_path);
-		if (cpu_sysfs_fds[cpu_idx].idle_spurr == -1)
-			goto error;
-
-		cpu_idx++;
-	}
-
-	return 0;
-error:
-	fprintf(stderr, "Failed to open %s\n", sysfs_file_path);
-	close_cpu_sysfs_fds(threads_in_system);
-	return -1;
-}
-
-int parse_sysfs_values(void)
-{
-	unsigned long long spurr, idle_spurr, idle_purr, value;
-	char line[SYSDATA_VALUE_SZ];
-	struct sysentry *se;
-	int i, rc;
-
-	spurr = idle_spurr = idle_purr = 0UL;
-
-	for (i = 0; cpu_sysfs_fds[i].spurr > 0; i++) {
-		rc = pread(cpu_sysfs_fds[i].spurr, (void *)line, sizeof(line), 0);
-		if (rc == -1) {
-			fprintf(stderr, "Failed to /sys/devices/system/cpu/cpu%d/spurr\n",
-					cpu_sysfs_fds[i].cpu);
-			goto check_cpu_hotplug;
-		}
-
-		value = strtoll(line, NULL, 16);
-		spurr += value;
+		/* Only cpus that are in both samples contribute to the
+		 * change over the interval.
+		 */
+		if (cpu_sampler.old_valid && !cpu_sampler.old_sampled[i])
+			continue;
 
-		rc = pread(cpu_sysfs_fds[i].idle_purr, (void *)line, sizeof(line), 0);
-		if (rc == -1) {
-			fprintf(stderr, "Failed to /sys/devices/system/cpu/cpu%d/idle_purr\n",
-					cpu_sysfs_fds[i].cpu);
-			goto check_cpu_hotplug;
+		for (j = 0; j < cpu_sampler.nr_counters; j++) {
+			sum[j] += cpu_sampler.val[j][i];
+			old_sum[j] += cpu_sampler.old[j][i];
 		}
+	}
 
-		value = strtoll(line, NULL, 16);
-		idle_purr += value;
+	set_sysentry_num(SE_SPURR, sum[CS_SPURR]);
+	set_sysentry_num(SE_IDLE_PURR, sum[CS_IDLE_PURR]);
+	set_sysentry_num(SE_IDLE_SPURR, sum[CS_IDLE_SPURR]);
 
-		rc = pread(cpu_sysfs_fds[i].idle_spurr, (void *)line, sizeof(line), 0);
-		if (rc == -1) {
-			fprintf(stderr, "Failed to /sys/devices/system/cpu/cpu%d/idle_spurr\n",
-					cpu_sysfs_fds[i].cpu);
-			goto check_cpu_hotplug;
-		}
-
-		value = strtoll(line, NULL, 16);
-		idle_spurr += value;
+	if (cpu_sampler.old_valid) {
+		system_data[SE_SPURR].old_num = old_sum[CS_SPURR];
+		system_data[SE_IDLE_PURR].old_num = old_sum[CS_IDLE_PURR];
+		system_data[SE_IDLE_SPURR].old_num = old_sum[CS_IDLE_SPURR];
 	}
 
-	se = get_sysentry("spurr");
-	sprintf(se->value, "%llu", spurr);
-	se = get_sysentry("idle_purr");
-	sprintf(se->value, "%llu", idle_purr);
-	se = get_sysentry("idle_spurr");
-	sprintf(se->value, "%llu", idle_spurr);
-
 	return 0;
-
-check_cpu_hotplug:
-	if(!cpu_online(cpu_sysfs_fds[i].cpu))
-		return 1;
-
-	return rc;
 }
 
 static void sig_int_handler(int signal)
 {
-	close_cpu_sysfs_fds(threads_in_system);
+	close_cpu_sysfs_fds();
 	exit(1);
 }
 
-long long get_delta_value(char *se_name)
+long long get_delta_value(enum sysentry_id id)
 {
-	long long value, old_value;
-	struct sysentry *se;
+	struct sysentry *se = &system_data[id];
 
-	se = get_sysentry(se_name);
-	if (se->value[0] == '\0')
+	if (!(se->flags & SE_NUM_VALID))
 		return 0LL;
 
-	value = strtoll(se->value, NULL, 0);
-	old_value = strtoll(se->old_value, NULL, 0);
+	if (!(se->flags & SE_OLD_VALID))
+		return se->num;
 
-	return (value - old_value);
+	return (long long)(se->num - se->old_num);
 }
 
 void get_time()
 {
-	struct timeval t;
-	struct sysentry *se;
-
-	gettimeofday(&t, 0);
-
-	se = get_sysentry("time");
-	sprintf(se->value, "%lld",
-		(long long)t.tv_sec * 1000000LL + (long long)t.tv_usec);
+	/* Only the change of this value is used, measure it with the
+	 * monotonic clock so it is not affected by clock adjustments.
+	 */
+	set_sysentry_num(SE_TIME, monotonic_usecs());
 }
 
 int get_time_base()
 {
-	FILE *f;
-	char buf[80];
-	char *tb = NULL;
-	struct sysentry *se;
-
-	f = fopen("/proc/cpuinfo", "r");
-	if (!f) {
-		fprintf(stderr, "Could not open /proc/cpuinfo\n");
-		return -1;
-	}
-
-	while ((fgets(buf, 80, f)) != NULL) {
-		if (!strncmp(buf, "timebase", 8)) {
-			tb = strchr(buf, ':') + 2;
-			break;
-		}
-	}
-	fclose(f);
+	unsigned long long tb = timebase_freq();
 
 	if (!tb)
 		return -1;
 
-	se = get_sysentry("timebase");
-	sprintf(se->value, "%s", tb);
+	set_sysentry_num(SE_TIMEBASE, tb);
 	return 0;
 }
 
 double get_scaled_tb(void)
 {
 	double elapsed, timebase;
-	struct sysentry *se;
 	int online_cores;
 
-	se = get_sysentry("online_cores");
-	online_cores = atoi(se->value);
+	online_cores = system_data[SE_ONLINE_CORES].num;
 
-	elapsed = get_delta_value("time");
+	elapsed = get_delta_value(SE_TIME);
 	elapsed = elapsed / 1000000.0;
 
-	se = get_sysentry("timebase");
-	timebase = atoi(se->value);
+	timebase = system_data[SE_TIMEBASE].num;
 
 	return (timebase * elapsed) * online_cores;
 }
@@ -357,7 +322,7 @@ int get_nominal_frequency(void)
 		return -1;
 	}
 
-	se = get_sysentry("nominal_freq");
+	se = &system_data[SE_NOMINAL_FREQ];
 	snprintf(se->value, sizeof(se->value), "%s", nfreq);
 
 	return 0;
@@ -369,19 +334,19 @@ void get_effective_frequency()
 	double delta_purr, delta_spurr;
 	double nominal_freq, effective_freq;
 
-	se = get_sysentry("nominal_freq");
+	se = &system_data[SE_NOMINAL_FREQ];
 	nominal_freq = strtol(se->value, NULL, 10);
 
 	/*
 	 * Calculate the Effective Frequency (EF)
 	 * EF = (delta SPURR / delta PURR) * nominal frequency
 	 */
-	delta_purr = get_delta_value("purr");
-	delta_spurr = get_delta_value("spurr");
+	delta_purr = get_delta_value(SE_PURR);
+	delta_spurr = get_delta_value(SE_SPURR);
 
 	effective_freq = (delta_spurr / delta_purr) * nominal_freq;
 
-	se = get_sysentry("effective_freq");
+	se = &system_data[SE_EFFECTIVE_FREQ];
 	sprintf(se->value, "%f", effective_freq);
 }
 
@@ -393,19 +358,18 @@ void get_cpu_physc(struct sysentry *unused_se, char *buf)
 	float timebase, physc;
 	float delta_tb;
 
-	delta_purr = get_delta_value("purr");
+	delta_purr = get_delta_value(SE_PURR);
 
-	se = get_sysentry("tbr");
-	if (se->value[0] != '\0') {
-		delta_tb = get_delta_value("tbr");
+	se = &system_data[SE_TBR];
+	if (se->flags & SE_NUM_VALID) {
+		delta_tb = get_delta_value(SE_TBR);
 
 		physc = delta_purr / delta_tb;
 	} else {
-		elapsed = get_delta_value("time");
+		elapsed = get_delta_value(SE_TIME);
 		elapsed = elapsed / 1000000.0;
 
-		se = get_sysentry("timebase");
-		timebase = atoi(se->value);
+		timebase = system_data[SE_TIMEBASE].num;
 
 		physc = delta_purr/timebase/elapsed;
 	}
@@ -419,8 +383,8 @@ void get_per_entc(struct sysentry *unused_se, char *buf)
 	char physc[32];
 	char entc[32];
 
-	get_sysdata("DesEntCap", &descr, entc);
-	get_sysdata("physc", &descr, physc);
+	get_sysdata(SE_DESENTCAP, &descr, entc);
+	get_sysdata(SE_PHYSC, &descr, physc);
 
 	sprintf(buf, "%.2f", atof(physc) / atof(entc) * 100.0);
 }
@@ -429,13 +393,13 @@ void get_cpu_app(struct sysentry *unused_se, char *buf)
 {
 	struct sysentry *se;
 	float timebase, app, elapsed_time;
-	long long new_app, old_app, delta_time;
+	long long delta_app, delta_time;
 	char *descr, uptime[32];
 
-	se = get_sysentry("time");
-	if (se->old_value[0] == '\0') {
+	se = &system_data[SE_TIME];
+	if (!(se->flags & SE_OLD_VALID)) {
 		/* Single report since boot */
-		get_sysdata("uptime", &descr, uptime);
+		get_sysdata(SE_UPTIME, &descr, uptime);
 
 		if (!strcmp(uptime, SE_NOT_VALID)) {
 			sprintf(buf, "-");
@@ -443,22 +407,15 @@ void get_cpu_app(struct sysentry *unused_se, char *buf)
 		}
 		elapsed_time = atof(uptime);
 	} else {
-		delta_time = get_delta_value("time");
+		delta_time = get_delta_value(SE_TIME);
 		elapsed_time = delta_time / 1000000.0;
 	}
 
-	se = get_sysentry("timebase");
-	timebase = atof(se->value);
+	timebase = system_data[SE_TIMEBASE].num;
 
-	se = get_sysentry("pool_idle_time");
-	new_app = strtoll(se->value, NULL, 0);
-	if (se->old_value[0] == '\0') {
-		old_app = 0;
-	} else {
-		old_app = strtoll(se->old_value, NULL, 0);
-	}
+	delta_app = get_delta_value(SE_POOL_IDLE_TIME);
 
-	app = (new_app - old_app)/timebase/elapsed_time;
+	app = delta_app/timebase/elapsed_time;
 	sprintf(buf, "%.2f", app);
 }
 
@@ -467,10 +424,10 @@ static double round_off_freq(void)
 	double effective_freq, nominal_freq, freq;
 	struct sysentry *se;
 
-	se = get_sysentry("effective_freq");
+	se = &system_data[SE_EFFECTIVE_FREQ];
 	effective_freq = strtod(se->value, NULL);
 
-	se = get_sysentry("nominal_freq");
+	se = &system_data[SE_NOMINAL_FREQ];
 	nominal_freq = strtod(se->value, NULL);
 
 	freq = ((int)((effective_freq/nominal_freq * 100)+ 0.44) -
@@ -486,8 +443,8 @@ void get_cpu_util_purr(struct sysentry *unused_se, char *buf)
 	double physc;
 
 	delta_tb = get_scaled_tb();
-	delta_purr = get_delta_value("purr");
-	delta_idle_purr = get_delta_value("idle_purr");
+	delta_purr = get_delta_value(SE_PURR);
+	delta_idle_purr = get_delta_value(SE_IDLE_PURR);
 
 	physc = (delta_purr - delta_idle_purr) / delta_tb;
 	physc *= 100.00;
@@ -501,8 +458,8 @@ void get_cpu_idle_purr(struct sysentry *unused_se, char *buf)
 	double physc, idle;
 
 	delta_tb = get_scaled_tb();
-	delta_purr = get_delta_value("purr");
-	delta_idle_purr = get_delta_value("idle_purr");
+	delta_purr = get_delta_value(SE_PURR);
+	delta_idle_purr = get_delta_value(SE_IDLE_PURR);
 
 	physc = (delta_purr - delta_idle_purr) / delta_tb;
 	idle = (delta_purr / delta_tb) - physc;
@@ -517,8 +474,8 @@ void get_cpu_util_spurr(struct sysentry *unused_se, char *buf)
 	double physc, rfreq;
 
 	delta_tb = get_scaled_tb();
-	delta_spurr = get_delta_value("spurr");
-	delta_idle_spurr = get_delta_value("idle_spurr");
+	delta_spurr = get_delta_value(SE_SPURR);
+	delta_idle_spurr = get_delta_value(SE_IDLE_SPURR);
 
 	physc = (delta_spurr - delta_idle_spurr) / delta_tb;
 	physc *= 100.00;
@@ -536,8 +493,8 @@ void get_cpu_idle_spurr(struct sysentry *unused_se, char *buf)
 	double rfreq;
 
 	delta_tb = get_scaled_tb();
-	delta_spurr = get_delta_value("spurr");
-	delta_idle_spurr = get_delta_value("idle_spurr");
+	delta_spurr = get_delta_value(SE_SPURR);
+	delta_idle_spurr = get_delta_value(SE_IDLE_SPURR);
 
 	physc = (delta_spurr - delta_idle_spurr) / delta_tb;
 	idle = (delta_spurr / delta_tb) - physc;
@@ -549,130 +506,169 @@ void get_cpu_idle_spurr(struct sysentry *unused_se, char *buf)
 	sprintf(buf, "%.2f", idle);
 }
 
+static struct sample_file lparcfg_file = SAMPLE_FILE_INIT(LPARCFG_FILE);
+static struct sample_file proc_stat_file = SAMPLE_FILE_INIT("/proc/stat");
+static struct sample_file proc_ints_file = SAMPLE_FILE_INIT("/proc/interrupts");
+
+static void close_proc_files(void)
+{
+	sample_file_close(&lparcfg_file);
+	sample_file_close(&proc_stat_file);
+	sample_file_close(&proc_ints_file);
+}
+
 int parse_lparcfg()
 {
-	FILE *f;
-	char line[128];
-	char *first_line;
+	char *line, *next;
 
-	f = fopen(LPARCFG_FILE, "r");
-	if (!f) {
-		fprintf(stderr, "Could not open %s\n", LPARCFG_FILE);
+	if (sample_file_read(&lparcfg_file, 0, false) < 0)
 		return -1;
-	}
 
 	/* parse the file skipping the first line */
-	first_line = fgets(line, 128, f);
-	if (!first_line) {
-		fclose(f);
+	line = strchr(lparcfg_file.buf, '\n');
+	if (!line) {
 		fprintf(stderr, "Could not read first line of %s\n",
 			LPARCFG_FILE);
 		return -1;
 	}
 
-	while (fgets(line, 128, f) != NULL) {
-		char *name, *value, *nl;
+	for (line++; *line != '\0'; line = next) {
+		char *name, *value;
 		struct sysentry *se;
 
-		if (line[0] == '\n')
-			continue;
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
 
-		name = &line[0];
+		name = line;
 		value = strchr(line, '=');
+		if (!value)
+			continue;
+
 		*value = '\0';
 		value++;
 
-		nl = strchr(value, '\n');
-		*nl = '\0';
-		
 		se = get_sysentry(name);
 		if (se) {
+			char *end;
+
 			strncpy(se->value, value, SYSDATA_VALUE_SZ - 1);
 			se->value[SYSDATA_VALUE_SZ - 1] = '\0';
+
+			/* Keep the numeric value of counters so deltas
+			 * can be computed without re-parsing the string.
+			 */
+			se->num = strtoull(value, &end, 0);
+			if (end != value && *end == '\0')
+				se->flags |= SE_NUM_VALID;
+			else
+				se->flags &= ~SE_NUM_VALID;
 		}
 	}
 
-	fclose(f);
 	return 0;
 }
 
-int parse_proc_ints()
+/**
+ * find_spu_row
+ * @brief Find the offset of the SPU: row in /proc/interrupts
+ *
+ * @returns 0 on success, -1 if the row is not found
+ */
+static int find_spu_row(void)
 {
-	FILE *f;
-	char *line;
-	size_t n = 0;
-	char *value;
-	struct sysentry *se;
-	long long int phint = 0;
-	const char *delim = " ";
+	char *row, *p;
 
-	f = fopen("/proc/interrupts", "r");
-	if (!f) {
-		fprintf(stderr, "Could not open /proc/interrupts\n");
+	if (sample_file_read(&proc_ints_file, 0, false) < 0)
 		return -1;
-	}
 
-	while (getline(&line, &n, f) != -1) {
-		/* we just need the SPU line */
-		if (!strstr(line, "SPU:"))
-			continue;
+	for (row = proc_ints_file.buf; *row != '\0'; row = p + 1) {
+		for (p = row; *p == ' '; p++)
+			;
 
-		/* target line. omit the 'SPU:' */
-		value = strtok(line, delim);
-		if (!value)
+		if (!strncmp(p, "SPU:", 4)) {
+			proc_ints_file.offset = row - proc_ints_file.buf;
+			return 0;
+		}
+
+		p = strchr(p, '\n');
+		if (!p)
 			break;
+	}
+
+	return -1;
+}
+
+static bool is_spu_row(const char *row)
+{
+	while (*row == ' ')
+		row++;
+
+	return !strncmp(row, "SPU:", 4);
+}
 
-		while ((value = strtok(NULL, delim)) && value[0] != 'S') {
+int parse_proc_ints()
+{
+	char *value, *saveptr;
+	long long int phint = 0;
+	const char *delim = " ";
+
+	/* Only the SPU row is needed.  Its offset only changes if the
+	 * set of cpus or interrupts changes, so read straight from the
+	 * offset found the last time and search again if that fails.
+	 */
+	if (proc_ints_file.offset == 0 ||
+	    sample_file_read(&proc_ints_file, proc_ints_file.offset, true) < 0 ||
+	    !is_spu_row(proc_ints_file.buf)) {
+		proc_ints_file.offset = 0;
+		if (find_spu_row() ||
+		    sample_file_read(&proc_ints_file, proc_ints_file.offset,
+				   true) < 0) {
+			set_sysentry_num(SE_PHINT, 0);
+			return 0;
+		}
+	}
+
+	/* target line. omit the 'SPU:' */
+	value = strtok_r(proc_ints_file.buf, delim, &saveptr);
+	if (value) {
+		while ((value = strtok_r(NULL, delim, &saveptr)) &&
+		       value[0] != 'S') {
 			int v;
 			v = atoi(value);
 			phint += v;
 		}
-
-		/* skim the rest of the lines */
-		break;
 	}
 
-	free(line);
-	fclose(f);
-
-	se = get_sysentry("phint");
-	sprintf(se->value, "%lld", phint);
+	set_sysentry_num(SE_PHINT, phint);
 
 	return 0;
 }
 
 int parse_proc_stat()
 {
-	FILE *f;
-	char line[128];
 	char *value;
 	int i, entries = 6;
 	long long statvals[entries];
-	struct sysentry *se;
-	char *first_line;
-	char *names[] = {"cpu_total", "cpu_user", "cpu_nice", "cpu_sys",
-			 "cpu_idle", "cpu_iowait"};
+	enum sysentry_id ids[] = {SE_CPU_TOTAL, SE_CPU_USER, SE_CPU_NICE,
+				  SE_CPU_SYS, SE_CPU_IDLE, SE_CPU_IOWAIT};
 
 	/* we just need the first line */
-	f = fopen("/proc/stat", "r");
-	if (!f) {
-		fprintf(stderr, "Could not open /proc/stat\n");
-		return -1;
-	}
-
-	first_line = fgets(line, 128, f);
-	fclose(f);
-
-	if (!first_line) {
+	if (sample_file_read(&proc_stat_file, 0, true) <= 0) {
 		fprintf(stderr, "Could not read first line of /proc/stat\n");
 		return -1;
 	}
 
 	statvals[0] = 0;
-	value = line;
+	value = proc_stat_file.buf;
 	for (i = 1; i <= (entries - 1); i++) {
 		long long v;
-		value = strchr(value, ' ') + 1;
+		value = strchr(value, ' ');
+		if (!value)
+			return -1;
+		value++;
 		if (i == 1)
 			value++;
 		v = atoll(value);
@@ -680,13 +676,10 @@ int parse_proc_stat()
 		statvals[0] += v;
 	}
 
-	for (i = 0; i < entries; i++) {
-		se = get_sysentry(names[i]);
-		sprintf(se->value, "%lld", statvals[i]);
-	}
+	for (i = 0; i < entries; i++)
+		set_sysentry_num(ids[i], statvals[i]);
 
-	se = get_sysentry("cpu_lbusy");
-	sprintf(se->value, "%lld", statvals[1] + statvals[3]);
+	set_sysentry_num(SE_CPU_LBUSY, statvals[1] + statvals[3]);
 
 	return 0;
 }
@@ -728,10 +721,10 @@ void get_phys_cpu_percentage(struct sysentry *se, char *buf)
 	struct sysentry *tmp_se;
 	int entcap, active;
 
-	tmp_se = get_sysentry("DesEntCap");
+	tmp_se = &system_data[SE_DESENTCAP];
 	entcap = atoi(tmp_se->value);
 
-	tmp_se = get_sysentry("partition_active_processors");
+	tmp_se = &system_data[SE_PARTITION_ACTIVE_PROCESSORS];
 	active = atoi(tmp_se->value);
 
 	sprintf(buf, "%d", entcap/active);
@@ -741,11 +734,11 @@ void get_active_cpus_in_pool(struct sysentry *se, char *buf)
 {
 	struct sysentry *tmp;
 
-	tmp = get_sysentry("physical_procs_allocated_to_virtualization");
+	tmp = &system_data[SE_PHYSICAL_PROCS_ALLOCATED_TO_VIRTUALIZATION];
 	if (tmp) {
 		sprintf(buf, "%d", atoi(tmp->value));
 	} else {
-		tmp = get_sysentry("pool_capacity");
+		tmp = &system_data[SE_POOL_CAPACITY];
 		sprintf(buf, "%d", atoi(tmp->value)/100);
 	}
 }
@@ -754,7 +747,7 @@ void get_memory_mode(struct sysentry *se, char *buf)
 {
 	struct sysentry *tmp;
 
-	tmp = get_sysentry("entitled_memory_pool_number");
+	tmp = &system_data[SE_ENTITLED_MEMORY_POOL_NUMBER];
 	if (atoi(tmp->value) == 65535)
 		sprintf(buf, "Dedicated");
 	else
@@ -862,7 +855,6 @@ void get_smt_mode(struct sysentry *se, char *buf)
 
 void get_online_cores(void)
 {
-	struct sysentry *se;
 	int *core_state;
 	int online_cores = 0;
 	int i;
@@ -879,8 +871,7 @@ void get_online_cores(void)
 			online_cores++;
 	}
 
-	se = get_sysentry("online_cores");
-	sprintf(se->value, "%d", online_cores);
+	set_sysentry_num(SE_ONLINE_CORES, online_cores);
 
 	free(core_state);
 }
@@ -890,56 +881,44 @@ void get_cpu_stat(struct sysentry *se, char *buf)
 	float percent;
 	long long total, delta_val;
 
-	total = get_delta_value("cpu_total");
-	delta_val = get_delta_value(se->name);
+	total = get_delta_value(SE_CPU_TOTAL);
+	delta_val = get_delta_value(se - system_data);
 	percent = (delta_val/(long double)total) * 100;
 	sprintf(buf, "%.2f", percent);
 }
 
-int has_cpu_topology_changed(void)
+/**
+ * update_cpu_topology
+ * @brief Track cpus coming online or going offline
+ *
+ * Only the sysfs files of the cpus that changed are opened or closed,
+ * and the interval is marked as partial.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+int update_cpu_topology(void)
 {
-	int i, changed = 1;
-	cpu_set_t *tmp_cpuset;
-	size_t online_cpus_size = CPU_ALLOC_SIZE(threads_in_system);
+	int nr = cpu_sampler.nr;
+	int changed;
 
-	if (!online_cpus) {
-		online_cpus = CPU_ALLOC(threads_in_system);
-		if (!online_cpus) {
-			fprintf(stderr, "Failed to allocate memory for cpu_set\n");
-			return -1;
-		}
-
-		CPU_ZERO_S(online_cpus_size, online_cpus);
-
-		for (i = 0; i < threads_in_system; i++) {
-			if (!cpu_online(i))
-				continue;
-			CPU_SET_S(i, online_cpus_size, online_cpus);
-		}
-
-		return changed;
-	}
+	changed = cpu_sampler_update(&cpu_sampler);
+	if (changed < 0)
+		return -1;
 
-	tmp_cpuset = CPU_ALLOC(threads_in_system);
-	if (!tmp_cpuset) {
-		fprintf(stderr, "Failed to allocate memory for cpu_set\n");
+	/* Cpus added beyond the known ones need a larger topology */
+	if (cpu_sampler.nr > nr && nr &&
+	    get_cpu_info(&threads_per_cpu, &cpus_in_system,
+			 &threads_in_system)) {
+		fprintf(stderr, "Failed to capture system CPUs information\n");
 		return -1;
 	}
 
-	CPU_ZERO_S(online_cpus_size, tmp_cpuset);
-
-	for (i = 0; i < threads_in_system; i++) {
-		if (!cpu_online(i))
-			continue;
-		CPU_SET_S(i, online_cpus_size, tmp_cpuset);
+	if (changed) {
+		partial_sample = true;
+		get_online_cores();
 	}
 
-	changed = CPU_EQUAL_S(online_cpus_size, online_cpus, tmp_cpuset);
-
-	CPU_FREE(online_cpus);
-	online_cpus = tmp_cpuset;
-
-	return changed;
+	return 0;
 }
 
 void init_sysinfo(void)
@@ -969,9 +948,10 @@ void init_sysinfo(void)
 		exit(-1);
 	}
 
-	rc = assign_cpu_sysfs_fds(threads_in_system);
-	if (rc)
-		exit(rc);
+	rc = cpu_sampler_init(&cpu_sampler, cpu_counters,
+			      (o_cores || o_threads) ? CS_MAX : CS_PURR, false);
+	if (rc || cpu_sampler_update(&cpu_sampler) < 0)
+		exit(-1);
 }
 
 void init_sysdata(void)
@@ -989,32 +969,30 @@ void init_sysdata(void)
 	if (!o_scaled)
 		return;
 
-	rc = has_cpu_topology_changed();
-	if (!rc)
-		goto cpu_hotplug_restart;
+	rc = update_cpu_topology();
+	if (rc)
+		exit(rc);
 
 	rc = parse_sysfs_values();
-	if (rc == -1)
+	if (rc)
 		exit(rc);
-	else if (rc)
-		goto cpu_hotplug_restart;
 
 	get_effective_frequency();
-
-	return;
-
-cpu_hotplug_restart:
-	close_cpu_sysfs_fds(threads_in_system);
-	init_sysinfo();
 }
 
 void update_sysdata(void)
 {
 	struct sysentry *se = &system_data[0];
 	while (se->name[0] != '\0') {
-		memcpy(se->old_value, se->value, SYSDATA_VALUE_SZ);
+		if (se->flags & SE_NUM_VALID) {
+			se->old_num = se->num;
+			se->flags |= SE_OLD_VALID;
+		}
 		se++;
 	}
+
+	cpu_sampler_save(&cpu_sampler);
+	partial_sample = false;
 	
 	init_sysdata();
 }
@@ -1022,12 +1000,20 @@ void update_sysdata(void)
 int print_iflag_data()
 {
 	char *fmt = "%-45s: %s\n";
-	char value[64];
+	char value[SE_STR_VALUE_MAX];
 	char *descr;
 	int i = 0;
 
 	while (iflag_entries[i] != NULL) {
-		get_sysdata(iflag_entries[i], &descr, value);
+		struct sysentry *se = get_sysentry(iflag_entries[i]);
+
+		if (se) {
+			get_sysentry_data(se, &descr, value);
+		} else {
+			descr = iflag_entries[i];
+			sprintf(value, SE_NOT_FOUND);
+		}
+
 #ifndef DEBUG
 		if (strcmp(value, SE_NOT_VALID) && strcmp(value, SE_NOT_FOUND))
 #endif
@@ -1043,48 +1029,174 @@ void print_system_configuration(void)
 	char *descr;
 	char buf[128];
 	int offset, smt, active_proc;
-	char type[32];
-	char value[32];
+	char type[SE_STR_VALUE_MAX];
+	char value[SE_STR_VALUE_MAX];
 
 	memset(buf, 0, 128);
-	get_sysdata("shared_processor_mode", &descr, value);
+	get_sysdata(SE_SHARED_PROCESSOR_MODE, &descr, value);
 	offset = sprintf(buf, "type=%s ", value);
 	sprintf(type, "%s", value);
-	get_sysdata("capped", &descr, value);
+	get_sysdata(SE_CAPPED, &descr, value);
 	offset += sprintf(buf + offset, "mode=%s ", value);
-	get_sysdata("smt_state", &descr, value);
+	get_sysdata(SE_SMT_STATE, &descr, value);
 	offset += sprintf(buf + offset, "smt=%s ", value);
 	if (!strcmp(value, "Off"))
 		smt = 1;
 	else
 		smt = atoi(value);
-	get_sysdata("partition_active_processors", &descr, value);
+	get_sysdata(SE_PARTITION_ACTIVE_PROCESSORS, &descr, value);
 	active_proc = atoi(value);
 	if (o_legacy)
 		offset += sprintf(buf + offset, "lcpu=%d ", active_proc*smt);
 	else
 		offset += sprintf(buf + offset, "lcpu=%s ", value);
-	get_sysdata("MemTotal", &descr, value);
+	get_sysdata(SE_MEMTOTAL, &descr, value);
 	offset += sprintf(buf + offset, "mem=%s ", value);
-	get_sysdata("active_cpus_in_pool", &descr, value);
+	get_sysdata(SE_ACTIVE_CPUS_IN_POOL, &descr, value);
 	if (o_legacy) {
 		if (strcmp(type, "Dedicated"))
 			offset += sprintf(buf + offset, "psize=%s ", value);
 	} else {
 		offset += sprintf(buf + offset, "cpus=%s ", value);
 	}
-	get_sysdata("DesEntCap", &descr, value);
+	get_sysdata(SE_DESENTCAP, &descr, value);
 	offset += sprintf(buf + offset, "ent=%s ", value);
 
 	fprintf(stdout, "\nSystem Configuration\n%s\n\n", buf);
 }
 
-void print_default_output(int interval, int count)
+/**
+ * record_add_sysdata
+ * @brief Add the displayed value of a sysentry to a record
+ *
+ * Values are added as numbers where they are numeric, and as null
+ * where they are not valid.
+ */
+static void record_add_sysdata(struct record *rec, const char *name,
+			       enum sysentry_id id)
+{
+	char value[SYSDATA_VALUE_SZ];
+	long long ival;
+	double dval;
+	char *descr, *end;
+
+	get_sysdata(id, &descr, value);
+
+	ival = strtoll(value, &end, 10);
+	if (end != value && *end == '\0') {
+		record_add_int(rec, name, ival);
+		return;
+	}
+
+	dval = strtod(value, &end);
+	if (end != value && *end == '\0') {
+		record_add_double(rec, name, dval);
+		return;
+	}
+
+	if (!strcmp(value, SE_NOT_VALID))
+		record_add_null(rec, name);
+	else
+		record_add_str(rec, name, value);
+}
+
+/**
+ * record_add_deltas
+ * @brief Add the change of a set of counters over the interval to a record
+ */
+static void record_add_deltas(struct record *rec, enum sysentry_id *ids,
+			      int nr)
+{
+	char name[SYSDATA_NAME_SZ + 8];
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		snprintf(name, sizeof(name), "%s_delta",
+			 system_data[ids[i]].name);
+		record_add_int(rec, name, get_delta_value(ids[i]));
+	}
+}
+
+void print_default_record(void)
+{
+	enum sysentry_id deltas[] = {SE_CPU_TOTAL, SE_CPU_USER, SE_CPU_NICE,
+				     SE_CPU_SYS, SE_CPU_IDLE, SE_CPU_IOWAIT,
+				     SE_PURR, SE_TBR, SE_POOL_IDLE_TIME,
+				     SE_DISPATCHES, SE_PHINT};
+
+	record_begin(&o_record);
+	record_add_int(&o_record, "interval_us", get_delta_value(SE_TIME));
+	record_add_sysdata(&o_record, "user", SE_CPU_USER);
+	record_add_sysdata(&o_record, "sys", SE_CPU_SYS);
+	record_add_sysdata(&o_record, "wait", SE_CPU_IOWAIT);
+	record_add_sysdata(&o_record, "idle", SE_CPU_IDLE);
+	record_add_sysdata(&o_record, "physc", SE_PHYSC);
+	record_add_sysdata(&o_record, "entc", SE_PER_ENTC);
+	record_add_sysdata(&o_record, "lbusy", SE_CPU_LBUSY);
+	record_add_sysdata(&o_record, "app", SE_APP);
+	record_add_sysdata(&o_record, "vcsw", SE_DISPATCHES);
+	record_add_sysdata(&o_record, "phint", SE_PHINT);
+	record_add_deltas(&o_record, deltas,
+			  sizeof(deltas) / sizeof(deltas[0]));
+	record_end(&o_record);
+	record_flush(&o_record);
+}
+
+void print_scaled_record(void)
+{
+	enum sysentry_id deltas[] = {SE_PURR, SE_IDLE_PURR, SE_SPURR,
+				     SE_IDLE_SPURR};
+
+	record_begin(&o_record);
+	record_add_int(&o_record, "interval_us", get_delta_value(SE_TIME));
+	record_add_sysdata(&o_record, "busy", SE_PURR_CPU_UTIL);
+	record_add_sysdata(&o_record, "idle", SE_PURR_CPU_IDLE);
+	record_add_sysdata(&o_record, "effective_freq", SE_EFFECTIVE_FREQ);
+	record_add_double(&o_record, "nominal_freq",
+			  strtod(system_data[SE_NOMINAL_FREQ].value, NULL));
+	record_add_sysdata(&o_record, "normalized_busy", SE_SPURR_CPU_UTIL);
+	record_add_sysdata(&o_record, "normalized_idle", SE_SPURR_CPU_IDLE);
+	record_add_int(&o_record, "partial", partial_sample);
+	record_add_deltas(&o_record, deltas,
+			  sizeof(deltas) / sizeof(deltas[0]));
+	record_end(&o_record);
+	record_flush(&o_record);
+}
+
+/**
+ * print_records
+ * @brief Stream one machine readable record per interval
+ *
+ * @param interval seconds between records
+ * @param count number of records, unbounded if less than zero
+ */
+void print_records(double interval, int count)
+{
+	struct sample_timer timer;
+
+	sample_timer_start(&timer, interval);
+	do {
+		if (interval) {
+			sample_timer_wait(&timer);
+			update_sysdata();
+		}
+
+		if (o_scaled)
+			print_scaled_record();
+		else
+			print_default_record();
+	} while (count < 0 || --count > 0);
+
+	record_free(&o_record);
+}
+
+void print_default_output(double interval, int count)
 {
 	char *fmt = "%5s %5s %5s %8s %8s %5s %5s %5s %5s %5s\n";
 	char *descr;
 	char user[32], sys[32], wait[32], idle[32], physc[32], entc[32];
 	char lbusy[32], app[32], vcsw[32], phint[32];
+	struct sample_timer timer;
 
 	print_system_configuration();
 
@@ -1093,22 +1205,23 @@ void print_default_output(int interval, int count)
 	fprintf(stdout, fmt, "-----", "-----", "-----", "-----", "-----",
 		"-----", "-----", "-----", "-----", "-----");
 
+	sample_timer_start(&timer, interval);
 	do {
 		if (interval) {
-			sleep(interval);
+			sample_timer_wait(&timer);
 			update_sysdata();
 		}
 
-		get_sysdata("cpu_user", &descr, user);
-		get_sysdata("cpu_sys", &descr, sys);
-		get_sysdata("cpu_iowait", &descr, wait);
-		get_sysdata("cpu_idle", &descr, idle);
-		get_sysdata("cpu_lbusy", &descr, lbusy);
-		get_sysdata("dispatches", &descr, vcsw);
-		get_sysdata("physc", &descr, physc);
-		get_sysdata("per_entc", &descr, entc);
-		get_sysdata("phint", &descr, phint);
-		get_sysdata("app", &descr, app);
+		get_sysdata(SE_CPU_USER, &descr, user);
+		get_sysdata(SE_CPU_SYS, &descr, sys);
+		get_sysdata(SE_CPU_IOWAIT, &descr, wait);
+		get_sysdata(SE_CPU_IDLE, &descr, idle);
+		get_sysdata(SE_CPU_LBUSY, &descr, lbusy);
+		get_sysdata(SE_DISPATCHES, &descr, vcsw);
+		get_sysdata(SE_PHYSC, &descr, physc);
+		get_sysdata(SE_PER_ENTC, &descr, entc);
+		get_sysdata(SE_PHINT, &descr, phint);
+		get_sysdata(SE_APP, &descr, app);
 
 		fprintf(stdout, fmt, user, sys, wait, idle, physc, entc,
 			lbusy, app, vcsw, phint);
@@ -1116,38 +1229,177 @@ void print_default_output(int interval, int count)
 	} while (--count > 0);
 }
 
-void print_scaled_output(int interval, int count)
+struct cpu_util {
+	int	id;		/* core or cpu number */
+	double	purr;		/* deltas over the interval */
+	double	idle_purr;
+	double	spurr;
+	double	idle_spurr;
+	double	busy;		/* percent of one core's capacity */
+};
+
+static int cpu_util_cmp(const void *a, const void *b)
+{
+	const struct cpu_util *ua = a, *ub = b;
+
+	if (ua->busy != ub->busy)
+		return (ua->busy < ub->busy) ? 1 : -1;
+
+	return ua->id - ub->id;
+}
+
+static void print_cpu_util(const char *label, struct cpu_util *util, int nr)
+{
+	double nominal_freq, effective_freq, capacity;
+	int i;
+
+	nominal_freq = strtod(system_data[SE_NOMINAL_FREQ].value, NULL);
+	capacity = system_data[SE_TIMEBASE].num *
+		   (get_delta_value(SE_TIME) / 1000000.0);
+
+	for (i = 0; i < nr; i++)
+		util[i].busy = (util[i].purr - util[i].idle_purr) /
+			       capacity * 100.0;
+
+	qsort(util, nr, sizeof(*util), cpu_util_cmp);
+
+	if (o_top && o_top < nr)
+		nr = o_top;
+
+	fprintf(stdout, "\n%5s  %%busy  %%idle   Frequency     %%busy  %%idle\n",
+		label);
+	fprintf(stdout, "----- ------ ------  ------------- ------ ------\n");
+
+	for (i = 0; i < nr; i++) {
+		effective_freq = 0;
+		if (util[i].purr)
+			effective_freq = util[i].spurr / util[i].purr *
+					 nominal_freq;
+
+		fprintf(stdout, "%5d %6.2f %6.2f  %5.2fGHz[%3d%%] %6.2f %6.2f\n",
+			util[i].id, util[i].busy,
+			util[i].idle_purr / capacity * 100.0,
+			effective_freq / 1000,
+			(int)((effective_freq / nominal_freq * 100) + 0.44),
+			(util[i].spurr - util[i].idle_spurr) / capacity * 100.0,
+			util[i].idle_spurr / capacity * 100.0);
+	}
+}
+
+/**
+ * print_cpu_breakdown
+ * @brief Print the per-core and/or per-thread utilization reports
+ *
+ * Utilization is relative to the capacity of one core, so the values
+ * of the threads of a core add up to the value of the core.
+ */
+void print_cpu_breakdown(void)
+{
+	struct cpu_util *util;
+	int i, j, nr;
+
+	if (!cpu_sampler.old_valid)
+		return;
+
+	nr = o_cores ? cpus_in_system : cpu_sampler.nr;
+	util = calloc(nr, sizeof(*util));
+	if (!util) {
+		fprintf(stderr, "Failed to allocate memory for cpu breakdown\n");
+		return;
+	}
+
+	if (o_cores) {
+		for (j = 0; j < nr; j++)
+			util[j].id = j;
+
+		for (i = 0; i < cpu_sampler.nr; i++) {
+			j = i / threads_per_cpu;
+			if (j >= nr || !cpu_sampler_both(&cpu_sampler, i))
+				continue;
+
+			util[j].purr += cpu_sampler.delta[CS_PURR][i];
+			util[j].idle_purr += cpu_sampler.delta[CS_IDLE_PURR][i];
+			util[j].spurr += cpu_sampler.delta[CS_SPURR][i];
+			util[j].idle_spurr += cpu_sampler.delta[CS_IDLE_SPURR][i];
+		}
+
+		/* only report cores with online threads */
+		for (i = 0, j = 0; i < nr; i++) {
+			if (util[i].purr)
+				util[j++] = util[i];
+		}
+
+		print_cpu_util("core", util, j);
+	}
+
+	if (o_threads) {
+		if (nr < cpu_sampler.nr) {
+			free(util);
+			nr = cpu_sampler.nr;
+			util = calloc(nr, sizeof(*util));
+			if (!util) {
+				fprintf(stderr, "Failed to allocate memory for cpu breakdown\n");
+				return;
+			}
+		}
+
+		for (i = 0, j = 0; i < cpu_sampler.nr; i++) {
+			if (!cpu_sampler_both(&cpu_sampler, i))
+				continue;
+
+			util[j].id = i;
+			util[j].purr = cpu_sampler.delta[CS_PURR][i];
+			util[j].idle_purr = cpu_sampler.delta[CS_IDLE_PURR][i];
+			util[j].spurr = cpu_sampler.delta[CS_SPURR][i];
+			util[j].idle_spurr = cpu_sampler.delta[CS_IDLE_SPURR][i];
+			j++;
+		}
+
+		print_cpu_util("cpu", util, j);
+	}
+
+	free(util);
+}
+
+void print_scaled_output(double interval, int count)
 {
 	char purr[32], purr_idle[32], spurr[32], spurr_idle[32];
 	char nominal_f[32], effective_f[32];
 	double nominal_freq, effective_freq;
 	char *descr;
+	struct sample_timer timer;
 
 	print_system_configuration();
 
 	fprintf(stdout, "---Actual---                 -Normalized-\n");
 	fprintf(stdout, "%%busy  %%idle   Frequency     %%busy  %%idle\n");
 	fprintf(stdout, "------ ------  ------------- ------ ------\n");
+
+	sample_timer_start(&timer, interval);
 	do {
 		if (interval) {
-			sleep(interval);
+			sample_timer_wait(&timer);
 			update_sysdata();
 		}
 
-		get_sysdata("purr_cpu_util", &descr, purr);
-		get_sysdata("purr_cpu_idle", &descr, purr_idle);
-		get_sysdata("spurr_cpu_util", &descr, spurr);
-		get_sysdata("spurr_cpu_idle", &descr, spurr_idle);
-		get_sysdata("nominal_freq", &descr, nominal_f);
-		get_sysdata("effective_freq", &descr, effective_f);
+		get_sysdata(SE_PURR_CPU_UTIL, &descr, purr);
+		get_sysdata(SE_PURR_CPU_IDLE, &descr, purr_idle);
+		get_sysdata(SE_SPURR_CPU_UTIL, &descr, spurr);
+		get_sysdata(SE_SPURR_CPU_IDLE, &descr, spurr_idle);
+		get_sysdata(SE_NOMINAL_FREQ, &descr, nominal_f);
+		get_sysdata(SE_EFFECTIVE_FREQ, &descr, effective_f);
 		nominal_freq = strtod(nominal_f, NULL);
 		effective_freq = strtod(effective_f, NULL);
 
-		fprintf(stdout, "%6s %6s %5.2fGHz[%3d%%] %6s %6s\n",
+		fprintf(stdout, "%6s %6s %5.2fGHz[%3d%%] %6s %6s%s\n",
 			purr, purr_idle,
 			effective_freq/1000,
 			(int)((effective_freq/nominal_freq * 100)+ 0.44 ),
-			spurr, spurr_idle );
+			spurr, spurr_idle, partial_sample ? " *" : "");
+
+		if (o_cores || o_threads)
+			print_cpu_breakdown();
+
 		fflush(stdout);
 	} while (--count > 0);
 }
@@ -1160,21 +1412,32 @@ static void usage(void)
 	       "\t-V, --version	\tDisplay lparstat version information.\n"
 	       "\t-i			Lists details on the LPAR configuration.\n"
 	       "\t-E			Print SPURR metrics.\n"
+	       "\t-c, --cores		Print SPURR metrics for each core, implies -E.\n"
+	       "\t-t, --threads		Print SPURR metrics for each thread, implies -E.\n"
+	       "\t-n, --top <N>		Only print the N busiest cores or threads.\n"
+	       "\t-o, --output <fmt>	Stream one csv or json record per interval.\n"
 	       "\t-l, --legacy		Print the report in legacy format.\n"
-	       "interval		The interval parameter specifies the amount of time between each report.\n"
-	       "count			The count parameter specifies how many reports will be displayed.\n");
+	       "interval		The interval parameter specifies the amount of time between each report,\n"
+	       "			in seconds.  Fractions of a second are allowed.\n"
+	       "count			The count parameter specifies how many reports will be displayed.\n"
+	       "			With -o and an interval, reports are unbounded if count is omitted.\n");
 }
 
 static struct option long_opts[] = {
 	{"version",	no_argument,	NULL,	'V'},
 	{"help",	no_argument,	NULL,	'h'},
 	{"legacy",	no_argument,	NULL,	'l'},
+	{"cores",	no_argument,	NULL,	'c'},
+	{"threads",	no_argument,	NULL,	't'},
+	{"top",		required_argument, NULL, 'n'},
+	{"output",	required_argument, NULL, 'o'},
 	{0, 0, 0, 0},
 };
 
 int main(int argc, char *argv[])
 {
-	int interval = 0, count = 0;
+	double interval = 0;
+	int count = 0;
 	int c, opt_index = 0;
 	int i_option = 0;
 
@@ -1184,7 +1447,7 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
-	while ((c = getopt_long(argc, argv, "iEVhl",
+	while ((c = getopt_long(argc, argv, "iEVhlctn:o:",
 				long_opts, &opt_index)) != -1) {
 		switch(c) {
 			case 'i':
@@ -1196,6 +1459,28 @@ int main(int argc, char *argv[])
 			case 'E':
 				o_scaled = true;
 				break;
+			case 'c':
+				o_cores = true;
+				o_scaled = true;
+				break;
+			case 't':
+				o_threads = true;
+				o_scaled = true;
+				break;
+			case 'n':
+				o_top = atoi(optarg);
+				if (o_top <= 0) {
+					usage();
+					return 1;
+				}
+				break;
+			case 'o':
+				if (record_parse_format(optarg,
+							&o_record.format)) {
+					usage();
+					return 1;
+				}
+				break;
 			case 'V':
 				printf("lparstat - %s\n", VERSION);
 				return 0;
@@ -1211,23 +1496,33 @@ int main(int argc, char *argv[])
 	}
 
 	/* see if there is an interval specified */
-	if (optind < argc)
-		interval = atoi(argv[optind++]);
+	if (optind < argc && parse_interval(argv[optind++], &interval)) {
+		fprintf(stderr, "Invalid interval specified\n");
+		return 1;
+	}
 
 	/* check for count specified */
 	if (optind < argc)
 		count = atoi(argv[optind++]);
+	else if (interval && o_record.format != RECORD_NONE)
+		count = -1;
 
 	init_sysinfo();
 	init_sysdata();
 
 	if (i_option)
 		print_iflag_data();
-	else if (o_scaled) {
+	else if (o_record.format != RECORD_NONE) {
+		print_records(interval, count);
+		if (o_scaled)
+			close_cpu_sysfs_fds();
+	} else if (o_scaled) {
 		print_scaled_output(interval, count);
-		close_cpu_sysfs_fds(threads_in_system);
+		close_cpu_sysfs_fds();
 	} else {
 		print_default_output(interval, count);
 	}
+
+	close_proc_files();
 	return 0;
 }
@@ -19,6 +19,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <dirent.h>
@@ -29,33 +31,149 @@
 #include <endian.h>
 #endif
 
+/* stdout buffer when it is not a terminal, a tree is written in few calls */
+#define OUTBUF_SIZE	(1024 * 1024)
+
 int recurse;
+int json;
 int maxbytes = 128;
 int words_per_line = 0;
 unsigned char *buf;
+size_t bufsize;
 
-void lsprop(FILE *f, char *name);
-void lsdir(char *name);
+void lsprop(int fd, char *name);
+void lsdir(int dfd, char *name);
 
 static struct option long_opts[] = {
 	{"version",     no_argument,    NULL, 'V'},
 	{"recurse",	no_argument,	NULL, 'R'},
+	{"json",	no_argument,	NULL, 'j'},
 	{0, 0, 0, 0},
 };
 
+/*
+ * Read a property into buf, growing it if more than maxbytes are
+ * wanted.  Returns the number of bytes read or -1.
+ */
+static int read_prop(int fd, size_t want)
+{
+    unsigned char *nbuf;
+    size_t n = 0;
+    ssize_t rc;
+
+    for (;;) {
+	if (n == want)
+	    break;
+	if (n == bufsize) {
+	    nbuf = realloc(buf, bufsize * 2);
+	    if (nbuf == NULL)
+		return -1;
+	    buf = nbuf;
+	    bufsize *= 2;
+	}
+	rc = read(fd, buf + n, (want < bufsize ? want : bufsize) - n);
+	if (rc < 0 && errno == EINTR)
+	    continue;
+	if (rc < 0)
+	    return n ? (int)n : -1;
+	if (rc == 0)
+	    break;
+	n += rc;
+    }
+    return n;
+}
+
+/*
+ * Total size of the property, n bytes of which have been read.  The
+ * rest is read too, sysfs does not report the real size of a file.
+ */
+static int prop_size(int fd, int n)
+{
+    ssize_t rc;
+
+    while ((rc = read(fd, buf, bufsize)) > 0 || (rc < 0 && errno == EINTR))
+	if (rc > 0)
+	    n += rc;
+    return n;
+}
+
+static void json_string(const unsigned char *s, int len)
+{
+    int i;
+
+    putchar('"');
+    for (i = 0; i < len; ++i) {
+	if (s[i] == '"' || s[i] == '\\')
+	    printf("\\%c", s[i]);
+	else if (s[i] < 0x20 || s[i] >= 0x7f)
+	    printf("\\u%04x", s[i]);
+	else
+	    putchar(s[i]);
+    }
+    putchar('"');
+}
+
+/*
+ * A property that is a list of NUL terminated strings becomes a JSON
+ * string, or an array of them, anything else a string of hex bytes.
+ */
+static void json_prop(int fd, char *name)
+{
+    int n, i, start;
+
+    n = read_prop(fd, (size_t)-1);
+    json_string((unsigned char *)name, strlen(name));
+    putchar(':');
+    if (n < 0) {
+	printf("null");
+	return;
+    }
+
+    for (i = 0; i < n; ++i)
+	if (buf[i] >= 0x7f ||
+	    (buf[i] < 0x20 && buf[i] != '\r' && buf[i] != '\n'
+	     && buf[i] != '\t' && buf[i] != 0))
+	    break;
+    if (i == n && n != 0 && (n == 1 || buf[0] != 0) && buf[n-1] == 0) {
+	if (memchr(buf, 0, n - 1) == NULL) {
+	    json_string(buf, n - 1);
+	    return;
+	}
+	putchar('[');
+	for (start = 0, i = 0; i < n; ++i) {
+	    if (buf[i] != 0)
+		continue;
+	    if (start)
+		putchar(',');
+	    json_string(buf + start, i - start);
+	    start = i + 1;
+	}
+	putchar(']');
+    } else {
+	putchar('"');
+	for (i = 0; i < n; ++i)
+	    printf("%.2x", buf[i]);
+	putchar('"');
+    }
+}
+
 int main(int ac, char **av)
 {
-    FILE *f;
+    int fd;
+    int np = 0;
     int i, opt_index = 0;
     struct stat sb;
     char *endp;
 
-    while ((i = getopt_long(ac, av, "Rm:w:V",
+    while ((i = getopt_long(ac, av, "Rm:w:Vj",
 			    long_opts, &opt_index)) != EOF) {
 	switch (i) {
 	case 'R':
 	    recurse = 1;
 	    break;
+	case 'j':
+	    json = 1;
+	    break;
 	case 'm':
 	    maxbytes = strtol(optarg, &endp, 0);
 	    if (endp == optarg) {
@@ -79,47 +197,90 @@ int main(int ac, char **av)
 	}
     }
 
-    buf = malloc(maxbytes);
+    bufsize = maxbytes > 4096 ? maxbytes : 4096;
+    buf = malloc(bufsize);
     if (buf == 0) {
 	fprintf(stderr, "%s: virtual memory exhausted\n", av[0]);
 	exit(1);
     }
 
-    if (optind == ac)
-	lsdir(".");
-    else
+    if (!isatty(STDOUT_FILENO))
+	setvbuf(stdout, NULL, _IOFBF, OUTBUF_SIZE);
+
+    if (optind == ac) {
+	/* the directory is the whole of the output, no key for it */
+	fd = open(".", O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+	    perror(".");
+	    if (json)
+		printf("null");
+	} else
+	    lsdir(fd, ".");
+	if (json)
+	    putchar('\n');
+    } else {
+	if (json)
+	    putchar('{');
 	for (i = optind; i < ac; ++i) {
 	    if (stat(av[i], &sb) < 0) {
 		perror(av[i]);
 		continue;
 	    }
+	    if (!S_ISREG(sb.st_mode) && !S_ISDIR(sb.st_mode))
+		continue;
+	    fd = open(av[i], O_RDONLY);
+	    if (fd < 0) {
+		perror(av[i]);
+		continue;
+	    }
+	    if (json && np)
+		putchar(',');
 	    if (S_ISREG(sb.st_mode)) {
-		f = fopen(av[i], "r");
-		if (f == NULL) {
-		    perror(av[i]);
-		    continue;
+		if (json)
+		    json_prop(fd, av[i]);
+		else
+		    lsprop(fd, av[i]);
+		close(fd);
+	    } else {
+		if (json) {
+		    json_string((unsigned char *)av[i], strlen(av[i]));
+		    putchar(':');
 		}
-		lsprop(f, av[i]);
-		fclose(f);
-	    } else if (S_ISDIR(sb.st_mode)) {
-		lsdir(av[i]);
+		lsdir(fd, av[i]);
 	    }
+	    ++np;
 	}
+	if (json)
+	    printf("}\n");
+    }
+
     exit(0);
 }
 
-void lsdir(char *name)
+/*
+ * List the properties of the directory open on dfd, then its
+ * subdirectories if recursing.  The directory is read once, d_type
+ * says what each entry is unless the filesystem does not fill it in,
+ * and everything is opened relative to dfd.  dfd is closed.
+ */
+void lsdir(int dfd, char *name)
 {
     DIR *d;
     struct dirent *de;
     char *p, *q;
     struct stat sb;
-    FILE *f;
+    char **subdirs = NULL, **nsubdirs;
+    int nsubdirs_alloc = 0, nsub = 0;
+    int is_reg, is_dir;
+    int fd, i;
     int np = 0;
 
-    d = opendir(name);
+    d = fdopendir(dfd);
     if (d == NULL) {
 	perror(name);
+	close(dfd);
+	if (json)
+	    printf("null");
 	return;
     }
 
@@ -127,6 +288,8 @@ void lsdir(char *name)
     if (p == 0) {
 	fprintf(stderr, "%s: virtual memory exhausted\n", name);
 	closedir(d);
+	if (json)
+	    printf("null");
 	return;
     }
     strcpy(p, name);
@@ -138,58 +301,101 @@ void lsdir(char *name)
     else
 	*q++ = '/';
 
+    if (json)
+	putchar('{');
+
     while ((de = readdir(d)) != NULL) {
 	if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
 	    continue;
 	strcpy(q, de->d_name);
-	if (stat(p, &sb) < 0) {
-	    perror(p);
-	    continue;
+
+	/* properties are followed through links, directories are not */
+	is_reg = de->d_type == DT_REG;
+	is_dir = de->d_type == DT_DIR;
+	if (de->d_type == DT_UNKNOWN || de->d_type == DT_LNK) {
+	    if (fstatat(dfd, de->d_name, &sb, 0) < 0) {
+		perror(p);
+		continue;
+	    }
+	    is_reg = S_ISREG(sb.st_mode);
+	    if (de->d_type == DT_UNKNOWN) {
+		if (fstatat(dfd, de->d_name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+		    perror(p);
+		    continue;
+		}
+		is_dir = S_ISDIR(sb.st_mode);
+	    }
 	}
-	if (S_ISREG(sb.st_mode)) {
-	    f = fopen(p, "r");
-	    if (f == NULL) {
+
+	if (is_reg) {
+	    fd = openat(dfd, de->d_name, O_RDONLY);
+	    if (fd < 0) {
 		perror(p);
 	    } else {
-		lsprop(f, de->d_name);
-		fclose(f);
+		if (json) {
+		    if (np)
+			putchar(',');
+		    json_prop(fd, de->d_name);
+		} else {
+		    lsprop(fd, de->d_name);
+		}
+		close(fd);
 		++np;
 	    }
+	} else if (is_dir && recurse) {
+	    if (nsub == nsubdirs_alloc) {
+		nsubdirs_alloc = nsubdirs_alloc ? nsubdirs_alloc * 2 : 16;
+		nsubdirs = realloc(subdirs, nsubdirs_alloc * sizeof(*subdirs));
+		if (nsubdirs == NULL) {
+		    fprintf(stderr, "%s: virtual memory exhausted\n", p);
+		    break;
+		}
+		subdirs = nsubdirs;
+	    }
+	    subdirs[nsub] = strdup(de->d_name);
+	    if (subdirs[nsub] != NULL)
+		nsub++;
 	}
     }
 
-    if (recurse) {
-	rewinddir(d);
-	while ((de = readdir(d)) != NULL) {
-	    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
-		continue;
-	    strcpy(q, de->d_name);
-	    if (lstat(p, &sb) < 0) {
-		perror(p);
-		continue;
-	    }
-	    if (S_ISDIR(sb.st_mode)) {
+    for (i = 0; i < nsub; ++i) {
+	strcpy(q, subdirs[i]);
+	fd = openat(dfd, subdirs[i], O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+	    perror(p);
+	} else {
+	    if (json) {
+		if (np)
+		    putchar(',');
+		json_string((unsigned char *)subdirs[i], strlen(subdirs[i]));
+		putchar(':');
+	    } else {
 		if (np)
 		    printf("\n");
 		printf("%s:\n", p);
-		lsdir(p);
-		++np;
 	    }
+	    lsdir(fd, p);
+	    ++np;
 	}
+	free(subdirs[i]);
     }
+
+    if (json)
+	putchar('}');
+
+    free(subdirs);
     free(p);
     closedir(d);
 }
 
-void lsprop(FILE *f, char *name)
+void lsprop(int fd, char *name)
 {
     int n, nw, npl, i, j;
 
-    n = fread(buf, 1, maxbytes, f);
-    if (n < 0) {
-	printf("%s: read error\n", name);
-	return;
-    }
+    /* unreadable properties are listed empty, as when read with stdio */
+    n = read_prop(fd, maxbytes);
+    if (n < 0)
+	n = 0;
     printf("%-16s", name);
     if (strlen(name) > 16)
 	printf("\n\t\t");
@@ -249,8 +455,7 @@ void lsprop(FILE *f, char *name)
     }
     printf("\n");
     if (n == maxbytes) {
-	while ((i = fread(buf, 1, maxbytes, f)) > 0)
-	    n += i;
+	n = prop_size(fd, n);
 	if (n > maxbytes)
 	    printf("\t\t [%d bytes total]\n", n);
     }
@@ -81,6 +81,7 @@ static struct option long_options[] = {
     {"print-all-vpd", 		optional_argument, NULL, 'W'},
     {"print-err-log", 		no_argument, 	   NULL, 'e'},
     {"print-event-scan", 	no_argument, 	   NULL, 'E'},
+    {"dump-logs", 		no_argument, 	   NULL, 'L'},
     {"partitions", 		no_argument, 	   NULL, 'P'},
     {"dump", 			required_argument, NULL, 'd'},
     {"ascii",			required_argument, NULL, 'a'},
@@ -103,12 +104,14 @@ help(void)
     printf("nvram options:\n"
     "  --print-config[=var]\n"
     "          print value of a config variable, or print all variables in\n"
-    "          the specified (or all) partitions\n"
+    "          the specified (or all) partitions; may be given several\n"
+    "          times to print name=value for each of the variables\n"
     "  --zero | -0\n"
     "          terminate config pairs with a NUL character\n"
     "  --update-config <var>=<value>\n"
     "          update the config variable in the specified partition; the -p\n"
-    "          option must also be specified\n"
+    "          option must also be specified; may be given several times to\n"
+    "          update all of the variables at once, or none if one fails\n"
     "  -p <partition>\n"
     "          specify a partition; required with --update-config option,\n"
     "          optional with --print-config option\n"
@@ -120,6 +123,8 @@ help(void)
     "          print checkstop error log\n"
     "  --print-event-scan\n"
     "          print event scan log\n"
+    "  --dump-logs\n"
+    "          print every error, event scan and oops log partition\n"
     "  --partitions\n"
     "          print NVRAM paritition header info\n"
     "  --dump <name>\n"
@@ -214,84 +219,6 @@ warn_msg(const char *fmt, ...)
     va_end(ap);
 }
 
-/**
- * nvram_read
- * @brief read in the contents of nvram
- *
- * @param nvram nvram struct to read data into
- * @return 0 on success, !0 on failure
- */
-int 
-nvram_read(struct nvram *nvram)
-{
-    int len, remaining, chunk;
-    char *p;
-
-    /* read in small chunks */
-    p = nvram->data;
-    remaining = nvram->nbytes;
-    chunk = (NVRAM_READ_SIZE < remaining) ? NVRAM_READ_SIZE : remaining;
-
-    while ((len = read(nvram->fd, p, chunk)) > 0) {
-        p+=len;
-        remaining -= len;
-        chunk = (NVRAM_READ_SIZE < remaining) ? NVRAM_READ_SIZE : remaining;
-    }
-
-    if (len == -1) {
-        err_msg("cannot read \"%s\": %s\n", nvram->filename, strerror(errno));
-        return -1;
-    }
-   
-    /* If we are using the DEFAULT_NVRAM_SZ value we to do a small bit of
-     * fixup here.  All of the remaining code assumes that nbytes contains
-     * the actual size of nvram, not a guess-timated amount and bad things
-     * ensue if it is not correct.
-     */
-    if (nvram->nbytes == DEFAULT_NVRAM_SZ) {
-	    nvram->nbytes = nvram->nbytes - remaining;
-	    remaining = DEFAULT_NVRAM_SZ - (remaining + nvram->nbytes);
-    }
-
-    if (remaining) {
-	warn_msg("expected %d bytes, but only read %d!\n", 
-	    	 nvram->nbytes, nvram->nbytes - remaining);
-	/* preserve the given nbytes, but zero the rest in case someone cares */
-	memset(p, 0, remaining);
-    }
-
-    if (verbose)
-	printf("NVRAM size %d bytes\n", nvram->nbytes);
-
-    return 0;
-}
-
-/**
- * checksum
- * @brief calculate the checksum for a partition header
- *
- * @param p pointer to partition header
- * @return calculated checksum
- */
-static unsigned char 
-checksum(struct partition_header *p)
-{
-    unsigned int c_sum, c_sum2;
-    unsigned short *sp = (unsigned short *)p->name; /* assume 6 shorts */
-
-    c_sum = p->signature + p->length + sp[0] + sp[1] + sp[2] + sp[3] 
-	    		 + sp[4] + sp[5];
-
-    /* The sum probably may have spilled into the 3rd byte.  Fold it back. */
-    c_sum = ((c_sum & 0xffff) + (c_sum >> 16)) & 0xffff;
-
-    /* The sum cannot exceed 2 bytes.  Fold it into a checksum */
-    c_sum2 = (c_sum >> 8) + (c_sum << 8);
-    c_sum = ((c_sum + c_sum2) >> 8) & 0xff;
-    
-    return c_sum;
-}
-
 /**
  * dump_raw_data
  * @brief raw data dump of a partition.
@@ -428,173 +355,6 @@ parse_of_common(char *data, int data_len, char *outname, char *outval)
     return p - data;
 }
 
-/**
- * nvram_parse_partitions
- * @brief fill in the nvram structure with data from nvram 
- *
- * Fill in the partition parts of the struct nvram.
- * This makes handling partitions easier for the rest of the code.
- *
- * The spec says that partitions are made up of 16 byte blocks and
- * the partition header must be 16 bytes.  We verify that here.
- *
- * @param nvram pointer to nvram struct to fill out
- * @return 0 on success, !0 otherwise
- */
-static int
-nvram_parse_partitions(struct nvram *nvram)
-{
-    char *nvram_end = nvram->data + nvram->nbytes;
-    char *p_start = nvram->data; 
-    struct partition_header *phead;
-    unsigned char c_sum;
-
-    if (sizeof(struct partition_header) != 16) {
-	err_msg("partition_header struct is not 16 bytes\n");
-	return -1;
-    }
-
-    while (p_start < nvram_end) {
-	phead = (struct partition_header *)p_start;
-	nvram->parts[nvram->nparts++] = phead;
-	c_sum = checksum(phead);
-	if (c_sum != phead->checksum)
-	    warn_msg("this partition checksum should be %02x!\n", c_sum);
-	phead->length = be16toh(phead->length);
-	p_start += phead->length * NVRAM_BLOCK_SIZE;
-    }
-
-    if (verbose)
-	printf("NVRAM contains %d partitions\n", nvram->nparts);
-
-    return 0;
-}
-
-bool part_name_valid(const char *name)
-{
-    if (strlen(name) > MAX_PART_NAME) {
-        err_msg("partition name maximum length is %d\n", MAX_PART_NAME);
-        return false;
-    }
-
-    return true;
-}
-
-/**
- * nvram_find_fd_partition
- * @brief Find a particular nvram partition using a file descriptor
- *
- * @param name name of the partition to find
- * @param nvram pointer to nvram struct to search
- * @return 0 on success, !0 otherwise
- */
-static int
-nvram_find_fd_partition(struct nvram *nvram, char *name)
-{
-    struct partition_header	phead;
-    int				len;
-    int				found = 0;
-
-    if (!part_name_valid(name))
-	    return -1;
-
-    if (lseek(nvram->fd, SEEK_SET, 0) == -1) {
-        err_msg("could not seek to beginning of file %s\n", nvram->filename);
-	return -1;
-    }
-    
-    while (! found) {
-        len = read(nvram->fd, &phead, sizeof(phead));
-	if (len == 0) { /* EOF */
-	    err_msg("could not find %s partition in %s\n", 
-	    	    name, nvram->filename);
-	    return -1;
-	} 
-        else if (len != sizeof(phead)) {
-	    err_msg("Invalid read from %s: %s\n", nvram->filename,
-	    	    strerror(errno));
-	    return -1;
-	}
-
-	if (! strncmp(phead.name, name, sizeof(phead.name)))
-	    found = 1;
-	else {
-	    int offset =
-		    be16toh(phead.length) * NVRAM_BLOCK_SIZE - len;
-	    if (lseek(nvram->fd, offset, SEEK_CUR) == -1) {
-	        err_msg("seek error in file %s: %s\n", nvram->filename,
-			strerror(errno));
-		return -1;
-	    }
-	}
-    }
-
-    if (! found) {
-        err_msg("could not find %s partition in %s\n", name, nvram->filename);
-	return -1;
-    }
-
-    /* we found the correct partition seek back to the beginning of it */
-    if (lseek(nvram->fd, -len, SEEK_CUR) == -1) {
-        err_msg("could not seek to %s partition\n", name);
-	return -1;
-    }
-
-    return 0;
-}
-	
-/**
- * nvram_find_partition
- * @brief Find a partition given a signature and name.
- * 
- * If signature is zero (invalid) it is not used for matching.
- * If name is NULL it is ignored.
- * start is the partition in which to resume a search (NULL starts at the first
- * partition).
- *
- * @param signature partition signature to find
- * @param name partition name to find
- * @param start partition header to start search at
- * @param nvram nvram struct to search
- * @return pointer to partition header on success, NULL otherwise 
- */
-static struct partition_header *
-nvram_find_partition(struct nvram *nvram, unsigned char signature, char *name, 
-		     struct partition_header *start)
-{
-    struct partition_header *phead;
-    int i;
-
-    /* Get starting partition.  This is not terribly efficient... */
-    if (start == NULL) {
-	i = 0;
-	if (verbose > 1)
-	    printf("find partition starts with zero\n");
-    } 
-    else {
-	for (i = 0; i < nvram->nparts; i++)
-	    if (nvram->parts[i] == start)
-		break;
-	i++;	/* start at next partition */
-	if (verbose > 1)
-	    printf("find partition starts with %d\n", i);
-    }
-
-    /* Search starting with partition i... */
-    while (i < nvram->nparts) {
-	phead = nvram->parts[i];
-	if (signature == '\0' || signature == phead->signature) {
-	    if (name == NULL 
-		|| strncmp(name, phead->name, sizeof(phead->name)) == 0) {
-		return phead;
-	    }
-	}
-	i++;
-    }
-	
-    return NULL;
-}
-
 /**
  * print_partition_table
  * @brief print a table of available partitions
@@ -882,6 +642,55 @@ dump_errlog(struct nvram *nvram)
     return 0;
 }
 
+/**
+ * @var rtasevent
+ * @brief librtasevent entry points, looked up once by load_rtasevent()
+ */
+static struct {
+    int		loaded;		/**< 1 if found, -1 if not, 0 if not tried */
+    void	*handle;
+    void	*(*parse_rtas_event)();
+    void	(*rtas_print_event)();
+    void	(*cleanup_rtas_event)();
+} rtasevent;
+
+/**
+ * load_rtasevent
+ * @brief dlopen librtasevent and look up the event printing routines
+ *
+ * The library is opened on first use and kept open until exit, the
+ * result is cached whether or not it could be found.
+ *
+ * @return 0 if librtasevent is available, !0 otherwise
+ */
+static int
+load_rtasevent(void)
+{
+    if (rtasevent.loaded)
+	return rtasevent.loaded < 0;
+
+    rtasevent.loaded = -1;
+
+    rtasevent.handle = dlopen("/usr/lib/librtasevent.so", RTLD_LAZY);
+    if (rtasevent.handle == NULL)
+        return 1;
+
+    rtasevent.parse_rtas_event = dlsym(rtasevent.handle, "parse_rtas_event");
+    rtasevent.rtas_print_event = dlsym(rtasevent.handle, "rtas_print_event");
+    rtasevent.cleanup_rtas_event = dlsym(rtasevent.handle,
+					 "cleanup_rtas_event");
+    if (rtasevent.parse_rtas_event == NULL ||
+	rtasevent.rtas_print_event == NULL ||
+	rtasevent.cleanup_rtas_event == NULL) {
+        dlclose(rtasevent.handle);
+	rtasevent.handle = NULL;
+        return 1;
+    }
+
+    rtasevent.loaded = 1;
+    return 0;
+}
+
 /**
  * dump_rtas_event_entry
  * @brief Dump event-scan data.
@@ -898,44 +707,18 @@ int
 dump_rtas_event_entry(char *data, int len)
 {
     void *rtas_event;
-    void *handle;
-    void *(*parse_rtas_event)();
-    void (*rtas_print_event)();
-    void (*cleanup_rtas_event)();
-
-    handle = dlopen("/usr/lib/librtasevent.so", RTLD_LAZY);
-    if (handle == NULL)
-        return 1;
-
-    parse_rtas_event = dlsym(handle, "parse_rtas_event");
-    if (parse_rtas_event == NULL) {
-        dlclose(handle);
-        return 1;
-    }
-
-    rtas_print_event = dlsym(handle, "rtas_print_event");
-    if (rtas_print_event == NULL) {
-        dlclose(handle);
-        return 1;
-    }
 
-    cleanup_rtas_event = dlsym(handle, "cleanup_rtas_event");
-    if (cleanup_rtas_event == NULL) {
-        dlclose(handle);
+    if (load_rtasevent() != 0)
         return 1;
-    }
 
-    rtas_event = parse_rtas_event(data, len);
-    if (rtas_event == NULL) {
-        dlclose(handle);
+    rtas_event = rtasevent.parse_rtas_event(data, len);
+    if (rtas_event == NULL)
         return 1;
-    }
 
-    rtas_print_event(stdout, rtas_event, 0);
+    rtasevent.rtas_print_event(stdout, rtas_event, 0);
 
-    cleanup_rtas_event(rtas_event);
+    rtasevent.cleanup_rtas_event(rtas_event);
 
-    dlclose(handle);
     return 0;
 }
 
@@ -1077,12 +860,26 @@ dump_ascii_partition(struct nvram *nvram, char *name)
     return 0;
 }
 
-int
+/**
+ * dump_zipped_text
+ * @brief Decompress zlib data to stdout through a bounded buffer
+ *
+ * The inflate stream is fed the compressed data in place and drained
+ * UNZIP_BUF_SZ bytes at a time, so only that much is ever held
+ * decompressed.  What could be decompressed of a truncated stream is
+ * printed with a warning.
+ *
+ * @param zipped_text compressed data
+ * @param zipped_length length of zipped_text
+ * @return 0 on success, !0 otherwise
+ */
+static int
 dump_zipped_text(char *zipped_text, unsigned int zipped_length)
 {
     z_stream strm;
     int result;
-    char unzipped_text[4096];
+    size_t have;
+    char unzipped_text[UNZIP_BUF_SZ];
 
     strm.zalloc = Z_NULL;
     strm.zfree = Z_NULL;
@@ -1096,7 +893,7 @@ dump_zipped_text(char *zipped_text, unsigned int zipped_length)
     }
 
     do {
-	strm.avail_out = 4096;
+	strm.avail_out = sizeof(unzipped_text);
 	strm.next_out = (Bytef*) unzipped_text;
     	result = inflate(&strm, Z_NO_FLUSH);
 	switch (result) {
@@ -1108,38 +905,34 @@ dump_zipped_text(char *zipped_text, unsigned int zipped_length)
 	    (void) inflateEnd(&strm);
 	    return -1;
 	}
-	if (fwrite(unzipped_text, 4096 - strm.avail_out, 1, stdout) != 1) {
+	have = sizeof(unzipped_text) - strm.avail_out;
+	if (have && fwrite(unzipped_text, have, 1, stdout) != 1) {
 	    err_msg("can't decompress text: fwrite() failed\n");
 	    (void) inflateEnd(&strm);
 	    return -1;
 	}
-    } while (strm.avail_out == 0);
+    } while (result == Z_OK);
+
+    if (result == Z_BUF_ERROR)
+	warn_msg("compressed text is truncated\n");
 
     (void) inflateEnd(&strm);
     return 0;
 }
 
 /**
- * unzip_partition
- * @brief Uncompress and print compressed data from a partition.
+ * unzip_part
+ * @brief Uncompress and print the compressed data of a partition.
  *
- * @param nvram nvram struct containing partition
- * @param name name of partition to dump
+ * @param phead partition to dump
  * @return 0 on success, !0 otherwise
  */
-int
-unzip_partition(struct nvram *nvram, char *name)
+static int
+unzip_part(struct partition_header *phead)
 {
-    struct partition_header *phead;
     char *start, *next;
     unsigned short zipped_length;
 
-    phead = nvram_find_partition(nvram, 0, name, NULL);
-    if (!phead) {
-	err_msg("there is no %s partition!\n", name);
-	return -1;
-    }
-    
     start = (char*) phead;
     next = start + sizeof(*phead);	/* Skip partition header. */
     next += sizeof(struct err_log_info);	/* Skip sub-header. */
@@ -1156,14 +949,131 @@ unzip_partition(struct nvram *nvram, char *name)
    }
 
     if ((next-start) + zipped_length > phead->length * NVRAM_BLOCK_SIZE) {
-    	err_msg("bogus size for compressed data in partition %s: %u\n", name,
-	    zipped_length);
+    	err_msg("bogus size for compressed data in partition %.12s: %u\n",
+		phead->name, zipped_length);
 	return -1;
     }
 
     return dump_zipped_text(next, zipped_length);
 }
 
+/**
+ * unzip_partition
+ * @brief Uncompress and print compressed data from a partition.
+ *
+ * @param nvram nvram struct containing partition
+ * @param name name of partition to dump
+ * @return 0 on success, !0 otherwise
+ */
+int
+unzip_partition(struct nvram *nvram, char *name)
+{
+    struct partition_header *phead;
+
+    phead = nvram_find_partition(nvram, 0, name, NULL);
+    if (!phead) {
+	err_msg("there is no %s partition!\n", name);
+	return -1;
+    }
+
+    return unzip_part(phead);
+}
+
+/**
+ * dump_log_partitions
+ * @brief Dump every log partition of NVRAM in one pass
+ *
+ * The checkstop and event scan logs are printed as with --print-err-log
+ * and --print-event-scan.  Linux oops logs are decompressed if the
+ * kernel compressed them, RTAS error logs are decoded with librtasevent
+ * when it is available.  Anything else is dumped raw.
+ *
+ * @param nvram nvram struct containing the partitions
+ * @return 0 on success, !0 if a partition could not be dumped
+ */
+static int
+dump_log_partitions(struct nvram *nvram)
+{
+    struct partition_header *phead;
+    struct err_log_info *info;
+    struct oops_log_info *oops;
+    char *data, *c;
+    int i, len, type, text_len, nlogs = 0, ret = 0;
+
+    for (i = 0; i < nvram->nparts; i++) {
+	phead = nvram->parts[i];
+	data = (char *)(phead + 1);
+	len = (phead->length - 1) * NVRAM_BLOCK_SIZE;
+
+	if (phead->signature == NVRAM_SIG_SP &&
+	    !strncmp(phead->name, "ibm,err-log", MAX_PART_NAME)) {
+	    printf("==== %.12s ====\n", phead->name);
+	    if (dump_errlog(nvram) != 0)
+		ret = -1;
+	} else if (phead->signature == NVRAM_SIG_SP &&
+		   !strncmp(phead->name, "ibm,es-logs", MAX_PART_NAME)) {
+	    printf("==== %.12s ====\n", phead->name);
+	    if (dump_eventscanlog(nvram) != 0)
+		ret = -1;
+	} else if (!strncmp(phead->name, "lnx,oops-log", MAX_PART_NAME) ||
+		   !strncmp(phead->name, "ibm,rtas-log", MAX_PART_NAME)) {
+	    if (len < (int)sizeof(*info))
+		continue;
+
+	    info = (struct err_log_info *)data;
+	    type = be32toh(info->error_type);
+	    data += sizeof(*info);
+	    len -= sizeof(*info);
+
+	    printf("==== %.12s ====\n", phead->name);
+	    if (type == ERR_TYPE_KERNEL_PANIC_GZ) {
+		if (unzip_part(phead) != 0)
+		    ret = -1;
+		putchar('\n');
+	    } else if (type == ERR_TYPE_KERNEL_PANIC) {
+		text_len = 0;
+		if (len >= (int)sizeof(unsigned short)) {
+		    text_len = be16toh(*((unsigned short *)data));
+		    data += sizeof(unsigned short);
+		    len -= sizeof(unsigned short);
+		}
+
+		/* New format oops header, as in unzip_part() */
+		if (text_len > OOPS_PARTITION_SZ) {
+		    oops = (struct oops_log_info *)(data -
+						    sizeof(unsigned short));
+		    if (len < (int)(sizeof(*oops) - sizeof(unsigned short))) {
+			text_len = 0;
+		    } else {
+			text_len = be16toh(oops->report_length);
+			data += sizeof(*oops) - sizeof(unsigned short);
+			len -= sizeof(*oops) - sizeof(unsigned short);
+		    }
+		}
+
+		if (text_len > len)
+		    text_len = len;
+
+		for (c = data; c < data + text_len; c++)
+		    putchar(isprint(*c) || isspace(*c) ? *c : '.');
+		putchar('\n');
+	    } else if (type != ERR_TYPE_RTAS_LOG ||
+		       dump_rtas_event_entry(data, len) != 0) {
+		dump_raw_data(data, len);
+	    }
+	} else {
+	    continue;
+	}
+
+	nlogs++;
+    }
+
+    if (!nlogs)
+	printf("There are no log partitions.\n");
+
+    return ret;
+}
+
 /**
  * print_of_config_part
  * @brief Print the name/value pairs of a partition
@@ -1185,8 +1095,9 @@ print_of_config_part(struct nvram *nvram, char *pname)
 
     data = (char *)phead + sizeof(*phead);
 
-    printf("\"%s\" Partition\n", pname);
-    for (i = 0; i <= (strlen(pname) + 14); i++)
+    /* names of 12 characters are not NUL terminated */
+    printf("\"%.*s\" Partition\n", MAX_PART_NAME, pname);
+    for (i = 0; i <= (strnlen(pname, MAX_PART_NAME) + 14); i++)
 	printf("-");
     printf("\n");
 
@@ -1204,33 +1115,38 @@ print_of_config_part(struct nvram *nvram, char *pname)
  * print_of_config
  * @brief Print the contents of an Open Firmware config partition
  *
- * This will print the name/value pair for a specified Open
- * Firmware config variable or print all of the name/value pairs
- * in the partition if the name is NULL.
+ * This will print the value of each of the specified Open Firmware
+ * config variables or print all of the name/value pairs in the
+ * partition if no name is given.  A single variable is printed as its
+ * value alone, several as name=value pairs in the order they were
+ * given.
  *
- * @param config_var config variable to print
- * @param pname partition name containing config_var
  * @param nvram nvram struct containing pname
+ * @param config_vars config variables to print
+ * @param nvars number of config variables, 0 to print all of them
+ * @param pname partition name containing config_vars
+ * @param zero_terminator terminate values with NUL instead of newline
  * @return 0 on success, !0 otherwise
  */
 static int 
-print_of_config(struct nvram *nvram, char *config_var, char *pname,
-	int zero_terminator)
+print_of_config(struct nvram *nvram, char **config_vars, int nvars,
+	char *pname, int zero_terminator)
 {
     struct partition_header *phead;
-    char *data, terminator;
-    int  i, varlen;
+    struct nvram_config_entry *entries;
+    char terminator;
+    int  i, j, n, v, found;
     int  rc = -1;
 
     terminator = '\n';
     if (zero_terminator)
 	terminator = '\0';
 
-    /* if config_var is NULL , print the data from the
+    /* if there are no config_vars, print the data from the
      * partition specified by pname or all of the
      * name/value pair partitions if pname is NULL. 
      */
-    if (config_var == NULL) {
+    if (nvars == 0) {
 	if (pname == NULL) {
 	    for (i = 0; i < nvram->nparts; i++) {
 		phead = nvram->parts[i];
@@ -1240,7 +1156,7 @@ print_of_config(struct nvram *nvram, char *config_var, char *pname,
         else {
 	    for (i = 0; i < nvram->nparts; i++) {
 		phead = nvram->parts[i];
-		if (strcmp(pname, phead->name) == 0) {
+		if (strncmp(pname, phead->name, sizeof(phead->name)) == 0) {
 		    (void)print_of_config_part(nvram, phead->name);
 		    rc = 0;
 		}
@@ -1250,209 +1166,65 @@ print_of_config(struct nvram *nvram, char *config_var, char *pname,
 	}
 	return rc;
     } 
-    
-    /* the config_var is a variable name */
-    varlen = strlen(config_var);
-    if (pname == NULL) {
-	for (i = 0; i < nvram->nparts; i++) {
-	    phead = nvram->parts[i];
-	    if (phead == NULL)
-		continue;
-
-	    data = (char *)phead + sizeof(*phead);
 
-	    while (*data != '\0') {
-	    	if ((data[varlen] == '=') && 
-		    strncmp(config_var, data, varlen) == 0) {
-    	            printf("%s%c", data + varlen + 1, terminator);
-		    rc = 0;
-		}
-	    	data += strlen(data) + 1;
-            }
-        }
-    } 
-    else {
+    phead = NULL;
+    if (pname != NULL) {
 	phead = nvram_find_partition(nvram, 0, pname, NULL);
 	if (phead == NULL) {
 	    err_msg("There is no \"%s\" partition.\n", pname);
 	    return -1;
 	}
-
-	data = (char *)phead + sizeof(*phead);
-	while (*data != '\0') {
-	    if ((data[varlen] == '=') && 
-		strncmp(config_var, data, varlen) == 0) {
-		printf("%s%c", data + varlen + 1, terminator);
-		rc = 0;
-	    }
-	    data += strlen(data) + 1;
-	}
-    }
-
-    return rc;
-}
-
-/**
- * update_config_var
- * @brief Update an Open Firmware config variable in nvram
- *
- * This will attempt to update the value half of a name/value
- * pair in the nvram config partition.  If the name/value pair
- * is not found in the partition then the specified name/value pair
- * is added to the end of the data in the partition.
- *
- * @param config_var OF config variable to update
- * @param pname partition containing config_var
- * @param nvram nvram struct containing pname
- * @return 0 on success, !0 otherwise
- */
-int
-update_of_config_var(struct nvram *nvram, char *config_var, char *pname)
-{
-    struct partition_header *phead, *new_phead;
-    char *new_config_value;
-    char *data_offset;
-    char *new_part;
-    char *new_part_offset, *new_part_end;
-    char *tmp_offset;
-    int	config_name_len;
-    int	len, rc, part_size;
-
-    new_config_value = strchr(config_var, '=');
-    if (!new_config_value) {
-	err_msg("config variables must be in the format \"name=value\"");
-	return -1;
-    }
-    new_config_value++;
-
-    phead = nvram_find_partition(nvram, 0, pname, NULL);
-    if (phead == NULL) {
-        err_msg("there is no \"%s\" partition!\n", pname);
-	return -1;
-    }
-
-    part_size = phead->length * NVRAM_BLOCK_SIZE;
-    data_offset = (char *)((unsigned long)phead + sizeof(*phead));
-
-    new_part = malloc(part_size);
-    if (new_part == NULL) {
-        err_msg("cannot allocate space to update \"%s\" partition\n", pname);
-	return -1;
-    }
-
-    memset(new_part, 0, part_size);
-
-    /* get the length of then name of the config variable we are updating */
-    config_name_len = strstr(config_var, "=") - config_var;
-    config_name_len++;
-    
-    /* now find this config variable in the partition */
-    while (*data_offset != '\0') {
-	if (strncmp(data_offset, config_var, config_name_len) == 0)
-	    break;
-	data_offset += strlen(data_offset) + 1;
     }
 
-    /* Copy everything up to the config name we are modifying 
-     * to the new partition 
+    /* Each partition is indexed on the first lookup, every variable is
+     * then found with a binary search.
      */
-    memcpy(new_part, phead, data_offset - (char *)phead);
-
-    /* make sure the new config var will fit into the partition and add it */
-    new_phead = (struct partition_header *)new_part;
-    new_phead->length = be16toh(new_phead->length);
-    new_part_offset = new_part + (data_offset - (char *)phead);
-    new_part_end = new_part + part_size;
-
-    if ((new_part_offset + strlen(config_var) + 1) >= new_part_end) {
-        err_msg("cannot update config var to\"%s\".\n"
-		"\tThere is not enough room in the \"%s\" partition\n", 
-		config_var, pname);
-	free(new_part);
-	return -1;
-    }
-
-    if (strlen(new_config_value)) {
-	memcpy(new_part_offset, config_var, strlen(config_var));
-	new_part_offset += strlen(config_var);
-	*new_part_offset++ = '\0';
-    }
-
-    /* Find the end of the name/value pairs in the partition so we
-     * can copy them over to the new partition.
-     */
-    data_offset += strlen(data_offset) + 1;
-    tmp_offset = data_offset;
-    while (*data_offset != '\0') {
-    	data_offset += strlen(data_offset) + 1;
-    }
-
-    /* we should now be pointing to a double NULL, verify this */
-    if ((data_offset[-1] != '\0') && (data_offset[0] != '\0')) {
-        err_msg("the \"%s\" partition appears to be corrupt\n", pname);
-	free(new_part);
-	return -1;
-    }
-
-    /* go past double NULL */
-    data_offset++;
-
-    /* verify that this will fit into the new partition */
-    if ((new_part_offset + (data_offset - tmp_offset)) > new_part_end) {
-        err_msg("cannot update open firmware config var to \"%s\".\n"
-		"\tThere is not enough room in the \"%s\" partition\n", 
-		config_var, pname);
-	free(new_part);
-	return -1;
-    }
-
-    memcpy(new_part_offset, tmp_offset, data_offset - tmp_offset);
-
-    /* recalculate the checksum */
-    new_phead->checksum = checksum(new_phead);
+    rc = 0;
+    for (v = 0; v < nvars; v++) {
+	found = 0;
+	for (i = 0; i < nvram->nparts; i++) {
+	    if (phead != NULL && nvram->parts[i] != phead)
+		continue;
 
-    /* seek the position in the /dev/nvram for the common partition */
-    if (nvram_find_fd_partition(nvram, new_phead->name) != 0) {
-    	free(new_part);
-	return -1;
-    }
-    
-    /* write the partition out to nvram */
-    for (rc = 0, len = 0; len < part_size; len += rc) {
-	rc = write(nvram->fd, new_part + len, part_size - len);
-	if (rc <= 0)
-	    break;
-    }
+	    n = nvram_find_config_var(nvram, nvram->parts[i], config_vars[v],
+				      &entries);
+	    for (j = 0; j < n; j++) {
+		if (nvars > 1)
+		    printf("%s=", config_vars[v]);
+		printf("%s%c", entries[j].value, terminator);
+		found = 1;
+	    }
+	}
 
-    if (len != part_size) {
-        err_msg("only wrote %d bytes of the \"%s\" partition back\n"
-		"\tto %s, expected to write %d bytes\n",
-		len, pname, nvram->filename, part_size);
+	if (!found)
+	    rc = -1;
     }
 
-    free(new_part);
-    return 0;
+    return rc;
 }
 
 int 
 main (int argc, char *argv[])
 {
     struct nvram nvram;
-    struct stat sbuf;
     int ret = 0; 
     int	option_index;
     char *endp;
-    char *of_config_var = NULL;
+    char **config_vars = NULL;
+    int nconfig_vars = 0;
+    int print_all_config = 0;
     int print_partitions = 0;
     int print_vpd = 0;
     int print_errlog = 0;
     int print_event_scan = 0;
+    int dump_logs = 0;
     int	print_config_var = 0;
     int zero_terminator = 0;
     char *dump_name = NULL;
     char *ascii_name = NULL;
     char *zip_name = NULL;
-    char *update_config_var = NULL;
+    char **update_config_vars;
+    int nupdate_vars = 0;
     char *config_pname = "common";
 
     nvram_cmdname = argv[0];
@@ -1461,6 +1233,16 @@ main (int argc, char *argv[])
 	exit(1);
     }
 
+    /* every --print-config=var and --update-config is kept, there are
+     * fewer than argc of either
+     */
+    config_vars = calloc(argc, sizeof(*config_vars));
+    update_config_vars = calloc(argc, sizeof(*update_config_vars));
+    if (config_vars == NULL || update_config_vars == NULL) {
+	err_msg("cannot allocate space for the config variables\n");
+	exit(1);
+    }
+
     /* initialize nvram struct */
     memset(&nvram, 0, sizeof(struct nvram));
     nvram.fd = -1;
@@ -1497,7 +1279,10 @@ main (int argc, char *argv[])
 		break;
 	    case 'o':	/*print-config */
 		print_config_var = 1;
-		of_config_var = optarg;
+		if (optarg)
+		    config_vars[nconfig_vars++] = optarg;
+		else
+		    print_all_config = 1;
 		break;
 	    case '0':
 		zero_terminator = 1;
@@ -1528,8 +1313,11 @@ main (int argc, char *argv[])
 	    case 'E':	/* print-event-scan */
 		print_event_scan = 1;
 		break;
+	    case 'L':	/* dump-logs */
+		dump_logs = 1;
+		break;
 	    case 'u':	/* update-config */
-	        update_config_var = optarg;
+	        update_config_vars[nupdate_vars++] = optarg;
 		break;
 	    case 'p':	/* update-config partition name */
 	        config_pname = optarg;
@@ -1554,88 +1342,31 @@ main (int argc, char *argv[])
 
     ret = 0;
 
-    if (nvram.filename) {
-        nvram.fd = open(nvram.filename, O_RDWR);
-        if (nvram.fd == -1) {
-	    err_msg("cannot open \"%s\": %s\n", 
-  		    nvram.filename, strerror(errno));
-              ret = -1;
-  	    goto err_exit;
-        }
-    } else {
-        nvram.filename = NVRAM_FILENAME1;
-        nvram.fd = open(nvram.filename, O_RDWR);
-        if (nvram.fd == -1) {
-	    int errno1 = errno;
-
-            nvram.filename = NVRAM_FILENAME2;
-            nvram.fd = open(nvram.filename, O_RDWR);
-            if (nvram.fd == -1) {
-                err_msg("cannot open \"%s\": %s\n", 
-                        NVRAM_FILENAME1, strerror(errno1));
-                err_msg("cannot open \"%s\": %s\n", 
-                        NVRAM_FILENAME2, strerror(errno));
-                ret = -1;
-                goto err_exit;
-            }
-        }
-    }
-
-    if (fstat(nvram.fd, &sbuf) < 0) {
-        err_msg("cannot stat %s: %s\n", nvram.filename, strerror(errno));
-	ret = -1;
-	goto err_exit;
-    }
-
-    if (!nvram.nbytes) {
-	ret = lseek(nvram.fd, 0, SEEK_END);
-	if (ret < 0) {
-	    err_msg("cannot seek(END) %s: %s\n", nvram.filename,
-		    strerror(errno));
-	    goto err_exit;
-	}
-
-	nvram.nbytes = ret;
-
-	ret = lseek(nvram.fd, 0, SEEK_SET);
-	if (ret < 0) {
-	    err_msg("cannot seek(SET) %s: %s\n", nvram.filename,
-		    strerror(errno));
-	    goto err_exit;
-	}
-    }
-
-    nvram.data = malloc(nvram.nbytes);
-    if (nvram.data == NULL) {
-        err_msg("cannot allocate space for nvram of %d bytes\n", nvram.nbytes);
-    	ret = -1;
-	goto err_exit;
-    }
-
-    if (nvram_read(&nvram) != 0) {
+    nvram.verbose = verbose;
+    nvram.read_only = (nupdate_vars == 0);
+    if (nvram_open(&nvram) != 0) {
         ret = -1;
         goto err_exit;
     }
 
-    if (nvram_parse_partitions(&nvram) != 0) {
-        ret = -1;
-	goto err_exit;
-    }
-
     if (print_partitions)
 	print_partition_table(&nvram);
 
-    if (update_config_var) {
+    if (nupdate_vars) {
         if (config_pname == NULL) {
 	    err_msg("you must specify the partition name with the -p option\n"
 	    	    "\twhen using the --update-config option\n");
 	    goto err_exit;
 	}
-    	if (update_of_config_var(&nvram, update_config_var, config_pname) != 0) 
-	    ret = -1; 
+	/* all of the variables are written back at once, or none is */
+    	if (nvram_set_config_vars(&nvram, config_pname, update_config_vars,
+				  nupdate_vars) != 0 ||
+	    nvram_flush(&nvram) != 0)
+	    ret = -1;
     }
     if (print_config_var)
-	if (print_of_config(&nvram, of_config_var, config_pname,
+	if (print_of_config(&nvram, config_vars,
+		    print_all_config ? 0 : nconfig_vars, config_pname,
 		    zero_terminator) != 0)
 	    ret = -1;
     if (print_vpd)
@@ -1647,6 +1378,9 @@ main (int argc, char *argv[])
     if (print_event_scan)
 	if (dump_eventscanlog(&nvram) != 0)
 	    ret = -1;
+    if (dump_logs)
+	if (dump_log_partitions(&nvram) != 0)
+	    ret = -1;
     if (dump_name)
 	if (dump_raw_partition(&nvram, dump_name) != 0)
 	    ret = -1;
@@ -1658,10 +1392,9 @@ main (int argc, char *argv[])
 	    ret = -1;
    
 err_exit:   
-   if (nvram.data)
-	free(nvram.data);
-   if (nvram.fd != -1)
-   	close(nvram.fd);
+   nvram_close(&nvram);
+   free(config_vars);
+   free(update_config_vars);
 	
    return ret;
 }
@@ -26,16 +26,7 @@
 #ifndef _DEV_NVRAM_H_
 #define _DEV_NVRAM_H_
 
-#define NVRAM_SIG_SP	0x02	/**< support processor signature */
-#define NVRAM_SIG_OF	0x50	/**< open firmware config signature */
-#define NVRAM_SIG_FW	0x51	/**< general firmware signature */
-#define NVRAM_SIG_HW	0x52	/**< hardware (VPD) signature */
-#define NVRAM_SIG_SYS	0x70	/**< system env vars signature */
-#define NVRAM_SIG_CFG	0x71	/**< config data signature */
-#define NVRAM_SIG_ELOG	0x72	/**< error log signature */
-#define NVRAM_SIG_VEND	0x7e	/**< vendor defined signature */
-#define NVRAM_SIG_FREE	0x7f	/**< Free space signature */
-#define NVRAM_SIG_OS	0xa0	/**< OS defined signature */
+#include "nvram_lib.h"
 
 /**
  * @def printmap(ch)
@@ -43,36 +34,24 @@
  */
 #define printmap(ch)	(isgraph(ch) ? (ch) : '.')
 
-#define NVRAM_BLOCK_SIZE	16
-#define NVRAM_READ_SIZE		512
-#define NVRAM_FILENAME1		"/dev/nvram"
-#define NVRAM_FILENAME2		"/dev/misc/nvram"
-
-#define DEFAULT_NVRAM_SZ	(1024 * 1024)
 #define OOPS_PARTITION_SZ	4000
 
 /**
- * @def MAX_CPUS
- * @brief maximum number of CPUS for errlog dumps
+ * @def UNZIP_BUF_SZ
+ * @brief bytes of decompressed text held at a time when unzipping
  */
-#define MAX_CPUS 128
+#define UNZIP_BUF_SZ		4096
 
-/**
- * @def MAX_PART_NAME
- * @brief maximum number of bytes in partition name
- */
-#define MAX_PART_NAME 12
+/* error_type of the err_log_info sub-header, as set by the kernel */
+#define ERR_TYPE_RTAS_LOG		0x2
+#define ERR_TYPE_KERNEL_PANIC		0x4
+#define ERR_TYPE_KERNEL_PANIC_GZ	0x8
 
 /**
- * @struct partition_header
- * @brief nvram partition header data
+ * @def MAX_CPUS
+ * @brief maximum number of CPUS for errlog dumps
  */
-struct partition_header {
-    unsigned char	signature;		/**< partition signature */
-    unsigned char 	checksum;		/**< partition checksum */
-    unsigned short 	length;			/**< partition length */
-    char 		name[MAX_PART_NAME];	/**< partition name */
-};
+#define MAX_CPUS 128
 
 /* sub-header for error-log partitions */
 struct err_log_info {
@@ -87,27 +66,6 @@ struct oops_log_info {
    unsigned long long	timestamp;
 }__attribute__((packed));
 
-/* Internal representation of NVRAM. */
-#define MAX_PARTITIONS 50
-/**
- * @struct nvram
- * @brief internal representation of nvram data
- */
-struct nvram {
-    char 	*filename;		/**< original filename */
-    int		fd;			/**< file descriptor */
-    int 	nparts;			/**< number of partitions */
-    int 	nbytes;			/**< size of data in bytes.  This 
-                                         *   cannot be changed 
-                                         *   (i.e. hardware size) 
-					 */
-    struct partition_header *parts[MAX_PARTITIONS]; 
-                                        /**< partition header pointers 
-                                         *   into data 
-                                         */
-    char	*data;                  /**< nvram contents */
-};
-
 /**
  * @var descs
  * @brief Array of VPD field names and descriptions
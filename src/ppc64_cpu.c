@@ -22,6 +22,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <dirent.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -33,7 +34,6 @@
 #include <sys/ioctl.h>
 #include <sys/ptrace.h>
 #include <sys/wait.h>
-#include <sys/resource.h>
 #include <sys/param.h>
 
 #ifdef WITH_LIBRTAS
@@ -47,10 +47,12 @@
 
 #include <errno.h>
 #include "cpu_info_helpers.h"
+#include "sample_core.h"
 
 #define PPC64_CPU_VERSION	"1.2"
 
 #define DSCR_DEFAULT_PATH "/sys/devices/system/cpu/dscr_default"
+#define SMT_CONTROL_PATH "/sys/devices/system/cpu/smt/control"
 
 #define MAX_NR_CPUS		1024
 #define DIAGNOSTICS_RUN_MODE	42
@@ -62,11 +64,22 @@ struct cpu_freq {
 	int counter;
 	pthread_t tid;
 	double freq;
+	uint64_t value;		/* counter value at the last read */
+	uint64_t time_running;	/* running time at the last read */
 };
 
-#ifndef __NR_perf_event_open
-#define __NR_perf_event_open	319
-#endif
+/* Frequency of a core or chip over a number of sampling windows */
+struct freq_stat {
+	int id;
+	int chip;
+	int nr;			/* windows with a measurement */
+	int nr_cur;		/* measurements in the current window */
+	double min, max, sum;
+	double cur;
+};
+
+/* Shortest sampling window in microseconds */
+#define FREQ_MIN_WINDOW		10000
 
 #endif
 
@@ -74,6 +87,29 @@ static int threads_per_cpu = 0;
 static int cpus_in_system = 0;
 static int threads_in_system = 0;
 
+/* Number of cores whose threads are on/offlined concurrently */
+static int nr_jobs = 1;
+
+/* errno of the last failure to on/offline each thread, 0 if none */
+static int *thread_errors;
+
+struct core_work {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int *cores;		/* cores to change */
+	int nr_cores;
+	int next;		/* next entry of cores to hand out */
+	int smt_state;
+	int state;		/* 1 to online cores, 0 to offline them */
+	int limit;		/* cores to change, 0 for all of them */
+	int stop_on_error;	/* hand out no more cores after a failure */
+	int nr_changed;
+	int in_flight;
+	int *result;		/* per core: 1 changed, -1 failed, or NULL */
+	int error;
+	int (*fn)(struct core_work *work, int core);
+};
+
 static int do_info(void);
 
 static int sysattr_is_readable(char *attribute)
@@ -282,44 +318,215 @@ static int set_one_smt_state(int thread, int online_threads)
 		 * returning failure. */
 		if (rc == -1 && errno == EINVAL)
 			rc = errno = 0;
-		if (rc)
+		if (rc) {
+			if (thread_errors)
+				thread_errors[thread + i] = errno ? errno : EIO;
 			break;
+		}
 	}
 
 	return rc;
 }
 
+static void *core_worker(void *arg)
+{
+	struct core_work *work = arg;
+	int core, rc;
+
+	pthread_mutex_lock(&work->lock);
+	while (1) {
+		/* With a limit, only start as many cores as are still
+		 * needed, and wait to see if those in flight fail. */
+		while (work->limit && work->in_flight &&
+		       work->nr_changed + work->in_flight >= work->limit)
+			pthread_cond_wait(&work->cond, &work->lock);
+
+		if (work->next >= work->nr_cores ||
+		    (work->limit && work->nr_changed >= work->limit) ||
+		    (work->stop_on_error && work->error))
+			break;
+
+		core = work->cores[work->next++];
+		work->in_flight++;
+		pthread_mutex_unlock(&work->lock);
+
+		rc = work->fn(work, core);
+
+		pthread_mutex_lock(&work->lock);
+		work->in_flight--;
+		if (rc)
+			work->error = 1;
+		else
+			work->nr_changed++;
+
+		if (work->result)
+			work->result[core] = rc ? -1 : 1;
+
+		pthread_cond_broadcast(&work->cond);
+	}
+	pthread_mutex_unlock(&work->lock);
+
+	return NULL;
+}
+
+/**
+ * run_core_work
+ * @brief Apply a state change to a list of cores
+ *
+ * Up to nr_jobs cores are changed concurrently, each by its own
+ * worker thread, in the order of the list.  Failing to change a core
+ * does not stop the others from being changed unless stop_on_error is
+ * set.  With a limit, the cores after the first limit ones only stand
+ * in for cores that failed.
+ *
+ * @param work cores to change and the change to apply to each
+ * @returns 0 if all cores were changed, -1 otherwise
+ */
+static int run_core_work(struct core_work *work)
+{
+	pthread_t *tids;
+	int i, nr_threads;
+
+	work->next = 0;
+	work->error = 0;
+	work->nr_changed = 0;
+	work->in_flight = 0;
+	pthread_mutex_init(&work->lock, NULL);
+	pthread_cond_init(&work->cond, NULL);
+
+	nr_threads = MIN(nr_jobs, work->nr_cores);
+	tids = nr_threads > 1 ? calloc(nr_threads, sizeof(*tids)) : NULL;
+
+	for (i = 0; tids && i < nr_threads; i++) {
+		if (pthread_create(&tids[i], NULL, core_worker, work))
+			break;
+	}
+
+	/* Fall back to doing the work in this thread if no workers
+	 * could be started. */
+	if (!tids || i == 0)
+		core_worker(work);
+
+	nr_threads = tids ? i : 0;
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(tids[i], NULL);
+
+	free(tids);
+	pthread_cond_destroy(&work->cond);
+	pthread_mutex_destroy(&work->lock);
+	online_cpus_invalidate();
+
+	return work->error ? -1 : 0;
+}
+
+/**
+ * report_thread_errors
+ * @brief Print the threads that failed to be on/offlined
+ *
+ * @returns number of failed threads
+ */
+static int report_thread_errors(void)
+{
+	int i, failed = 0;
+
+	for (i = 0; i < threads_in_system; i++) {
+		if (!thread_errors[i])
+			continue;
+
+		fprintf(stderr, "cpu%d: %s\n", i, strerror(thread_errors[i]));
+		failed++;
+	}
+
+	if (failed)
+		fprintf(stderr, "%d of %d cpus could not be on/offlined\n",
+			failed, threads_in_system);
+
+	return failed;
+}
+
+/**
+ * set_smt_control
+ * @brief Set the smt state of all cores through the kernel smt control
+ *
+ * The kernel changes the state of all cores in a single operation,
+ * which is much faster than on/offlining each thread separately.
+ * Older kernels only accept on and off, and may online threads of
+ * cores that are offline, so the control is only used when every
+ * core is online and the result is checked afterwards.
+ *
+ * @param smt_state number of threads to have online in each core
+ * @returns 0 on success, -1 if the threads have to be set one by one
+ */
+static int set_smt_control(int smt_state)
+{
+	int i, rc;
+
+	if (access(SMT_CONTROL_PATH, W_OK))
+		return -1;
+
+	for (i = 0; i < cpus_in_system; i++) {
+		if (get_one_smt_state(i) == 0)
+			return -1;
+	}
+
+	rc = set_attribute(SMT_CONTROL_PATH, "%d", smt_state);
+	online_cpus_invalidate();
+	if (rc)
+		return -1;
+
+	return get_smt_state() == smt_state ? 0 : -1;
+}
+
+static int smt_work(struct core_work *work, int core)
+{
+	return set_one_smt_state(core * threads_per_cpu, work->smt_state);
+}
+
 static int set_smt_state(int smt_state)
 {
+	struct core_work work = { .smt_state = smt_state, .fn = smt_work };
 	int i, j, rc;
-	int error = 0;
 
 	if (!sysattr_is_writeable("online")) {
 		perror("Cannot set smt state");
 		return -1;
 	}
 
+	if (!set_smt_control(smt_state))
+		return 0;
+
+	work.cores = calloc(cpus_in_system, sizeof(int));
+	thread_errors = calloc(threads_in_system, sizeof(int));
+	if (!work.cores || !thread_errors) {
+		free(work.cores);
+		free(thread_errors);
+		thread_errors = NULL;
+		return -ENOMEM;
+	}
+
 	for (i = 0; i < threads_in_system; i += threads_per_cpu) {
 		/* Online means any thread on this core running, so check all
 		 * threads in the core, not just the first. */
 		for (j = 0; j < threads_per_cpu; j++) {
-			if (!cpu_online(i + j))
-				continue;
-
-			rc = set_one_smt_state(i, smt_state);
-			/* Record an error, but do not check result: if we
-			 * have failed to set this core, keep trying
-			 * subsequent ones. */
-			if (rc)
-				error = 1;
-			break;
+			if (cpu_online(i + j)) {
+				work.cores[work.nr_cores++] = i / threads_per_cpu;
+				break;
+			}
 		}
 	}
 
-	if (error) {
-		fprintf(stderr, "One or more cpus could not be on/offlined\n");
-		return -1;
+	/* Record errors, but do not stop: if we have failed to set
+	 * a core, keep trying the others. */
+	rc = run_core_work(&work);
+	if (rc) {
+		if (!report_thread_errors())
+			fprintf(stderr, "One or more cpus could not be on/offlined\n");
+		rc = -1;
 	}
+
+	free(work.cores);
+	free(thread_errors);
+	thread_errors = NULL;
 	return rc;
 }
 
@@ -424,44 +631,369 @@ static int do_subcores_per_core(char *state)
 
 #define PTRACE_DSCR 44
 
-static int do_dscr_pid(int dscr_state, pid_t pid)
+/* Passes over the threads to catch those created while they are updated */
+#define DSCR_MAX_PASSES	3
+
+/**
+ * dscr_thread
+ * @brief Get, and optionally set, the DSCR of a single thread
+ *
+ * The thread is seized and interrupted rather than attached, so no
+ * signal is sent to it, and it is let go as soon as the DSCR has been
+ * accessed.
+ *
+ * @param tid thread to access
+ * @param set true to set the DSCR to value
+ * @param value value to set
+ * @param dscr set to the DSCR of the thread
+ * @returns 0 on success, an errno value otherwise
+ */
+static int dscr_thread(pid_t tid, bool set, int value, long *dscr)
+{
+	int status, rc, err = 0;
+	long sig = 0;
+
+	if (ptrace(PTRACE_SEIZE, tid, NULL, NULL))
+		return errno;
+
+	/* A tracee that did not stop can not be detached, it is let go
+	 * when this process exits.
+	 */
+	if (ptrace(PTRACE_INTERRUPT, tid, NULL, NULL))
+		return errno;
+
+	do {
+		rc = waitpid(tid, &status, __WALL);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc != tid)
+		return errno;
+
+	if (!WIFSTOPPED(status))
+		return ESRCH;	/* the thread exited */
+
+	/* A signal pending on the thread is reported by a signal-delivery
+	 * stop before the interrupt stop.  The DSCR can be accessed in
+	 * that stop as well, the signal is passed on when detaching.
+	 */
+	if (status >> 16 != PTRACE_EVENT_STOP)
+		sig = WSTOPSIG(status);
+
+	if (set && ptrace(PTRACE_POKEUSER, tid, PTRACE_DSCR << 3, value)) {
+		err = errno;
+		goto out;
+	}
+
+	errno = 0;
+	*dscr = ptrace(PTRACE_PEEKUSER, tid, PTRACE_DSCR << 3, NULL);
+	err = errno;
+
+out:
+	ptrace(PTRACE_DETACH, tid, NULL, (void *)sig);
+	return err;
+}
+
+static int do_dscr_pid(char *state, pid_t pid)
+{
+	int dscr_state = state ? strtol(state, NULL, 0) : 0;
+	long dscr;
+	int err;
+
+	err = dscr_thread(pid, state != NULL, dscr_state, &dscr);
+	if (err) {
+		fprintf(stderr, "Could not %s the DSCR value for pid %d\n%s\n",
+			(state ? "set" : "get"), pid, strerror(err));
+		return -1;
+	}
+
+	printf("DSCR for pid %d is %ld\n", pid, dscr);
+	return 0;
+}
+
+struct tid_list {
+	pid_t	*tids;
+	int	nr;
+	int	alloc;
+};
+
+static int tid_cmp(const void *a, const void *b)
+{
+	return *(const pid_t *)a - *(const pid_t *)b;
+}
+
+static int add_tid(struct tid_list *list, pid_t tid)
+{
+	pid_t *tmp;
+
+	if (list->nr == list->alloc) {
+		list->alloc = list->alloc ? list->alloc * 2 : 256;
+		tmp = realloc(list->tids, list->alloc * sizeof(pid_t));
+		if (!tmp) {
+			fprintf(stderr, "Out of memory\n");
+			return -1;
+		}
+		list->tids = tmp;
+	}
+
+	list->tids[list->nr++] = tid;
+	return 0;
+}
+
+/*
+ * Add the numbers in a file, such as cgroup.threads or a children file.
+ * Returns 1 if the file could not be opened, -1 if out of memory.
+ */
+static int add_tids_from_file(const char *path, struct tid_list *list)
+{
+	FILE *fp;
+	int tid, rc = 0;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return 1;
+
+	while (fscanf(fp, "%d", &tid) == 1) {
+		rc = add_tid(list, tid);
+		if (rc)
+			break;
+	}
+
+	fclose(fp);
+	return rc;
+}
+
+/* Add the threads of a process, as listed in /proc/<pid>/task */
+static int add_process_tids(pid_t pid, struct tid_list *list)
 {
+	char path[PATH_MAX];
+	struct dirent *de;
+	DIR *dir;
+	int rc = 0;
+
+	sprintf(path, "/proc/%d/task", pid);
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		rc = add_tid(list, atoi(de->d_name));
+		if (rc)
+			break;
+	}
+
+	closedir(dir);
+	return rc;
+}
+
+/*
+ * Add the children of a process by looking for its pid as the parent
+ * pid in /proc/<pid>/stat, for kernels without the children files.
+ */
+static int add_children_by_ppid(pid_t pid, struct tid_list *procs)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	DIR *dir;
+	FILE *fp;
+	int ppid, rc = 0;
+	pid_t child;
+
+	dir = opendir("/proc");
+	if (!dir)
+		return -1;
+
+	while (!rc && (de = readdir(dir)) != NULL) {
+		child = atoi(de->d_name);
+		if (child <= 0)
+			continue;
+
+		sprintf(path, "/proc/%d/stat", child);
+		fp = fopen(path, "r");
+		if (!fp)
+			continue;
+
+		/* the command name may contain spaces, skip to its end */
+		if (fscanf(fp, "%*d (%*[^)]) %*c %d", &ppid) == 1 &&
+		    ppid == pid)
+			rc = add_tid(procs, child);
+		fclose(fp);
+	}
+
+	closedir(dir);
+	return rc;
+}
+
+/*
+ * Add the threads of a process and of all of its descendants.  The
+ * children of each thread are listed in /proc/<pid>/task/<tid>/children
+ * when the kernel provides it.
+ */
+static int add_tree_tids(pid_t pid, struct tid_list *list)
+{
+	struct tid_list procs = { NULL, 0, 0 };
+	char path[PATH_MAX];
+	int first, i, p, rc;
+	bool children;
+
+	sprintf(path, "/proc/%d/task/%d/children", getpid(), getpid());
+	children = !access(path, R_OK);
+
+	rc = add_tid(&procs, pid);
+
+	for (p = 0; !rc && p < procs.nr; p++) {
+		first = list->nr;
+		if (add_process_tids(procs.tids[p], list))
+			continue;	/* it is gone */
+
+		if (!children) {
+			rc = add_children_by_ppid(procs.tids[p], &procs);
+			continue;
+		}
+
+		for (i = first; i < list->nr; i++) {
+			sprintf(path, "/proc/%d/task/%d/children",
+				procs.tids[p], list->tids[i]);
+			if (add_tids_from_file(path, &procs) < 0)
+				rc = -1;
+		}
+	}
+
+	free(procs.tids);
+	return rc;
+}
+
+/*
+ * Add the threads of a cgroup, from cgroup.threads on cgroup v2 and
+ * tasks on v1.  Relative paths are taken from /sys/fs/cgroup.
+ */
+static int add_cgroup_tids(const char *cgroup, struct tid_list *list)
+{
+	char path[PATH_MAX];
+	const char *base = cgroup[0] == '/' ? "" : "/sys/fs/cgroup/";
 	int rc;
 
-	rc = ptrace(PTRACE_ATTACH, pid, NULL, NULL);
-	if (rc) {
-		fprintf(stderr, "Could not attach to process %d to %s the "
-			"DSCR value\n%s\n", pid, (dscr_state ? "set" : "get"),
-			strerror(errno));
+	snprintf(path, sizeof(path), "%s%s/cgroup.threads", base, cgroup);
+	rc = add_tids_from_file(path, list);
+	if (rc <= 0)
 		return rc;
-	}
 
-	wait(NULL);
+	snprintf(path, sizeof(path), "%s%s/tasks", base, cgroup);
+	rc = add_tids_from_file(path, list);
+	if (rc <= 0)
+		return rc;
 
-	if (dscr_state) {
-		rc = ptrace(PTRACE_POKEUSER, pid, PTRACE_DSCR << 3, dscr_state);
-		if (rc) {
-			fprintf(stderr, "Could not set the DSCR value for pid "
+	fprintf(stderr, "Could not list the threads of cgroup %s\n%s\n",
+		cgroup, strerror(errno));
+	return -1;
+}
+
+struct dscr_count {
+	long	dscr;
+	int	threads;
+};
+
+/*
+ * Get, or set, the DSCR of all of the threads of a process, process
+ * tree or cgroup.  The threads are listed again after each pass, those
+ * that were created in the meantime are done in another pass.  The
+ * results are reported per DSCR value and per error.
+ */
+static int do_dscr_bulk(char *state, pid_t pid, bool tree, char *cgroup)
+{
+	struct tid_list done = { NULL, 0, 0 }, cur = { NULL, 0, 0 };
+	struct dscr_count *counts = NULL, *tmp;
+	int dscr_state = state ? strtol(state, NULL, 0) : 0;
+	int ncounts = 0, gone = 0, failed = 0, first_err = 0;
+	int pass, i, j, ndone, err, rc = 0;
+	long dscr;
+
+	for (pass = 0; !rc && pass < DSCR_MAX_PASSES; pass++) {
+		cur.nr = 0;
+		if (cgroup)
+			rc = add_cgroup_tids(cgroup, &cur);
+		else if (tree)
+			rc = add_tree_tids(pid, &cur);
+		else if (add_process_tids(pid, &cur)) {
+			fprintf(stderr, "Could not list the threads of pid "
 				"%d\n%s\n", pid, strerror(errno));
-			ptrace(PTRACE_DETACH, pid, NULL, NULL);
-			return rc;
+			rc = -1;
 		}
+		if (rc)
+			break;
+
+		qsort(done.tids, done.nr, sizeof(pid_t), tid_cmp);
+		ndone = done.nr;
+
+		for (i = 0; !rc && i < cur.nr; i++) {
+			if (bsearch(&cur.tids[i], done.tids, ndone,
+				    sizeof(pid_t), tid_cmp))
+				continue;
+			rc = add_tid(&done, cur.tids[i]);
+			if (rc)
+				break;
+
+			err = dscr_thread(cur.tids[i], state != NULL,
+					  dscr_state, &dscr);
+			if (err == ESRCH) {
+				gone++;
+				continue;
+			} else if (err) {
+				if (!failed++)
+					first_err = err;
+				continue;
+			}
+
+			for (j = 0; j < ncounts; j++)
+				if (counts[j].dscr == dscr)
+					break;
+			if (j == ncounts) {
+				tmp = realloc(counts, (j + 1) * sizeof(*counts));
+				if (!tmp) {
+					fprintf(stderr, "Out of memory\n");
+					rc = -1;
+					break;
+				}
+				counts = tmp;
+				counts[j].dscr = dscr;
+				counts[j].threads = 0;
+				ncounts++;
+			}
+			counts[j].threads++;
+		}
+
+		/* stop once a pass finds no new thread */
+		if (done.nr == ndone)
+			break;
 	}
 
-	rc = ptrace(PTRACE_PEEKUSER, pid, PTRACE_DSCR << 3, NULL);
-	if (errno) {
-		fprintf(stderr, "Could not get the DSCR value for pid "
-			"%d\n%s\n", pid, strerror(errno));
+	for (j = 0; j < ncounts; j++)
+		printf("DSCR is %ld for %d threads\n", counts[j].dscr,
+		       counts[j].threads);
+	if (gone)
+		printf("%d threads exited before their DSCR was %s\n", gone,
+		       state ? "set" : "read");
+	if (failed) {
+		fprintf(stderr, "Could not %s the DSCR value of %d threads\n"
+			"%s\n", state ? "set" : "get", failed,
+			strerror(first_err));
+		rc = -1;
+	}
+	if (!rc && !ncounts && !failed) {
+		fprintf(stderr, "No threads found\n");
 		rc = -1;
-	} else {
-		printf("DSCR for pid %d is %d\n", pid, rc);
 	}
 
-	ptrace(PTRACE_DETACH, pid, NULL, NULL);
+	free(counts);
+	free(done.tids);
+	free(cur.tids);
 	return rc;
 }
 
-static int do_dscr(char *state, pid_t pid)
+static int do_dscr(char *state, pid_t pid, bool all_threads, bool tree,
+		   char *cgroup)
 {
 	int rc = 0;
 	int dscr_state = 0;
@@ -474,8 +1006,11 @@ static int do_dscr(char *state, pid_t pid)
 	if (state)
 		dscr_state = strtol(state, NULL, 0);
 
+	if (cgroup || (pid != -1 && (all_threads || tree)))
+		return do_dscr_bulk(state, pid, tree, cgroup);
+
 	if (pid != -1)
-		return do_dscr_pid(dscr_state, pid);
+		return do_dscr_pid(state, pid);
 
 	if (!state) {
 		int dscr, inconsistent = 0;
@@ -575,16 +1110,6 @@ static int do_run_mode(char *run_mode)
 static int setup_counters(struct cpu_freq *cpu_freqs, int max_thread)
 {
 	int i;
-	struct perf_event_attr attr;
-
-	memset(&attr, 0, sizeof(attr));
-	attr.type = PERF_TYPE_HARDWARE;
-	attr.config = PERF_COUNT_HW_CPU_CYCLES;
-	attr.disabled = 1;
-	attr.size = sizeof(attr);
-
-	/* Record how long the event ran for */
-	attr.read_format |= PERF_FORMAT_TOTAL_TIME_RUNNING;
 
 	for (i = 0; i < max_thread; i++) {
 		if (!cpu_online(i)) {
@@ -592,8 +1117,8 @@ static int setup_counters(struct cpu_freq *cpu_freqs, int max_thread)
 			continue;
 		}
 
-		cpu_freqs[i].counter = syscall(__NR_perf_event_open, &attr,
-					       -1, i, -1, 0);
+		cpu_freqs[i].counter = perf_counter_open(i, PERF_TYPE_HARDWARE,
+						PERF_COUNT_HW_CPU_CYCLES, true);
 
 		if (cpu_freqs[i].counter < 0) {
 			if (errno == ENOSYS)
@@ -633,24 +1158,19 @@ static void stop_counters(struct cpu_freq *cpu_freqs, int max_thread)
 	}
 }
 
-struct read_format {
-	uint64_t value;
-	uint64_t time_running;
-};
-
 static void read_counters(struct cpu_freq *cpu_freqs, int max_thread)
 {
 	int i;
-	struct read_format vals;
+	struct perf_count vals;
 
 	for (i = 0; i < max_thread; i++) {
-		size_t res;
+		int res;
 
 		if (cpu_freqs[i].offline)
 			continue;
 
-		res = read(cpu_freqs[i].counter, &vals, sizeof(vals));
-		assert(res == sizeof(vals));
+		res = perf_counter_read(cpu_freqs[i].counter, &vals);
+		assert(res == 0);
 
 		/* Warn if we don't get at least 0.1s of time on the CPU */
 		if (vals.time_running < 100000000) {
@@ -770,24 +1290,213 @@ static void report_system_power_mode(void)
 	return;
 }
 
-/* We need an FD per CPU, with a few more for stdin/out/err etc */
-static void setrlimit_open_files(void)
+static void freq_stat_add(struct freq_stat *stat, double freq)
 {
-	struct rlimit old_rlim, new_rlim;
-	int new = threads_in_system + 8;
+	if (!stat->nr || freq < stat->min)
+		stat->min = freq;
+	if (!stat->nr || freq > stat->max)
+		stat->max = freq;
 
-	getrlimit(RLIMIT_NOFILE, &old_rlim);
+	stat->sum += freq;
+	stat->nr++;
+}
 
-	if (old_rlim.rlim_cur > new)
-		return;
+/**
+ * read_window
+ * @brief Read the frequency of each cpu since the previous read
+ *
+ * The counters keep running across windows, only the change of the
+ * cycle count and running time since the previous read is used.  As
+ * the running time excludes the time the counter was multiplexed out,
+ * this is the frequency scaled to the time the counter was enabled.
+ *
+ * @returns number of multiplexed counters
+ */
+static int read_window(struct cpu_freq *cpu_freqs, int max_thread)
+{
+	struct perf_count vals;
+	int i, multiplexed = 0;
 
-	new_rlim.rlim_cur = new;
-	new_rlim.rlim_max = old_rlim.rlim_max;
+	for (i = 0; i < max_thread; i++) {
+		uint64_t running;
+
+		if (cpu_freqs[i].offline)
+			continue;
+
+		if (perf_counter_read(cpu_freqs[i].counter, &vals)) {
+			/* the cpu went offline */
+			cpu_freqs[i].offline = 1;
+			close(cpu_freqs[i].counter);
+			continue;
+		}
+
+		running = vals.time_running - cpu_freqs[i].time_running;
+		cpu_freqs[i].freq = running ?
+			1.0 * (vals.value - cpu_freqs[i].value) / running : 0;
+		cpu_freqs[i].value = vals.value;
+		cpu_freqs[i].time_running = vals.time_running;
+
+		if (vals.time_running < vals.time_enabled)
+			multiplexed++;
+	}
+
+	return multiplexed;
+}
+
+static struct freq_stat *find_chip(struct freq_stat *chips, int *nr_chips,
+				   int chip)
+{
+	int i;
 
-	setrlimit(RLIMIT_NOFILE, &new_rlim);
+	for (i = 0; i < *nr_chips; i++) {
+		if (chips[i].id == chip)
+			return &chips[i];
+	}
+
+	chips[i].id = chip;
+	(*nr_chips)++;
+	return &chips[i];
 }
 
-static int do_cpu_frequency(int sleep_time)
+/**
+ * sample_core_frequency
+ * @brief Report min, mean and max frequency per core and chip
+ *
+ * The measurement time is split into a number of windows.  The
+ * frequency of a core in a window is the highest of its threads, as
+ * the threads of a core share its clock but idle threads do not count
+ * cycles.  The frequency of a chip is the mean of its cores.
+ *
+ * @param cpu_freqs counters of each cpu, already set up
+ * @param max_thread number of cpus
+ * @param sleep_time measurement time in seconds
+ * @param samples number of windows
+ * @returns 0 on success, !0 otherwise
+ */
+static int sample_core_frequency(struct cpu_freq *cpu_freqs, int max_thread,
+				 int sleep_time, int samples)
+{
+	struct freq_stat *cores, *chips, *chip;
+	char path[SYSFS_PATH_MAX];
+	long long window_us;
+	int i, w, core, nr_chips = 0, multiplexed = 0;
+	double min = 0, max = 0, sum = 0;
+	int count = 0;
+
+	window_us = sleep_time * 1000000LL / samples;
+	if (window_us < FREQ_MIN_WINDOW)
+		window_us = FREQ_MIN_WINDOW;
+
+	cores = calloc(cpus_in_system, sizeof(*cores));
+	chips = calloc(cpus_in_system, sizeof(*chips));
+	if (!cores || !chips) {
+		free(cores);
+		free(chips);
+		return -ENOMEM;
+	}
+
+	for (core = 0; core < cpus_in_system; core++) {
+		cores[core].id = core;
+		snprintf(path, SYSFS_PATH_MAX,
+			 SYSFS_CPUDIR"/topology/physical_package_id",
+			 core * threads_per_cpu);
+		if (get_attribute(path, "%d", &cores[core].chip))
+			cores[core].chip = -1;
+
+		find_chip(chips, &nr_chips, cores[core].chip);
+	}
+
+	start_counters(cpu_freqs, max_thread);
+	read_window(cpu_freqs, max_thread);
+
+	for (w = 0; w < samples; w++) {
+		usleep(window_us);
+		multiplexed += read_window(cpu_freqs, max_thread);
+
+		for (core = 0; core < cpus_in_system; core++)
+			cores[core].cur = 0;
+		for (i = 0; i < nr_chips; i++) {
+			chips[i].cur = 0;
+			chips[i].nr_cur = 0;
+		}
+
+		for (i = 0; i < max_thread; i++) {
+			core = i / threads_per_cpu;
+			if (cpu_freqs[i].offline || core >= cpus_in_system)
+				continue;
+
+			if (cpu_freqs[i].freq > cores[core].cur)
+				cores[core].cur = cpu_freqs[i].freq;
+		}
+
+		for (core = 0; core < cpus_in_system; core++) {
+			if (cores[core].cur == 0)
+				continue;
+
+			freq_stat_add(&cores[core], cores[core].cur);
+
+			chip = find_chip(chips, &nr_chips, cores[core].chip);
+			chip->cur += cores[core].cur;
+			chip->nr_cur++;
+		}
+
+		for (i = 0; i < nr_chips; i++) {
+			if (chips[i].nr_cur)
+				freq_stat_add(&chips[i],
+					      chips[i].cur / chips[i].nr_cur);
+		}
+	}
+
+	stop_counters(cpu_freqs, max_thread);
+	for (i = 0; i < max_thread; i++) {
+		if (!cpu_freqs[i].offline)
+			close(cpu_freqs[i].counter);
+	}
+
+	report_system_power_mode();
+	if (multiplexed)
+		printf("Counters were shared with other perf users, "
+		       "frequencies are scaled\n");
+
+	printf("%-6s %-6s %8s %8s %8s   (GHz, %d x %lld ms)\n", "core", "chip",
+	       "min", "mean", "max", samples, window_us / 1000);
+	for (core = 0; core < cpus_in_system; core++) {
+		if (!cores[core].nr)
+			continue;
+
+		printf("%-6d %-6d %8.3f %8.3f %8.3f\n", core, cores[core].chip,
+		       cores[core].min, cores[core].sum / cores[core].nr,
+		       cores[core].max);
+
+		if (!count || cores[core].min < min)
+			min = cores[core].min;
+		if (!count || cores[core].max > max)
+			max = cores[core].max;
+		sum += cores[core].sum / cores[core].nr;
+		count++;
+	}
+
+	printf("\n%-13s %8s %8s %8s\n", "chip", "min", "mean", "max");
+	for (i = 0; i < nr_chips; i++) {
+		if (!chips[i].nr)
+			continue;
+
+		printf("%-13d %8.3f %8.3f %8.3f\n", chips[i].id, chips[i].min,
+		       chips[i].sum / chips[i].nr, chips[i].max);
+	}
+
+	if (count) {
+		printf("\nmin:\t%.3f GHz\n", min);
+		printf("max:\t%.3f GHz\n", max);
+		printf("avg:\t%.3f GHz\n\n", sum / count);
+	}
+
+	free(cores);
+	free(chips);
+	return count ? 0 : -1;
+}
+
+static int do_cpu_frequency(int sleep_time, int samples, bool soak_cpus)
 {
 	int i, rc;
 	double min = -1ULL;
@@ -799,7 +1508,8 @@ static int do_cpu_frequency(int sleep_time)
 	struct cpu_freq *cpu_freqs;
 	int max_thread;
 
-	setrlimit_open_files();
+	/* We need an FD per CPU */
+	raise_nofile_limit(threads_in_system);
 
 	max_thread = MIN(threads_in_system, CPU_SETSIZE);
 	if (max_thread < threads_in_system)
@@ -817,7 +1527,7 @@ static int do_cpu_frequency(int sleep_time)
 	}
 
 	/* Start a soak thread on each CPU */
-	for (i = 0; i < max_thread; i++) {
+	for (i = 0; soak_cpus && i < max_thread; i++) {
 		if (cpu_freqs[i].offline)
 			continue;
 
@@ -829,8 +1539,18 @@ static int do_cpu_frequency(int sleep_time)
 		}
 	}
 
-	/* Wait for soak threads to start */
-	usleep(1000000);
+	if (soak_cpus) {
+		/* Wait for soak threads to start */
+		usleep(1000000);
+		check_threads(cpu_freqs, max_thread);
+	}
+
+	if (samples > 1 || !soak_cpus) {
+		rc = sample_core_frequency(cpu_freqs, max_thread, sleep_time,
+					   samples);
+		free(cpu_freqs);
+		return rc;
+	}
 
 	start_counters(cpu_freqs, max_thread);
 	/* Count for specified timeout in seconds */
@@ -871,7 +1591,7 @@ static int do_cpu_frequency(int sleep_time)
 
 #else
 
-static int do_cpu_frequency(int sleep_time)
+static int do_cpu_frequency(int sleep_time, int samples, bool soak_cpus)
 {
 	printf("CPU Frequency determination is not supported on this "
 	       "platfom.\n");
@@ -919,8 +1639,131 @@ static int set_one_core(int smt_state, int core, int state)
 	return rc;
 }
 
+static int core_work_fn(struct core_work *work, int core)
+{
+	return set_one_core(work->smt_state, core, work->state);
+}
+
+/**
+ * core_node
+ * @brief Find the NUMA node of a core
+ *
+ * The node links of a cpu stay in sysfs while the cpu is offline,
+ * unlike its topology directory.
+ *
+ * @returns node id, INT_MAX if it can not be determined
+ */
+static int core_node(int core)
+{
+	char path[SYSFS_PATH_MAX];
+	struct dirent *de;
+	int node = INT_MAX;
+	DIR *d;
+
+	snprintf(path, SYSFS_PATH_MAX, SYSFS_CPUDIR, core * threads_per_cpu);
+	d = opendir(path);
+	if (!d)
+		return node;
+
+	while ((de = readdir(d)) != NULL) {
+		if (!strncmp(de->d_name, "node", 4) &&
+		    sscanf(de->d_name + 4, "%d", &node) == 1)
+			break;
+	}
+
+	closedir(d);
+	return node;
+}
+
+static int *core_nodes;
+
+static int core_node_cmp(const void *a, const void *b)
+{
+	int ca = *(const int *)a, cb = *(const int *)b;
+
+	if (core_nodes[ca] != core_nodes[cb])
+		return core_nodes[ca] < core_nodes[cb] ? -1 : 1;
+
+	return ca - cb;
+}
+
+/**
+ * sort_cores
+ * @brief Order cores by NUMA node, then by core number
+ *
+ * Changing cores in this order fills up, or empties, one node
+ * before moving on to the next one.
+ *
+ * @param cores list of cores to sort
+ * @param nr number of cores in the list
+ * @param reverse non-zero to sort in descending order
+ */
+static void sort_cores(int *cores, int nr, int reverse)
+{
+	int i, tmp;
+
+	core_nodes = calloc(cpus_in_system, sizeof(int));
+	if (!core_nodes)
+		return;
+
+	for (i = 0; i < nr; i++)
+		core_nodes[cores[i]] = core_node(cores[i]);
+
+	qsort(cores, nr, sizeof(*cores), core_node_cmp);
+
+	for (i = 0; reverse && i < nr / 2; i++) {
+		tmp = cores[i];
+		cores[i] = cores[nr - i - 1];
+		cores[nr - i - 1] = tmp;
+	}
+
+	free(core_nodes);
+	core_nodes = NULL;
+}
+
+/**
+ * rollback_cores
+ * @brief Return the cores changed by a failed operation to their state
+ *
+ * Cores that failed partway are also returned, so none is left with
+ * only some of its threads changed.
+ *
+ * @param work the failed operation
+ */
+static void rollback_cores(struct core_work *work)
+{
+	struct core_work undo = {
+		.smt_state = work->smt_state,
+		.state = !work->state,
+		.fn = core_work_fn,
+	};
+	int i;
+
+	undo.cores = calloc(work->nr_cores, sizeof(int));
+	if (!undo.cores) {
+		printf("Unable to roll back the cores that were changed\n");
+		return;
+	}
+
+	for (i = 0; i < work->nr_cores; i++) {
+		if (work->result[work->cores[i]])
+			undo.cores[undo.nr_cores++] = work->cores[i];
+	}
+
+	printf("Rolling back %d cores\n", undo.nr_cores);
+	if (run_core_work(&undo))
+		printf("Unable to roll back all of the cores\n");
+
+	free(undo.cores);
+}
+
 static int do_online_cores(char *cores, int state)
 {
+	struct core_work work = {
+		.state = state,
+		.stop_on_error = 1,
+		.fn = core_work_fn,
+	};
 	int smt_state;
 	int *core_state, *desired_core_state;
 	int i, rc = 0;
@@ -972,6 +1815,7 @@ static int do_online_cores(char *cores, int state)
 		return -1;
 	}
 
+	work.smt_state = smt_state;
 	desired_core_state = calloc(cpus_in_system, sizeof(int));
 	if (!desired_core_state) {
 		free(core_state);
@@ -1012,14 +1856,31 @@ static int do_online_cores(char *cores, int state)
 		return rc;
 	}
 
+	work.cores = calloc(cpus_in_system, sizeof(int));
+	work.result = calloc(cpus_in_system, sizeof(int));
+	if (!work.cores || !work.result) {
+		free(work.cores);
+		free(work.result);
+		free(core_state);
+		free(desired_core_state);
+		return -ENOMEM;
+	}
+
+	/* Cores already in the requested state are left alone, so a
+	 * rollback does not change them either. */
 	for (i = 0; i < cpus_in_system; i++) {
-		if (desired_core_state[i] != -1) {
-			rc = set_one_core(smt_state, i, state);
-			if (rc)
-				break;
-		}
+		if (desired_core_state[i] != -1 && core_state[i] != state)
+			work.cores[work.nr_cores++] = i;
 	}
 
+	/* Either all of the cores are changed, or none is */
+	sort_cores(work.cores, work.nr_cores, !state);
+	rc = run_core_work(&work);
+	if (rc)
+		rollback_cores(&work);
+
+	free(work.cores);
+	free(work.result);
 	free(core_state);
 	free(desired_core_state);
 	return rc;
@@ -1027,10 +1888,11 @@ static int do_online_cores(char *cores, int state)
 
 static int do_cores_on(char *state)
 {
+	struct core_work work = { 0 };
 	int smt_state;
 	int *core_state;
 	int cores_now_online = 0;
-	int i, rc;
+	int i;
 	int number_to_have, number_to_change = 0, number_changed = 0;
 	int new_state;
 	char *end_state;
@@ -1103,28 +1965,30 @@ static int do_cores_on(char *state)
 		new_state = 0;
 	}
 
-	if (new_state) {
-		for (i = 0; i < cpus_in_system; i++) {
-			if (!core_state[i]) {
-				rc = set_one_core(smt_state, i, new_state);
-				if (!rc)
-					number_changed++;
-				if (number_changed >= number_to_change)
-					break;
-			}
-		}
-	} else {
-		for (i = cpus_in_system - 1; i > 0; i--) {
-			if (core_state[i]) {
-				rc = set_one_core(smt_state, i, new_state);
-				if (!rc)
-					number_changed++;
-				if (number_changed >= number_to_change)
-					break;
-			}
-		}
+	work.cores = calloc(cpus_in_system, sizeof(int));
+	if (!work.cores) {
+		free(core_state);
+		return -ENOMEM;
 	}
 
+	/* Any core in the wrong state is a candidate, core 0 is never
+	 * taken offline.  Candidates past the number to change stand in
+	 * for the ones that fail. */
+	for (i = new_state ? 0 : 1; i < cpus_in_system; i++) {
+		if (core_state[i] != new_state)
+			work.cores[work.nr_cores++] = i;
+	}
+
+	work.smt_state = smt_state;
+	work.state = new_state;
+	work.limit = number_to_change;
+	work.fn = core_work_fn;
+
+	sort_cores(work.cores, work.nr_cores, !new_state);
+	run_core_work(&work);
+	number_changed = work.nr_changed;
+	free(work.cores);
+
 	if (number_changed != number_to_change) {
 		cores_now_online = 0;
 		for (i = 0; i < cpus_in_system ; i++) {
@@ -1177,21 +2041,34 @@ static void usage(void)
 "Usage: ppc64_cpu [command] [options]\n"
 "ppc64_cpu --smt [-n]                # Get current SMT state. [-n] shows numeric output\n"
 "ppc64_cpu --smt={on|off}            # Turn SMT on/off\n"
-"ppc64_cpu --smt=X                   # Set SMT state to X\n\n"
+"ppc64_cpu --smt=X                   # Set SMT state to X\n"
+"ppc64_cpu --smt=X [-j <jobs>]       # Change up to <jobs> cores at a time\n\n"
 "ppc64_cpu --cores-present           # Get the number of cores present\n"
 "ppc64_cpu --cores-on                # Get the number of cores currently online\n"
 "ppc64_cpu --cores-on=X              # Put exactly X cores online\n"
 "ppc64_cpu --cores-on=all            # Put all cores online\n\n"
 "ppc64_cpu --online-cores=X[,Y...]   # Put specified cores online\n\n"
-"ppc64_cpu --offline-cores=X[,Y,...] # Put specified cores offline\n\n"
+"ppc64_cpu --offline-cores=X[,Y,...] # Put specified cores offline\n"
+"                                    # [-j <jobs>] changes up to <jobs> cores\n"
+"                                    # at a time with --cores-on too\n\n"
 "ppc64_cpu --dscr                    # Get current DSCR system setting\n"
 "ppc64_cpu --dscr=<val>              # Change DSCR system setting\n"
 "ppc64_cpu --dscr [-p <pid>]         # Get DSCR setting for process <pid>\n"
-"ppc64_cpu --dscr=<val> [-p <pid>]   # Change DSCR setting for process <pid>\n\n"
+"ppc64_cpu --dscr=<val> [-p <pid>]   # Change DSCR setting for process <pid>\n"
+"ppc64_cpu --dscr[=<val>] -p <pid> -a\n"
+"                                    # Get or change DSCR for all threads of <pid>\n"
+"ppc64_cpu --dscr[=<val>] -p <pid> -r\n"
+"                                    # Get or change DSCR for <pid> and descendants\n"
+"ppc64_cpu --dscr[=<val>] -g <cgroup>\n"
+"                                    # Get or change DSCR for all threads of <cgroup>\n\n"
 "ppc64_cpu --run-mode                # Get current diagnostics run mode\n"
 "ppc64_cpu --run-mode=<val>          # Set current diagnostics run mode\n\n"
 "ppc64_cpu --frequency [-t <time>]   # Determine cpu frequency for <time>\n"
-"                                    # seconds, default is 1 second.\n\n"
+"                                    # seconds, default is 1 second.\n"
+"ppc64_cpu --frequency [-t <time>] [-s <samples>] [-w]\n"
+"                                    # Report per core and chip frequency\n"
+"                                    # over <samples> windows, [-w] measures\n"
+"                                    # the running workload without soaking.\n\n"
 "ppc64_cpu --subcores-per-core       # Get number of subcores per core\n"
 "ppc64_cpu --subcores-per-core=X     # Set subcores per core to X (1 or 4)\n"
 "ppc64_cpu --threads-per-core        # Get threads per core\n"
@@ -1221,7 +2098,11 @@ int main(int argc, char *argv[])
 	char *equal_char;
 	int opt;
 	int sleep_time = 1; /* default to one second */
+	int samples = 1;
+	bool soak_cpus = true;
 	bool numeric = false;
+	bool all_threads = false, dscr_tree = false;
+	char *cgroup = NULL;
 	pid_t pid = -1;
 
 	if (argc == 1) {
@@ -1253,7 +2134,7 @@ int main(int argc, char *argv[])
 	/* Now parse out any additional options. */
 	optind = 2;
 	while (1) {
-		opt = getopt(argc, argv, "p:t:n");
+		opt = getopt(argc, argv, "p:arg:t:nj:s:w");
 		if (opt == -1)
 			break;
 
@@ -1269,6 +2150,23 @@ int main(int argc, char *argv[])
 
 			pid = atoi(optarg);
 			break;
+		case 'a':
+		case 'r':
+		case 'g':
+			if (strcmp(action, "dscr")) {
+				fprintf(stderr, "The %c option is only valid "
+					"with the --dscr option\n", opt);
+				usage();
+				exit(-1);
+			}
+
+			if (opt == 'a')
+				all_threads = true;
+			else if (opt == 'r')
+				dscr_tree = true;
+			else
+				cgroup = optarg;
+			break;
 		case 't':
 			/* only valid for --frequency */
 			if (strcmp(action, "frequency")) {
@@ -1280,6 +2178,27 @@ int main(int argc, char *argv[])
 
 			sleep_time = atoi(optarg);
 			break;
+		case 's':
+		case 'w':
+			if (strcmp(action, "frequency")) {
+				fprintf(stderr, "The %c option is only valid "
+					"with the --frequency option\n", opt);
+				usage();
+				exit(-1);
+			}
+
+			if (opt == 'w') {
+				soak_cpus = false;
+				break;
+			}
+
+			samples = atoi(optarg);
+			if (samples <= 0) {
+				fprintf(stderr, "Invalid number of samples: "
+					"%s\n", optarg);
+				exit(-1);
+			}
+			break;
 		case 'n':
 			if (strcmp(action, "smt")) {
 				fprintf(stderr, "The n option is only valid "
@@ -1289,6 +2208,26 @@ int main(int argc, char *argv[])
 			}
 			numeric = true;
 			break;
+		case 'j':
+			if (strcmp(action, "smt") &&
+			    strcmp(action, "cores-on") &&
+			    strcmp(action, "online-cores") &&
+			    strcmp(action, "offline-cores")) {
+				fprintf(stderr, "The j option is only valid "
+					"with the --smt, --cores-on, "
+					"--online-cores and --offline-cores "
+					"options\n");
+				usage();
+				exit(-1);
+			}
+
+			nr_jobs = atoi(optarg);
+			if (nr_jobs <= 0) {
+				fprintf(stderr, "Invalid number of jobs: %s\n",
+					optarg);
+				exit(-1);
+			}
+			break;
 		default:
 			fprintf(stderr, "%c is not a valid option\n", opt);
 			usage();
@@ -1296,14 +2235,26 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if ((all_threads || dscr_tree) && pid == -1) {
+		fprintf(stderr, "The a and r options require the p option\n");
+		usage();
+		exit(-1);
+	}
+
+	if (cgroup && pid != -1) {
+		fprintf(stderr, "The g and p options cannot be combined\n");
+		usage();
+		exit(-1);
+	}
+
 	if (!strcmp(action, "smt"))
 		rc = do_smt(action_arg, numeric);
 	else if (!strcmp(action, "dscr"))
-		rc = do_dscr(action_arg, pid);
+		rc = do_dscr(action_arg, pid, all_threads, dscr_tree, cgroup);
 	else if (!strcmp(action, "run-mode"))
 		rc = do_run_mode(action_arg);
 	else if (!strcmp(action, "frequency"))
-		rc = do_cpu_frequency(sleep_time);
+		rc = do_cpu_frequency(sleep_time, samples, soak_cpus);
 	else if (!strcmp(action, "cores-present"))
 		do_cores_present();
 	else if (!strcmp(action, "cores-on"))
@@ -30,7 +30,6 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <getopt.h>
-#include <dirent.h>
 #include <string.h>
 #include <endian.h>
 #include <sys/syscall.h>
@@ -38,6 +37,7 @@
 #include <linux/unistd.h>
 #include <linux/types.h>
 #include "pseries_platform.h"
+#include "rtas_tokens.h"
 
 /* Syscall number */
 #ifndef __NR_rtas
@@ -46,8 +46,6 @@
 
 #define MAX_ARGS		16
 #define RTAS_DBG_ENABLE		0x81
-#define OFDT_RTAS_PATH		"/proc/device-tree/rtas"
-#define MAX_RTAS_NAME_LEN	80
 
 #ifdef _syscall1
 _syscall1(int, rtas, void *, args);
@@ -65,145 +63,22 @@ struct rtas_args {
 	rtas_arg_t *rets;     /* Pointer to return values in args[]. */
 };
 
-struct rtas_token {
-	struct rtas_token	*next;
-	uint32_t		token;
-	char			*name;
-};
-
 void usage(void)
 {
 	fprintf(stderr, "Usage: rtas_dbg [-l] <rtas token | rtas name>\n");
 	fprintf(stderr, "\t-l    Print the specified rtas token or all tokens if not specified\n");
 }
 
-void free_rtas_tokens(struct rtas_token *tok_list)
-{
-	struct rtas_token *tok;
-
-	while (tok_list != NULL) {
-		tok = tok_list;
-		tok_list = tok->next;
-		free(tok->name);
-		free(tok);
-	}
-}
-
-void insert_token(struct rtas_token *tok, struct rtas_token **tok_listp)
-{
-	struct rtas_token *tmp, *prev = NULL;
-
-	if (*tok_listp == NULL) {
-		tok->next = NULL;
-		*tok_listp = tok;
-		return;
-	}
-
-	/* This list won't get big, just brute force it :) */
-	for (tmp = *tok_listp; tmp; prev = tmp, tmp = tmp->next) {
-		if (strncmp(tmp->name, tok->name, MAX_RTAS_NAME_LEN) >= 0)
-			break;
-	}
-
-	tok->next = tmp;
-	if (prev)
-		prev->next = tok;
-	if (tmp == *tok_listp)
-		*tok_listp = tok;
-}
-
-struct rtas_token *get_rtas_tokens(void)
-{
-	DIR	*dir;
-	struct dirent *dp;
-	struct rtas_token *tok_list = NULL;
-	uint32_t betoken;
-
-	dir = opendir(OFDT_RTAS_PATH);
-	if (dir == NULL) {
-		fprintf(stderr, "Could not open %s:\n%s\n", OFDT_RTAS_PATH,
-			strerror(errno));
-		return NULL;
-	}
-
-	while ((dp = readdir(dir)) != NULL) {
-		FILE *fp;
-		struct rtas_token *tok;
-		char dir[512];
-		int rc;
-
-		if (dp->d_name[0] == '.')
-			continue;
-
-		snprintf(dir, sizeof(dir), "%s/%s", OFDT_RTAS_PATH, dp->d_name);
-
-		fp = fopen(dir, "r");
-		if (fp == NULL) {
-			fprintf(stderr, "Could not get rtas token for %s\n",
-				dp->d_name);
-			continue;
-		}
-
-		rc = fread(&betoken, sizeof(betoken), 1, fp);
-		fclose(fp);
-		if (rc <= 0) {
-			fprintf(stderr, "Could not get rtas token for %s\n",
-				dp->d_name);
-			continue;
-		}
-
-		tok = malloc(sizeof(*tok));
-		if (tok == NULL) {
-			fprintf(stderr, "Could not allocate token list\n");
-			free_rtas_tokens(tok_list);
-			tok_list = NULL;
-			break;
-		}
-
-		tok->token = be32toh(betoken);
-		tok->name = strdup(dp->d_name);
-		insert_token(tok, &tok_list);
-	}
-
-	closedir(dir);
-	return tok_list;
-}
-
-struct rtas_token *get_rtas_token_by_name(char *name,
-					  struct rtas_token *tok_list)
-{
-	struct rtas_token *tok;
-
-	for (tok = tok_list; tok; tok = tok->next) {
-		if (!strncmp(name, tok->name, MAX_RTAS_NAME_LEN))
-			return tok;
-	}
-
-	return NULL;
-}
-
-struct rtas_token *get_rtas_token_by_value(int value,
-					   struct rtas_token *tok_list)
-{
-	struct rtas_token *tok;
-
-	for (tok = tok_list; tok; tok = tok->next) {
-		if (value == tok->token)
-			return tok;
-	}
-
-	return NULL;
-}
-
-void print_rtas_tokens(struct rtas_token *tok, struct rtas_token *tok_list)
+void print_rtas_tokens(struct rtas_token *tok, struct rtas_tokens *tokens)
 {
-	struct rtas_token *t;
+	int i;
 
 	if (tok)
 		printf("%-40s%d\n", tok->name, tok->token);
 	else {
-		for (t = tok_list; t; t = t->next)
-			printf("%-40s%d\n", t->name, t->token);
+		for (i = 0; i < tokens->ntokens; i++)
+			printf("%-40s%d\n", tokens->tokens[i].name,
+			       tokens->tokens[i].token);
 	}
 }
 
@@ -229,7 +104,7 @@ int set_rtas_dbg(struct rtas_token *tok)
 
 int main(int argc, char *argv[])
 {
-	struct rtas_token *tok_list = NULL;
+	struct rtas_tokens *tokens = NULL;
 	struct rtas_token *tok = NULL;
 	int print_tokens = 0;
 	char *dbg_arg = NULL;
@@ -241,8 +116,8 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
-	tok_list = get_rtas_tokens();
-	if (tok_list == NULL)
+	tokens = rtas_tokens_load();
+	if (tokens == NULL)
 		return -1;
 
 	while ((c = getopt(argc, argv, "l")) != -1) {
@@ -257,26 +132,25 @@ int main(int argc, char *argv[])
 
 	if (dbg_arg == NULL) {
 		if (print_tokens) {
-			print_rtas_tokens(NULL, tok_list);
-			free_rtas_tokens(tok_list);
+			print_rtas_tokens(NULL, tokens);
+			rtas_tokens_free(tokens);
 			return 0;
 		}
 
 		fprintf(stderr, "A rtas name or token must be specified\n");
-		free_rtas_tokens(tok_list);
+		rtas_tokens_free(tokens);
 		usage();
 		return -1;
 	}
 
 	if ((dbg_arg[0] >= '0') && (dbg_arg[0] <= '9'))
-		tok = get_rtas_token_by_value(strtol(dbg_arg, NULL, 0),
-					      tok_list);
+		tok = rtas_token_by_value(tokens, strtol(dbg_arg, NULL, 0));
 	else
-		tok = get_rtas_token_by_name(dbg_arg, tok_list);
+		tok = rtas_token_by_name(tokens, dbg_arg);
 
 	if (tok != NULL) {
 		if (print_tokens) {
-			print_rtas_tokens(tok, tok_list);
+			print_rtas_tokens(tok, tokens);
 			rc = 0;
 		} else {
 			rc = set_rtas_dbg(tok);
@@ -288,7 +162,7 @@ int main(int argc, char *argv[])
 		rc = -1;
 	}
 
-	free_rtas_tokens(tok_list);
+	rtas_tokens_free(tokens);
 
 	return rc;
 }
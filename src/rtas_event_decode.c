@@ -30,6 +30,10 @@
  * 'rtas_dump' shell script, which provides a suitable user 
  * interface.
  *
+ * With -s a whole log is read instead, and every RTAS event found
+ * between its "RTAS event begin" and "RTAS event end" lines is decoded,
+ * optionally only those of a type or severity.
+ *
  * Bug fixes June 2004 by Linas Vepstas <linas@linas.org>
  */
 
@@ -43,8 +47,81 @@
 
 #define RTAS_BUF_SIZE   3000
 #define RTAS_STR_SIZE   1024
+#define RTAS_OUT_SIZE   (1024 * 1024)
 char rtas_buf[RTAS_BUF_SIZE];
 
+/**
+ * @var hex_val
+ * @brief value of each hex digit character, -1 for anything else
+ */
+static signed char hex_val[256];
+
+/**
+ * init_hex_val
+ * @brief fill in the hex_val table
+ */
+static void
+init_hex_val(void)
+{
+    int i;
+
+    memset(hex_val, -1, sizeof(hex_val));
+    for (i = 0; i < 10; i++)
+        hex_val['0' + i] = i;
+    for (i = 0; i < 6; i++) {
+        hex_val['a' + i] = 0xa + i;
+        hex_val['A' + i] = 0xa + i;
+    }
+}
+
+/**
+ * hex_to_bin
+ * @brief convert the hex digits of an RTAS log line into binary
+ *
+ * Anything before the ':' following "RTAS" is the line prefix and is
+ * skipped, as is anything in the data that is not a hex digit.
+ *
+ * @param line line of the log
+ * @param msgbuf buffer to write the RTAS event into
+ * @param buflen length of "msgbuf"
+ * @param j bytes of msgbuf filled in so far, updated
+ * @param high 1 if the next digit is the high half of a byte, updated
+ * @return 1 once msgbuf is full, 0 otherwise
+ */
+static int
+hex_to_bin(const char *line, char *msgbuf, size_t buflen, size_t *j,
+           int *high)
+{
+    const unsigned char *p;
+    int val;
+
+    p = (const unsigned char *)strstr(line, "RTAS");
+    if (p)
+        p = (const unsigned char *)strchr((const char *)p, ':');
+    else
+        p = (const unsigned char *)line;
+
+    for (; p && *p; p++) {
+        val = hex_val[*p];
+        if (val < 0)
+            continue;
+
+        if (*high) {
+            msgbuf[*j] = val << 4;
+            *high = 0;
+        } else {
+            msgbuf[(*j)++] |= val;
+            *high = 1;
+        }
+
+        /* Don't overflow the output buffer */
+        if (*j >= buflen)
+            return 1;
+    }
+
+    return 0;
+}
+
 /**
  * get_buffer
  * @brief read an RTAS event in from the specified input
@@ -58,10 +135,9 @@ int
 get_buffer(FILE *fh, char *msgbuf, size_t buflen)
 {
     char tmpbuf[RTAS_STR_SIZE];
-    unsigned int val;
     size_t j = 0;
     int high = 1;
-    char *p, *line;
+    char *line;
    
     memset(msgbuf, 0, buflen);
 
@@ -74,38 +150,8 @@ get_buffer(FILE *fh, char *msgbuf, size_t buflen)
         if (strstr (tmpbuf, "event end")) goto done;
         if (strstr (tmpbuf, "eventend")) goto done;
 
-        /* Skip over the initial part of the line */
-        p = strstr (line, "RTAS");
-        if (p) 
-           p = strchr (p, ':');
-        else 
-            p = line;
-        
-        while (p && *p) {
-            val = 0xff;
-
-	    if (*p >= '0' && *p <= '9') 
-                val = *p - '0';
-            else if (*p >= 'a' && *p <= 'f')
-                val = *p - 'a' + 0xa;
-            else if (*p >= 'A' && *p <= 'F')
-                val = *p - 'A' + 0xa;
-
-            if (val != 0xff) {
-		if (high) {
-		    msgbuf[j] = val << 4;
-		    high = 0;
-		} else { 
-		    msgbuf[j++] |= val; 
-		    high = 1;
-		}
-	    }
-
-            /* Don't overflow the output buffer */
-            if (j >= buflen) 
-                goto done;
-            p++;
-	}
+        if (hex_to_bin(line, msgbuf, buflen, &j, &high))
+            goto done;
 next:
         line = fgets (tmpbuf, RTAS_STR_SIZE, fh);
     }
@@ -114,6 +160,116 @@ done:
     return j;
 }
 
+/**
+ * @var filter_type
+ * @brief only decode events of this type, -1 for all
+ */
+static int filter_type = -1;
+
+/**
+ * @var filter_severity
+ * @brief only decode events of at least this severity, -1 for all
+ */
+static int filter_severity = -1;
+
+/**
+ * event_wanted
+ * @brief check the fixed header of a raw RTAS event against the filters
+ *
+ * The severity is the top three bits of the second byte of the header
+ * and the type its fourth byte, the event does not need decoding to
+ * be filtered out.
+ *
+ * @param msgbuf raw RTAS event
+ * @param len length of "msgbuf"
+ * @return 1 if the event should be decoded, 0 otherwise
+ */
+static int
+event_wanted(const char *msgbuf, int len)
+{
+    if (filter_type == -1 && filter_severity == -1)
+        return 1;
+
+    if (len < 4)
+        return 0;
+
+    if (filter_type != -1 && (unsigned char)msgbuf[3] != filter_type)
+        return 0;
+
+    if (filter_severity != -1 &&
+        ((unsigned char)msgbuf[1] >> 5) < filter_severity)
+        return 0;
+
+    return 1;
+}
+
+/**
+ * stream_events
+ * @brief decode every RTAS event of a log
+ *
+ * Each event is gathered from its "RTAS event begin" line to its
+ * "RTAS event end" line, and numbered by the begin line.
+ *
+ * @param fh log to read the RTAS events from
+ * @param event_no only decode this event, -1 for all
+ * @param dump_raw also dump the raw RTAS events
+ * @param verbose passed to rtas_print_event()
+ * @return 0 on success, 1 if an event could not be decoded
+ */
+static int
+stream_events(FILE *fh, int event_no, int dump_raw, int verbose)
+{
+    struct rtas_event *re;
+    char *line = NULL, *p;
+    size_t linesz = 0, j = 0;
+    int in_event = 0, this_no = -1, high = 1, rc = 0;
+
+    while (getline(&line, &linesz, fh) != -1) {
+        if (strstr(line, "event begin") || strstr(line, "eventbegin")) {
+            p = strstr(line, "RTAS:");
+            this_no = p ? atoi(p + 5) : -1;
+            in_event = (event_no == -1 || this_no == event_no);
+            memset(rtas_buf, 0, sizeof(rtas_buf));
+            j = 0;
+            high = 1;
+            continue;
+        }
+
+        if (!in_event)
+            continue;
+
+        if (strstr(line, "event end") || strstr(line, "eventend")) {
+            in_event = 0;
+            if (!event_wanted(rtas_buf, j))
+                continue;
+
+            re = parse_rtas_event(rtas_buf, j);
+            if (re == NULL) {
+                fprintf(stderr, "Could not decode RTAS event %d\n",
+                        this_no);
+                rc = 1;
+                continue;
+            }
+
+            re->event_no = this_no;
+            if (dump_raw) {
+                rtas_print_raw_event(stdout, re);
+                fprintf(stdout, "\n");
+            }
+            rtas_print_event(stdout, re, verbose);
+            cleanup_rtas_event(re);
+            continue;
+        }
+
+        if (j < sizeof(rtas_buf))
+            hex_to_bin(line, rtas_buf, sizeof(rtas_buf), &j, &high);
+    }
+
+    free(line);
+    fflush(stdout);
+    return rc;
+}
+
 /**
  * usage
  * @brief print the event_decode usage statement
@@ -124,8 +280,16 @@ void
 usage (const char *progname)
 {
     printf("Usage: %s [-dv] [-n eventnum]\n", progname);
+    printf("       %s -s [-dv] [-n eventnum] [-t type] [-e severity] [file]\n",
+           progname);
     printf("-d              dump the raw RTAS event\n");
-    printf("-n eventnum     event number of the RTAS event being dumped\n");
+    printf("-n eventnum     event number of the RTAS event being dumped,\n"
+           "                  with -s only dump that event\n");
+    printf("-s              decode every RTAS event of the log in file,\n"
+           "                  or stdin\n");
+    printf("-t type         only decode events of the specified type\n");
+    printf("-e severity     only decode events of at least the specified\n"
+           "                  severity\n");
     printf("-v              verbose, print all details, not just header\n");
     printf("-w width        limit the output to the specified width, default\n"
            "                  width is 80 characters. The width must be > 0\n"
@@ -140,7 +304,9 @@ main(int argc , char *argv[])
     int     verbose = 0;
     int     dump_raw = 0;
     int     len = 0;
+    int     stream = 0;
     int     c, rtas_buf_len;
+    FILE    *fh = stdin;
 
     switch (get_platform()) {
     case PLATFORM_UNKNOWN:
@@ -152,7 +318,7 @@ main(int argc , char *argv[])
     /* Suppress error messages from getopt */
     opterr = 0;
 
-    while ((c = getopt(argc, argv, "dn:vw:")) != EOF) {
+    while ((c = getopt(argc, argv, "dn:vw:st:e:")) != EOF) {
         switch (c) {
             case 'd':
                 dump_raw = 1;
@@ -163,6 +329,15 @@ main(int argc , char *argv[])
             case 'v':
                 verbose++;
                 break;
+            case 's':
+                stream = 1;
+                break;
+            case 't':
+                filter_type = strtol(optarg, NULL, 0);
+                break;
+            case 'e':
+                filter_severity = strtol(optarg, NULL, 0);
+                break;
             case 'w':
                 if (rtas_set_print_width(atoi(optarg))) {
                     fprintf(stderr, "rtas_dump: (%d) is not a valid print "
@@ -177,6 +352,27 @@ main(int argc , char *argv[])
         }
     }
 
+    init_hex_val();
+
+    if (!stream && (filter_type != -1 || filter_severity != -1)) {
+        fprintf(stderr, "%s: the -t and -e options require -s\n", argv[0]);
+        usage(argv[0]);
+        exit(1);
+    }
+
+    if (stream) {
+        if (optind < argc) {
+            fh = fopen(argv[optind], "r");
+            if (fh == NULL) {
+                perror(argv[optind]);
+                exit(1);
+            }
+        }
+
+        setvbuf(stdout, NULL, _IOFBF, RTAS_OUT_SIZE);
+        return stream_events(fh, event_no, dump_raw, verbose);
+    }
+
     rtas_buf_len = get_buffer(stdin, rtas_buf, RTAS_BUF_SIZE);
 
     re = parse_rtas_event(rtas_buf, rtas_buf_len);
@@ -41,8 +41,9 @@
 #include <librtas.h>
 #include "librtas_error.h"
 #include "pseries_platform.h"
+#include "rtas_tokens.h"
 
-#define PROC_FILE_RTAS_CALL "/proc/device-tree/rtas/ibm,get-vpd"
+#define RTAS_CALL_NAME "ibm,get-vpd"
 #define BUF_SIZE	2048
 #define ERR_BUF_SIZE	40
 
@@ -54,14 +55,16 @@
 #define VPD_CHANGED	-4
 
 /**
- * @struct buf_element
- * @brief List element for data returned by rtas_get_vpd()
+ * @struct vpd_buf
+ * @brief Buffer for the data returned by rtas_get_vpd()
+ *
+ * The buffer grows in BUF_SIZE chunks as needed and is reused for each
+ * location code.
  */
-struct buf_element {
-	char buf[BUF_SIZE];		/**< data buffer for rtas_get_vpd() */
-	struct buf_element *next;
-	unsigned int size;		/**< amount of the buffer filled in 
-					 *   by rtas_get_vpd() */
+struct vpd_buf {
+	char *buf;			/**< data returned by rtas_get_vpd() */
+	size_t len;			/**< amount of the buffer filled in */
+	size_t size;			/**< size of the buffer */
 };
 
 /**
@@ -71,7 +74,7 @@ struct buf_element {
  * @param cmd command name for rtas_ibm_get_vpd invocation (argv[0])
  */
 void print_usage(char *cmd) {
-	printf ("Usage: %s [-l location_code] [-h]\n", cmd);
+	printf ("Usage: %s [-l location_code]... [-h]\n", cmd);
 }
 
 /**
@@ -84,7 +87,8 @@ void print_help(char *cmd)
 {
 	print_usage(cmd);
 	printf ("  -l location_code  print the dynamic VPD for the specified location code\n");
-	printf ("                    if the -l option is not used, all dynamic VPD will be printed\n");
+	printf ("                    may be given several times, if the -l option is not used,\n");
+	printf ("                    all dynamic VPD will be printed\n");
 	printf ("  -h                print this help message\n");
 }
 
@@ -96,37 +100,86 @@ void print_help(char *cmd)
  */
 int check_rtas_call(void) 
 {
-	int fd;
-
-	if ((fd = open(PROC_FILE_RTAS_CALL, O_RDONLY, 0)) == -1) {
-		return 0;
-	}
-	close(fd);
-	return 1;
+	return rtas_token_read(RTAS_CALL_NAME, NULL) == 0;
 }
 
 /**
- * delete_list
- * @brief free all of the elements on a list
+ * get_vpd
+ * @brief gather the dynamic VPD of a location code and print it
  *
- * @param elem pointer to the beginning of the list to delete
- */ 
-void delete_list(struct buf_element *elem) 
+ * The VPD is gathered into vb and printed once complete.  If it
+ * changes while it is gathered, only this location code is started
+ * over.
+ *
+ * @param loc_code location code, "" for all of the dynamic VPD
+ * @param vb buffer to gather the VPD into
+ * @return 0 on success, the exit status of the command otherwise
+ */
+int get_vpd(char *loc_code, struct vpd_buf *vb)
 {
-	if (!elem)
-		return;
-	delete_list(elem->next);
-	free (elem);
-	return;
+	char err_buf[ERR_BUF_SIZE];
+	unsigned int seq = 1, next_seq;
+	unsigned int bytes;
+	char *tmp;
+	int rc;
+
+	vb->len = 0;
+
+	do {
+		if (vb->size - vb->len < BUF_SIZE) {
+			tmp = realloc(vb->buf, vb->size + BUF_SIZE);
+			if (!tmp) {
+				fprintf(stderr, "Out of memory\n");
+				return 5;
+			}
+			vb->buf = tmp;
+			vb->size += BUF_SIZE;
+		}
+
+		bytes = 0;
+		rc = rtas_get_vpd(loc_code, vb->buf + vb->len, BUF_SIZE,
+				seq, &next_seq, &bytes);
+
+		switch (rc) {
+		case CONTINUE:
+			seq = next_seq;
+			/* fall through */
+		case SUCCESS:
+			vb->len += bytes;
+			break;
+		case VPD_CHANGED:
+			seq = 1;
+			vb->len = 0;
+			break;
+		case PARAMETER_ERROR:
+			return 1;
+		case HARDWARE_ERROR:
+			return 2;
+		default:
+			if (is_librtas_error(rc)) {
+				librtas_error(rc, err_buf, ERR_BUF_SIZE);
+				fprintf(stderr, "Could not gather vpd\n%s\n", err_buf);
+			} else {
+				fprintf(stderr, "Could not gather vpd\n");
+			}
+
+	                return 3;
+        	}
+	} while(rc != SUCCESS);
+
+	if (vb->len)
+		fwrite(vb->buf, 1, vb->len, stdout);
+
+	return 0;
 }
 
 int main(int argc, char **argv) 
 {
-	char *loc_code = "";
-	char err_buf[ERR_BUF_SIZE];
-	int rc, c;
-	unsigned int seq = 1, next_seq;
-	struct buf_element *list, *current;
+	char *all_loc_codes[] = { "" };
+	char **loc_codes;
+	int nloc_codes = 0;
+	struct vpd_buf vb = { NULL, 0, 0 };
+	int rc, ret = 0, c, i;
 
 	if (get_platform() != PLATFORM_PSERIES_LPAR) {
 		fprintf(stderr, "%s: is not supported on the %s platform\n",
@@ -140,12 +193,19 @@ int main(int argc, char **argv)
 		return 4;
 	}
 
+	/* every -l location code is kept, there are fewer than argc */
+	loc_codes = calloc(argc, sizeof(*loc_codes));
+	if (!loc_codes) {
+		fprintf(stderr, "Out of memory\n");
+		return 5;
+	}
+
 	/* Parse command line options */
 	opterr = 0;
 	while ((c = getopt (argc, argv, "l:h")) != -1) {
 		switch (c) {
 		case 'l':
-			loc_code = optarg;
+			loc_codes[nloc_codes++] = optarg;
 			break;
 		case 'h':
 			print_help(argv[0]);
@@ -164,82 +224,26 @@ int main(int argc, char **argv)
 		}
 	}
 
-	list = (struct buf_element *)malloc(sizeof(struct buf_element));
-	if (!list) {
-		fprintf(stderr, "Out of memory\n");
-		return 5;
+	if (!nloc_codes) {
+		free(loc_codes);
+		loc_codes = all_loc_codes;
+		nloc_codes = 1;
 	}
-	list->size = 0;
-	list->next = NULL;
-	current = list;
 
-	do {
-		rc = rtas_get_vpd(loc_code, current->buf, BUF_SIZE,
-				seq, &next_seq, &(current->size));
-
-		switch (rc) {
-		case CONTINUE:
-			seq = next_seq;
-			current->next = (struct buf_element *)
-					malloc(sizeof(struct buf_element));
-			if (!current->next) {
-				fprintf(stderr, "Out of memory\n");
-				delete_list(list);
-				return 5;
-			}
-			current = current->next;
-			current->size = 0;
-			current->next = NULL;
-			/* fall through */
-		case SUCCESS:
+	/* the VPD of the other location codes is still printed if one
+	 * fails, the exit status is that of the first failure
+	 */
+	for (i = 0; i < nloc_codes; i++) {
+		rc = get_vpd(loc_codes[i], &vb);
+		if (rc && !ret)
+			ret = rc;
+		if (rc == 5)
 			break;
-		case VPD_CHANGED:
-			seq = 1;
-			delete_list(list);
-			list = (struct buf_element *)
-					malloc(sizeof(struct buf_element));
-			if (!list) {
-				fprintf(stderr, "Out of memory\n");
-				return 5;
-			}
-			list->size = 0;
-			list->next = NULL;
-			current = list;
-			break;
-		case PARAMETER_ERROR:
-			delete_list(list);
-			return 1;
-		case HARDWARE_ERROR:
-			delete_list(list);
-			return 2;
-		default:
-			delete_list(list);
-			if (is_librtas_error(rc)) {
-				librtas_error(rc, err_buf, ERR_BUF_SIZE);
-				fprintf(stderr, "Could not gather vpd\n%s\n", err_buf);
-			} else {
-				fprintf(stderr, "Could not gather vpd\n");
-			}
-
-	                return 3;
-        	}
-	} while(rc != SUCCESS);
-
-	current = list;
-	do {
-		size_t count;
-
-		if (current->size <= 0) 
-			continue;
-		
-		count = fwrite(current->buf, 1, current->size, stdout);
-		if (count < current->size)
-			break;
-
-	} while ((current = (current->next)) != NULL);
+	}
 
-	delete_list(list);
+	free(vb.buf);
+	if (loc_codes != all_loc_codes)
+		free(loc_codes);
 
-	return 0;
+	return ret;
 }
-
@@ -51,14 +51,13 @@
 #include <unistd.h>
 #include <limits.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <librtas.h>
 #include <getopt.h>
 
 #include "librtas_error.h"
 #include "pseries_platform.h"
+#include "nvram_lib.h"
 
-#define NVRAM_PROGRAM     "/usr/sbin/nvram"
 #define PATH_GET_SYSPARM  "/proc/device-tree/rtas/ibm,get-system-parameter"
 #define PATH_SET_SYSPARM  "/proc/device-tree/rtas/ibm,set-system-parameter"
 #define PATH_PARTITION_NO "/proc/device-tree/ibm,partition-no"
@@ -75,6 +74,8 @@ char *call_home_buffer = NULL;  /**< saved rtas call data */
 int nvram_setupcfg = 0;		/**< nvram setupcfg partition availability */
 int nvram_common = 0;		/**< nvram common partition availibility */
 int nvram_ofconfig = 0;		/**< nvram ofconfig partition availability */
+int nvram_loaded = 0;		/**< nvram has been read into "nvram" */
+struct nvram nvram = { .fd = -1 };	/**< copy of nvram, written back on exit */
 
 static struct option long_options[] = {
 	{"surveillance",		optional_argument, NULL, 'S'},
@@ -463,50 +464,28 @@ err_msg(int msg_type, const char *fmt, ...) {
  * update_nvram
  * @brief update the nvram partition
  *
- * This will attempt to fork a child process to execute the nvram
- * command and update the nvram val in the specified partition
+ * The variable is only updated in the copy of nvram in memory, main()
+ * writes the partitions that changed back before exiting.
  *
  * @param var nvram variable to update
  * @param val value to update "var" to
  * @param partition nvram partition to update
- * @return 0 on success, !0 otherwise
+ * @return 1 on success, 0 otherwise
  */
 int
 update_nvram(char *var, char *val, char *partition) {
-	char buf[256];
-	pid_t child;
-	int status;
-	char *nvram_args[] = { "nvram", "--update-config",
-			buf, "-p", partition, NULL };
+	char buf[BUF_SIZE];
+
+	if (!nvram_loaded)
+		return 0;
 
-	strcpy(buf, var);
-	strcat(buf, "=");
-	strcat(buf, val);
+	snprintf(buf, sizeof(buf), "%s=%s", var, val);
 
 	if (verbose > 1)
 		printf("Updating NVRAM: %s(%s) = %s\n", var, partition, val);
 
-	/* fork and exec nvram */
-	child = fork();
-	if (child == -1) {
-		err_msg(ERR_MSG, "Cannot fork utility to update NVRAM\n");
+	if (nvram_set_config_var(&nvram, partition, buf))
 		return 0;
-	}
-	else if (child == 0) {
-		/* child process */
-		if (execv(NVRAM_PROGRAM, nvram_args)) {
-			/* shouldn't get here */
-			err_msg(ERR_MSG, "Could not exec %s to update NVRAM\n",
-				NVRAM_PROGRAM);
-			exit(1);
-		}
-	}
-	else {
-		/* parent process */
-		waitpid (child, &status, 0);
-		if (status)
-			return 0;
-	}
 
 	return 1;
 }
@@ -524,49 +503,22 @@ update_nvram(char *var, char *val, char *partition) {
  */
 int
 retrieve_from_nvram(char *var, char *partition, char *buf, size_t size) {
-	char nvram_args[BUF_SIZE];
-	FILE *fp;
-	int rc, len;
-
-	if ((var == NULL) || (partition == NULL)) return 6;
-
-	/* build the nvram command, checking to ensure the buffer is
-	   not exceeded */
-	len = strlen(NVRAM_PROGRAM);
-	if (len >= BUF_SIZE) return RC_OTHER;
-	strcpy(nvram_args, NVRAM_PROGRAM);
-	len += strlen(" --print-config=");
-	if (len >= BUF_SIZE) return RC_OTHER;
-	strcat(nvram_args, " --print-config=");
-	len += strlen(var);
-	if (len >= BUF_SIZE) return RC_OTHER;
-	strcat(nvram_args, var);
-	len += strlen(" -p ");
-	if (len >= BUF_SIZE) return RC_OTHER;
-	strcat(nvram_args, " -p ");
-	len += strlen(partition);
-	if (len >= BUF_SIZE) return RC_OTHER;
-	strcat(nvram_args, partition);
+	char *value;
+
+	if ((var == NULL) || (partition == NULL)) return RC_OTHER;
 
 	if (verbose > 1)
 		printf("Retrieving from nvram: %s(%s)\n", var, partition);
 
-	/* open a pipe to nvram */
-	if ((fp = popen(nvram_args, "r")) == NULL) {
-		err_msg(ERR_MSG, "Cannot open a pipe with NVRAM "
-				"retrieval utility.\n");
-		return RC_OTHER;
-	}
-	rc = fread(buf, 1, size, fp);
-	buf[rc-1] = '\0';
-	rc = pclose(fp);
-
-	if ((int8_t)WEXITSTATUS(rc) == (int8_t)-1) {
+	value = nvram_loaded ?
+		nvram_get_config_var(&nvram, partition, var) : NULL;
+	if (value == NULL) {
 		if (verbose > 1)
 			err_msg(WARN_MSG, "Cannot find the variable %s\n", var);
 		return RC_NO_VAR;
 	}
 
+	snprintf(buf, size, "%s", value);
 	return RC_SUCCESS;
 }
 
@@ -1476,8 +1428,8 @@ find_and_update_var(char *name, char *val, int include_others, int print) {
 	return RC_SUCCESS;
 }
 
-int 
-main(int argc, char *argv[]) {
+static int
+serv_config(int argc, char *argv[]) {
 	int rc, option_index, validated = 0, i, j, s;
 	int interactive_mode=0, macro_mode=0;
 	int force_flag=0, l_flag=0, e_flag=0, z_flag=0;
@@ -1701,23 +1653,20 @@ main(int argc, char *argv[]) {
 			printf("ibm,set-system-parameter is supported\n");
 	}
 
-	/* Check for the existence of the NVRAM partitions */
-	if ((fp = popen("/usr/sbin/nvram --partitions", "r")) == NULL) {
-		err_msg(ERR_MSG, "Cannot open a pipe with NVRAM "
-				"retrieval utility.\n");
-		return 2;
-	}
-	rc = fread(buffer, 1, BUF_SIZE, fp);
-	if (!ferror(fp)) {
-		buffer[rc] = '\0';
-		if (strstr(buffer, "ibm,setupcfg"))
+	/* Read NVRAM once, all of the variables are looked up and updated
+	 * in this copy.
+	 */
+	nvram.verbose = verbose > 1;
+	nvram.read_only = l_flag;
+	if (nvram_open(&nvram) == 0) {
+		nvram_loaded = 1;
+		if (nvram_find_partition(&nvram, 0, "ibm,setupcfg", NULL))
 			nvram_setupcfg = 1;
-		if (strstr(buffer, "common"))
+		if (nvram_find_partition(&nvram, 0, "common", NULL))
 			nvram_common = 1;
-		if (strstr(buffer, "of-config"))
+		if (nvram_find_partition(&nvram, 0, "of-config", NULL))
 			nvram_ofconfig = 1;
 	}
-	pclose(fp);
 
 	if (verbose > 1) {
 		printf("ibm,setupcfg NVRAM partition %s.\n",
@@ -1930,3 +1879,24 @@ main(int argc, char *argv[]) {
 	if (call_home_buffer) free(call_home_buffer);
 	return 0;
 }
+
+int
+main(int argc, char *argv[]) {
+	int rc;
+
+	rc = serv_config(argc, argv);
+
+	if (nvram_loaded) {
+		if (nvram_flush(&nvram)) {
+			err_msg(ERR_MSG, "Could not write the updated "
+				"variables back to NVRAM\n");
+			if (!rc)
+				rc = RC_HW_ERROR;
+		}
+	}
+
+	/* Also frees what a failed nvram_open() left behind */
+	nvram_close(&nvram);
+
+	return rc;
+}
@@ -72,8 +72,9 @@
 #include <librtas.h>
 #include "librtas_error.h"
 #include "pseries_platform.h"
+#include "rtas_tokens.h"
 
-#define PROC_FILE_RTAS_CALL "/proc/device-tree/rtas/set-time-for-power-on"
+#define RTAS_CALL_NAME "set-time-for-power-on"
 #define PROC_FILE_MAX_LATENCY "/proc/device-tree/rtas/power-on-max-latency"
 #define ERROR_BUF_SIZE 40
 
@@ -132,13 +133,7 @@ void print_help(char *cmd) {
  * @return 0 on success, !0 otherwise
  */
 int check_rtas_call(void) {
-	int fd;
-
-	if ((fd = open(PROC_FILE_RTAS_CALL, O_RDONLY, 0)) == -1) {
-		return 0;
-	}
-	close(fd);
-	return 1;
+	return rtas_token_read(RTAS_CALL_NAME, NULL) == 0;
 }
 
 /**
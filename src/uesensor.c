@@ -59,6 +59,10 @@
  * may not be unique (for example, there may be multiple voltage sensors on
  * a planar).
  *
+ * When all sensors are listed, they can also be sampled repeatedly on an
+ * interval, and streamed as csv or json records.  The list of sensors and
+ * their location codes are then read from the device tree only once.
+ *
  * @author Michael Strosaker <strosake@us.ibm.com>
  */
 
@@ -74,9 +78,22 @@
 
 #include "librtas_error.h"
 #include "pseries_platform.h"
+#include "record_output.h"
+#include "sample_timer.h"
 
 #define BUF_SIZE		1024
 #define PATH_RTAS_SENSORS	"/proc/device-tree/rtas/rtas-sensors"
+#define LOC_CODE_SIZE		80
+
+/**
+ * @struct sensor
+ * @brief a sensor, and its location code read once from the device tree
+ */
+struct sensor {
+	uint32_t	token;
+	uint32_t	index;
+	char		loc_code[LOC_CODE_SIZE];
+};
 
 /**
  * @var status_text
@@ -105,14 +122,18 @@ char *cmd;
  */
 void
 print_usage (char *cmd) {
-	printf("Usage: %s [-l | -a] [-t token -i index [-v]]\n"
+	printf("Usage: %s [-l | -a | -o csv|json] [interval [count]]\n"
+		"       %s [-t token -i index [-v]]\n"
 		"\t-l: list all sensor values in a text format\n"
 		"\t-a: list all sensor values in a tabular format\n"
+		"\t-o: stream all sensor values as csv or json records\n"
+		"\tinterval: sample all sensors every interval seconds,\n"
+		"\t    count times or until interrupted\n"
 		"\t-t: specify the token of the sensor to query\n"
 		"\t-i: specify the index of the sensor to query\n"
 		"\t-v: return the measured value of the sensor, rather than\n"
 		"\t    the sensor status which is returned by default\n",
-		cmd);
+		cmd, cmd);
 	return;
 }
 
@@ -191,55 +212,117 @@ get_sensor (int token, int index, int *state) {
 }
 
 /**
- * get_location_code
- * @brief retrieve the locations code for a specified token and index
+ * get_location_codes
+ * @brief retrieve the location codes of the sensors of a token
  *
- * @param token rtas token for the location code
- * @param index rtas index for the location code
- * @param buffer buffer to put location code into
- * @param size size of "buffer"
- * @return 1 on success, 0 on failure
+ * The ibm,sensor-<token> property lists the location code of each
+ * index of the token.  The location codes of the indexes that are not
+ * listed are left empty.
+ *
+ * @param token rtas token of the sensors
+ * @param sensors sensors of the token, indexes 0 to nsensors - 1
+ * @param nsensors number of sensors
  */
-int
-get_location_code (int token, int index, char *buffer, size_t size) {
+void
+get_location_codes (int token, struct sensor *sensors, int nsensors) {
 	int fd, i, len;
 	char filename[45], temp[4096], *pos;
 
-	if ((size == 0) || (buffer == NULL))
-		return 0;
+	for (i = 0; i < nsensors; i++)
+		sensors[i].loc_code[0] = '\0';
 
-	buffer[0] = '\0';
 	sprintf(filename, "/proc/device-tree/rtas/ibm,sensor-%04d", token);
 
 	fd = open(filename, O_RDONLY);
 	if (fd < 0)
-		return 0;
+		return;
 
-	if ((len = read(fd, temp, 4096)) < 0) {
-		close(fd);	
-		return 0;
-	}
+	len = read(fd, temp, sizeof(temp) - 1);
+	close(fd);
+	if (len <= 0)
+		return;
+	temp[len] = '\0';
 
 	pos = temp;
+	for (i = 0; i < nsensors && pos < temp + len; i++) {
+		size_t n = strnlen(pos, LOC_CODE_SIZE - 1);
 
-	for (i=0; i<index; i++) {
-		pos += strlen(pos)+1;
-		if (pos >= temp + len) {
-			close(fd);
-			return 0;
+		memcpy(sensors[i].loc_code, pos, n);
+		sensors[i].loc_code[n] = '\0';
+		pos += strlen(pos) + 1;
+	}
+}
+
+/**
+ * load_sensors
+ * @brief enumerate the supported sensors and their location codes
+ *
+ * @param sensorsp set to the array of sensors, to be freed by the caller
+ * @return number of sensors, -1 on failure
+ */
+int
+load_sensors (struct sensor **sensorsp) {
+	struct sensor *sensors = NULL, *tmp;
+	uint32_t buf[2], tok, max_index, i;
+	int fd, rc, nsensors = 0;
+
+	/* no sensors are listed without one */
+	*sensorsp = NULL;
+	fd = open(PATH_RTAS_SENSORS, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	while ((rc = read(fd, buf, sizeof(buf))) == sizeof(buf)) {
+		tok = be32toh(buf[0]);
+		max_index = be32toh(buf[1]);
+
+		if ((tok != 3) && (tok != 9001) &&
+				(tok != 9002) && (tok != 9004))
+			continue;
+
+		tmp = realloc(sensors, (nsensors + max_index + 1) *
+			      sizeof(*sensors));
+		if (tmp == NULL) {
+			err_msg(ERR_MSG, "Could not allocate the list of "
+				"sensors.\n");
+			rc = -1;
+			break;
+		}
+		sensors = tmp;
+
+		for (i = 0; i <= max_index; i++) {
+			sensors[nsensors + i].token = tok;
+			sensors[nsensors + i].index = i;
 		}
+		get_location_codes(tok, &sensors[nsensors], max_index + 1);
+		nsensors += max_index + 1;
 	}
 
-	strncpy(buffer, pos, size);
 	close(fd);
 
-	return 1;
+	if (rc != 0) {
+		if (rc > 0)
+			err_msg(ERR_MSG, "Error reading the list of "
+				"sensors.\n");
+		free(sensors);
+		return -1;
+	}
+
+	*sensorsp = sensors;
+	return nsensors;
 }
 
 #define PRINT_STATUS	0	/**< print the sensor status only */
 #define PRINT_VALUE	1	/**< print the measured value only */
 #define PRINT_TABULAR	2	/**< print the sensor/values as a table */
 #define PRINT_TEXT	3	/**< print the sensor/values verbosely */
+#define PRINT_RECORD	4	/**< stream the sensor/values as records */
+
+/**
+ * @var record
+ * @brief csv or json records being streamed with -o
+ */
+struct record record;
 
 /**
  * print_sensor
@@ -247,13 +330,14 @@ get_location_code (int token, int index, char *buffer, size_t size) {
  *
  * @param token rtas token of sensor to print
  * @param index rtas index of sensor to print
+ * @param loc_code location code of the sensor
  * @param verbosity verbose level
  * @return 1 on success, 0 on failure
  */
 int
-print_sensor (uint32_t token, uint32_t index, int verbosity) {
+print_sensor (uint32_t token, uint32_t index, const char *loc_code,
+	      int verbosity) {
 	int status, state;
-	char loc_buf[80];
 
 	status = get_sensor (token, index, &state);
 
@@ -269,8 +353,16 @@ print_sensor (uint32_t token, uint32_t index, int verbosity) {
 		break;
 	case PRINT_TABULAR:
 		printf("%d %d %d %d ", token, index, status, state);
-		get_location_code(token, index, loc_buf, 80);
-		printf("%s\n", loc_buf);
+		printf("%s\n", loc_code);
+		break;
+	case PRINT_RECORD:
+		record_begin(&record);
+		record_add_uint(&record, "token", token);
+		record_add_uint(&record, "index", index);
+		record_add_int(&record, "status", status);
+		record_add_int(&record, "value", state);
+		record_add_str(&record, "location", loc_code);
+		record_end(&record);
 		break;
 	case PRINT_TEXT:
 		switch (token) {
@@ -300,8 +392,7 @@ print_sensor (uint32_t token, uint32_t index, int verbosity) {
 			printf("Status = %d\n", status);
 			printf("Value = %d\n", state);
 		}
-		get_location_code(token, index, loc_buf, 80);
-		printf("Location Code = %s\n\n", loc_buf);
+		printf("Location Code = %s\n\n", loc_code);
 		break;
 	default:
 		return 0;
@@ -310,12 +401,53 @@ print_sensor (uint32_t token, uint32_t index, int verbosity) {
 	return 1;
 }
 
+/**
+ * sample_sensors
+ * @brief print all of the sensors, count times on an interval
+ *
+ * @param sensors sensors to print
+ * @param nsensors number of sensors
+ * @param verbosity PRINT_TEXT, PRINT_TABULAR or PRINT_RECORD
+ * @param interval seconds between samples, 0 to print them once
+ * @param count number of samples, 0 to sample until interrupted
+ * @return 0 on success, !0 if the records could not be written
+ */
+int
+sample_sensors (struct sensor *sensors, int nsensors, int verbosity,
+		double interval, int count) {
+	struct sample_timer timer;
+	int i, n;
+
+	sample_timer_start(&timer, interval);
+
+	for (n = 1; ; n++) {
+		for (i = 0; i < nsensors; i++)
+			print_sensor(sensors[i].token, sensors[i].index,
+				     sensors[i].loc_code, verbosity);
+
+		if (verbosity == PRINT_RECORD) {
+			if (record_flush(&record))
+				return 1;
+		} else {
+			fflush(stdout);
+		}
+
+		if (!interval || n == count)
+			break;
+		if (sample_timer_wait(&timer))
+			break;
+	}
+
+	return 0;
+}
+
 int
 main (int argc, char **argv)
 {
 	int c, text=0, numerical=0, measured=0, i;
-	int fd, rc;
-	uint32_t tok, max_index;
+	int rc, nsensors, count = 0;
+	double interval = 0;
+	struct sensor *sensors;
 	char *token=NULL, *index=NULL;
 
 	cmd = argv[0];
@@ -325,7 +457,7 @@ main (int argc, char **argv)
 		return 1;
 	}
 
-	while ((c = getopt (argc, argv, "hlat:i:v")) != -1) {
+	while ((c = getopt (argc, argv, "hlat:i:vo:")) != -1) {
 
 		switch (c) {
 		case 'h':
@@ -346,6 +478,12 @@ main (int argc, char **argv)
 		case 'v':
 			measured = 1;
 			break;
+		case 'o':
+			if (record_parse_format(optarg, &record.format)) {
+				print_usage (argv[0]);
+				return 1;
+			}
+			break;
 		case '?':
 			if (isprint (optopt))
 				fprintf(stderr,
@@ -363,6 +501,21 @@ main (int argc, char **argv)
 	}
 
 	/* Option checking */
+	if (optind < argc && !token &&
+	    (text || numerical || record.format != RECORD_NONE)) {
+		if (parse_interval(argv[optind++], &interval)) {
+			fprintf(stderr, "Invalid interval specified\n");
+			return 1;
+		}
+		if (optind < argc) {
+			count = atoi(argv[optind++]);
+			if (count <= 0) {
+				fprintf(stderr, "Invalid count specified\n");
+				return 1;
+			}
+		}
+	}
+
 	for (i = optind; i < argc; i++) {
 		fprintf(stderr,
 			"Unrecognized argument %s\n", argv[i]);
@@ -382,22 +535,23 @@ main (int argc, char **argv)
 		return 1;
 	}
 
-	if (!token && !text && !numerical) {
+	if (!token && !text && !numerical && record.format == RECORD_NONE) {
 		print_usage (argv[0]);
 		return 1;
 	}
 
-	if (text && numerical) {
+	if (text + numerical + (record.format != RECORD_NONE) > 1) {
 		fprintf(stderr,
-			"The -l and -a options cannot be used together.\n");
+			"The -l, -a and -o options cannot be used "
+			"together.\n");
 		print_usage (argv[0]);
 		return 1;
 	}
 
-	if (token && (text || numerical)) {
+	if (token && (text || numerical || record.format != RECORD_NONE)) {
 		fprintf(stderr,
 			"The -t and -i options cannot be used with either "
-			"-l or -a.\n");
+			"-l, -a or -o.\n");
 		print_usage (argv[0]);
 		return 1;
 	}
@@ -411,7 +565,7 @@ main (int argc, char **argv)
 	}
 
 	if (token) {
-		rc = print_sensor(atoi(token), atoi(index),
+		rc = print_sensor(atoi(token), atoi(index), "",
 			measured?PRINT_VALUE:PRINT_STATUS);
 		if (!rc) {
 			err_msg(ERR_MSG,
@@ -421,32 +575,20 @@ main (int argc, char **argv)
 		}
 	}
 
-	if (text || numerical) {
+	if (!token) {
 		/* Print the status/value of all sensors */
-		fd = open(PATH_RTAS_SENSORS, O_RDONLY);
-
-		while (read(fd, (char *)&tok, sizeof(uint32_t)) ==
-					sizeof(uint32_t)) {
-			tok = be32toh(tok);
-			rc = read(fd, (char *)&max_index, sizeof(uint32_t));
-			max_index=be32toh(max_index);
-			if (rc != sizeof(uint32_t)) {
-				err_msg(ERR_MSG, "Error reading the "
-						"list of sensors.\n");
-				return 2;
-			}
-
-			if ((tok == 3) || (tok == 9001) ||
-					(tok == 9002) || (tok == 9004)) {
-				for (i = 0; i <= max_index; i++) {
-					rc = print_sensor(tok, i,
-						text?PRINT_TEXT:PRINT_TABULAR);
-				}
-			}
-
-		}
+		nsensors = load_sensors(&sensors);
+		if (nsensors < 0)
+			return 2;
 
-		close(fd);
+		rc = sample_sensors(sensors, nsensors,
+				    text ? PRINT_TEXT :
+				    numerical ? PRINT_TABULAR : PRINT_RECORD,
+				    interval, count);
+		free(sensors);
+		record_free(&record);
+		if (rc)
+			return 2;
 	}
 
 	return 0;
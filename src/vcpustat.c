@@ -29,15 +29,22 @@
 #include <signal.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <dirent.h>
 #include "pseries_platform.h"
+#include "record_output.h"
+#include "sample_timer.h"
+#include "sample_core.h"
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#endif
 
 #define VCPUSTAT_FILE	"/proc/powerpc/vcpudispatch_stats"
-#define NR_CPUS 4096
 
 struct vcpudispatch_stat {
-	unsigned long idx;
+	int cpu;
 	int total;
 	int same_cpu;
 	int same_chip;
@@ -48,66 +55,227 @@ struct vcpudispatch_stat {
 	int far_numa_node;
 };
 
-unsigned long idx;
-int retain_stats, numeric_stats, raw_stats, stats_off, intr;
+/* Statistics of the cpus listed in one read of VCPUSTAT_FILE, in
+ * ascending cpu order.
+ */
+struct vcpu_sample {
+	struct vcpudispatch_stat *stats;
+	int nr;
+	int sz;
+};
+
+enum cpu_group {
+	GROUP_NONE,
+	GROUP_CORE,
+	GROUP_CHIP,
+	GROUP_NODE,
+};
+
+static const char *group_names[] = {"cpu", "core", "chip", "node"};
+
+/* Dispatch statistics rolled up for a core, chip or node */
+struct group_stat {
+	int id;
+	struct vcpudispatch_stat stat;	/* sum over the cpus of the group */
+	int *far;			/* far dispatches, per window slot */
+	int *total;			/* dispatches, per window slot */
+};
+
+long long sample_time, interval_us;
+int retain_stats, numeric_stats, raw_stats, stats_off, all_stats, intr;
+struct record record;
+
+enum cpu_group group_by;
+int window = 10;
+
+static struct sample_file stats_file = SAMPLE_FILE_INIT(VCPUSTAT_FILE);
+
+/* Per-cpu counters sampled along with the dispatch statistics by --all */
+enum all_counter_id {
+	AC_PURR,
+	AC_SPURR,
+	AC_CYCLES,
+	AC_MAX
+};
+
+static const struct cpu_counter all_counters[AC_MAX] = {
+	[AC_PURR]	= { .name = "purr", .base = 16 },
+	[AC_SPURR]	= { .name = "spurr", .base = 16, .optional = true },
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	[AC_CYCLES]	= { .name = "cycles", .perf = true,
+			    .perf_type = PERF_TYPE_HARDWARE,
+			    .perf_config = PERF_COUNT_HW_CPU_CYCLES,
+			    .optional = true },
+#else
+	[AC_CYCLES]	= { .name = "cycles", .perf = true, .optional = true },
+#endif
+};
+
+static struct cpu_sampler all_sampler;
 
-int read_stats(struct vcpudispatch_stat stats[])
+/**
+ * scan_int
+ * @brief Parse a decimal integer preceded by blanks
+ *
+ * @param p position to parse at, advanced past the integer
+ * @param val parsed value
+ * @returns 0 on success, -1 if there is no integer at p
+ */
+static inline int scan_int(char **p, int *val)
 {
-	struct vcpudispatch_stat stat;
-	int cpu, rc = -1;
-	char buf[144];
-	FILE *f;
+	char *c = *p;
+	int neg = 0, v = 0;
 
-	f = fopen(VCPUSTAT_FILE, "r");
-	if (!f) {
-		fprintf(stderr, "Could not open %s\n", VCPUSTAT_FILE);
-		return -1;
+	while (*c == ' ' || *c == '\t')
+		c++;
+
+	if (*c == '-') {
+		neg = 1;
+		c++;
 	}
 
-	if ((fgets(buf, 144, f)) == NULL) {
+	if (*c < '0' || *c > '9')
+		return -1;
+
+	while (*c >= '0' && *c <= '9')
+		v = v * 10 + (*c++ - '0');
+
+	*val = neg ? -v : v;
+	*p = c;
+	return 0;
+}
+
+static int stat_cmp(const void *a, const void *b)
+{
+	return ((const struct vcpudispatch_stat *)a)->cpu -
+	       ((const struct vcpudispatch_stat *)b)->cpu;
+}
+
+int read_stats(struct vcpu_sample *sample)
+{
+	struct vcpudispatch_stat *stat;
+	int sorted = 1;
+	long long now;
+	char *p;
+
+	if (sample_file_read(&stats_file, 0, false) < 0)
+		return -1;
+
+	p = stats_file.buf;
+	if (*p == '\0') {
 		fprintf(stderr, "Could not read %s\n", VCPUSTAT_FILE);
-		goto out;
+		return -1;
 	}
 
-	if (!strncmp(buf, "off", 3)) {
+	if (!strncmp(p, "off", 3)) {
 		stats_off = 1;
-		rc = 0; /* not an error */
-		goto out;
+		return 0; /* not an error */
 	} else
 		stats_off = 0;
 
-	idx++;
+	now = monotonic_usecs();
+	interval_us = now - sample_time;
+	sample_time = now;
 
-	do {
-		rc = sscanf(buf, "cpu%d %d %d %d %d %d %d %d %d", &cpu,
-				  &stat.total, &stat.same_cpu, &stat.same_chip,
-				  &stat.same_package, &stat.diff_package,
-				  &stat.home_numa_node, &stat.next_numa_node,
-				  &stat.far_numa_node);
-		if (rc != 9) {
-			fprintf(stderr, "Error parsing %s\n", VCPUSTAT_FILE);
-			goto out;
-		}
-		if (cpu < 0 || cpu >= NR_CPUS) {
-			fprintf(stderr, "Cpu (%d) out of range\n", cpu);
-			goto out;
+	sample->nr = 0;
+	while (*p != '\0') {
+		if (sample->nr == sample->sz) {
+			int sz = sample->sz ? sample->sz * 2 : 256;
+
+			stat = realloc(sample->stats, sz * sizeof(*stat));
+			if (!stat) {
+				fprintf(stderr, "Error allocating memory for stats\n");
+				return -1;
+			}
+
+			sample->stats = stat;
+			sample->sz = sz;
 		}
-		stat.idx = idx;
-		stats[cpu] = stat;
-	} while (!intr && (fgets(buf, 144, f)) != NULL);
 
-	rc = 0;
+		stat = &sample->stats[sample->nr];
+
+		if (strncmp(p, "cpu", 3))
+			goto parse_error;
+		p += 3;
+
+		if (scan_int(&p, &stat->cpu) || stat->cpu < 0 ||
+		    scan_int(&p, &stat->total) ||
+		    scan_int(&p, &stat->same_cpu) ||
+		    scan_int(&p, &stat->same_chip) ||
+		    scan_int(&p, &stat->same_package) ||
+		    scan_int(&p, &stat->diff_package) ||
+		    scan_int(&p, &stat->home_numa_node) ||
+		    scan_int(&p, &stat->next_numa_node) ||
+		    scan_int(&p, &stat->far_numa_node))
+			goto parse_error;
+
+		if (sample->nr && stat->cpu <= stat[-1].cpu)
+			sorted = 0;
+		sample->nr++;
+
+		/* skip to the next line */
+		while (*p != '\0' && *p != '\n')
+			p++;
+		while (*p == '\n')
+			p++;
+	}
 
-out:
-	fclose(f);
-	return rc;
+	if (!sorted)
+		qsort(sample->stats, sample->nr, sizeof(*sample->stats),
+		      stat_cmp);
+
+	return 0;
+
+parse_error:
+	fprintf(stderr, "Error parsing %s\n", VCPUSTAT_FILE);
+	return -1;
 }
 
-void print_alltime_stats(struct vcpudispatch_stat stats[])
+/**
+ * next_stat
+ * @brief Find the previous statistics of a cpu
+ *
+ * Both samples are in ascending cpu order, so the search resumes
+ * where the last one left off.
+ *
+ * @param sample previous sample
+ * @param pos search position, advanced past the cpus already handled
+ * @param cpu cpu to find
+ * @returns the statistics of the cpu, NULL if it is not in the sample
+ */
+static struct vcpudispatch_stat *next_stat(struct vcpu_sample *sample,
+					   int *pos, int cpu)
+{
+	while (*pos < sample->nr && sample->stats[*pos].cpu < cpu)
+		(*pos)++;
+
+	if (*pos < sample->nr && sample->stats[*pos].cpu == cpu)
+		return &sample->stats[*pos];
+
+	return NULL;
+}
+
+static void diff_stat(struct vcpudispatch_stat *stat,
+		      struct vcpudispatch_stat *new,
+		      struct vcpudispatch_stat *old)
+{
+	stat->cpu = new->cpu;
+	stat->total = new->total - old->total;
+	stat->same_cpu = new->same_cpu - old->same_cpu;
+	stat->same_chip = new->same_chip - old->same_chip;
+	stat->same_package = new->same_package - old->same_package;
+	stat->diff_package = new->diff_package - old->diff_package;
+	stat->home_numa_node = new->home_numa_node - old->home_numa_node;
+	stat->next_numa_node = new->next_numa_node - old->next_numa_node;
+	stat->far_numa_node = new->far_numa_node - old->far_numa_node;
+}
+
+void print_alltime_stats(struct vcpu_sample *sample)
 {
 	char raw_header1[] = "%22s %43s | %32s\n";
 	char raw_header2[] = "%-7s | %10s | %10s %10s %10s %10s | %10s %10s %10s\n";
 	char raw_fmt[] = "cpu%-4d | %10d | %10d %10d %10d %10d | %10d %10d %10d\n";
+	struct vcpudispatch_stat *stat;
 	int i;
 
 	printf(raw_header1, " ",
@@ -117,23 +285,72 @@ void print_alltime_stats(struct vcpudispatch_stat stats[])
 					"core", "chip", "socket", "cec",
 					"home", "adj", "far");
 
-	for (i = 0; i < NR_CPUS; i++) {
-		if (!stats[i].idx)
-			continue;
+	for (i = 0; i < sample->nr; i++) {
+		stat = &sample->stats[i];
 
-		printf(raw_fmt, i,
-			stats[i].total, stats[i].same_cpu, stats[i].same_chip,
-			stats[i].same_package, stats[i].diff_package,
-			stats[i].home_numa_node, stats[i].next_numa_node,
-			stats[i].far_numa_node);
+		printf(raw_fmt, stat->cpu,
+			stat->total, stat->same_cpu, stat->same_chip,
+			stat->same_package, stat->diff_package,
+			stat->home_numa_node, stat->next_numa_node,
+			stat->far_numa_node);
 	}
 
 	printf("\n");
 	fflush(stdout);
 }
 
-void print_stats(struct vcpudispatch_stat stats1[],
-		 struct vcpudispatch_stat stats2[])
+/**
+ * print_stats_records
+ * @brief Stream one machine readable record per cpu
+ *
+ * All of the records of a sample go out in a single write.
+ *
+ * @param sample1 previous sample, NULL to report the raw counts of sample2
+ * @param sample2 current sample
+ */
+void print_stats_records(struct vcpu_sample *sample1,
+			 struct vcpu_sample *sample2)
+{
+	struct vcpudispatch_stat stat, *old, zero;
+	int i, pos = 0;
+
+	if (stats_off)
+		return;
+
+	memset(&zero, 0, sizeof(zero));
+
+	for (i = 0; i < sample2->nr; i++) {
+		old = &zero;
+
+		if (sample1) {
+			old = next_stat(sample1, &pos, sample2->stats[i].cpu);
+			if (!old)
+				continue;
+			if (raw_stats)
+				old = &zero;
+		}
+
+		diff_stat(&stat, &sample2->stats[i], old);
+
+		record_begin(&record);
+		if (sample1)
+			record_add_int(&record, "interval_us", interval_us);
+		record_add_int(&record, "cpu", stat.cpu);
+		record_add_int(&record, "total", stat.total);
+		record_add_int(&record, "core", stat.same_cpu);
+		record_add_int(&record, "chip", stat.same_chip);
+		record_add_int(&record, "socket", stat.same_package);
+		record_add_int(&record, "cec", stat.diff_package);
+		record_add_int(&record, "home", stat.home_numa_node);
+		record_add_int(&record, "adj", stat.next_numa_node);
+		record_add_int(&record, "far", stat.far_numa_node);
+		record_end(&record);
+	}
+
+	record_flush(&record);
+}
+
+void print_stats(struct vcpu_sample *sample1, struct vcpu_sample *sample2)
 {
 	char percent_header1[] = "%35s | %20s\n";
 	char percent_header2[] = "%-7s %6s %6s %6s %6s | %6s %6s %6s\n";
@@ -141,8 +358,8 @@ void print_stats(struct vcpudispatch_stat stats1[],
 	char raw_header1[] = "%22s %43s | %32s\n";
 	char raw_header2[] = "%-7s | %10s | %10s %10s %10s %10s | %10s %10s %10s\n";
 	char raw_fmt[] = "cpu%-4d | %10d | %10d %10d %10d %10d | %10d %10d %10d\n";
-	struct vcpudispatch_stat stat;
-	int i;
+	struct vcpudispatch_stat stat, *old, *new;
+	int i, pos = 0;
 
 	if (stats_off) {
 		printf("off\n");
@@ -163,35 +380,29 @@ void print_stats(struct vcpudispatch_stat stats1[],
 					"home", "adj", "far");
 	}
 
-	for (i = 0; i < NR_CPUS; i++) {
-		if (stats2[i].idx != idx || stats1[i].idx != (idx - 1))
+	for (i = 0; i < sample2->nr; i++) {
+		new = &sample2->stats[i];
+		old = next_stat(sample1, &pos, new->cpu);
+		if (!old)
 			continue;
 
-		if (!raw_stats) {
-			stat.total = stats2[i].total - stats1[i].total;
-			stat.same_cpu = stats2[i].same_cpu - stats1[i].same_cpu;
-			stat.same_chip = stats2[i].same_chip - stats1[i].same_chip;
-			stat.same_package = stats2[i].same_package - stats1[i].same_package;
-			stat.diff_package = stats2[i].diff_package - stats1[i].diff_package;
-			stat.home_numa_node = stats2[i].home_numa_node - stats1[i].home_numa_node;
-			stat.next_numa_node = stats2[i].next_numa_node - stats1[i].next_numa_node;
-			stat.far_numa_node = stats2[i].far_numa_node - stats1[i].far_numa_node;
-		}
+		if (!raw_stats)
+			diff_stat(&stat, new, old);
 
 		if (numeric_stats)
-			printf(raw_fmt, i,
+			printf(raw_fmt, new->cpu,
 				stat.total, stat.same_cpu, stat.same_chip,
 				stat.same_package, stat.diff_package,
 				stat.home_numa_node, stat.next_numa_node,
 				stat.far_numa_node);
 		else if (raw_stats)
-			printf(raw_fmt, i,
-				stats2[i].total, stats2[i].same_cpu, stats2[i].same_chip,
-				stats2[i].same_package, stats2[i].diff_package,
-				stats2[i].home_numa_node, stats2[i].next_numa_node,
-				stats2[i].far_numa_node);
+			printf(raw_fmt, new->cpu,
+				new->total, new->same_cpu, new->same_chip,
+				new->same_package, new->diff_package,
+				new->home_numa_node, new->next_numa_node,
+				new->far_numa_node);
 		else
-			printf(percent_fmt, i,
+			printf(percent_fmt, new->cpu,
 				100 * (float)stat.same_cpu / stat.total,
 				100 * (float)stat.same_chip / stat.total,
 				100 * (float)stat.same_package / stat.total,
@@ -205,34 +416,546 @@ void print_stats(struct vcpudispatch_stat stats1[],
 	fflush(stdout);
 }
 
-void process_stats(int interval, int count)
+static int *cpu_group_ids;
+static int nr_cpu_group_ids;
+
+static struct group_stat *groups;
+static int nr_groups;
+static int window_slot;
+
+/**
+ * read_cpu_group
+ * @brief Look up the core, chip or node of a cpu in sysfs
+ *
+ * @param cpu cpu number
+ * @returns group id, -1 if it can not be determined
+ */
+static int read_cpu_group(int cpu)
 {
-	struct vcpudispatch_stat *stats1, *stats2, *stats_tmp;
-	int rc, dec = count;
+	char path[128];
+	struct dirent *de;
+	int id = -1;
+	DIR *d;
+	FILE *f;
+
+	if (group_by == GROUP_NODE) {
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d",
+			 cpu);
+		d = opendir(path);
+		if (!d)
+			return -1;
+
+		while ((de = readdir(d)) != NULL) {
+			if (!strncmp(de->d_name, "node", 4) &&
+			    sscanf(de->d_name + 4, "%d", &id) == 1)
+				break;
+		}
+
+		closedir(d);
+		return id;
+	}
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/topology/%s", cpu,
+		 group_by == GROUP_CORE ? "core_id" : "physical_package_id");
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+
+	if (fscanf(f, "%d", &id) != 1)
+		id = -1;
+
+	fclose(f);
+	return id;
+}
+
+/**
+ * cpu_group
+ * @brief Find the group of a cpu, the topology is only read once per cpu
+ *
+ * @param cpu cpu number
+ * @returns group id, -1 if it can not be determined
+ */
+static int cpu_group(int cpu)
+{
+	if (cpu >= nr_cpu_group_ids) {
+		int i, nr = cpu + 256;
+		int *ids;
+
+		ids = realloc(cpu_group_ids, nr * sizeof(*ids));
+		if (!ids)
+			return -1;
+
+		for (i = nr_cpu_group_ids; i < nr; i++)
+			ids[i] = -2;
+
+		cpu_group_ids = ids;
+		nr_cpu_group_ids = nr;
+	}
+
+	if (cpu_group_ids[cpu] == -2)
+		cpu_group_ids[cpu] = read_cpu_group(cpu);
 
-	stats1 = calloc(NR_CPUS, sizeof(struct vcpudispatch_stat));
-	stats2 = calloc(NR_CPUS, sizeof(struct vcpudispatch_stat));
+	return cpu_group_ids[cpu];
+}
+
+/**
+ * find_group
+ * @brief Find the statistics of a group, adding the group if it is new
+ *
+ * Groups are kept sorted by id.
+ *
+ * @param id group id
+ * @returns group statistics, NULL on allocation failure
+ */
+static struct group_stat *find_group(int id)
+{
+	struct group_stat *group;
+	int lo = 0, hi = nr_groups;
 
-	if (!stats1 || !stats2) {
-		fprintf(stderr, "Error allocating memory for stats\n");
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (groups[mid].id == id)
+			return &groups[mid];
+
+		if (groups[mid].id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	group = realloc(groups, (nr_groups + 1) * sizeof(*groups));
+	if (!group)
+		return NULL;
+	groups = group;
+
+	memmove(&groups[lo + 1], &groups[lo],
+		(nr_groups - lo) * sizeof(*groups));
+	nr_groups++;
+
+	group = &groups[lo];
+	memset(group, 0, sizeof(*group));
+	group->id = id;
+	group->far = calloc(window, sizeof(*group->far));
+	group->total = calloc(window, sizeof(*group->total));
+	if (!group->far || !group->total) {
+		free(group->far);
+		free(group->total);
+		memmove(&groups[lo], &groups[lo + 1],
+			(nr_groups - lo - 1) * sizeof(*groups));
+		nr_groups--;
+		return NULL;
+	}
+
+	return group;
+}
+
+static void free_groups(void)
+{
+	int i;
+
+	for (i = 0; i < nr_groups; i++) {
+		free(groups[i].far);
+		free(groups[i].total);
+	}
+
+	free(groups);
+	groups = NULL;
+	nr_groups = 0;
+
+	free(cpu_group_ids);
+	cpu_group_ids = NULL;
+	nr_cpu_group_ids = 0;
+}
+
+static void add_stat(struct vcpudispatch_stat *sum,
+		     struct vcpudispatch_stat *stat)
+{
+	sum->total += stat->total;
+	sum->same_cpu += stat->same_cpu;
+	sum->same_chip += stat->same_chip;
+	sum->same_package += stat->same_package;
+	sum->diff_package += stat->diff_package;
+	sum->home_numa_node += stat->home_numa_node;
+	sum->next_numa_node += stat->next_numa_node;
+	sum->far_numa_node += stat->far_numa_node;
+}
+
+/**
+ * window_far_rate
+ * @brief Percentage of far node dispatches over the sliding window
+ */
+static double window_far_rate(struct group_stat *group)
+{
+	long long far = 0, total = 0;
+	int i;
+
+	for (i = 0; i < window; i++) {
+		far += group->far[i];
+		total += group->total[i];
+	}
+
+	return total ? 100.0 * far / total : 0;
+}
+
+/**
+ * aggregate_stats
+ * @brief Roll the dispatch statistics of an interval up per group
+ *
+ * @param sample1 previous sample
+ * @param sample2 current sample
+ */
+static void aggregate_stats(struct vcpu_sample *sample1,
+			    struct vcpu_sample *sample2)
+{
+	struct vcpudispatch_stat stat, *old, *new;
+	struct group_stat *group;
+	int i, id, pos = 0;
+
+	for (i = 0; i < nr_groups; i++) {
+		memset(&groups[i].stat, 0, sizeof(groups[i].stat));
+		groups[i].far[window_slot] = 0;
+		groups[i].total[window_slot] = 0;
+	}
+
+	for (i = 0; i < sample2->nr; i++) {
+		new = &sample2->stats[i];
+		old = next_stat(sample1, &pos, new->cpu);
+		if (!old)
+			continue;
+
+		id = cpu_group(new->cpu);
+		if (id < 0)
+			continue;
+
+		group = find_group(id);
+		if (!group)
+			continue;
+
+		diff_stat(&stat, new, old);
+		group->far[window_slot] += stat.far_numa_node;
+		group->total[window_slot] += stat.total;
+		add_stat(&group->stat, raw_stats ? new : &stat);
+	}
+}
+
+/**
+ * print_group_stats
+ * @brief Report dispatch statistics per core, chip or node
+ *
+ * Along with the statistics of the interval, the percentage of far
+ * node dispatches over the last window intervals is reported.
+ *
+ * @param sample1 previous sample
+ * @param sample2 current sample
+ */
+void print_group_stats(struct vcpu_sample *sample1,
+		       struct vcpu_sample *sample2)
+{
+	char percent_header1[] = "%35s | %20s | %8s\n";
+	char percent_header2[] = "%-7s %6s %6s %6s %6s | %6s %6s %6s | %8s\n";
+	char percent_fmt[] = "%-4s%-3d %6.2f %6.2f %6.2f %6.2f | %6.2f %6.2f %6.2f | %8.2f\n";
+	char raw_header1[] = "%22s %43s | %32s | %8s\n";
+	char raw_header2[] = "%-7s | %10s | %10s %10s %10s %10s | %10s %10s %10s | %8s\n";
+	char raw_fmt[] = "%-4s%-3d | %10d | %10d %10d %10d %10d | %10d %10d %10d | %8.2f\n";
+	const char *name = group_names[group_by];
+	struct vcpudispatch_stat *stat;
+	int i;
+
+	if (stats_off) {
+		if (record.format == RECORD_NONE)
+			printf("off\n");
 		return;
 	}
 
-	rc = read_stats(stats1);
+	aggregate_stats(sample1, sample2);
+
+	if (record.format != RECORD_NONE) {
+		for (i = 0; i < nr_groups; i++) {
+			stat = &groups[i].stat;
+
+			record_begin(&record);
+			record_add_int(&record, "interval_us", interval_us);
+			record_add_int(&record, name, groups[i].id);
+			record_add_int(&record, "total", stat->total);
+			record_add_int(&record, "core", stat->same_cpu);
+			record_add_int(&record, "chip", stat->same_chip);
+			record_add_int(&record, "socket", stat->same_package);
+			record_add_int(&record, "cec", stat->diff_package);
+			record_add_int(&record, "home", stat->home_numa_node);
+			record_add_int(&record, "adj", stat->next_numa_node);
+			record_add_int(&record, "far", stat->far_numa_node);
+			record_add_double(&record, "far_window",
+					  window_far_rate(&groups[i]));
+			record_end(&record);
+		}
+
+		record_flush(&record);
+	} else {
+		if (numeric_stats || raw_stats) {
+			printf(raw_header1, " ",
+				"========== dispatch dispersions ==========",
+				"======= numa dispersions =======", "window");
+			printf(raw_header2, name, "total",
+				"core", "chip", "socket", "cec",
+				"home", "adj", "far", "far");
+		} else {
+			printf(percent_header1,
+				"         == dispatch dispersions ==",
+				"= numa dispersions =", "window");
+			printf(percent_header2, name, "core", "chip", "socket",
+				"cec", "home", "adj", "far", "far");
+		}
+
+		for (i = 0; i < nr_groups; i++) {
+			stat = &groups[i].stat;
+
+			if (numeric_stats || raw_stats)
+				printf(raw_fmt, name, groups[i].id,
+					stat->total, stat->same_cpu,
+					stat->same_chip, stat->same_package,
+					stat->diff_package,
+					stat->home_numa_node,
+					stat->next_numa_node,
+					stat->far_numa_node,
+					window_far_rate(&groups[i]));
+			else
+				printf(percent_fmt, name, groups[i].id,
+					100 * (float)stat->same_cpu / stat->total,
+					100 * (float)stat->same_chip / stat->total,
+					100 * (float)stat->same_package / stat->total,
+					100 * (float)stat->diff_package / stat->total,
+					100 * (float)stat->home_numa_node / stat->total,
+					100 * (float)stat->next_numa_node / stat->total,
+					100 * (float)stat->far_numa_node / stat->total,
+					window_far_rate(&groups[i]));
+		}
+
+		printf("\n");
+		fflush(stdout);
+	}
+
+	window_slot = (window_slot + 1) % window;
+}
+
+/**
+ * read_all
+ * @brief Sample the per-cpu counters and the dispatch statistics
+ *
+ * The current counters are kept as the previous sample first, and the
+ * cpus that came online or went offline are picked up before the
+ * counters and VCPUSTAT_FILE are read back to back.
+ *
+ * @param sample dispatch statistics sample to fill in
+ * @returns 0 on success, -1 on failure
+ */
+static int read_all(struct vcpu_sample *sample)
+{
+	cpu_sampler_save(&all_sampler);
+
+	if (cpu_sampler_update(&all_sampler) < 0 ||
+	    cpu_sampler_read(&all_sampler) < 0)
+		return -1;
+
+	return read_stats(sample);
+}
+
+/**
+ * print_all_stats
+ * @brief Report the counters and the dispatch statistics of each cpu
+ *
+ * Only the cpus of our cpuset that were sampled at both ends of the
+ * interval are reported.  Values that are not available, a counter
+ * that could not be opened or a cpu missing from the dispatch
+ * statistics, are reported as null records fields or as "-".
+ *
+ * @param sample1 previous dispatch statistics sample
+ * @param sample2 current dispatch statistics sample
+ */
+void print_all_stats(struct vcpu_sample *sample1,
+		     struct vcpu_sample *sample2)
+{
+	char header1[] = "%32s | %34s | %20s\n";
+	char header2[] = "%-7s %7s %7s %8s | %6s %6s %6s %6s %6s | %6s %6s %6s\n";
+	char raw_header1[] = "%32s | %54s | %32s\n";
+	char raw_header2[] = "%-7s %7s %7s %8s | %10s %10s %10s %10s %10s | %10s %10s %10s\n";
+	struct cpu_sampler *s = &all_sampler;
+	struct vcpudispatch_stat stat, *old, *new;
+	char spurr[16], mhz[16], disp[96];
+	int cpu, pos1 = 0, pos2 = 0;
+	unsigned long long *delta;
+	long long elapsed;
+	double tb;
+
+	elapsed = s->time_us - s->old_time_us;
+	tb = s->tb - s->old_tb;
+	if (!tb)
+		tb = 1;
+
+	if (record.format == RECORD_NONE) {
+		if (numeric_stats) {
+			printf(raw_header1, "======== counters ========",
+				"===== dispatch dispersions =====",
+				"======= numa dispersions =======");
+			printf(raw_header2, "cpu", "purr%", "spurr%", "MHz",
+				"total", "core", "chip", "socket", "cec",
+				"home", "adj", "far");
+		} else {
+			printf(header1, "======== counters ========",
+				"====== dispatch dispersions ======",
+				"= numa dispersions =");
+			printf(header2, "cpu", "purr%", "spurr%", "MHz",
+				"total", "core", "chip", "socket", "cec",
+				"home", "adj", "far");
+		}
+	}
+
+	for_each_sampled_cpu(s, cpu) {
+		new = stats_off ? NULL : next_stat(sample2, &pos2, cpu);
+		old = new ? next_stat(sample1, &pos1, cpu) : NULL;
+		if (old)
+			diff_stat(&stat, new, old);
+
+		if (record.format != RECORD_NONE) {
+			record_begin(&record);
+			record_add_int(&record, "interval_us", elapsed);
+			record_add_int(&record, "cpu", cpu);
+
+			delta = s->delta[AC_PURR];
+			record_add_uint(&record, "purr", delta[cpu]);
+
+			delta = s->delta[AC_SPURR];
+			if (cpu_counter_valid(s, AC_SPURR, cpu))
+				record_add_uint(&record, "spurr", delta[cpu]);
+			else
+				record_add_null(&record, "spurr");
+
+			delta = s->delta[AC_CYCLES];
+			if (cpu_counter_valid(s, AC_CYCLES, cpu))
+				record_add_uint(&record, "cycles", delta[cpu]);
+			else
+				record_add_null(&record, "cycles");
+
+			if (old) {
+				record_add_int(&record, "total", stat.total);
+				record_add_int(&record, "core", stat.same_cpu);
+				record_add_int(&record, "chip", stat.same_chip);
+				record_add_int(&record, "socket",
+					       stat.same_package);
+				record_add_int(&record, "cec",
+					       stat.diff_package);
+				record_add_int(&record, "home",
+					       stat.home_numa_node);
+				record_add_int(&record, "adj",
+					       stat.next_numa_node);
+				record_add_int(&record, "far",
+					       stat.far_numa_node);
+			} else {
+				record_add_null(&record, "total");
+				record_add_null(&record, "core");
+				record_add_null(&record, "chip");
+				record_add_null(&record, "socket");
+				record_add_null(&record, "cec");
+				record_add_null(&record, "home");
+				record_add_null(&record, "adj");
+				record_add_null(&record, "far");
+			}
+
+			record_end(&record);
+			continue;
+		}
+
+		strcpy(spurr, "-");
+		if (cpu_counter_valid(s, AC_SPURR, cpu))
+			snprintf(spurr, sizeof(spurr), "%.2f",
+				 100 * s->delta[AC_SPURR][cpu] / tb);
+
+		strcpy(mhz, "-");
+		if (cpu_counter_valid(s, AC_CYCLES, cpu) && elapsed > 0)
+			snprintf(mhz, sizeof(mhz), "%.0f",
+				 (double)s->delta[AC_CYCLES][cpu] / elapsed);
+
+		if (!old) {
+			if (numeric_stats)
+				snprintf(disp, sizeof(disp),
+					 "%10s %10s %10s %10s %10s | %10s %10s %10s",
+					 "-", "-", "-", "-", "-", "-", "-", "-");
+			else
+				snprintf(disp, sizeof(disp),
+					 "%6s %6s %6s %6s %6s | %6s %6s %6s",
+					 "-", "-", "-", "-", "-", "-", "-", "-");
+		} else if (numeric_stats) {
+			snprintf(disp, sizeof(disp),
+				 "%10d %10d %10d %10d %10d | %10d %10d %10d",
+				 stat.total, stat.same_cpu, stat.same_chip,
+				 stat.same_package, stat.diff_package,
+				 stat.home_numa_node, stat.next_numa_node,
+				 stat.far_numa_node);
+		} else {
+			float total = stat.total ? stat.total : 1;
+
+			snprintf(disp, sizeof(disp),
+				 "%6d %6.2f %6.2f %6.2f %6.2f | %6.2f %6.2f %6.2f",
+				 stat.total,
+				 100 * stat.same_cpu / total,
+				 100 * stat.same_chip / total,
+				 100 * stat.same_package / total,
+				 100 * stat.diff_package / total,
+				 100 * stat.home_numa_node / total,
+				 100 * stat.next_numa_node / total,
+				 100 * stat.far_numa_node / total);
+		}
+
+		printf("cpu%-4d %7.2f %7s %8s | %s\n", cpu,
+		       100 * s->delta[AC_PURR][cpu] / tb, spurr, mhz, disp);
+	}
+
+	if (record.format != RECORD_NONE) {
+		record_flush(&record);
+	} else {
+		printf("\n");
+		fflush(stdout);
+	}
+}
+
+void process_stats(double interval, int count)
+{
+	struct vcpu_sample samples[2], *sample1, *sample2, *sample_tmp;
+	struct sample_timer timer;
+	int rc, dec = count;
+
+	memset(samples, 0, sizeof(samples));
+	sample1 = &samples[0];
+	sample2 = &samples[1];
+
+	if (all_stats &&
+	    cpu_sampler_init(&all_sampler, all_counters, AC_MAX, true))
+		goto out;
+
+	sample_timer_start(&timer, interval);
+	rc = all_stats ? read_all(sample1) : read_stats(sample1);
 	if (rc)
 		goto out;
-	sleep(interval);
+	sample_timer_wait(&timer);
 
 	while (!intr) {
-		rc = read_stats(stats2);
+		rc = all_stats ? read_all(sample2) : read_stats(sample2);
 		if (rc)
 			goto out;
 
-		print_stats(stats1, stats2);
+		if (all_stats)
+			print_all_stats(sample1, sample2);
+		else if (group_by != GROUP_NONE)
+			print_group_stats(sample1, sample2);
+		else if (record.format != RECORD_NONE)
+			print_stats_records(sample1, sample2);
+		else
+			print_stats(sample1, sample2);
 
-		stats_tmp = stats2;
-		stats2 = stats1;
-		stats1 = stats_tmp;
+		sample_tmp = sample2;
+		sample2 = sample1;
+		sample1 = sample_tmp;
 
 		if (count) {
 			dec--;
@@ -241,27 +964,26 @@ void process_stats(int interval, int count)
 		}
 
 		if (!intr)
-			sleep(interval);
+			sample_timer_wait(&timer);
 	}
 
 out:
-	free(stats1);
-	free(stats2);
+	free(samples[0].stats);
+	free(samples[1].stats);
+	free_groups();
+	if (all_stats)
+		cpu_sampler_close(&all_sampler);
+	sample_file_close(&stats_file);
 }
 
 void display_raw_counts(void)
 {
-	struct vcpudispatch_stat *stats;
+	struct vcpu_sample sample;
 	int rc;
 
-	stats = calloc(NR_CPUS, sizeof(struct vcpudispatch_stat));
-
-	if (!stats) {
-		fprintf(stderr, "Error allocating memory for stats\n");
-		return;
-	}
+	memset(&sample, 0, sizeof(sample));
 
-	rc = read_stats(stats);
+	rc = read_stats(&sample);
 	if (rc)
 		goto out;
 
@@ -271,10 +993,14 @@ void display_raw_counts(void)
 		goto out;
 	}
 
-	print_alltime_stats(stats);
+	if (record.format != RECORD_NONE)
+		print_stats_records(NULL, &sample);
+	else
+		print_alltime_stats(&sample);
 
 out:
-	free(stats);
+	free(sample.stats);
+	sample_file_close(&stats_file);
 }
 
 int init_stats(bool enable, bool user_requested)
@@ -354,9 +1080,16 @@ static void usage(void)
 	       "\t-d, --disable         Disable gathering statistics.\n"
 	       "\t-n, --numeric         Display the statistics in numbers, rather than percentage.\n"
 	       "\t-r, --raw             Display the raw counts, rather than the difference in an interval.\n"
+	       "\t-o, --output <fmt>    Stream csv or json records, one per cpu, rather than a table.\n"
+	       "\t-g, --group <type>    Aggregate the statistics per core, chip or node.\n"
+	       "\t-w, --window <N>      Report far node dispatches over the last N intervals\n"
+	       "\t                      when aggregating, default 10.\n"
+	       "\t-a, --all             Report the purr, spurr and cycles of each cpu of our\n"
+	       "\t                      cpuset along with its dispatch statistics.\n"
 	       "\t-h, --help            Show this message and exit.\n"
 	       "\t-V, --version         Display vcpustat version information.\n"
-	       "\tinterval              The interval parameter specifies the amount of time between each report.\n"
+	       "\tinterval              The interval parameter specifies the amount of time between each report,\n"
+	       "\t                      in seconds.  Fractions of a second are allowed.\n"
 	       "\tcount                 The count parameter specifies how many reports will be displayed.\n");
 }
 
@@ -367,6 +1100,10 @@ static struct option long_opts[] = {
 	{"disable",	no_argument,		NULL,	'd'},
 	{"numeric",	no_argument,		NULL,	'n'},
 	{"raw",		no_argument,		NULL,	'r'},
+	{"output",	required_argument,	NULL,	'o'},
+	{"group",	required_argument,	NULL,	'g'},
+	{"window",	required_argument,	NULL,	'w'},
+	{"all",		no_argument,		NULL,	'a'},
 	{0, 0, 0, 0},
 };
 
@@ -374,7 +1111,8 @@ int main(int argc, char *argv[])
 {
 	bool enable_only = false, disable_only = false;
 	int platform = get_platform();
-	int interval = 0, count = 0;
+	double interval = 0;
+	int count = 0;
 	struct sigaction sa;
 	int c, opt_idx = 0;
 
@@ -389,7 +1127,7 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
-	while ((c = getopt_long(argc, argv, "Vhnred",
+	while ((c = getopt_long(argc, argv, "Vhnredo:g:w:a",
 				long_opts, &opt_idx)) != -1) {
 		switch (c) {
 		case 'V':
@@ -413,20 +1151,50 @@ int main(int argc, char *argv[])
 		case 'r':
 			raw_stats = 1;
 			break;
+		case 'o':
+			if (record_parse_format(optarg, &record.format)) {
+				usage();
+				return 1;
+			}
+			break;
+		case 'g':
+			for (group_by = GROUP_CORE; group_by <= GROUP_NODE;
+			     group_by++) {
+				if (!strcmp(optarg, group_names[group_by]))
+					break;
+			}
+
+			if (group_by > GROUP_NODE) {
+				usage();
+				return 1;
+			}
+			break;
+		case 'w':
+			window = atoi(optarg);
+			if (window <= 0) {
+				usage();
+				return 1;
+			}
+			break;
+		case 'a':
+			all_stats = 1;
+			break;
 		default:
 			break;
 		}
 	}
 
 	/* see if there is an interval specified */
-	if (optind < argc)
-		interval = atoi(argv[optind++]);
+	if (optind < argc && parse_interval(argv[optind++], &interval)) {
+		fprintf(stderr, "Invalid interval/count specified\n");
+		return -1;
+	}
 
 	/* check for count specified */
 	if (optind < argc)
 		count = atoi(argv[optind++]);
 
-	if (interval < 0 || count < 0) {
+	if (count < 0) {
 		fprintf(stderr, "Invalid interval/count specified\n");
 		return -1;
 	}
@@ -436,7 +1204,9 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	if ((enable_only || disable_only) && (raw_stats || numeric_stats || interval)) {
+	if ((enable_only || disable_only) &&
+	    (raw_stats || numeric_stats || interval || all_stats ||
+	     record.format != RECORD_NONE || group_by != GROUP_NONE)) {
 		fprintf(stderr, "-e|-d cannot be used with other options\n");
 		return -1;
 	}
@@ -444,7 +1214,22 @@ int main(int argc, char *argv[])
 	if (enable_only || disable_only)
 		return init_stats(enable_only, true);
 
+	if (all_stats && (raw_stats || group_by != GROUP_NONE)) {
+		fprintf(stderr, "-a cannot be used with -r or -g\n");
+		return -1;
+	}
+
 	if (!interval) {
+		if (group_by != GROUP_NONE) {
+			fprintf(stderr, "-g requires an interval\n");
+			return -1;
+		}
+
+		if (all_stats) {
+			fprintf(stderr, "-a requires an interval\n");
+			return -1;
+		}
+
 		display_raw_counts();
 		return 0;
 	}